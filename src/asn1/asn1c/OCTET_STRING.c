@@ -173,6 +173,51 @@ _new_stack(void) {
 	return (struct _stack *)CALLOC(1, sizeof(struct _stack));
 }
 
+/*
+ * Fort: While decoding into a pool (see asn1/pool.h), complete primitive
+ * values are not copied; @st points into the input buffer instead. @hdr_len is
+ * the length of the tag and length octets, @len is the length of the content.
+ * Returns nonzero if the value was borrowed.
+ */
+static int
+OS__borrow(BIT_STRING_t *st, enum asn_OS_Subvariant type_variant, int tag_mode,
+           const void *buf_ptr, size_t hdr_len, ber_tlv_len_t len,
+           size_t size) {
+	const uint8_t *value = (const uint8_t *)buf_ptr + hdr_len;
+	size_t value_len = len;
+	int bits_unused = 0;
+
+	if(!asn1_pool_active() || st->buf || len < 0
+	|| (size_t)len > size - hdr_len)
+		return 0;
+
+	if(type_variant == ASN_OSUBV_ANY && tag_mode != 1) {
+		/* ANY keeps the tag and length too */
+		value = (const uint8_t *)buf_ptr;
+		value_len += hdr_len;
+	} else if(type_variant == ASN_OSUBV_BIT) {
+		if(value_len == 0)
+			return 0;
+		bits_unused = value[0];
+		value++;
+		value_len--;
+		/* Unused bits need to be zeroed; leave that to the copy. */
+		if(bits_unused > 7 || (value_len
+		&& (value[value_len-1] & ~(0xff << bits_unused) & 0xff)))
+			return 0;
+	}
+
+	/* int is really a typeof(st->size): */
+	if((int)value_len < 0)
+		return 0;
+
+	st->buf = (uint8_t *)value;
+	st->size = value_len;
+	if(type_variant == ASN_OSUBV_BIT)
+		st->bits_unused = bits_unused;
+	return 1;
+}
+
 /*
  * Decode OCTET STRING type.
  */
@@ -233,6 +278,13 @@ OCTET_STRING_decode_ber(const asn_codec_ctx_t *opt_codec_ctx,
 			 * Jump into stackless primitive decoding.
 			 */
 			_CH_PHASE(ctx, 3);
+			if(OS__borrow(st, type_variant, tag_mode, buf_ptr,
+					rval.consumed, ctx->left, size)) {
+				ADVANCE(rval.consumed + ctx->left);
+				ctx->left = 0;
+				NEXT_PHASE(ctx);
+				break;
+			}
 			if(type_variant == ASN_OSUBV_ANY && tag_mode != 1)
 				APPEND(buf_ptr, rval.consumed);
 			ADVANCE(rval.consumed);
@@ -511,7 +563,9 @@ OCTET_STRING_decode_ber(const asn_codec_ctx_t *opt_codec_ctx,
 				RETURN(RC_FAIL);
 			}
 			/* Finalize BIT STRING: zero out unused bits. */
-			st->buf[st->size-1] &= 0xff << st->bits_unused;
+			/* (Fort: Only if needed; the buffer might be borrowed.) */
+			if(st->buf[st->size-1] & ~(0xff << st->bits_unused) & 0xff)
+				st->buf[st->size-1] &= 0xff << st->bits_unused;
 		} else {
 			if(st->bits_unused) {
 				RETURN(RC_FAIL);
@@ -58,14 +58,19 @@ ber_decode_primitive(const asn_codec_ctx_t *opt_codec_ctx,
 		ASN__DECODE_FAILED;
 	}
 
-	st->buf = (uint8_t *)MALLOC(length + 1);
-	if(!st->buf) {
-		st->size = 0;
-		ASN__DECODE_FAILED;
-	}
+	if(asn1_pool_active()) {
+		/* Fort: Borrow the value from the input. (See asn1/pool.h.) */
+		st->buf = (uint8_t *)buf_ptr;
+	} else {
+		st->buf = (uint8_t *)MALLOC(length + 1);
+		if(!st->buf) {
+			st->size = 0;
+			ASN__DECODE_FAILED;
+		}
 
-	memcpy(st->buf, buf_ptr, length);
-	st->buf[length] = '\0';		/* Just in case */
+		memcpy(st->buf, buf_ptr, length);
+		st->buf[length] = '\0';		/* Just in case */
+	}
 
 	rval.code = RC_OK;
 	rval.consumed += length;
@@ -10,6 +10,7 @@
 #define __EXTENSIONS__          /* for Sun */
 
 #include "asn_application.h"	/* Application-visible API */
+#include "asn1/pool.h"
 
 #ifndef	__NO_ASSERT_H__		/* Include assert.h only for internal use. */
 #include <assert.h>		/* for assert() macro */
@@ -23,10 +24,11 @@ extern "C" {
 #define	ASN1C_ENVIRONMENT_VERSION	923	/* Compile-time version */
 int get_asn1c_environment_version(void);	/* Run-time version */
 
-#define	CALLOC(nmemb, size)	calloc(nmemb, size)
-#define	MALLOC(size)		malloc(size)
-#define	REALLOC(oldptr, size)	realloc(oldptr, size)
-#define	FREEMEM(ptr)		free(ptr)
+/* Fort: Allocations can be redirected to a pool. (See asn1/pool.h.) */
+#define	CALLOC(nmemb, size)	asn1_pool_calloc(nmemb, size)
+#define	MALLOC(size)		asn1_pool_malloc(size)
+#define	REALLOC(oldptr, size)	asn1_pool_realloc(oldptr, size)
+#define	FREEMEM(ptr)		asn1_pool_free(ptr)
 
 #define	asn_debug_indent	0
 #define ASN_DEBUG_INDENT_ADD(i) do{}while(0)
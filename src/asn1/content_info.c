@@ -4,6 +4,7 @@
 #include "file.h"
 #include "log.h"
 #include "oid.h"
+#include "rpp.h"
 #include "asn1/decode.h"
 #include "asn1/asn1c/ContentType.h"
 
@@ -50,12 +51,13 @@ decode(struct file_contents *fc, struct ContentInfo **result)
 }
 
 int
-content_info_load(struct rpki_uri *uri, struct ContentInfo **result)
+content_info_load(struct rpki_uri *uri, struct rpp *pp,
+    struct ContentInfo **result)
 {
 	struct file_contents fc;
 	int error;
 
-	error = file_load(uri_get_local(uri), &fc);
+	error = rpp_load_file(pp, uri, &fc);
 	if (error)
 		return error;
 
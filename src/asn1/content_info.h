@@ -3,10 +3,12 @@
 
 /* Some wrappers for asn1/asn1c/ContentInfo.h. */
 
+#include "rpp.h"
 #include "types/uri.h"
 #include "asn1/asn1c/ContentInfo.h"
 
-int content_info_load(struct rpki_uri *, struct ContentInfo **);
+/* @rpp can be NULL, in which case the file is read from the disk. */
+int content_info_load(struct rpki_uri *, struct rpp *, struct ContentInfo **);
 void content_info_free(struct ContentInfo *);
 
 #endif /* SRC_CONTENT_INFO_H_ */
@@ -4,6 +4,8 @@
 #include "common.h"
 #include "config.h"
 #include "log.h"
+#include "asn1/der.h"
+#include "asn1/pool.h"
 #include "incidence/incidence.h"
 
 #define COND_LOG(log, pr) (log ? pr : -EINVAL)
@@ -51,12 +53,9 @@ der_coder(const void *buf, size_t size, void *app_key)
 	return 0;
 }
 
-/*
- * TODO (performance) This isn't efficient, consider implement DER decoding
- * or something better.
- */
+/* Fallback for the types der_validate() doesn't know: encode and compare. */
 static int
-validate_der(size_t ber_consumed, asn_TYPE_descriptor_t const *descriptor,
+reencode_der(size_t ber_consumed, asn_TYPE_descriptor_t const *descriptor,
     const void *original, void *result)
 {
 	struct ber_data data;
@@ -81,10 +80,32 @@ validate_der(size_t ber_consumed, asn_TYPE_descriptor_t const *descriptor,
 	return 0;
 }
 
-int
-asn1_decode(const void *buffer, size_t buffer_size,
+static int
+validate_der(size_t ber_consumed, asn_TYPE_descriptor_t const *descriptor,
+    const void *original, void *result)
+{
+	char const *failed;
+	int error;
+
+	error = der_validate(descriptor, result, original, ber_consumed,
+	    &failed);
+	if (error == -EINVAL)
+		return incidence(INID_OBJ_NOT_DER, "'%s' isn't DER encoded",
+		    failed);
+	if (error == -ENOTSUP)
+		return reencode_der(ber_consumed, descriptor, original, result);
+
+	return error;
+}
+
+/*
+ * If @pool isn't NULL, the result is allocated from it, and borrows from
+ * @buffer. (See asn1/pool.h.)
+ */
+static int
+decode(const void *buffer, size_t buffer_size,
     asn_TYPE_descriptor_t const *descriptor, void **result, bool log,
-    bool dec_as_der)
+    bool dec_as_der, struct arena *pool)
 {
 	asn_codec_ctx_t s_codec_ctx;
 	asn_dec_rval_t rval;
@@ -93,11 +114,14 @@ asn1_decode(const void *buffer, size_t buffer_size,
 	*result = NULL;
 	s_codec_ctx.max_stack_size = config_get_asn1_decode_max_stack();
 
+	asn1_pool_set(pool);
 	rval = ber_decode(&s_codec_ctx, descriptor, result, buffer,
 	    buffer_size);
+	asn1_pool_set(NULL);
 	if (rval.code != RC_OK) {
 		/* Must free partial object according to API contracts. */
-		ASN_STRUCT_FREE(*descriptor, *result);
+		if (pool == NULL)
+			ASN_STRUCT_FREE(*descriptor, *result);
 		/* We expect the data to be complete; RC_WMORE is an error. */
 		return COND_LOG(log,
 		    pr_val_err("Error '%u' decoding ASN.1 object around byte %zu",
@@ -109,19 +133,29 @@ asn1_decode(const void *buffer, size_t buffer_size,
 	    incidence_get_action(INID_OBJ_NOT_DER) != INAC_IGNORE) {
 		error = validate_der(rval.consumed, descriptor, buffer,
 		    *result);
-		if (error) {
-			ASN_STRUCT_FREE(*descriptor, *result);
-			return error;
-		}
+		if (error)
+			goto fail;
 	}
 
 	error = validate(descriptor, *result, log);
-	if (error) {
-		ASN_STRUCT_FREE(*descriptor, *result);
-		return error;
-	}
+	if (error)
+		goto fail;
 
 	return 0;
+
+fail:
+	if (pool == NULL)
+		ASN_STRUCT_FREE(*descriptor, *result);
+	return error;
+}
+
+int
+asn1_decode(const void *buffer, size_t buffer_size,
+    asn_TYPE_descriptor_t const *descriptor, void **result, bool log,
+    bool dec_as_der)
+{
+	return decode(buffer, buffer_size, descriptor, result, log, dec_as_der,
+	    NULL);
 }
 
 int
@@ -141,6 +175,34 @@ asn1_decode_octet_string(OCTET_STRING_t *string,
 	    dec_as_der);
 }
 
+/*
+ * Like asn1_decode_octet_string(), except the result doesn't own its memory.
+ * Its structures are allocated from *@pool, and its primitive values point into
+ * @string's buffer, which therefore needs to outlive it.
+ *
+ * Release the result with arena_destroy(*@pool), not ASN_STRUCT_FREE().
+ * (Don't modify it, either.) This is meant for big, read-only objects; it
+ * saves most of their allocations.
+ */
+int
+asn1_decode_octet_string_pooled(OCTET_STRING_t *string,
+    asn_TYPE_descriptor_t const *descriptor, void **result,
+    struct arena **pool, bool log, bool dec_as_der)
+{
+	int error;
+
+	error = arena_create(pool);
+	if (error)
+		return error;
+
+	error = decode(string->buf, string->size, descriptor, result, log,
+	    dec_as_der, *pool);
+	if (error)
+		arena_destroy(*pool);
+
+	return error;
+}
+
 /*
  * TODO (next iteration) There's no need to load the entire file into memory.
  * ber_decode() can take an incomplete buffer, in which case it returns
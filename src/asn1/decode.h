@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include "file.h"
+#include "data_structure/arena.h"
 #include "asn1/asn1c/ANY.h"
 #include "asn1/asn1c/constr_TYPE.h"
 
@@ -12,6 +13,8 @@ int asn1_decode_any(ANY_t *, asn_TYPE_descriptor_t const *, void **, bool,
     bool);
 int asn1_decode_octet_string(OCTET_STRING_t *, asn_TYPE_descriptor_t const *,
     void **, bool, bool);
+int asn1_decode_octet_string_pooled(OCTET_STRING_t *,
+    asn_TYPE_descriptor_t const *, void **, struct arena **, bool, bool);
 int asn1_decode_fc(struct file_contents *, asn_TYPE_descriptor_t const *,
     void **, bool, bool);
 
@@ -0,0 +1,473 @@
+#include "asn1/der.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "log.h"
+#include "asn1/asn1c/ANY.h"
+#include "asn1/asn1c/BIT_STRING.h"
+#include "asn1/asn1c/BOOLEAN.h"
+#include "asn1/asn1c/GeneralizedTime.h"
+#include "asn1/asn1c/IA5String.h"
+#include "asn1/asn1c/INTEGER.h"
+#include "asn1/asn1c/NULL.h"
+#include "asn1/asn1c/OBJECT_IDENTIFIER.h"
+#include "asn1/asn1c/OCTET_STRING.h"
+#include "asn1/asn1c/UTCTime.h"
+#include "asn1/asn1c/asn_SET_OF.h"
+#include "asn1/asn1c/constr_CHOICE.h"
+#include "asn1/asn1c/constr_SEQUENCE.h"
+#include "asn1/asn1c/constr_SEQUENCE_OF.h"
+#include "asn1/asn1c/constr_SET_OF.h"
+
+/*
+ * Strict DER validation.
+ *
+ * asn1c only decodes BER, so the objects that must be DER encoded used to be
+ * encoded again (with der_encode()) and compared to the original. That's
+ * expensive: asn1c's DER encoder measures every constructed value by encoding
+ * it in advance, and sorts the elements of every SET OF by encoding them into
+ * temporary buffers.
+ *
+ * This instead walks the original bytes once, along with the decoded structure
+ * and its type descriptor, and checks the DER rules in place:
+ *
+ * - Tags and lengths are in their shortest forms, and lengths are definite.
+ * - Primitive types are not encoded in constructed form.
+ * - BOOLEANs, INTEGERs, BIT STRINGs and GeneralizedTimes are canonical.
+ * - Members that equal their DEFAULT values are omitted.
+ * - The elements of every SET OF are sorted.
+ *
+ * These are the rules der_encode() would have enforced. (Neither looks inside
+ * ANYs nor OBJECT IDENTIFIERs.) Types that are not handled here are reported
+ * as unsupported, so the caller can fall back to der_encode().
+ */
+
+struct tlv {
+	ber_tlv_tag_t tag;
+	bool constructed;
+	unsigned char const *content;
+	size_t content_len;
+	/* Length of the whole TLV (header + content) */
+	size_t total_len;
+};
+
+static int check_value(asn_TYPE_descriptor_t const *, int, void const *,
+    unsigned char const *, size_t, char const **);
+
+static int
+not_der(asn_TYPE_descriptor_t const *td, char const *reason,
+    char const **failed)
+{
+	pr_val_debug("'%s' isn't DER encoded: %s", td->name, reason);
+	*failed = td->name;
+	return -EINVAL;
+}
+
+/* Parses the header of the TLV that starts at @buf. */
+static int
+read_tlv(unsigned char const *buf, size_t size, struct tlv *tlv)
+{
+	ber_tlv_tag_t value;
+	size_t offset;
+	size_t len;
+	unsigned int n;
+
+	if (size < 2)
+		return -EINVAL;
+
+	tlv->constructed = (buf[0] & 0x20) != 0;
+	value = buf[0] & 0x1F;
+	offset = 1;
+	if (value == 0x1F) {
+		/* High tag number form; no leading zeroes allowed */
+		if (buf[offset] == 0x80)
+			return -EINVAL;
+		value = 0;
+		do {
+			if (offset >= size || value >= (1u << 20))
+				return -EINVAL;
+			value = (value << 7) | (buf[offset] & 0x7F);
+		} while (buf[offset++] & 0x80);
+		if (value < 0x1F)
+			return -EINVAL; /* Should have used the low form */
+	}
+	tlv->tag = (value << 2) | (buf[0] >> 6);
+
+	if (offset >= size)
+		return -EINVAL;
+	len = buf[offset++];
+	if (len == 0x80)
+		return -EINVAL; /* Indefinite length */
+	if (len > 0x80) {
+		n = len & 0x7F;
+		if (n > sizeof(size_t) || n > size - offset)
+			return -EINVAL;
+		if (buf[offset] == 0)
+			return -EINVAL; /* Leading zeroes */
+		for (len = 0; n > 0; n--)
+			len = (len << 8) | buf[offset++];
+		if (len < 0x80)
+			return -EINVAL; /* Should have used the short form */
+	}
+	if (len > size - offset)
+		return -EINVAL;
+
+	tlv->content = buf + offset;
+	tlv->content_len = len;
+	tlv->total_len = offset + len;
+	return 0;
+}
+
+static bool
+is_constructed(asn_TYPE_descriptor_t const *td)
+{
+	/* (CHOICEs and ANYs are only wrapped by explicit tags.) */
+	return td->op == &asn_OP_SEQUENCE
+	    || td->op == &asn_OP_SEQUENCE_OF
+	    || td->op == &asn_OP_SET_OF
+	    || td->op == &asn_OP_CHOICE
+	    || td->op == &asn_OP_ANY;
+}
+
+static void const *
+get_member(void const *sptr, asn_TYPE_member_t const *member)
+{
+	void const *ptr;
+
+	ptr = ((char const *) sptr) + member->memb_offset;
+	return (member->flags & ATF_POINTER)
+	    ? *((void const * const *) ptr)
+	    : ptr;
+}
+
+static asn_TYPE_member_t const *
+find_alternative(asn_TYPE_descriptor_t const *td, ber_tlv_tag_t tag)
+{
+	asn_CHOICE_specifics_t const *specs = td->specifics;
+	unsigned int i;
+
+	for (i = 0; i < specs->tag2el_count; i++)
+		if (specs->tag2el[i].el_tag == tag)
+			return &td->elements[specs->tag2el[i].el_no];
+
+	return NULL;
+}
+
+static bool
+member_matches(asn_TYPE_member_t const *member, ber_tlv_tag_t tag)
+{
+	asn_TYPE_descriptor_t const *type;
+
+	if (member->tag != (ber_tlv_tag_t) -1)
+		return member->tag == tag;
+
+	/* Untagged member; its type decides. */
+	type = member->type;
+	if (type->op == &asn_OP_CHOICE)
+		return find_alternative(type, tag) != NULL;
+	if (type->tags_count > 0)
+		return type->tags[0] == tag;
+	return true; /* ANY */
+}
+
+static int
+check_sequence(asn_TYPE_descriptor_t const *td, void const *sptr,
+    unsigned char const *buf, size_t size, char const **failed)
+{
+	unsigned char const *end = buf + size;
+	asn_TYPE_member_t const *member;
+	void const *memb_ptr;
+	struct tlv tlv;
+	unsigned int i;
+	int error;
+
+	for (i = 0; i < td->elements_count && buf < end; i++) {
+		member = &td->elements[i];
+		if (member->flags & ATF_OPEN_TYPE)
+			return -ENOTSUP;
+
+		if (read_tlv(buf, end - buf, &tlv) != 0)
+			return not_der(td, "Bad tag or length", failed);
+		if (!member_matches(member, tlv.tag)) {
+			if (member->optional)
+				continue;
+			return -ENOTSUP;
+		}
+
+		memb_ptr = get_member(sptr, member);
+		if (memb_ptr == NULL)
+			return -ENOTSUP;
+		if (member->default_value_cmp != NULL &&
+		    member->default_value_cmp(memb_ptr) == 0)
+			return not_der(td, "A DEFAULT value is encoded", failed);
+
+		error = check_value(member->type, member->tag_mode, memb_ptr,
+		    buf, tlv.total_len, failed);
+		if (error)
+			return error;
+
+		buf += tlv.total_len;
+	}
+
+	return (buf == end) ? 0 : -ENOTSUP;
+}
+
+/* The order asn1c's DER encoder sorts SET OF elements in. */
+static int
+set_of_cmp(unsigned char const *a, size_t a_len, unsigned char const *b,
+    size_t b_len)
+{
+	int cmp;
+
+	cmp = memcmp(a, b, (a_len < b_len) ? a_len : b_len);
+	if (cmp != 0)
+		return cmp;
+	return (a_len < b_len) ? -1 : (a_len > b_len);
+}
+
+static int
+check_list(asn_TYPE_descriptor_t const *td, void const *sptr,
+    unsigned char const *buf, size_t size, bool sorted, char const **failed)
+{
+	A_SET_OF(void) const *list = sptr;
+	asn_TYPE_member_t const *member = &td->elements[0];
+	unsigned char const *end = buf + size;
+	unsigned char const *prev;
+	size_t prev_len;
+	struct tlv tlv;
+	int i;
+	int error;
+
+	prev = NULL;
+	prev_len = 0;
+
+	for (i = 0; buf < end; i++) {
+		if (read_tlv(buf, end - buf, &tlv) != 0)
+			return not_der(td, "Bad tag or length", failed);
+		if (i >= list->count)
+			return -ENOTSUP;
+
+		error = check_value(member->type, member->tag_mode,
+		    list->array[i], buf, tlv.total_len, failed);
+		if (error)
+			return error;
+
+		if (sorted && prev != NULL &&
+		    set_of_cmp(prev, prev_len, buf, tlv.total_len) > 0)
+			return not_der(td, "SET OF elements are not sorted",
+			    failed);
+
+		prev = buf;
+		prev_len = tlv.total_len;
+		buf += tlv.total_len;
+	}
+
+	return (i == list->count) ? 0 : -ENOTSUP;
+}
+
+/* @buf is the whole TLV of the chosen alternative. */
+static int
+check_choice(asn_TYPE_descriptor_t const *td, void const *sptr,
+    unsigned char const *buf, size_t size, char const **failed)
+{
+	asn_TYPE_member_t const *member;
+	void const *memb_ptr;
+	struct tlv tlv;
+
+	if (read_tlv(buf, size, &tlv) != 0)
+		return not_der(td, "Bad tag or length", failed);
+	if (tlv.total_len != size)
+		return -ENOTSUP;
+
+	member = find_alternative(td, tlv.tag);
+	if (member == NULL)
+		return -ENOTSUP;
+	memb_ptr = get_member(sptr, member);
+	if (memb_ptr == NULL)
+		return -ENOTSUP;
+
+	return check_value(member->type, member->tag_mode, memb_ptr, buf, size,
+	    failed);
+}
+
+static int
+check_integer(asn_TYPE_descriptor_t const *td, unsigned char const *buf,
+    size_t size, char const **failed)
+{
+	if (size == 0)
+		return not_der(td, "Empty INTEGER", failed);
+	if (size > 1 && ((buf[0] == 0x00 && !(buf[1] & 0x80))
+	    || (buf[0] == 0xFF && (buf[1] & 0x80))))
+		return not_der(td, "INTEGER has redundant leading octets",
+		    failed);
+	return 0;
+}
+
+static int
+check_bit_string(asn_TYPE_descriptor_t const *td, unsigned char const *buf,
+    size_t size, char const **failed)
+{
+	unsigned int unused;
+
+	if (size == 0)
+		return not_der(td, "BIT STRING lacks the unused bits octet",
+		    failed);
+
+	unused = buf[0];
+	if (unused > 7 || (size == 1 && unused != 0))
+		return not_der(td, "Bad BIT STRING unused bits count", failed);
+	if (buf[size - 1] & ((1u << unused) - 1))
+		return not_der(td, "BIT STRING unused bits are not zero",
+		    failed);
+
+	return 0;
+}
+
+static int
+parse_digits(unsigned char const *buf, unsigned int digits)
+{
+	int result;
+	unsigned int i;
+
+	result = 0;
+	for (i = 0; i < digits; i++) {
+		if (buf[i] < '0' || '9' < buf[i])
+			return -1;
+		result = 10 * result + (buf[i] - '0');
+	}
+
+	return result;
+}
+
+static int
+days_in_month(int year, int month)
+{
+	static const int DAYS[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30,
+	    31 };
+
+	if (month == 2 &&
+	    (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0)))
+		return 29;
+	return DAYS[month - 1];
+}
+
+/* YYYYMMDDHHMMSS[.fff]Z, without trailing zeroes in the fraction. */
+static int
+check_generalized_time(asn_TYPE_descriptor_t const *td,
+    unsigned char const *buf, size_t size, char const **failed)
+{
+	int year, month, day, hour, minute, second;
+	size_t i;
+
+	if (size < 15 || buf[size - 1] != 'Z')
+		return not_der(td, "Time is not in UTC", failed);
+
+	year = parse_digits(buf, 4);
+	month = parse_digits(buf + 4, 2);
+	day = parse_digits(buf + 6, 2);
+	hour = parse_digits(buf + 8, 2);
+	minute = parse_digits(buf + 10, 2);
+	second = parse_digits(buf + 12, 2);
+	if (year < 0 || month < 1 || 12 < month || day < 1 ||
+	    days_in_month(year, month) < day || hour < 0 || 23 < hour ||
+	    minute < 0 || 59 < minute || second < 0 || 59 < second)
+		return not_der(td, "Bad time", failed);
+
+	if (size == 15)
+		return 0;
+
+	if (buf[14] != '.' || size == 16 || buf[size - 2] == '0')
+		return not_der(td, "Bad fraction of second", failed);
+	for (i = 15; i < size - 1; i++)
+		if (buf[i] < '0' || '9' < buf[i])
+			return not_der(td, "Bad fraction of second", failed);
+
+	return 0;
+}
+
+/* @buf is the content of the innermost tag. */
+static int
+check_content(asn_TYPE_descriptor_t const *td, void const *sptr,
+    unsigned char const *buf, size_t size, char const **failed)
+{
+	if (td->op == &asn_OP_SEQUENCE)
+		return check_sequence(td, sptr, buf, size, failed);
+	if (td->op == &asn_OP_SEQUENCE_OF)
+		return check_list(td, sptr, buf, size, false, failed);
+	if (td->op == &asn_OP_SET_OF)
+		return check_list(td, sptr, buf, size, true, failed);
+	if (td->op == &asn_OP_CHOICE)
+		return check_choice(td, sptr, buf, size, failed);
+	if (td->op == &asn_OP_INTEGER)
+		return check_integer(td, buf, size, failed);
+	if (td->op == &asn_OP_BIT_STRING)
+		return check_bit_string(td, buf, size, failed);
+	if (td->op == &asn_OP_GeneralizedTime)
+		return check_generalized_time(td, buf, size, failed);
+	if (td->op == &asn_OP_BOOLEAN)
+		return (size == 1 && (buf[0] == 0x00 || buf[0] == 0xFF))
+		    ? 0
+		    : not_der(td, "BOOLEAN is not 0x00 nor 0xFF", failed);
+	if (td->op == &asn_OP_NULL)
+		return (size == 0) ? 0 : not_der(td, "NULL has content", failed);
+	if (td->op == &asn_OP_ANY
+	    || td->op == &asn_OP_OCTET_STRING
+	    || td->op == &asn_OP_IA5String
+	    || td->op == &asn_OP_OBJECT_IDENTIFIER
+	    || td->op == &asn_OP_UTCTime)
+		return 0;
+
+	return -ENOTSUP;
+}
+
+/*
+ * @buf is the whole encoding of a value of type @td, tagged according to
+ * @tag_mode (-1 IMPLICIT, 0 untagged, 1 EXPLICIT).
+ */
+static int
+check_value(asn_TYPE_descriptor_t const *td, int tag_mode, void const *sptr,
+    unsigned char const *buf, size_t size, char const **failed)
+{
+	struct tlv tlv;
+	unsigned int layers;
+	unsigned int i;
+	bool constructed;
+
+	/* An IMPLICIT tag replaces the outermost one, so it doesn't count. */
+	layers = td->tags_count + ((tag_mode == 1) ? 1 : 0);
+
+	for (i = 0; i < layers; i++) {
+		if (read_tlv(buf, size, &tlv) != 0)
+			return not_der(td, "Bad tag or length", failed);
+		if (tlv.total_len != size)
+			return -ENOTSUP;
+
+		constructed = (i < layers - 1) || is_constructed(td);
+		if (tlv.constructed != constructed)
+			return not_der(td, constructed
+			    ? "Constructed type has primitive encoding"
+			    : "Primitive type has constructed encoding",
+			    failed);
+
+		buf = tlv.content;
+		size = tlv.content_len;
+	}
+
+	return check_content(td, sptr, buf, size, failed);
+}
+
+/*
+ * Checks that @buf (whose decoded form is @sptr, of type @td) is DER encoded.
+ *
+ * Returns 0 if it is, -EINVAL if it isn't (and points @failed to the name of
+ * the offending type), and -ENOTSUP if @td contains types this module doesn't
+ * know how to check.
+ */
+int
+der_validate(asn_TYPE_descriptor_t const *td, void const *sptr,
+    unsigned char const *buf, size_t size, char const **failed)
+{
+	return check_value(td, 0, sptr, buf, size, failed);
+}
@@ -0,0 +1,10 @@
+#ifndef SRC_ASN1_DER_H_
+#define SRC_ASN1_DER_H_
+
+#include <stddef.h>
+#include "asn1/asn1c/asn_application.h"
+
+int der_validate(asn_TYPE_descriptor_t const *, void const *,
+    unsigned char const *, size_t, char const **);
+
+#endif /* SRC_ASN1_DER_H_ */
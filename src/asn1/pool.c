@@ -0,0 +1,89 @@
+#include "asn1/pool.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static _Thread_local struct arena *pool;
+
+/* Pool chunks are prefixed by their size, for the sake of realloc(). */
+union chunk_header {
+	size_t size;
+	max_align_t align;
+};
+
+/* Pass NULL to go back to the standard allocator. */
+void
+asn1_pool_set(struct arena *arena)
+{
+	pool = arena;
+}
+
+bool
+asn1_pool_active(void)
+{
+	return pool != NULL;
+}
+
+void *
+asn1_pool_malloc(size_t size)
+{
+	union chunk_header *header;
+
+	if (pool == NULL)
+		return malloc(size);
+
+	if (size > SIZE_MAX / 2)
+		return NULL;
+	header = arena_alloc(pool, sizeof(*header) + size);
+	if (header == NULL)
+		return NULL;
+
+	header->size = size;
+	return header + 1;
+}
+
+void *
+asn1_pool_calloc(size_t nmemb, size_t size)
+{
+	void *result;
+
+	if (pool == NULL)
+		return calloc(nmemb, size);
+
+	if (size != 0 && nmemb > SIZE_MAX / 2 / size)
+		return NULL;
+	result = asn1_pool_malloc(nmemb * size);
+	if (result != NULL)
+		memset(result, 0, nmemb * size);
+	return result;
+}
+
+void *
+asn1_pool_realloc(void *ptr, size_t size)
+{
+	size_t old_size;
+	void *result;
+
+	if (pool == NULL)
+		return realloc(ptr, size);
+	if (ptr == NULL)
+		return asn1_pool_malloc(size);
+
+	old_size = (((union chunk_header *) ptr) - 1)->size;
+	if (size <= old_size)
+		return ptr;
+
+	result = asn1_pool_malloc(size);
+	if (result != NULL)
+		memcpy(result, ptr, old_size);
+	return result;
+}
+
+void
+asn1_pool_free(void *ptr)
+{
+	/* Pooled chunks die with the pool. */
+	if (pool == NULL)
+		free(ptr);
+}
@@ -0,0 +1,29 @@
+#ifndef SRC_ASN1_POOL_H_
+#define SRC_ASN1_POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "data_structure/arena.h"
+
+/*
+ * Allocator of the asn1c library. (Its CALLOC, MALLOC, REALLOC and FREEMEM
+ * macros land here.)
+ *
+ * Normally, it's just the standard allocator. But while a pool is set, the
+ * structures are carved out of the pool instead, FREEMEM does nothing, and the
+ * decoders point complete primitive values into the input buffer rather than
+ * copying them. The result can only be released by destroying the pool, and
+ * the input buffer must outlive it.
+ *
+ * The pool is per-thread.
+ */
+
+void asn1_pool_set(struct arena *);
+bool asn1_pool_active(void);
+
+void *asn1_pool_malloc(size_t);
+void *asn1_pool_calloc(size_t, size_t);
+void *asn1_pool_realloc(void *, size_t);
+void asn1_pool_free(void *);
+
+#endif /* SRC_ASN1_POOL_H_ */
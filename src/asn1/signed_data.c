@@ -23,7 +23,7 @@ static const OID oid_bsta = OID_BINARY_SIGNING_TIME_ATTR;
 int
 signed_object_args_init(struct signed_object_args *args,
     struct rpki_uri *uri,
-    STACK_OF(X509_CRL) *crls,
+    struct rpp *pp,
     bool force_inherit)
 {
 	args->res = resources_create(force_inherit);
@@ -31,7 +31,7 @@ signed_object_args_init(struct signed_object_args *args,
 		return pr_enomem();
 
 	args->uri = uri;
-	args->crls = crls;
+	args->pp = pp;
 	memset(&args->refs, 0, sizeof(args->refs));
 	return 0;
 }
@@ -63,6 +63,7 @@ static int
 handle_sdata_certificate(ANY_t *cert_encoded, struct signed_object_args *args,
     OCTET_STRING_t *sid, ANY_t *signedData, SignatureValue_t *signature)
 {
+	struct validation *state;
 	const unsigned char *tmp;
 	X509 *cert;
 	enum rpki_policy policy;
@@ -92,7 +93,7 @@ handle_sdata_certificate(ANY_t *cert_encoded, struct signed_object_args *args,
 
 	x509_name_pr_debug("Issuer", X509_get_issuer_name(cert));
 
-	error = certificate_validate_chain(cert, args->crls);
+	error = certificate_validate_chain(cert, args->pp);
 	if (error)
 		goto end2;
 	error = certificate_validate_rfc6487(cert, EE);
@@ -114,6 +115,12 @@ handle_sdata_certificate(ANY_t *cert_encoded, struct signed_object_args *args,
 	if (error)
 		goto end2;
 
+	/* Whatever the object yields is only valid as long as @cert is. */
+	state = state_retrieve();
+	if (state != NULL)
+		rpp_memo_expire_at(validation_get_rpp_memo(state),
+		    X509_get0_notAfter(cert));
+
 end2:
 	X509_free(cert);
 end1:
@@ -16,8 +16,11 @@
 struct signed_object_args {
 	/** Location of the signed object. */
 	struct rpki_uri *uri;
-	/** CRL that might or might not revoke the embedded certificate. */
-	STACK_OF(X509_CRL) *crls;
+	/**
+	 * RPP whose CRL might or might not revoke the embedded certificate.
+	 * (Not a reference.)
+	 */
+	struct rpp *pp;
 	/** A copy of the resources carried by the embedded certificate. */
 	struct resources *res;
 	/**
@@ -28,7 +31,7 @@ struct signed_object_args {
 };
 
 int signed_object_args_init(struct signed_object_args *, struct rpki_uri *,
-    STACK_OF(X509_CRL) *, bool);
+    struct rpp *, bool);
 void signed_object_args_cleanup(struct signed_object_args *);
 
 struct signed_data {
@@ -1,11 +1,17 @@
 #include "cert_stack.h"
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
 #include <sys/queue.h>
 
+#include "common.h"
 #include "resource.h"
 #include "str_token.h"
 #include "thread_var.h"
+#include "data_structure/arena.h"
 #include "data_structure/array_list.h"
+#include "data_structure/uthash_nonfatal.h"
 #include "object/name.h"
 
 enum defer_node_type {
@@ -22,39 +28,60 @@ struct defer_node {
 	 */
 	struct deferred_cert deferred;
 
-	/** Used by certstack. Points to the next stacked certificate. */
+	/**
+	 * Used by certstack. Points to the next stacked certificate.
+	 * (Or the next spare node.)
+	 */
 	SLIST_ENTRY(defer_node) next;
 };
 
 SLIST_HEAD(defer_stack, defer_node);
 
 struct serial_number {
-	BIGNUM *number;
 	char *file; /* File where this serial number was found. */
+	UT_hash_handle hh;
+	/* Hash table key: Sign byte, then the big-endian magnitude. */
+	size_t len;
+	unsigned char bytes[];
 };
 
-STATIC_ARRAY_LIST(serial_numbers, struct serial_number)
+STATIC_ARRAY_LIST(files, char *)
 
 struct subject_name {
-	struct rfc5280_name *name;
-	char *file; /* File where this subject name was found. */
+	/*
+	 * Files where this subject name was found. (There can be more than one
+	 * if they share the public key; see x509stack_store_subject().)
+	 */
+	struct files files;
+	UT_hash_handle hh;
+	/*
+	 * Hash table key: The commonName, then (if there is one) a 1 and the
+	 * serialNumber. (The NUL characters are included.)
+	 */
+	size_t len;
+	char key[];
 };
 
-STATIC_ARRAY_LIST(subjects, struct subject_name)
-
 /**
  * Cached certificate data.
+ *
+ * Once pushed, only @serials and @subjects are ever modified, so a node can be
+ * shared by all the stacks that descend from it. (See certstack_snapshot().)
  */
 struct metadata_node {
 	struct rpki_uri *uri;
 	struct resources *resources;
 	/*
-	 * Serial numbers of the children.
-	 * This is an unsorted array list for two reasons: Certificates usually
-	 * don't have many children, and I'm running out of time.
+	 * Serial numbers and subject names of the children, indexed.
+	 * (Some CAs have tens of thousands of children.)
 	 */
-	struct serial_numbers serials;
-	struct subjects subjects;
+	struct serial_number *serials;
+	struct subject_name *subjects;
+	/*
+	 * Protects @serials and @subjects, since the children can be validated
+	 * by different threads at the same time.
+	 */
+	pthread_mutex_t lock;
 
 	/*
 	 * Certificate repository "level". This aims to identify if the
@@ -63,12 +90,14 @@ struct metadata_node {
 	 */
 	unsigned int level;
 
-	/** Used by certstack. Points to the next stacked certificate. */
-	SLIST_ENTRY(metadata_node) next;
+	/**
+	 * The metadata of the certificate's parent. (ie. the next stacked
+	 * certificate.) Holds a reference.
+	 */
+	struct metadata_node *parent;
+	atomic_uint references;
 };
 
-SLIST_HEAD(metadata_stack, metadata_node);
-
 /**
  * This is the foundation through which we pull off our iterative traversal,
  * as opposed to a stack-threatening recursive one.
@@ -84,6 +113,14 @@ struct cert_stack {
 	 * stored here so they can be traversed later.
 	 */
 	struct defer_stack defers;
+	/**
+	 * Defer nodes that were popped, ready to be reused.
+	 *
+	 * The nodes are allocated from @arena; they are only released (all at
+	 * once) when the validation state dies.
+	 */
+	struct defer_stack spares;
+	struct arena *arena;
 
 	/**
 	 * x509 stack. Parents of the certificate we're currently iterating
@@ -99,15 +136,18 @@ struct cert_stack {
 	 * don't combine them is because libcrypto's validation function needs
 	 * the X509 stack, and I'm not creating it over and over again.)
 	 *
-	 * (This is a SLIST and not a STACK_OF because the OpenSSL stack
+	 * (This is a linked list and not a STACK_OF because the OpenSSL stack
 	 * implementation is different than the LibreSSL one, and the latter is
 	 * seemingly not intended to be used outside of its library.)
+	 *
+	 * Points to the top of the stack. Holds a reference.
 	 */
-	struct metadata_stack metas;
+	struct metadata_node *metas;
 };
 
+/* @arena must outlive the stack. */
 int
-certstack_create(struct cert_stack **result)
+certstack_create(struct arena *arena, struct cert_stack **result)
 {
 	struct cert_stack *stack;
 
@@ -122,14 +162,81 @@ certstack_create(struct cert_stack **result)
 	}
 
 	SLIST_INIT(&stack->defers);
-	SLIST_INIT(&stack->metas);
+	SLIST_INIT(&stack->spares);
+	stack->arena = arena;
+	stack->metas = NULL;
 
 	*result = stack;
 	return 0;
 }
 
 static void
-defer_destroy(struct defer_node *defer)
+meta_refget(struct metadata_node *meta)
+{
+	atomic_fetch_add(&meta->references, 1);
+}
+
+static void meta_refput(struct metadata_node *);
+
+/**
+ * Creates a new certificate stack, whose x509 stack contains the same
+ * certificates as @src's, and whose metadata stack is @src's.
+ * The defer stack starts empty.
+ *
+ * Meant for the validation of a subtree in a different thread; the new stack
+ * can be used to validate the children of @src's current certificate.
+ * (Because the metadata is shared, the sibling serial numbers and subjects are
+ * still checked against each other.)
+ *
+ * The new stack's defer nodes are allocated from @arena, which must outlive
+ * it.
+ */
+int
+certstack_snapshot(struct cert_stack *src, struct arena *arena,
+    struct cert_stack **result)
+{
+	struct cert_stack *stack;
+	int i;
+
+	stack = malloc(sizeof(struct cert_stack));
+	if (stack == NULL)
+		return pr_enomem();
+
+	stack->x509s = sk_X509_dup(src->x509s);
+	if (stack->x509s == NULL) {
+		free(stack);
+		return val_crypto_err("sk_X509_dup() returned NULL");
+	}
+	for (i = 0; i < sk_X509_num(stack->x509s); i++)
+		X509_up_ref(sk_X509_value(stack->x509s, i));
+
+	SLIST_INIT(&stack->defers);
+	SLIST_INIT(&stack->spares);
+	stack->arena = arena;
+	stack->metas = src->metas;
+	if (stack->metas != NULL)
+		meta_refget(stack->metas);
+
+	*result = stack;
+	return 0;
+}
+
+static struct defer_node *
+defer_alloc(struct cert_stack *stack)
+{
+	struct defer_node *defer;
+
+	defer = SLIST_FIRST(&stack->spares);
+	if (defer != NULL) {
+		SLIST_REMOVE_HEAD(&stack->spares, next);
+		return defer;
+	}
+
+	return arena_alloc(stack->arena, sizeof(struct defer_node));
+}
+
+static void
+defer_destroy(struct cert_stack *stack, struct defer_node *defer)
 {
 	switch (defer->type) {
 	case DNT_SEPARATOR:
@@ -140,21 +247,72 @@ defer_destroy(struct defer_node *defer)
 		break;
 	}
 
-	free(defer);
+	SLIST_INSERT_HEAD(&stack->spares, defer, next);
 }
 
 static void
-serial_cleanup(struct serial_number *serial)
+serials_destroy(struct serial_number *serials)
 {
-	BN_free(serial->number);
-	free(serial->file);
+	struct serial_number *serial, *tmp;
+
+	HASH_ITER(hh, serials, serial, tmp) {
+		HASH_DEL(serials, serial);
+		free(serial->file);
+		free(serial);
+	}
+}
+
+static void
+__free(char **file)
+{
+	free(*file);
+}
+
+static struct subject_name *
+subject_create(struct rfc5280_name *name)
+{
+	struct subject_name *subject;
+	char const *cn;
+	char const *sn;
+	size_t cn_len;
+	size_t sn_len;
+
+	cn = x509_name_commonName(name);
+	sn = x509_name_serialNumber(name);
+	cn_len = strlen(cn) + 1;
+	sn_len = (sn != NULL) ? (strlen(sn) + 2) : 0;
+
+	subject = malloc(sizeof(struct subject_name) + cn_len + sn_len);
+	if (subject == NULL)
+		return NULL;
+
+	files_init(&subject->files);
+	subject->len = cn_len + sn_len;
+	memcpy(subject->key, cn, cn_len);
+	if (sn != NULL) {
+		subject->key[cn_len] = 1;
+		memcpy(subject->key + cn_len + 1, sn, sn_len - 1);
+	}
+
+	return subject;
 }
 
 static void
-subject_cleanup(struct subject_name *subject)
+subject_destroy(struct subject_name *subject)
 {
-	x509_name_put(subject->name);
-	free(subject->file);
+	files_cleanup(&subject->files, __free);
+	free(subject);
+}
+
+static void
+subjects_destroy(struct subject_name *subjects)
+{
+	struct subject_name *subject, *tmp;
+
+	HASH_ITER(hh, subjects, subject, tmp) {
+		HASH_DEL(subjects, subject);
+		subject_destroy(subject);
+	}
 }
 
 static void
@@ -162,23 +320,40 @@ meta_destroy(struct metadata_node *meta)
 {
 	uri_refput(meta->uri);
 	resources_destroy(meta->resources);
-	serial_numbers_cleanup(&meta->serials, serial_cleanup);
-	subjects_cleanup(&meta->subjects, subject_cleanup);
+	serials_destroy(meta->serials);
+	subjects_destroy(meta->subjects);
+	pthread_mutex_destroy(&meta->lock);
 	free(meta);
 }
 
+/* Iterative, so long chains do not threaten the stack. */
+static void
+meta_refput(struct metadata_node *meta)
+{
+	struct metadata_node *parent;
+
+	/*
+	 * Reminder: atomic_fetch_sub() returns the previous value, not the
+	 * resulting one.
+	 */
+	while (meta != NULL && atomic_fetch_sub(&meta->references, 1) == 1) {
+		parent = meta->parent;
+		meta_destroy(meta);
+		meta = parent;
+	}
+}
+
 void
 certstack_destroy(struct cert_stack *stack)
 {
 	unsigned int stack_size;
-	struct metadata_node *meta;
 	struct defer_node *post;
 
 	stack_size = 0;
 	while (!SLIST_EMPTY(&stack->defers)) {
 		post = SLIST_FIRST(&stack->defers);
 		SLIST_REMOVE_HEAD(&stack->defers, next);
-		defer_destroy(post);
+		defer_destroy(stack, post);
 		stack_size++;
 	}
 	pr_val_debug("Deleted %u deferred certificates.", stack_size);
@@ -186,14 +361,7 @@ certstack_destroy(struct cert_stack *stack)
 	pr_val_debug("Deleting %d stacked x509s.", sk_X509_num(stack->x509s));
 	sk_X509_pop_free(stack->x509s, X509_free);
 
-	stack_size = 0;
-	while (!SLIST_EMPTY(&stack->metas)) {
-		meta = SLIST_FIRST(&stack->metas);
-		SLIST_REMOVE_HEAD(&stack->metas, next);
-		meta_destroy(meta);
-		stack_size++;
-	}
-	pr_val_debug("Deleted %u metadatas.", stack_size);
+	meta_refput(stack->metas);
 
 	free(stack);
 }
@@ -203,7 +371,7 @@ deferstack_push(struct cert_stack *stack, struct deferred_cert *deferred)
 {
 	struct defer_node *node;
 
-	node = malloc(sizeof(struct defer_node));
+	node = defer_alloc(stack);
 	if (node == NULL)
 		return pr_enomem();
 
@@ -226,11 +394,13 @@ x509stack_pop(struct cert_stack *stack)
 		pr_crit("Attempted to pop empty X509 stack");
 	X509_free(cert);
 
-	meta = SLIST_FIRST(&stack->metas);
+	meta = stack->metas;
 	if (meta == NULL)
 		pr_crit("Attempted to pop empty metadata stack");
-	SLIST_REMOVE_HEAD(&stack->metas, next);
-	meta_destroy(meta);
+	stack->metas = meta->parent;
+	if (stack->metas != NULL)
+		meta_refget(stack->metas);
+	meta_refput(meta);
 }
 
 /**
@@ -249,16 +419,15 @@ again:	node = SLIST_FIRST(&stack->defers);
 		x509stack_pop(stack);
 
 		SLIST_REMOVE_HEAD(&stack->defers, next);
-		defer_destroy(node);
+		defer_destroy(stack, node);
 		goto again;
 	}
 
+	/* The node's references are transferred to @result. */
 	*result = node->deferred;
-	uri_refget(node->deferred.uri);
-	rpp_refget(node->deferred.pp);
 
 	SLIST_REMOVE_HEAD(&stack->defers, next);
-	defer_destroy(node);
+	SLIST_INSERT_HEAD(&stack->spares, node, next);
 	return 0;
 }
 
@@ -318,7 +487,7 @@ init_level(struct cert_stack *stack, unsigned int *_result)
 
 	result = 0;
 	work_repo_level = working_repo_peek_level();
-	head_meta = SLIST_FIRST(&stack->metas);
+	head_meta = stack->metas;
 	if (head_meta != NULL && work_repo_level > head_meta->level)
 		result = work_repo_level;
 
@@ -327,11 +496,11 @@ init_level(struct cert_stack *stack, unsigned int *_result)
 }
 
 static struct defer_node *
-create_separator(void)
+create_separator(struct cert_stack *stack)
 {
 	struct defer_node *result;
 
-	result = malloc(sizeof(struct defer_node));
+	result = defer_alloc(stack);
 	if (result == NULL)
 		return NULL;
 
@@ -353,20 +522,29 @@ x509stack_push(struct cert_stack *stack, struct rpki_uri *uri, X509 *x509,
 	if (meta == NULL)
 		return pr_enomem();
 
+	error = pthread_mutex_init(&meta->lock, NULL);
+	if (error) {
+		pr_op_err("pthread_mutex_init() returned error %d: %s", error,
+		    strerror(error));
+		free(meta);
+		return -error;
+	}
+
 	meta->uri = uri;
 	uri_refget(uri);
-	serial_numbers_init(&meta->serials);
-	subjects_init(&meta->subjects);
+	meta->serials = NULL;
+	meta->subjects = NULL;
+	atomic_init(&meta->references, 1);
 
 	error = init_resources(x509, policy, type, &meta->resources);
 	if (error)
-		goto cleanup_subjects;
+		goto cleanup_meta;
 
 	error = init_level(stack, &meta->level); /* Does not need a revert */
 	if (error)
 		goto destroy_resources;
 
-	defer_separator = create_separator();
+	defer_separator = create_separator(stack);
 	if (defer_separator == NULL) {
 		error = pr_enomem();
 		goto destroy_resources;
@@ -380,18 +558,19 @@ x509stack_push(struct cert_stack *stack, struct rpki_uri *uri, X509 *x509,
 	}
 
 	SLIST_INSERT_HEAD(&stack->defers, defer_separator, next);
-	SLIST_INSERT_HEAD(&stack->metas, meta, next);
+	/* The stack's reference to the old top is transferred to @meta. */
+	meta->parent = stack->metas;
+	stack->metas = meta;
 
 	return 0;
 
 destroy_separator:
-	free(defer_separator);
+	defer_destroy(stack, defer_separator);
 destroy_resources:
 	resources_destroy(meta->resources);
-cleanup_subjects:
-	subjects_cleanup(&meta->subjects, subject_cleanup);
-	serial_numbers_cleanup(&meta->serials, serial_cleanup);
+cleanup_meta:
 	uri_refput(meta->uri);
+	pthread_mutex_destroy(&meta->lock);
 	free(meta);
 	return error;
 }
@@ -414,7 +593,7 @@ x509stack_cancel(struct cert_stack *stack)
 	if (defer_separator == NULL)
 		pr_crit("Attempted to pop empty defer stack");
 	SLIST_REMOVE_HEAD(&stack->defers, next);
-	defer_destroy(defer_separator);
+	defer_destroy(stack, defer_separator);
 }
 
 X509 *
@@ -427,21 +606,21 @@ x509stack_peek(struct cert_stack *stack)
 struct rpki_uri *
 x509stack_peek_uri(struct cert_stack *stack)
 {
-	struct metadata_node *meta = SLIST_FIRST(&stack->metas);
+	struct metadata_node *meta = stack->metas;
 	return (meta != NULL) ? meta->uri : NULL;
 }
 
 struct resources *
 x509stack_peek_resources(struct cert_stack *stack)
 {
-	struct metadata_node *meta = SLIST_FIRST(&stack->metas);
+	struct metadata_node *meta = stack->metas;
 	return (meta != NULL) ? meta->resources : NULL;
 }
 
 unsigned int
 x509stack_peek_level(struct cert_stack *stack)
 {
-	struct metadata_node *meta = SLIST_FIRST(&stack->metas);
+	struct metadata_node *meta = stack->metas;
 	return (meta != NULL) ? meta->level : 0;
 }
 
@@ -474,20 +653,34 @@ int
 x509stack_store_serial(struct cert_stack *stack, BIGNUM *number)
 {
 	struct metadata_node *meta;
-	struct serial_number *cursor;
-	array_index i;
-	struct serial_number duplicate;
+	struct serial_number *serial;
+	struct serial_number *old;
 	char *string;
+	int len;
 	int error;
 
 	/* Remember to free @number if you return 0 but don't store it. */
 
-	meta = SLIST_FIRST(&stack->metas);
+	meta = stack->metas;
 	if (meta == NULL) {
 		BN_free(number);
 		return 0; /* The TA lacks siblings, so serial is unique. */
 	}
 
+	len = BN_num_bytes(number);
+	serial = malloc(sizeof(struct serial_number) + 1 + len);
+	if (serial == NULL)
+		return pr_enomem();
+	serial->len = 1 + len;
+	serial->bytes[0] = BN_is_negative(number);
+	BN_bn2bin(number, serial->bytes + 1);
+
+	error = get_current_file_name(&serial->file);
+	if (error) {
+		free(serial);
+		return error;
+	}
+
 	/*
 	 * Note: This is is reported as a warning, even though duplicate serial
 	 * numbers are clearly a violation of the RFC and common sense.
@@ -509,26 +702,34 @@ x509stack_store_serial(struct cert_stack *stack, BIGNUM *number)
 	 *
 	 * TODO I haven't seen this warning in a while. Review.
 	 */
-	ARRAYLIST_FOREACH(&meta->serials, cursor, i) {
-		if (BN_cmp(cursor->number, number) == 0) {
-			BN2string(number, &string);
-			pr_val_warn("Serial number '%s' is not unique. (Also found in '%s'.)",
-			    string, cursor->file);
-			BN_free(number);
-			free(string);
-			return 0;
-		}
+	mutex_lock(&meta->lock);
+
+	HASH_FIND(hh, meta->serials, serial->bytes, serial->len, old);
+	if (old != NULL) {
+		BN2string(number, &string);
+		pr_val_warn("Serial number '%s' is not unique. (Also found in '%s'.)",
+		    string, old->file);
+		free(string);
+		goto discard;
 	}
 
-	duplicate.number = number;
-	error = get_current_file_name(&duplicate.file);
-	if (error)
-		return error;
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, meta->serials, serial->bytes, serial->len, serial);
+	if (errno) {
+		error = pr_enomem();
+		goto discard;
+	}
 
-	error = serial_numbers_add(&meta->serials, &duplicate);
-	if (error)
-		free(duplicate.file);
+	mutex_unlock(&meta->lock);
+	BN_free(number); /* The serial is stored in @serial, in binary form. */
+	return 0;
 
+discard:
+	mutex_unlock(&meta->lock);
+	free(serial->file);
+	free(serial);
+	if (!error)
+		BN_free(number);
 	return error;
 }
 
@@ -544,9 +745,11 @@ x509stack_store_subject(struct cert_stack *stack, struct rfc5280_name *subject,
     subject_pk_check_cb cb, void *arg)
 {
 	struct metadata_node *meta;
-	struct subject_name *cursor;
+	struct subject_name *node;
+	struct subject_name *old;
+	char *file;
+	char **cursor;
 	array_index i;
-	struct subject_name duplicate;
 	bool duplicated;
 	int error;
 
@@ -589,48 +792,67 @@ x509stack_store_subject(struct cert_stack *stack, struct rfc5280_name *subject,
 	 *
 	 */
 
-	meta = SLIST_FIRST(&stack->metas);
+	meta = stack->metas;
 	if (meta == NULL)
 		return 0; /* The TA lacks siblings, so subject is unique. */
 
-	/* See the large comment in certstack_x509_store_serial(). */
-	duplicated = false;
-	ARRAYLIST_FOREACH(&meta->subjects, cursor, i) {
-		if (x509_name_equals(cursor->name, subject)) {
-			error = cb(&duplicated, cursor->file, arg);
-			if (error)
-				return error;
-
-			if (!duplicated)
-				continue;
-
-			char const *serial = x509_name_serialNumber(subject);
-			pr_val_warn("Subject name '%s%s%s' is not unique. (Also found in '%s'.)",
-			    x509_name_commonName(subject),
-			    (serial != NULL) ? "/" : "",
-			    (serial != NULL) ? serial : "",
-			    cursor->file);
-			return 0;
-		}
+	node = subject_create(subject);
+	if (node == NULL)
+		return pr_enomem();
+	error = get_current_file_name(&file);
+	if (error) {
+		subject_destroy(node);
+		return error;
 	}
 
-	duplicate.name = subject;
-	x509_name_get(subject);
+	mutex_lock(&meta->lock);
+
+	HASH_FIND(hh, meta->subjects, node->key, node->len, old);
+	if (old == NULL) {
+		error = files_add(&node->files, &file);
+		if (error)
+			goto free_file;
+
+		errno = 0;
+		HASH_ADD_KEYPTR(hh, meta->subjects, node->key, node->len, node);
+		if (errno)
+			error = pr_enomem(); /* @file belongs to @node now. */
+		else
+			node = NULL;
+		goto end;
+	}
 
-	error = get_current_file_name(&duplicate.file);
-	if (error)
-		goto revert_name;
+	/* See the large comment in certstack_x509_store_serial(). */
+	duplicated = false;
+	ARRAYLIST_FOREACH(&old->files, cursor, i) {
+		error = cb(&duplicated, *cursor, arg);
+		if (error)
+			goto free_file;
+
+		if (!duplicated)
+			continue;
+
+		char const *serial = x509_name_serialNumber(subject);
+		pr_val_warn("Subject name '%s%s%s' is not unique. (Also found in '%s'.)",
+		    x509_name_commonName(subject),
+		    (serial != NULL) ? "/" : "",
+		    (serial != NULL) ? serial : "",
+		    *cursor);
+		goto free_file;
+	}
 
-	error = subjects_add(&meta->subjects, &duplicate);
+	/* Same name and public key; likely another version of the cert. */
+	error = files_add(&old->files, &file);
 	if (error)
-		goto revert_file;
-
-	return 0;
-
-revert_file:
-	free(duplicate.file);
-revert_name:
-	x509_name_put(subject);
+		goto free_file;
+	goto end;
+
+free_file:
+	free(file);
+end:
+	mutex_unlock(&meta->lock);
+	if (node != NULL)
+		subject_destroy(node);
 	return error;
 }
 
@@ -4,12 +4,13 @@
 #include <openssl/x509.h>
 #include <stdbool.h>
 #include "resource.h"
+#include "data_structure/arena.h"
 #include "object/certificate.h"
 #include "object/name.h"
 #include "types/uri.h"
 
 /*
- * One certificate stack is allocated per validation cycle, and it is used
+ * One certificate stack is allocated per validation thread, and it is used
  * through its entirety to hold the certificates relevant to the ongoing
  * validation.
  *
@@ -26,6 +27,9 @@
  *   libcrypto.
  *   For any given certificate being validated, this stack stores all of its
  *   parents.
+ *
+ * Subtrees can be handed over to other threads; each of them receives a
+ * snapshot of the x509 stack (and its metadata), and a defer stack of its own.
  */
 
 struct cert_stack;
@@ -35,7 +39,9 @@ struct deferred_cert {
 	struct rpp *pp;
 };
 
-int certstack_create(struct cert_stack **);
+int certstack_create(struct arena *, struct cert_stack **);
+int certstack_snapshot(struct cert_stack *, struct arena *,
+    struct cert_stack **);
 void certstack_destroy(struct cert_stack *);
 
 int deferstack_push(struct cert_stack *, struct deferred_cert *cert);
@@ -67,6 +67,33 @@ rwlock_unlock(pthread_rwlock_t *lock)
 		    error);
 }
 
+void
+mutex_lock(pthread_mutex_t *lock)
+{
+	int error;
+
+	/*
+	 * The only possible errors (EINVAL, EAGAIN, EDEADLK) indicate serious
+	 * programming errors.
+	 */
+	error = pthread_mutex_lock(lock);
+	if (error)
+		pr_crit("pthread_mutex_lock() returned error code %d. This is too critical for a graceful recovery; I must die now.",
+		    error);
+}
+
+void
+mutex_unlock(pthread_mutex_t *lock)
+{
+	int error;
+
+	/* Same as above; only EINVAL, EAGAIN and EPERM. */
+	error = pthread_mutex_unlock(lock);
+	if (error)
+		pr_crit("pthread_mutex_unlock() returned error code %d. This is too critical for a graceful recovery; I must die now.",
+		    error);
+}
+
 static int
 process_file(char const *dir_name, char const *file_name, char const *file_ext,
     int *fcount, process_file_cb cb, void *arg)
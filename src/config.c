@@ -83,6 +83,8 @@ struct rpki_config {
 		} interval;
 		/** Number of iterations the deltas will be stored. */
 		unsigned int deltas_lifetime;
+		/** File where the VRPs are kept between restarts. */
+		char *state_file;
 	} server;
 
 	struct {
@@ -211,6 +213,9 @@ struct rpki_config {
 	/* Time period that must lapse to warn about a stale repository */
 	unsigned int stale_repository_period;
 
+	/* Maximum number of signatures remembered by the signature cache */
+	unsigned int signature_cache_size;
+
 	/* Download the normal TALs into --tal? */
 	bool init_tals;
 	/* Download AS0 TALs into --tal? */
@@ -229,6 +234,10 @@ struct rpki_config {
 		struct {
 			unsigned int max;
 		} validation;
+		/* Threads that download repositories ahead of the validation */
+		struct {
+			unsigned int max;
+		} fetch;
 	} thread_pool;
 };
 
@@ -454,6 +463,13 @@ static const struct option_field options[] = {
 		.doc = "Number of iterations the deltas will be stored.",
 		.min = 0,
 		.max = UINT_MAX,
+	}, {
+		.id = 5008,
+		.name = "server.state-file",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, server.state_file),
+		.doc = "File where the VRPs, deltas and serial are saved after every validation cycle, so they can be served right after a restart.",
+		.arg_doc = "<file>",
 	},
 
 	/* RSYNC fields */
@@ -788,6 +804,14 @@ static const struct option_field options[] = {
 		.doc = "Time period that must lapse to warn about stale repositories",
 		.min = 0,
 		.max = UINT_MAX,
+	}, {
+		.id = 8002,
+		.name = "signature-cache-size",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, signature_cache_size),
+		.doc = "Number of verified signatures remembered between validations. (0 disables the cache.)",
+		.min = 0,
+		.max = UINT_MAX,
 	},
 
 	{
@@ -827,9 +851,17 @@ static const struct option_field options[] = {
 		.type = &gt_uint,
 		.offset = offsetof(struct rpki_config,
 		    thread_pool.validation.max),
-		.doc = "Number of threads in the validation thread pool. (Each thread handles one TAL tree.)",
+		.doc = "Number of threads in the validation thread pool. (The threads are shared by all the TAL trees.)",
 		.min = 0,
 		.max = 100,
+	}, {
+		.id = 12002,
+		.name = "thread-pool.fetch.max",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, thread_pool.fetch.max),
+		.doc = "Number of threads in the repository fetch thread pool. Also known as the maximum number of repositories that will be prefetched at the same time.",
+		.min = 1,
+		.max = 100,
 	},
 
 	{ 0 },
@@ -1007,6 +1039,7 @@ set_default_values(void)
 	rpki_config.server.interval.retry = 600;
 	rpki_config.server.interval.expire = 7200;
 	rpki_config.server.deltas_lifetime = 2;
+	rpki_config.server.state_file = NULL;
 
 	rpki_config.tal = NULL;
 	rpki_config.slurm = NULL;
@@ -1102,6 +1135,7 @@ set_default_values(void)
 
 	rpki_config.asn1_decode_max_stack = 4096; /* 4kB */
 	rpki_config.stale_repository_period = 43200; /* 12 hours */
+	rpki_config.signature_cache_size = 1048576;
 
 	rpki_config.init_tals = false;
 	rpki_config.init_tal_locations = 0;
@@ -1110,6 +1144,8 @@ set_default_values(void)
 	rpki_config.thread_pool.server.max = 20;
 	/* Usually 5 TALs, let a few more available */
 	rpki_config.thread_pool.validation.max = 5;
+	/* Downloads mostly wait on the network; be more generous */
+	rpki_config.thread_pool.fetch.max = 10;
 
 	return 0;
 
@@ -1367,6 +1403,12 @@ config_get_deltas_lifetime(void)
 	return rpki_config.server.deltas_lifetime;
 }
 
+char const *
+config_get_state_file(void)
+{
+	return rpki_config.server.state_file;
+}
+
 char const *
 config_get_slurm(void)
 {
@@ -1632,6 +1674,12 @@ config_get_stale_repository_period(void)
 	return rpki_config.stale_repository_period;
 }
 
+unsigned int
+config_get_signature_cache_size(void)
+{
+	return rpki_config.signature_cache_size;
+}
+
 unsigned int
 config_get_thread_pool_server_max(void)
 {
@@ -1644,6 +1692,12 @@ config_get_thread_pool_validation_max(void)
 	return rpki_config.thread_pool.validation.max;
 }
 
+unsigned int
+config_get_thread_pool_fetch_max(void)
+{
+	return rpki_config.thread_pool.fetch.max;
+}
+
 void
 config_set_rsync_enabled(bool value)
 {
@@ -25,6 +25,7 @@ unsigned int config_get_interval_refresh(void);
 unsigned int config_get_interval_retry(void);
 unsigned int config_get_interval_expire(void);
 unsigned int config_get_deltas_lifetime(void);
+char const *config_get_state_file(void);
 char const *config_get_slurm(void);
 
 char const *config_get_tal(void);
@@ -55,8 +56,10 @@ char const *config_get_output_bgpsec(void);
 enum output_format config_get_output_format(void);
 unsigned int config_get_asn1_decode_max_stack(void);
 unsigned int config_get_stale_repository_period(void);
+unsigned int config_get_signature_cache_size(void);
 unsigned int config_get_thread_pool_server_max(void);
 unsigned int config_get_thread_pool_validation_max(void);
+unsigned int config_get_thread_pool_fetch_max(void);
 
 /* Logging getters */
 bool config_get_op_log_enabled(void);
@@ -10,6 +10,9 @@
 #include "log.h"
 #include "asn1/oid.h"
 
+static int hash_buffer(char const *, unsigned char const *, size_t,
+    unsigned char *, unsigned int *);
+
 static int
 get_md(char const *algorithm, EVP_MD const **result)
 {
@@ -109,8 +112,16 @@ end1:
 }
 
 /**
- * Computes the hash of the file @uri, and compares it to @expected (The
- * "expected" hash).
+ * Loads the file @uri into @fc, computes its hash, and compares it to
+ * @expected (The "expected" hash).
+ *
+ * The file is read only once; if the result is zero, @fc holds the contents
+ * that were hashed, so the caller can decode them without going back to the
+ * disk. (Don't forget to file_free() it.) Otherwise @fc is left unallocated.
+ *
+ * On success, the actual hash of the file is also stored in @actual (which
+ * needs EVP_MAX_MD_SIZE bytes) and @actual_len. It can differ from @expected if
+ * the mismatch incidence is ignored.
  *
  * Returns:
  *   0 if no errors happened and the hashes match, or the hash doesn't match
@@ -121,17 +132,16 @@ end1:
  */
 int
 hash_validate_mft_file(char const *algorithm, struct rpki_uri *uri,
-    BIT_STRING_t const *expected)
+    BIT_STRING_t const *expected, struct file_contents *fc,
+    unsigned char *actual, unsigned int *actual_len)
 {
-	unsigned char actual[EVP_MAX_MD_SIZE];
-	unsigned int actual_len;
 	int error;
 
 	if (expected->bits_unused != 0)
 		return pr_val_err("Hash string has unused bits.");
 
 	do {
-		error = hash_file(algorithm, uri, actual, &actual_len);
+		error = file_load(uri_get_local(uri), fc);
 		if (!error)
 			break;
 
@@ -143,17 +153,28 @@ hash_validate_mft_file(char const *algorithm, struct rpki_uri *uri,
 
 			return error;
 		}
-		/* Any other error (crypto, enomem, file read) */
+		/* Any other error (enomem, file read) */
 		return ENSURE_NEGATIVE(error);
 	} while (0);
 
-	if (!hash_matches(expected->buf, expected->size, actual, actual_len)) {
-		return incidence(INID_MFT_FILE_HASH_NOT_MATCH,
+	error = hash_buffer(algorithm, fc->buffer, fc->buffer_size, actual,
+	    actual_len);
+	if (error)
+		goto fail;
+
+	if (!hash_matches(expected->buf, expected->size, actual, *actual_len)) {
+		error = incidence(INID_MFT_FILE_HASH_NOT_MATCH,
 		    "File '%s' does not match its manifest hash.",
 		    uri_val_get_printable(uri));
+		if (error)
+			goto fail;
 	}
 
 	return 0;
+
+fail:
+	file_free(fc);
+	return ENSURE_NEGATIVE(error);
 }
 
 /**
@@ -180,6 +201,67 @@ hash_validate_file(char const *algorithm, struct rpki_uri *uri,
 	return 0;
 }
 
+/*
+ * Prepares @result to hash content that doesn't arrive all at once. Feed it
+ * with hash_stream_update(), and check it with hash_stream_validate().
+ */
+int
+hash_stream_create(char const *algorithm, EVP_MD_CTX **result)
+{
+	EVP_MD const *md;
+	EVP_MD_CTX *ctx;
+	int error;
+
+	error = get_md(algorithm, &md);
+	if (error)
+		return error;
+
+	ctx = EVP_MD_CTX_new();
+	if (ctx == NULL)
+		return pr_enomem();
+
+	if (!EVP_DigestInit_ex(ctx, md, NULL)) {
+		EVP_MD_CTX_free(ctx);
+		return val_crypto_err("EVP_DigestInit_ex() failed");
+	}
+
+	*result = ctx;
+	return 0;
+}
+
+int
+hash_stream_update(EVP_MD_CTX *ctx, unsigned char const *data, size_t len)
+{
+	if (!EVP_DigestUpdate(ctx, data, len))
+		return val_crypto_err("EVP_DigestUpdate() failed");
+	return 0;
+}
+
+/*
+ * Returns 0 if the hash of everything @ctx has been fed is @expected. @ctx
+ * cannot be updated afterwards.
+ */
+int
+hash_stream_validate(EVP_MD_CTX *ctx, unsigned char const *expected,
+    size_t expected_len)
+{
+	unsigned char actual[EVP_MAX_MD_SIZE];
+	unsigned int actual_len;
+
+	if (!EVP_DigestFinal_ex(ctx, actual, &actual_len))
+		return val_crypto_err("EVP_DigestFinal_ex() failed");
+
+	return hash_matches(expected, expected_len, actual, actual_len)
+	    ? 0
+	    : -EINVAL;
+}
+
+void
+hash_stream_destroy(EVP_MD_CTX *ctx)
+{
+	EVP_MD_CTX_free(ctx);
+}
+
 static int
 hash_buffer(char const *algorithm,
     unsigned char const *content, size_t content_len,
@@ -3,11 +3,14 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <openssl/evp.h>
+#include "file.h"
 #include "types/uri.h"
 #include "asn1/asn1c/BIT_STRING.h"
 
 int hash_validate_mft_file(char const *, struct rpki_uri *uri,
-    BIT_STRING_t const *);
+    BIT_STRING_t const *, struct file_contents *, unsigned char *,
+    unsigned int *);
 int hash_validate_file(char const *, struct rpki_uri *, unsigned char const *,
     size_t);
 int hash_validate(char const *, unsigned char const *, size_t,
@@ -15,6 +18,11 @@ int hash_validate(char const *, unsigned char const *, size_t,
 int hash_validate_octet_string(char const *, OCTET_STRING_t const*,
     OCTET_STRING_t const *);
 
+int hash_stream_create(char const *, EVP_MD_CTX **);
+int hash_stream_update(EVP_MD_CTX *, unsigned char const *, size_t);
+int hash_stream_validate(EVP_MD_CTX *, unsigned char const *, size_t);
+void hash_stream_destroy(EVP_MD_CTX *);
+
 int hash_local_file(char const *, char const *, unsigned char *,
     unsigned int *);
 
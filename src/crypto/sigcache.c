@@ -0,0 +1,322 @@
+#include "crypto/sigcache.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/x509v3.h>
+
+#include "common.h"
+#include "config.h"
+#include "log.h"
+
+/*
+ * Signature verification cache.
+ *
+ * Remembers the signatures that were found to be valid, so they don't need to
+ * be verified again. RPKI objects rarely change, so most of the signatures
+ * verified by a validation cycle were already verified by the previous one.
+ * It also helps within a single cycle, because libcrypto verifies the
+ * signatures of the whole certificate chain every time a certificate is
+ * validated.
+ *
+ * Only the signatures are cached. Validity periods and revocation are still
+ * checked every time.
+ *
+ * The cache is a fixed-size, direct-mapped table: each key can only live in
+ * one slot (which is derived from the key itself), and newcomers evict
+ * whatever was already there. An empty slot is all zeroes.
+ */
+
+/* Slots are protected by one of these locks, depending on their index. */
+#define LOCK_COUNT 64
+
+static unsigned char (*slots)[SHA256_DIGEST_LENGTH];
+static size_t slot_count;
+static pthread_mutex_t locks[LOCK_COUNT];
+
+int
+sigcache_init(void)
+{
+	unsigned int i;
+	int error;
+
+	slot_count = config_get_signature_cache_size();
+	if (slot_count == 0) {
+		slots = NULL;
+		return 0;
+	}
+
+	slots = calloc(slot_count, sizeof(*slots));
+	if (slots == NULL)
+		return pr_enomem();
+
+	for (i = 0; i < LOCK_COUNT; i++) {
+		error = pthread_mutex_init(&locks[i], NULL);
+		if (error) {
+			pr_op_err("pthread_mutex_init() errored: %s",
+			    strerror(error));
+			while (i > 0)
+				pthread_mutex_destroy(&locks[--i]);
+			free(slots);
+			slots = NULL;
+			return -error;
+		}
+	}
+
+	return 0;
+}
+
+void
+sigcache_cleanup(void)
+{
+	unsigned int i;
+
+	if (slots == NULL)
+		return;
+
+	for (i = 0; i < LOCK_COUNT; i++)
+		pthread_mutex_destroy(&locks[i]);
+	free(slots);
+	slots = NULL;
+}
+
+bool
+sigcache_enabled(void)
+{
+	return slots != NULL;
+}
+
+/*
+ * Starts computing the key of a signature made by @signer's private key.
+ * Feed the signed content and the signature to sigcache_key_update(), then
+ * call sigcache_key_finish().
+ */
+int
+sigcache_key_start(X509 *signer, EVP_MD_CTX **result)
+{
+	ASN1_BIT_STRING const *pubkey;
+	EVP_MD_CTX *ctx;
+
+	pubkey = X509_get0_pubkey_bitstr(signer);
+	if (pubkey == NULL)
+		return val_crypto_err("Certificate seems to lack a public key");
+
+	ctx = EVP_MD_CTX_new();
+	if (ctx == NULL)
+		return pr_enomem();
+
+	if (!EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) ||
+	    !EVP_DigestUpdate(ctx, pubkey->data, pubkey->length)) {
+		EVP_MD_CTX_free(ctx);
+		return val_crypto_err("Could not hash the signer's public key");
+	}
+
+	*result = ctx;
+	return 0;
+}
+
+int
+sigcache_key_update(EVP_MD_CTX *ctx, void const *data, size_t size)
+{
+	if (!EVP_DigestUpdate(ctx, data, size))
+		return val_crypto_err("EVP_DigestUpdate() returned error");
+	return 0;
+}
+
+/* Also releases @ctx. */
+int
+sigcache_key_finish(EVP_MD_CTX *ctx, struct sigcache_key *key)
+{
+	int error;
+
+	error = 0;
+	if (!EVP_DigestFinal_ex(ctx, key->bytes, NULL))
+		error = val_crypto_err("EVP_DigestFinal_ex() returned error");
+
+	EVP_MD_CTX_free(ctx);
+	return error;
+}
+
+static size_t
+get_slot(struct sigcache_key const *key)
+{
+	uint64_t index;
+
+	/* The key is a hash, so any part of it is as good as any other. */
+	memcpy(&index, key->bytes, sizeof(index));
+	return index % slot_count;
+}
+
+bool
+sigcache_contains(struct sigcache_key const *key)
+{
+	size_t slot;
+	bool result;
+
+	if (slots == NULL)
+		return false;
+
+	slot = get_slot(key);
+	mutex_lock(&locks[slot % LOCK_COUNT]);
+	result = memcmp(slots[slot], key->bytes, sizeof(key->bytes)) == 0;
+	mutex_unlock(&locks[slot % LOCK_COUNT]);
+
+	return result;
+}
+
+/* Records that the signature identified by @key is valid. */
+void
+sigcache_add(struct sigcache_key const *key)
+{
+	size_t slot;
+
+	if (slots == NULL)
+		return;
+
+	slot = get_slot(key);
+	mutex_lock(&locks[slot % LOCK_COUNT]);
+	memcpy(slots[slot], key->bytes, sizeof(key->bytes));
+	mutex_unlock(&locks[slot % LOCK_COUNT]);
+}
+
+/* Verifies @cert's signature, which was made by @issuer. */
+static bool
+verify_cert_signature(X509 *cert, X509 *issuer, EVP_PKEY *pkey)
+{
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_len;
+	struct sigcache_key key;
+	EVP_MD_CTX *ctx;
+	bool cacheable;
+
+	/* The DER includes both the signed content and the signature. */
+	cacheable = slots != NULL
+	    && X509_digest(cert, EVP_sha256(), digest, &digest_len)
+	    && sigcache_key_start(issuer, &ctx) == 0
+	    && sigcache_key_update(ctx, digest, digest_len) == 0
+	    && sigcache_key_finish(ctx, &key) == 0;
+
+	if (cacheable && sigcache_contains(&key))
+		return true;
+	if (X509_verify(cert, pkey) <= 0)
+		return false;
+	if (cacheable)
+		sigcache_add(&key);
+	return true;
+}
+
+/* Reports error @err on @cert to the verification callback. */
+static int
+report(X509_STORE_CTX *ctx, X509 *cert, int depth, int err)
+{
+	X509_STORE_CTX_set_error_depth(ctx, depth);
+	X509_STORE_CTX_set_current_cert(ctx, cert);
+	X509_STORE_CTX_set_error(ctx, err);
+	return X509_STORE_CTX_get_verify_cb(ctx)(0, ctx);
+}
+
+static int
+check_cert_time(X509_STORE_CTX *ctx, X509 *cert, int depth)
+{
+	X509_VERIFY_PARAM *param;
+	unsigned long flags;
+	time_t check_time;
+	time_t *ptime;
+	int cmp;
+
+	param = X509_STORE_CTX_get0_param(ctx);
+	flags = X509_VERIFY_PARAM_get_flags(param);
+	if (flags & X509_V_FLAG_USE_CHECK_TIME) {
+		check_time = X509_VERIFY_PARAM_get_time(param);
+		ptime = &check_time;
+	} else if (flags & X509_V_FLAG_NO_CHECK_TIME) {
+		return 1;
+	} else {
+		ptime = NULL;
+	}
+
+	cmp = X509_cmp_time(X509_get0_notBefore(cert), ptime);
+	if (cmp == 0 && !report(ctx, cert, depth,
+	    X509_V_ERR_ERROR_IN_CERT_NOT_BEFORE_FIELD))
+		return 0;
+	if (cmp > 0 && !report(ctx, cert, depth, X509_V_ERR_CERT_NOT_YET_VALID))
+		return 0;
+
+	cmp = X509_cmp_time(X509_get0_notAfter(cert), ptime);
+	if (cmp == 0 && !report(ctx, cert, depth,
+	    X509_V_ERR_ERROR_IN_CERT_NOT_AFTER_FIELD))
+		return 0;
+	if (cmp < 0 && !report(ctx, cert, depth, X509_V_ERR_CERT_HAS_EXPIRED))
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Replacement for libcrypto's internal_verify(); the last step of
+ * X509_verify_cert(), which checks the signatures and the validity periods of
+ * the chain. The only difference is that the signatures are looked up in the
+ * cache first.
+ *
+ * (Install it with X509_STORE_set_verify().)
+ */
+int
+sigcache_verify_chain(X509_STORE_CTX *ctx)
+{
+	STACK_OF(X509) *chain;
+	unsigned long flags;
+	X509 *issuer;
+	X509 *cert;
+	EVP_PKEY *pkey;
+	int n;
+
+	chain = X509_STORE_CTX_get0_chain(ctx);
+	flags = X509_VERIFY_PARAM_get_flags(X509_STORE_CTX_get0_param(ctx));
+	n = sk_X509_num(chain) - 1;
+	issuer = sk_X509_value(chain, n);
+
+	if (X509_check_issued(issuer, issuer) == X509_V_OK) {
+		/* Self-signed top. Its signature is only checked on demand. */
+		cert = issuer;
+	} else if (flags & X509_V_FLAG_PARTIAL_CHAIN) {
+		/* Trusted, and there's no issuer to check its signature. */
+		cert = issuer;
+		issuer = NULL;
+	} else {
+		if (n <= 0) {
+			return report(ctx, issuer, 0,
+			    X509_V_ERR_UNABLE_TO_VERIFY_LEAF_SIGNATURE);
+		}
+		n--;
+		cert = sk_X509_value(chain, n);
+	}
+
+	while (n >= 0) {
+		if (issuer != NULL && (cert != issuer
+		    || (flags & X509_V_FLAG_CHECK_SS_SIGNATURE))) {
+			pkey = X509_get0_pubkey(issuer);
+			if (pkey == NULL) {
+				if (!report(ctx, issuer,
+				    (cert != issuer) ? (n + 1) : n,
+				    X509_V_ERR_UNABLE_TO_DECODE_ISSUER_PUBLIC_KEY))
+					return 0;
+			} else if (!verify_cert_signature(cert, issuer, pkey)) {
+				if (!report(ctx, cert, n,
+				    X509_V_ERR_CERT_SIGNATURE_FAILURE))
+					return 0;
+			}
+		}
+
+		if (!check_cert_time(ctx, cert, n))
+			return 0;
+
+		if (--n >= 0) {
+			issuer = cert;
+			cert = sk_X509_value(chain, n);
+		}
+	}
+
+	return 1;
+}
@@ -0,0 +1,32 @@
+#ifndef SRC_CRYPTO_SIGCACHE_H_
+#define SRC_CRYPTO_SIGCACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+
+/*
+ * Identifies one signature verification: a hash of the signer's public key,
+ * the signed content and the signature.
+ */
+struct sigcache_key {
+	unsigned char bytes[SHA256_DIGEST_LENGTH];
+};
+
+int sigcache_init(void);
+void sigcache_cleanup(void);
+
+bool sigcache_enabled(void);
+
+int sigcache_key_start(X509 *, EVP_MD_CTX **);
+int sigcache_key_update(EVP_MD_CTX *, void const *, size_t);
+int sigcache_key_finish(EVP_MD_CTX *, struct sigcache_key *);
+
+bool sigcache_contains(struct sigcache_key const *);
+void sigcache_add(struct sigcache_key const *);
+
+int sigcache_verify_chain(X509_STORE_CTX *);
+
+#endif /* SRC_CRYPTO_SIGCACHE_H_ */
@@ -0,0 +1,130 @@
+#include "data_structure/arena.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+/*
+ * Usable sizes of the regular blocks. The first one is small, because most
+ * arenas (those of the subtree forks, in particular) only ever hold a handful
+ * of objects. Each block is then twice as big as the previous one, up to the
+ * maximum.
+ */
+#define FIRST_BLOCK_SIZE 1024
+#define MAX_BLOCK_SIZE (64 * 1024)
+/* Allocations larger than this get a block of their own. */
+#define LARGE_SIZE (MAX_BLOCK_SIZE / 4)
+
+struct arena_block {
+	struct arena_block *next;
+	/* Bytes of @data already handed out. */
+	size_t used;
+	size_t size;
+	alignas(max_align_t) unsigned char data[];
+};
+
+struct arena {
+	/* Block memory is currently being taken from. */
+	struct arena_block *current;
+	/* Exhausted blocks, and blocks of large allocations. */
+	struct arena_block *full;
+	/* Usable size of the next regular block. */
+	size_t next_size;
+};
+
+int
+arena_create(struct arena **result)
+{
+	struct arena *arena;
+
+	arena = malloc(sizeof(struct arena));
+	if (arena == NULL)
+		return pr_enomem();
+
+	arena->current = NULL;
+	arena->full = NULL;
+	arena->next_size = FIRST_BLOCK_SIZE;
+
+	*result = arena;
+	return 0;
+}
+
+static void
+blocks_destroy(struct arena_block *block)
+{
+	struct arena_block *next;
+
+	for (; block != NULL; block = next) {
+		next = block->next;
+		free(block);
+	}
+}
+
+void
+arena_destroy(struct arena *arena)
+{
+	blocks_destroy(arena->current);
+	blocks_destroy(arena->full);
+	free(arena);
+}
+
+static struct arena_block *
+block_create(size_t size)
+{
+	struct arena_block *block;
+
+	block = malloc(sizeof(struct arena_block) + size);
+	if (block == NULL)
+		return NULL;
+
+	block->next = NULL;
+	block->used = 0;
+	block->size = size;
+	return block;
+}
+
+/*
+ * Returns @size bytes, aligned for any type, or NULL on memory allocation
+ * failure. (No error message is printed.)
+ *
+ * The memory lives until arena_destroy().
+ */
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_block *block;
+	void *result;
+
+	size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+	if (size > LARGE_SIZE) {
+		block = block_create(size);
+		if (block == NULL)
+			return NULL;
+		block->used = size;
+		block->next = arena->full;
+		arena->full = block;
+		return block->data;
+	}
+
+	block = arena->current;
+	if (block == NULL || block->size - block->used < size) {
+		while (arena->next_size < size)
+			arena->next_size *= 2;
+		block = block_create(arena->next_size);
+		if (block == NULL)
+			return NULL;
+		if (arena->next_size < MAX_BLOCK_SIZE)
+			arena->next_size *= 2;
+		if (arena->current != NULL) {
+			arena->current->next = arena->full;
+			arena->full = arena->current;
+		}
+		arena->current = block;
+	}
+
+	result = block->data + block->used;
+	block->used += size;
+	return result;
+}
@@ -0,0 +1,23 @@
+#ifndef SRC_DATA_STRUCTURE_ARENA_H_
+#define SRC_DATA_STRUCTURE_ARENA_H_
+
+#include <stddef.h>
+
+/*
+ * Region allocator.
+ *
+ * Hands out memory from large blocks, and releases all of it at once when the
+ * arena is destroyed. Objects cannot be freed individually; users that need to
+ * recycle them should keep their own free lists.
+ *
+ * Not thread-safe. Each validation state owns one (see struct validation), and
+ * so does each pooled ASN.1 object (see asn1/pool.h).
+ */
+struct arena;
+
+int arena_create(struct arena **);
+void arena_destroy(struct arena *);
+
+void *arena_alloc(struct arena *, size_t);
+
+#endif /* SRC_DATA_STRUCTURE_ARENA_H_ */
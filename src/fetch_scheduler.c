@@ -0,0 +1,211 @@
+#include "fetch_scheduler.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "config.h"
+#include "log.h"
+#include "state.h"
+#include "thread_var.h"
+#include "data_structure/uthash_nonfatal.h"
+
+/* A repository that is being downloaded by some thread. */
+struct fetch {
+	/* Key. Update Notification URI (RRDP) or rsync'd URI. */
+	char *uri;
+	UT_hash_handle hh;
+};
+
+struct fetch_table {
+	struct fetch *fetches;
+	pthread_mutex_t lock;
+	/* Signaled whenever a download finishes. */
+	pthread_cond_t done;
+};
+
+static struct thread_pool *pool;
+
+int
+fetch_table_create(struct fetch_table **result)
+{
+	struct fetch_table *table;
+	int error;
+
+	table = malloc(sizeof(struct fetch_table));
+	if (table == NULL)
+		return pr_enomem();
+
+	table->fetches = NULL;
+
+	error = pthread_mutex_init(&table->lock, NULL);
+	if (error) {
+		pr_op_err("pthread_mutex_init() returned error %d: %s", error,
+		    strerror(error));
+		goto free_table;
+	}
+	error = pthread_cond_init(&table->done, NULL);
+	if (error) {
+		pr_op_err("pthread_cond_init() returned error %d: %s", error,
+		    strerror(error));
+		goto destroy_lock;
+	}
+
+	*result = table;
+	return 0;
+
+destroy_lock:
+	pthread_mutex_destroy(&table->lock);
+free_table:
+	free(table);
+	return -error;
+}
+
+void
+fetch_table_destroy(struct fetch_table *table)
+{
+	struct fetch *fetch;
+	struct fetch *tmp;
+
+	/* There shouldn't be any, but whatever */
+	HASH_ITER(hh, table->fetches, fetch, tmp) {
+		HASH_DEL(table->fetches, fetch);
+		free(fetch->uri);
+		free(fetch);
+	}
+
+	pthread_cond_destroy(&table->done);
+	pthread_mutex_destroy(&table->lock);
+	free(table);
+}
+
+static int
+get_thread_fetches(struct fetch_table **result)
+{
+	struct validation *state;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return pr_val_err("No state related to this thread");
+
+	*result = validation_fetches(state);
+	return 0;
+}
+
+/*
+ * Announces that the calling thread is about to download @uri. If another
+ * thread is already downloading it, waits until it's done first.
+ *
+ * Since the repository might have been downloaded while waiting, the caller
+ * should check whether the download is still necessary after this returns.
+ *
+ * Every successful call has to be paired with a fetch_end().
+ */
+int
+fetch_begin(char const *uri)
+{
+	struct fetch_table *table;
+	struct fetch *fetch;
+	struct fetch *found;
+	int error;
+
+	table = NULL;
+	error = get_thread_fetches(&table);
+	if (error)
+		return error;
+
+	fetch = malloc(sizeof(struct fetch));
+	if (fetch == NULL)
+		return pr_enomem();
+	fetch->uri = strdup(uri);
+	if (fetch->uri == NULL) {
+		free(fetch);
+		return pr_enomem();
+	}
+
+	mutex_lock(&table->lock);
+
+	do {
+		HASH_FIND_STR(table->fetches, uri, found);
+		if (found == NULL)
+			break;
+		pr_val_debug("'%s' is being downloaded by another thread; waiting.",
+		    uri);
+		error = pthread_cond_wait(&table->done, &table->lock);
+		if (error)
+			pr_crit("pthread_cond_wait() returned error code %d.",
+			    error);
+	} while (true);
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, table->fetches, fetch->uri, strlen(fetch->uri),
+	    fetch);
+	error = errno;
+
+	mutex_unlock(&table->lock);
+
+	if (error) {
+		free(fetch->uri);
+		free(fetch);
+		return pr_enomem();
+	}
+
+	return 0;
+}
+
+/* Announces that the calling thread is done downloading @uri. */
+void
+fetch_end(char const *uri)
+{
+	struct fetch_table *table;
+	struct fetch *fetch;
+
+	table = NULL;
+	if (get_thread_fetches(&table) != 0)
+		return;
+
+	mutex_lock(&table->lock);
+	HASH_FIND_STR(table->fetches, uri, fetch);
+	if (fetch != NULL)
+		HASH_DEL(table->fetches, fetch);
+	pthread_cond_broadcast(&table->done);
+	mutex_unlock(&table->lock);
+
+	if (fetch == NULL)
+		pr_crit("'%s' was not being downloaded.", uri);
+
+	free(fetch->uri);
+	free(fetch);
+}
+
+int
+fetch_scheduler_init(void)
+{
+	pool = NULL;
+	return thread_pool_create("Fetch", config_get_thread_pool_fetch_max(),
+	    &pool);
+}
+
+/*
+ * Queues a download. Tasks that need the validation state have to fork it,
+ * since they might outlive the task that pushed them.
+ */
+int
+fetch_scheduler_push(char const *task_name, thread_pool_task_cb cb, void *arg)
+{
+	return thread_pool_push(pool, task_name, cb, arg);
+}
+
+/* Waits until all the queued downloads are finished. */
+void
+fetch_scheduler_wait(void)
+{
+	thread_pool_wait(pool);
+}
+
+void
+fetch_scheduler_cleanup(void)
+{
+	thread_pool_destroy(pool);
+}
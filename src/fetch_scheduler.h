@@ -0,0 +1,32 @@
+#ifndef SRC_FETCH_SCHEDULER_H_
+#define SRC_FETCH_SCHEDULER_H_
+
+#include "thread/thread_pool.h"
+
+/*
+ * Repository downloads (rsync and RRDP) that are currently in progress, in the
+ * tree of a single TAL.
+ *
+ * Different repositories are downloaded at the same time, but a repository is
+ * only downloaded by one thread at a time. Threads that need a repository that
+ * is already being downloaded wait for the download to finish.
+ */
+struct fetch_table;
+
+int fetch_table_create(struct fetch_table **);
+void fetch_table_destroy(struct fetch_table *);
+
+int fetch_begin(char const *);
+void fetch_end(char const *);
+
+/*
+ * Thread pool where the repositories are downloaded ahead of the validation.
+ * Unlike the validation pool's, its threads spend most of their time waiting
+ * on the network.
+ */
+int fetch_scheduler_init(void);
+int fetch_scheduler_push(char const *, thread_pool_task_cb, void *);
+void fetch_scheduler_wait(void);
+void fetch_scheduler_cleanup(void);
+
+#endif /* SRC_FETCH_SCHEDULER_H_ */
@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include "log.h"
 
 static int
@@ -117,6 +118,50 @@ file_free(struct file_contents *fc)
 	free(fc->buffer);
 }
 
+/*
+ * Like file_load(), except the contents are mapped rather than copied.
+ * The buffer is read-only. Release it with file_unmap().
+ */
+int
+file_map(char const *file_name, struct file_contents *fc)
+{
+	FILE *file;
+	struct stat stat;
+	void *map;
+	int error;
+
+	error = file_open(file_name, &file, &stat);
+	if (error)
+		return error;
+
+	fc->buffer_size = stat.st_size;
+	if (fc->buffer_size == 0) {
+		fc->buffer = NULL;
+		goto end;
+	}
+
+	map = mmap(NULL, fc->buffer_size, PROT_READ, MAP_PRIVATE,
+	    fileno(file), 0);
+	if (map == MAP_FAILED) {
+		error = errno;
+		pr_op_err("Could not map file '%s': %s", file_name,
+		    strerror(error));
+		goto end;
+	}
+	fc->buffer = map;
+
+end:
+	file_close(file);
+	return error;
+}
+
+void
+file_unmap(struct file_contents *fc)
+{
+	if (fc->buffer != NULL)
+		munmap(fc->buffer, fc->buffer_size);
+}
+
 /*
  * Validate @file_name, if it doesn't exist, this function will create it and
  * close it.
@@ -23,6 +23,9 @@ void file_close(FILE *);
 int file_load(char const *, struct file_contents *);
 void file_free(struct file_contents *);
 
+int file_map(char const *, struct file_contents *);
+void file_unmap(struct file_contents *);
+
 bool file_valid(char const *);
 
 #endif /* SRC_FILE_H_ */
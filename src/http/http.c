@@ -1,6 +1,10 @@
 #include "http.h"
 
+#include <sys/queue.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <curl/curl.h>
@@ -8,27 +12,319 @@
 #include "config.h"
 #include "file.h"
 #include "log.h"
+#include "crypto/hash.h"
+
+/*
+ * All the RRDP and TAL downloads are driven by a single curl multi handle,
+ * which lives in its own thread (the "HTTP thread"). Since the multi handle
+ * keeps the connection cache, consecutive requests to the same server (eg. the
+ * notification, snapshot and deltas of a RIR) reuse the connection, and
+ * concurrent requests are multiplexed through it if the server speaks HTTP/2.
+ * TLS sessions and DNS lookups are shared through a curl share handle.
+ *
+ * Requesting threads create and configure their own easy handles, and hand them
+ * over to the HTTP thread (transfer_start()). They get them back once the
+ * transfer finishes (transfer_wait()).
+ *
+ * Transfers are either written into a file, or streamed: the HTTP thread leaves
+ * the received bytes in a bounded buffer, and the requesting thread consumes
+ * them while the rest of the response arrives (http_stream_read()).
+ *
+ * A requesting thread can have several file transfers going at once (see
+ * http_download_start()). If asked to, the HTTP thread also hashes the files
+ * as they arrive, so the requester only has to compare the result.
+ */
 
 struct http_handler {
 	CURL *curl;
 	char errbuf[CURL_ERROR_SIZE];
 };
 
+struct write_callback_arg {
+	size_t total_bytes;
+	int error;
+	FILE *dst;
+	/* If not NULL, the received bytes are also fed to this hash. */
+	EVP_MD_CTX *hash;
+};
+
+/* A request that was handed over to the HTTP thread. */
+struct http_transfer {
+	struct http_handler handler;
+	struct write_callback_arg args;
+	/* Result of the transfer. Only meaningful once @done. */
+	CURLcode res;
+	bool done;
+	TAILQ_ENTRY(http_transfer) next;
+};
+
+TAILQ_HEAD(transfer_queue, http_transfer);
+
+/*
+ * How many received bytes a stream can hold before the transfer is paused.
+ * (Must be at least CURL_MAX_WRITE_SIZE.)
+ */
+#define STREAM_BUFFER_SIZE (16 * CURL_MAX_WRITE_SIZE)
+
+/* A transfer whose response is consumed while it's being received. */
+struct http_stream {
+	struct http_transfer transfer;
+
+	/* Received bytes are buffer[start, end). */
+	unsigned char *buffer;
+	size_t start;
+	size_t end;
+
+	/* The buffer filled up; curl is holding the rest of the data. */
+	bool paused;
+	/* The reader gave up; the rest of the response should be dropped. */
+	bool aborted;
+	TAILQ_ENTRY(http_stream) next;
+};
+
+TAILQ_HEAD(stream_queue, http_stream);
+
+static CURLM *multi;
+static CURLSH *share;
+static pthread_mutex_t share_lock;
+static pthread_t http_thread;
+
+/* Protects @pending, @resumed, @stop, and the transfers' and streams' state. */
+static pthread_mutex_t lock;
+/* Signaled whenever a transfer finishes, or a stream receives data. */
+static pthread_cond_t transfer_event;
+/* Transfers that haven't been added to @multi yet. */
+static struct transfer_queue pending;
+/* Paused streams whose reader made room for more data. */
+static struct stream_queue resumed;
+static bool stop;
+
+static void
+share_lock_cb(CURL *handle, curl_lock_data data, curl_lock_access access,
+    void *userptr)
+{
+	mutex_lock(&share_lock);
+}
+
+static void
+share_unlock_cb(CURL *handle, curl_lock_data data, void *userptr)
+{
+	mutex_unlock(&share_lock);
+}
+
+static void
+finish_transfer(CURL *curl, CURLcode res)
+{
+	struct http_transfer *transfer;
+	CURLcode error;
+
+	transfer = NULL;
+	error = curl_easy_getinfo(curl, CURLINFO_PRIVATE, &transfer);
+	if (error != CURLE_OK || transfer == NULL)
+		pr_crit("The curl handle lost its transfer.");
+
+	curl_multi_remove_handle(multi, curl);
+
+	mutex_lock(&lock);
+	transfer->res = res;
+	transfer->done = true;
+	pthread_cond_broadcast(&transfer_event);
+	mutex_unlock(&lock);
+}
+
+static void
+adopt_pending(void)
+{
+	struct http_transfer *transfer;
+	CURLMcode error;
+
+	while (!TAILQ_EMPTY(&pending)) {
+		transfer = TAILQ_FIRST(&pending);
+		TAILQ_REMOVE(&pending, transfer, next);
+
+		error = curl_multi_add_handle(multi, transfer->handler.curl);
+		if (error != CURLM_OK) {
+			pr_op_err("curl_multi_add_handle() returned %d: %s",
+			    error, curl_multi_strerror(error));
+			transfer->res = CURLE_FAILED_INIT;
+			transfer->done = true;
+			pthread_cond_broadcast(&transfer_event);
+		}
+	}
+}
+
+static void
+resume_streams(struct stream_queue *queue)
+{
+	struct http_stream *stream;
+	CURLcode error;
+
+	while (!TAILQ_EMPTY(queue)) {
+		stream = TAILQ_FIRST(queue);
+		TAILQ_REMOVE(queue, stream, next);
+
+		/*
+		 * This might call the write callback right away.
+		 * (If the stream was aborted, that's what fails it, and the
+		 * owner will find out through the transfer's result.)
+		 */
+		error = curl_easy_pause(stream->transfer.handler.curl,
+		    CURLPAUSE_CONT);
+		if (error != CURLE_OK && error != CURLE_WRITE_ERROR)
+			pr_op_err("curl_easy_pause() returned %d: %s", error,
+			    curl_easy_strerror(error));
+	}
+}
+
+static void *
+http_loop(void *arg)
+{
+	struct stream_queue to_resume;
+	CURLMsg *msg;
+	CURLMcode error;
+	int running;
+	int left;
+
+	TAILQ_INIT(&to_resume);
+
+	mutex_lock(&lock);
+	while (!stop) {
+		adopt_pending();
+		TAILQ_CONCAT(&to_resume, &resumed, next);
+		mutex_unlock(&lock);
+
+		/* Outside of the lock, since the write callback needs it */
+		resume_streams(&to_resume);
+
+		error = curl_multi_perform(multi, &running);
+		if (error != CURLM_OK)
+			pr_op_err("curl_multi_perform() returned %d: %s",
+			    error, curl_multi_strerror(error));
+
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL)
+			if (msg->msg == CURLMSG_DONE)
+				finish_transfer(msg->easy_handle,
+				    msg->data.result);
+
+		/* Sleeps until there's socket activity or a wakeup. */
+		error = curl_multi_poll(multi, NULL, 0, 1000, NULL);
+		if (error != CURLM_OK)
+			pr_op_err("curl_multi_poll() returned %d: %s",
+			    error, curl_multi_strerror(error));
+
+		mutex_lock(&lock);
+	}
+	mutex_unlock(&lock);
+
+	return NULL;
+}
+
+static int
+share_init(void)
+{
+	int error;
+
+	share = curl_share_init();
+	if (share == NULL)
+		return pr_enomem();
+
+	error = pthread_mutex_init(&share_lock, NULL);
+	if (error) {
+		pr_op_err("pthread_mutex_init() returned error %d: %s", error,
+		    strerror(error));
+		curl_share_cleanup(share);
+		return -error;
+	}
+
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock_cb);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock_cb);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	return 0;
+}
+
+static void
+share_cleanup(void)
+{
+	curl_share_cleanup(share);
+	pthread_mutex_destroy(&share_lock);
+}
+
 int
 http_init(void)
 {
 	CURLcode res;
+	int error;
+
 	res = curl_global_init(CURL_GLOBAL_SSL);
 	if (res != CURLE_OK)
 		return pr_op_err("Error initializing global curl (%s)",
 		    curl_easy_strerror(res));
 
+	error = share_init();
+	if (error)
+		goto revert_global;
+
+	multi = curl_multi_init();
+	if (multi == NULL) {
+		error = pr_enomem();
+		goto revert_share;
+	}
+	/* Multiplex over HTTP/2 whenever possible */
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+	TAILQ_INIT(&pending);
+	TAILQ_INIT(&resumed);
+	stop = false;
+
+	error = pthread_mutex_init(&lock, NULL);
+	if (error) {
+		pr_op_err("pthread_mutex_init() returned error %d: %s", error,
+		    strerror(error));
+		goto revert_multi;
+	}
+	error = pthread_cond_init(&transfer_event, NULL);
+	if (error) {
+		pr_op_err("pthread_cond_init() returned error %d: %s", error,
+		    strerror(error));
+		goto revert_lock;
+	}
+	error = pthread_create(&http_thread, NULL, http_loop, NULL);
+	if (error) {
+		pr_op_err("Could not spawn the HTTP thread: %s",
+		    strerror(error));
+		goto revert_cond;
+	}
+
 	return 0;
+
+revert_cond:
+	pthread_cond_destroy(&transfer_event);
+revert_lock:
+	pthread_mutex_destroy(&lock);
+revert_multi:
+	curl_multi_cleanup(multi);
+revert_share:
+	share_cleanup();
+revert_global:
+	curl_global_cleanup();
+	return ENSURE_NEGATIVE(error);
 }
 
 void
 http_cleanup(void)
 {
+	mutex_lock(&lock);
+	stop = true;
+	mutex_unlock(&lock);
+	curl_multi_wakeup(multi);
+	pthread_join(http_thread, NULL);
+
+	/* Nobody should be waiting on transfers by now. */
+	pthread_cond_destroy(&transfer_event);
+	pthread_mutex_destroy(&lock);
+	curl_multi_cleanup(multi);
+	share_cleanup();
 	curl_global_cleanup();
 }
 
@@ -59,12 +355,6 @@ setopt_long(CURL *curl, CURLoption opt, long value)
 	}
 }
 
-struct write_callback_arg {
-	size_t total_bytes;
-	int error;
-	FILE *dst;
-};
-
 static size_t
 write_callback(void *data, size_t size, size_t nmemb, void *userp)
 {
@@ -84,15 +374,21 @@ write_callback(void *data, size_t size, size_t nmemb, void *userp)
 		return 0; /* Ugh. See fwrite(3) */
 	}
 
+	if (arg->hash != NULL &&
+	    !EVP_DigestUpdate(arg->hash, data, size * nmemb)) {
+		arg->error = -EINVAL;
+		return 0;
+	}
+
 	return fwrite(data, size, nmemb, arg->dst);
 }
 
 static void
-setopt_writefunction(CURL *curl)
+setopt_writefunction(CURL *curl, size_t (*cb)(void *, size_t, size_t, void *))
 {
 	CURLcode result;
 
-	result = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+	result = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, cb);
 	if (result != CURLE_OK) {
 		fprintf(stderr, "curl_easy_setopt(%d) returned %d: %s\n",
 		    CURLOPT_WRITEFUNCTION, result, curl_easy_strerror(result));
@@ -132,7 +428,7 @@ http_easy_init(struct http_handler *handler)
 	    config_get_http_low_speed_time());
 	setopt_long(result, CURLOPT_MAXFILESIZE,
 	    config_get_http_max_file_size());
-	setopt_writefunction(result);
+	setopt_writefunction(result, write_callback);
 
 	/* Always expect HTTPS usage */
 	setopt_long(result, CURLOPT_SSL_VERIFYHOST, 2L);
@@ -220,37 +516,43 @@ handle_http_response_code(long http_code)
 	return -EINVAL; /* Do not retry */
 }
 
+/* Prepares @handler to fetch @uri into @file. */
+static void
+http_fetch_prepare(struct http_handler *handler, char const *uri,
+    struct write_callback_arg *args, FILE *file)
+{
+	handler->errbuf[0] = 0;
+	setopt_str(handler->curl, CURLOPT_URL, uri);
+
+	args->total_bytes = 0;
+	args->error = 0;
+	args->dst = file;
+	args->hash = NULL;
+	setopt_writedata(handler->curl, args);
+}
+
 /*
- * Fetch data from @uri and write result using @cb (which will receive @arg).
+ * Analyzes the outcome (@res) of the transfer of @uri, once @handler is done
+ * with it.
  */
 static int
-http_fetch(struct http_handler *handler, char const *uri, long *response_code,
-    long *cond_met, bool log_operation, FILE *file)
+http_fetch_result(struct http_handler *handler, char const *uri, CURLcode res,
+    struct write_callback_arg *args, long *response_code, long *cond_met,
+    bool log_operation)
 {
-	struct write_callback_arg args;
-	CURLcode res;
 	long http_code;
 	long unmet = 0;
+	int error;
 
-	handler->errbuf[0] = 0;
-	setopt_str(handler->curl, CURLOPT_URL, uri);
-
-	args.total_bytes = 0;
-	args.error = 0;
-	args.dst = file;
-	setopt_writedata(handler->curl, &args);
-
-	pr_val_info("HTTP GET: %s", uri);
-	res = curl_easy_perform(handler->curl);
-	pr_val_debug("Done. Total bytes transferred: %zu", args.total_bytes);
+	pr_val_debug("Done. Total bytes transferred: %zu", args->total_bytes);
 
-	args.error = validate_file_size(uri, &args);
-	if (args.error)
-		return args.error;
+	error = validate_file_size(uri, args);
+	if (error)
+		return error;
 
-	args.error = get_http_response_code(handler, &http_code, uri);
-	if (args.error)
-		return args.error;
+	error = get_http_response_code(handler, &http_code, uri);
+	if (error)
+		return error;
 	*response_code = http_code;
 
 	if (res != CURLE_OK) {
@@ -336,153 +638,439 @@ http_fetch(struct http_handler *handler, char const *uri, long *response_code,
 	return 0;
 }
 
+/*
+ * Fetches @uri into @file, blocking the calling thread (and without the
+ * HTTP thread's help).
+ */
+static int
+http_fetch(struct http_handler *handler, char const *uri, long *response_code,
+    long *cond_met, bool log_operation, FILE *file)
+{
+	struct write_callback_arg args;
+	CURLcode res;
+
+	http_fetch_prepare(handler, uri, &args, file);
+
+	pr_val_info("HTTP GET: %s", uri);
+	res = curl_easy_perform(handler->curl);
+
+	return http_fetch_result(handler, uri, res, &args, response_code,
+	    cond_met, log_operation);
+}
+
 static void
 http_easy_cleanup(struct http_handler *handler)
 {
 	curl_easy_cleanup(handler->curl);
 }
 
+static void
+setopt_ptr(CURL *curl, CURLoption opt, void *value)
+{
+	CURLcode result;
+
+	result = curl_easy_setopt(curl, opt, value);
+	if (result != CURLE_OK) {
+		fprintf(stderr, "curl_easy_setopt(%d) returned %d: %s\n",
+		    opt, result, curl_easy_strerror(result));
+	}
+}
+
+/*
+ * Hands @transfer over to the HTTP thread. Its handler has to be ready to fetch
+ * @uri already. (See http_fetch_prepare().)
+ */
+static void
+transfer_start(struct http_transfer *transfer, char const *uri)
+{
+	CURL *curl = transfer->handler.curl;
+
+	setopt_ptr(curl, CURLOPT_PRIVATE, transfer);
+	setopt_ptr(curl, CURLOPT_SHARE, share);
+	/* Prefer waiting for a multiplexable connection over opening another */
+	setopt_long(curl, CURLOPT_PIPEWAIT, 1L);
+
+	pr_val_info("HTTP GET: %s", uri);
+
+	mutex_lock(&lock);
+	transfer->done = false;
+	TAILQ_INSERT_TAIL(&pending, transfer, next);
+	mutex_unlock(&lock);
+
+	curl_multi_wakeup(multi);
+}
+
+static void
+wait_transfer_event(void)
+{
+	int error;
+
+	error = pthread_cond_wait(&transfer_event, &lock);
+	if (error)
+		pr_crit("pthread_cond_wait() returned error code %d.", error);
+}
+
+/* Waits until the HTTP thread is done with @transfer. */
+static void
+transfer_join(struct http_transfer *transfer)
+{
+	mutex_lock(&lock);
+	while (!transfer->done)
+		wait_transfer_event();
+	mutex_unlock(&lock);
+}
+
+/*
+ * Waits until the HTTP thread is done with @transfer, and analyzes the
+ * outcome.
+ */
 static int
-__http_download_file(struct rpki_uri *uri, long *response_code, long ims_value,
-    long *cond_met, bool log_operation)
+transfer_wait(struct http_transfer *transfer, char const *uri,
+    long *response_code, long *cond_met, bool log_operation)
 {
-	char const *tmp_suffix = "_tmp";
-	struct http_handler handler;
-	FILE *out;
-	unsigned int retries;
-	char const *original_file;
+	transfer_join(transfer);
+	return http_fetch_result(&transfer->handler, uri, transfer->res,
+	    &transfer->args, response_code, cond_met, log_operation);
+}
+
+/* A file being downloaded from an HTTPS URI into its local path. */
+struct http_download {
+	struct rpki_uri *uri;
+	/* If-Modified-Since value; 0 means the header won't be sent. */
+	long ims;
+	/* If not NULL, the file's expected SHA-256 hash. */
+	unsigned char const *hash;
+	size_t hash_len;
+	bool log_operation;
+	/* The download is written here, and renamed once it's complete. */
 	char *tmp_file;
+	/* NULL if HTTP is disabled. */
+	FILE *out;
+	struct http_transfer transfer;
+	/* The owner lost interest; the HTTP thread should drop the transfer. */
+	atomic_bool aborted;
+};
+
+/* Called periodically by the HTTP thread, even if no data is arriving. */
+static int
+download_progress_cb(void *userp, curl_off_t dltotal, curl_off_t dlnow,
+    curl_off_t ultotal, curl_off_t ulnow)
+{
+	struct http_download *download = userp;
+	return atomic_load(&download->aborted) ? 1 : 0; /* 1 aborts */
+}
+
+static void
+setopt_xferinfofunction(CURL *curl, curl_xferinfo_callback cb)
+{
+	CURLcode result;
+
+	result = curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, cb);
+	if (result != CURLE_OK) {
+		fprintf(stderr, "curl_easy_setopt(%d) returned %d: %s\n",
+		    CURLOPT_XFERINFOFUNCTION, result,
+		    curl_easy_strerror(result));
+	}
+}
+
+/* Prepares @download's handler for a (new) attempt. */
+static int
+download_prepare(struct http_download *download)
+{
+	struct write_callback_arg *args = &download->transfer.args;
 	int error;
 
-	retries = 0;
-	*cond_met = 1;
-	if (!config_get_http_enabled()) {
-		*response_code = 0; /* Not 200 code, but also not an error */
-		return 0;
+	http_fetch_prepare(&download->transfer.handler,
+	    uri_get_global(download->uri), args, download->out);
+
+	if (download->hash != NULL) {
+		/* The HTTP thread hashes the file while it arrives */
+		error = hash_stream_create("sha256", &args->hash);
+		if (error)
+			return error;
 	}
 
-	original_file = uri_get_local(uri);
+	return 0;
+}
 
-	tmp_file = malloc(strlen(original_file) + strlen(tmp_suffix) + 1);
-	if (tmp_file == NULL)
+static void
+download_release_hash(struct http_download *download)
+{
+	if (download->transfer.args.hash != NULL) {
+		hash_stream_destroy(download->transfer.args.hash);
+		download->transfer.args.hash = NULL;
+	}
+}
+
+static int
+__http_download_start(struct http_download *download)
+{
+	char const *tmp_suffix = "_tmp";
+	char const *original_file;
+	struct http_handler *handler;
+	int error;
+
+	original_file = uri_get_local(download->uri);
+
+	download->tmp_file = malloc(strlen(original_file) + strlen(tmp_suffix)
+	    + 1);
+	if (download->tmp_file == NULL)
 		return pr_enomem();
-	strcpy(tmp_file, original_file);
-	strcat(tmp_file, tmp_suffix);
+	strcpy(download->tmp_file, original_file);
+	strcat(download->tmp_file, tmp_suffix);
 
-	error = create_dir_recursive(tmp_file);
+	error = create_dir_recursive(download->tmp_file);
 	if (error)
 		goto release_tmp;
 
-	error = file_write(tmp_file, &out);
+	error = file_write(download->tmp_file, &download->out);
 	if (error)
 		goto delete_dir;
 
-	do {
-		error = http_easy_init(&handler);
-		if (error)
-			goto close_file;
+	handler = &download->transfer.handler;
+	error = http_easy_init(handler);
+	if (error)
+		goto close_file;
 
-		/* Set "If-Modified-Since" header only if a value is specified */
-		if (ims_value > 0) {
-			setopt_long(handler.curl, CURLOPT_TIMEVALUE, ims_value);
-			setopt_long(handler.curl, CURLOPT_TIMECONDITION,
-			    CURL_TIMECOND_IFMODSINCE);
+	/* Set "If-Modified-Since" header only if a value is specified */
+	if (download->ims > 0) {
+		setopt_long(handler->curl, CURLOPT_TIMEVALUE, download->ims);
+		setopt_long(handler->curl, CURLOPT_TIMECONDITION,
+		    CURL_TIMECOND_IFMODSINCE);
+	}
+
+	/* So http_download_abort() doesn't have to wait for the data */
+	atomic_init(&download->aborted, false);
+	setopt_xferinfofunction(handler->curl, download_progress_cb);
+	setopt_ptr(handler->curl, CURLOPT_XFERINFODATA, download);
+	setopt_long(handler->curl, CURLOPT_NOPROGRESS, 0L);
+
+	error = download_prepare(download);
+	if (error)
+		goto cleanup_handler;
+	transfer_start(&download->transfer, uri_get_global(download->uri));
+	return 0;
+
+cleanup_handler:
+	http_easy_cleanup(handler);
+close_file:
+	file_close(download->out);
+delete_dir:
+	delete_dir_recursive_bottom_up(download->tmp_file);
+release_tmp:
+	free(download->tmp_file);
+	return error;
+}
+
+static int
+download_start(struct rpki_uri *uri, long ims, unsigned char const *hash,
+    size_t hash_len, bool log_operation, struct http_download **result)
+{
+	struct http_download *download;
+	int error;
+
+	download = malloc(sizeof(struct http_download));
+	if (download == NULL)
+		return pr_enomem();
+
+	download->uri = uri;
+	uri_refget(uri);
+	download->ims = ims;
+	download->hash = hash;
+	download->hash_len = hash_len;
+	download->log_operation = log_operation;
+	download->tmp_file = NULL;
+	download->out = NULL;
+
+	if (config_get_http_enabled()) {
+		error = __http_download_start(download);
+		if (error) {
+			uri_refput(uri);
+			free(download);
+			return error;
 		}
-		error = http_fetch(&handler, uri_get_global(uri), response_code,
-		    cond_met, log_operation, out);
+	}
+
+	*result = download;
+	return 0;
+}
+
+/*
+ * Starts downloading global @uri into a local directory structure created from
+ * local @uri. Returns immediately; the download happens in the background.
+ *
+ * The HTTP request is made using the header 'If-Modified-Since' with a value
+ * of @ims (if @ims is 0, the header isn't set).
+ *
+ * Every successful call has to be paired with a http_download_finish() or a
+ * http_download_abort().
+ */
+int
+http_download_start(struct rpki_uri *uri, long ims, bool log_operation,
+    struct http_download **result)
+{
+	return download_start(uri, ims, NULL, 0, log_operation, result);
+}
+
+/*
+ * Same as http_download_start(), except the file is hashed while it arrives,
+ * and http_download_finish() will fail (without touching the local file) if it
+ * doesn't match the SHA-256 @hash. @hash has to outlive the download.
+ */
+int
+http_download_start_hashed(struct rpki_uri *uri, unsigned char const *hash,
+    size_t hash_len, bool log_operation, struct http_download **result)
+{
+	return download_start(uri, 0, hash, hash_len, log_operation, result);
+}
+
+static void
+http_download_destroy(struct http_download *download)
+{
+	uri_refput(download->uri);
+	free(download->tmp_file);
+	free(download);
+}
+
+/*
+ * Called after a request failed in a way that might be temporal. Returns true
+ * (after waiting the configured interval) if the request should be retried.
+ */
+static bool
+retry_after_failure(unsigned int *retries)
+{
+	if ((*retries) == config_get_http_retry_count()) {
+		if ((*retries) > 0)
+			pr_val_warn("Max HTTP retries (%u) reached. Won't retry again.",
+			    *retries);
+		return false;
+	}
+
+	pr_val_warn("Retrying HTTP request in %u seconds. %u attempts remaining.",
+	    config_get_http_retry_interval(),
+	    config_get_http_retry_count() - (*retries));
+	(*retries)++;
+	sleep(config_get_http_retry_interval());
+	return true;
+}
+
+static int
+__http_download_finish(struct http_download *download, long *response_code,
+    long *cond_met)
+{
+	char const *global;
+	char const *original_file;
+	unsigned int retries;
+	int error;
+
+	global = uri_get_global(download->uri);
+	original_file = uri_get_local(download->uri);
+	retries = 0;
+
+	do {
+		error = transfer_wait(&download->transfer, global,
+		    response_code, cond_met, download->log_operation);
 		if (error != EREQFAILED)
 			break; /* Note: Usually happy path */
+		if (!retry_after_failure(&retries))
+			break;
 
-		if (retries == config_get_http_retry_count()) {
-			if (retries > 0)
-				pr_val_warn("Max HTTP retries (%u) reached. Won't retry again.",
-				    retries);
+		/* Drop whatever the failed attempt wrote */
+		rewind(download->out);
+		if (ftruncate(fileno(download->out), 0) != 0) {
+			error = errno;
+			pr_val_err("Could not truncate '%s': %s",
+			    download->tmp_file, strerror(error));
 			break;
 		}
-		pr_val_warn("Retrying HTTP request in %u seconds. %u attempts remaining.",
-		    config_get_http_retry_interval(),
-		    config_get_http_retry_count() - retries);
-		retries++;
-		http_easy_cleanup(&handler);
-		sleep(config_get_http_retry_interval());
+		download_release_hash(download);
+		error = download_prepare(download);
+		if (error)
+			break;
+		transfer_start(&download->transfer, global);
 	} while (true);
 
-	http_easy_cleanup(&handler);
-	file_close(out);
+	http_easy_cleanup(&download->transfer.handler);
+	file_close(download->out);
 
-	if ((*response_code) == 304)
-		goto end;
 	if (error)
-		goto delete_dir;
+		goto delete_tmp;
+	if ((*response_code) == 304) {
+		download_release_hash(download);
+		delete_dir_recursive_bottom_up(download->tmp_file);
+		return 0;
+	}
+
+	if (download->hash != NULL) {
+		error = hash_stream_validate(download->transfer.args.hash,
+		    download->hash, download->hash_len);
+		if (error) {
+			error = pr_val_err("File '%s' does not match its expected hash.",
+			    uri_val_get_printable(download->uri));
+			goto delete_tmp;
+		}
+		download_release_hash(download);
+	}
 
 	/* Overwrite the original file */
-	error = rename(tmp_file, original_file);
+	error = rename(download->tmp_file, original_file);
 	if (error) {
 		error = errno;
 		pr_val_err("Renaming temporal file from '%s' to '%s': %s",
-		    tmp_file, original_file, strerror(error));
-		goto delete_dir;
+		    download->tmp_file, original_file, strerror(error));
+		delete_dir_recursive_bottom_up(download->tmp_file);
+		return -error;
 	}
 
-end:
-	free(tmp_file);
 	return 0;
-close_file:
-	file_close(out);
-delete_dir:
-	delete_dir_recursive_bottom_up(tmp_file);
-release_tmp:
-	free(tmp_file);
-	return ENSURE_NEGATIVE(error);
-}
 
-/*
- * Try to download from global @uri into a local directory structure created
- * from local @uri.
- *
- * Return values: 0 on success, negative value on error, EREQFAILED if the
- * request to the server failed.
- */
-int
-http_download_file(struct rpki_uri *uri, bool log_operation)
-{
-	long response;
-	long cond_met;
-	return __http_download_file(uri, &response, 0, &cond_met,
-	    log_operation);
+delete_tmp:
+	download_release_hash(download);
+	delete_dir_recursive_bottom_up(download->tmp_file);
+	return ENSURE_NEGATIVE(error);
 }
 
 /*
- * Fetch the file from @uri.
- *
- * The HTTP request is made using the header 'If-Modified-Since' with a value
- * of @value (if @value is 0, the header isn't set).
+ * Waits for @download to finish, and releases it.
  *
  * Returns:
- *   EREQFAILED the request to the server has failed.
+ *   -EREQFAILED the request to the server has failed.
  *   > 0 file was requested but wasn't downloaded since the server didn't sent
  *       a response due to its policy using the header 'If-Modified-Since'.
  *   = 0 file successfully downloaded.
  *   < 0 an actual error happened.
  */
 int
-http_download_file_with_ims(struct rpki_uri *uri, long value,
-    bool log_operation)
+http_download_finish(struct http_download *download)
 {
+	struct http_download *retry;
 	long response;
 	long cond_met;
 	int error;
 
-	error = __http_download_file(uri, &response, value, &cond_met,
-	    log_operation);
-	if (error)
+	if (download->out == NULL) {
+		/* HTTP is disabled. Not 200 code, but also not an error */
+		error = 0;
+		if (download->hash != NULL)
+			error = hash_validate_file("sha256", download->uri,
+			    download->hash, download->hash_len);
+		http_download_destroy(download);
 		return error;
+	}
+
+	response = 0;
+	cond_met = 1;
+	error = __http_download_finish(download, &response, &cond_met);
+	if (error)
+		goto end;
 
 	/* rfc7232#section-3.3:
 	 * "the origin server SHOULD generate a 304 (Not Modified) response"
 	 */
-	if (response == 304)
-		return 1;
+	if (response == 304) {
+		error = 1;
+		goto end;
+	}
 
 	/*
 	 * Got another HTTP response code (OK or error).
@@ -491,7 +1079,7 @@ http_download_file_with_ims(struct rpki_uri *uri, long value,
 	 * 'true'), if it wasn't, then do a regular request (no time condition).
 	 */
 	if (cond_met)
-		return 0;
+		goto end;
 
 	/*
 	 * Situation:
@@ -503,10 +1091,282 @@ http_download_file_with_ims(struct rpki_uri *uri, long value,
 	 *
 	 * libcurl wrote an empty file, so we have to redownload.
 	 */
+	error = download_start(download->uri, 0, download->hash,
+	    download->hash_len, download->log_operation, &retry);
+	if (error)
+		goto end;
+	error = http_download_finish(retry);
+
+end:
+	http_download_destroy(download);
+	return error;
+}
 
-	return __http_download_file(uri, &response, 0, &cond_met,
-	    log_operation);
+/*
+ * Cancels @download (without retries), drops whatever it managed to write, and
+ * releases it. The local file is left alone.
+ */
+void
+http_download_abort(struct http_download *download)
+{
+	if (download->out != NULL) {
+		atomic_store(&download->aborted, true);
+		curl_multi_wakeup(multi);
+		transfer_join(&download->transfer);
+
+		http_easy_cleanup(&download->transfer.handler);
+		file_close(download->out);
+		download_release_hash(download);
+		delete_dir_recursive_bottom_up(download->tmp_file);
+	}
 
+	http_download_destroy(download);
+}
+
+/*
+ * Download from global @uri into a local directory structure created from
+ * local @uri, blocking the calling thread until it's done.
+ *
+ * Return values: 0 on success, negative value on error, -EREQFAILED if the
+ * request to the server failed.
+ */
+int
+http_download_file(struct rpki_uri *uri, bool log_operation)
+{
+	struct http_download *download;
+	int error;
+
+	error = http_download_start(uri, 0, log_operation, &download);
+	if (error)
+		return error;
+
+	return http_download_finish(download);
+}
+
+static size_t
+stream_write_callback(void *data, size_t size, size_t nmemb, void *userp)
+{
+	struct http_stream *stream = userp;
+	struct write_callback_arg *args = &stream->transfer.args;
+	size_t len = size * nmemb;
+	size_t result;
+
+	mutex_lock(&lock);
+
+	if (stream->aborted) {
+		result = 0; /* Abort the transfer */
+		goto end;
+	}
+
+	if (args->total_bytes + len > config_get_http_max_file_size()) {
+		/* Same as write_callback() */
+		args->total_bytes += len;
+		args->error = -EFBIG;
+		result = 0;
+		goto end;
+	}
+
+	if (len > STREAM_BUFFER_SIZE - stream->end) {
+		if (len > STREAM_BUFFER_SIZE - (stream->end - stream->start)) {
+			/* Wait until the reader makes room */
+			stream->paused = true;
+			result = CURL_WRITEFUNC_PAUSE;
+			goto end;
+		}
+		memmove(stream->buffer, stream->buffer + stream->start,
+		    stream->end - stream->start);
+		stream->end -= stream->start;
+		stream->start = 0;
+	}
+
+	memcpy(stream->buffer + stream->end, data, len);
+	stream->end += len;
+	args->total_bytes += len;
+	pthread_cond_broadcast(&transfer_event);
+	result = len;
+
+end:
+	mutex_unlock(&lock);
+	return result;
+}
+
+/* Asks the HTTP thread to resume @stream. Call with the lock held. */
+static void
+stream_resume(struct http_stream *stream)
+{
+	/* (A transfer can finish while paused; eg. if it times out.) */
+	if (!stream->paused || stream->transfer.done)
+		return;
+
+	stream->paused = false;
+	TAILQ_INSERT_TAIL(&resumed, stream, next);
+	curl_multi_wakeup(multi);
+}
+
+static int
+stream_start(struct http_stream *stream, char const *uri)
+{
+	CURL *curl;
+	int error;
+
+	error = http_easy_init(&stream->transfer.handler);
+	if (error)
+		return error;
+	curl = stream->transfer.handler.curl;
+
+	http_fetch_prepare(&stream->transfer.handler, uri,
+	    &stream->transfer.args, NULL);
+	setopt_writefunction(curl, stream_write_callback);
+	setopt_ptr(curl, CURLOPT_WRITEDATA, stream);
+
+	stream->start = 0;
+	stream->end = 0;
+	stream->paused = false;
+	stream->aborted = false;
+
+	transfer_start(&stream->transfer, uri);
+	return 0;
+}
+
+/*
+ * Makes sure the HTTP thread won't touch @stream anymore, so it can be released.
+ * Call once the transfer is done.
+ *
+ * (By then, the HTTP thread has already resumed the streams it took from
+ * @resumed, but @stream might have been queued after that.)
+ */
+static void
+stream_forget(struct http_stream *stream)
+{
+	struct http_stream *cursor;
+
+	mutex_lock(&lock);
+	TAILQ_FOREACH(cursor, &resumed, next) {
+		if (cursor == stream) {
+			TAILQ_REMOVE(&resumed, stream, next);
+			break;
+		}
+	}
+	mutex_unlock(&lock);
+}
+
+/* Drops the rest of @stream's response. */
+static void
+stream_abort(struct http_stream *stream)
+{
+	mutex_lock(&lock);
+	stream->aborted = true;
+	/* The write callback has to run once more to notice */
+	stream_resume(stream);
+	mutex_unlock(&lock);
+}
+
+/*
+ * Reads up to @size bytes from @stream into @buffer, waiting for them to arrive
+ * if necessary. Meant to be called from http_stream()'s callback.
+ *
+ * Returns the number of bytes read, 0 if the response is over, and a negative
+ * value if the transfer failed. (In which case, http_stream() will report the
+ * reason.)
+ */
+int
+http_stream_read(struct http_stream *stream, unsigned char *buffer,
+    size_t size)
+{
+	size_t available;
+	int result;
+
+	if (size > INT_MAX)
+		size = INT_MAX;
+
+	mutex_lock(&lock);
+
+	while (stream->start == stream->end && !stream->transfer.done)
+		wait_transfer_event();
+
+	available = stream->end - stream->start;
+	if (available == 0) {
+		result = (stream->transfer.res == CURLE_OK) ? 0 : -EIO;
+		goto end;
+	}
+
+	if (size > available)
+		size = available;
+	memcpy(buffer, stream->buffer + stream->start, size);
+	stream->start += size;
+	if (stream->start == stream->end)
+		stream->start = stream->end = 0;
+
+	stream_resume(stream);
+	result = size;
+
+end:
+	mutex_unlock(&lock);
+	return result;
+}
+
+/*
+ * Downloads @uri, feeding the response to @cb (which will receive @arg as
+ * argument) as it arrives. Nothing is written to the disk. @cb is expected to
+ * pull the data with http_stream_read().
+ *
+ * If the request fails before @cb is done, the error is reported here, and
+ * might result in a retry. Therefore, @cb might be called more than once; each
+ * call needs to start from scratch.
+ *
+ * Returns 0 on success, the error returned by @cb, or (if the request failed)
+ * a negative value. (-EREQFAILED if the request to the server failed.)
+ */
+int
+http_stream(struct rpki_uri *uri, bool log_operation, http_stream_cb cb,
+    void *arg)
+{
+	struct http_stream stream;
+	char const *global;
+	unsigned int retries;
+	long response_code;
+	long cond_met;
+	int cb_error;
+	int error;
+
+	global = uri_get_global(uri);
+	cb_error = 0;
+	retries = 0;
+
+	stream.buffer = malloc(STREAM_BUFFER_SIZE);
+	if (stream.buffer == NULL)
+		return pr_enomem();
+
+	do {
+		error = stream_start(&stream, global);
+		if (error)
+			break;
+
+		cb_error = cb(&stream, arg);
+		if (cb_error)
+			stream_abort(&stream);
+		transfer_join(&stream.transfer);
+		stream_forget(&stream);
+
+		if (stream.aborted && stream.transfer.res == CURLE_WRITE_ERROR
+		    && stream.transfer.args.error == 0)
+			error = 0; /* We cut it ourselves; report @cb's error */
+		else
+			error = transfer_wait(&stream.transfer, global,
+			    &response_code, &cond_met, log_operation);
+		http_easy_cleanup(&stream.transfer.handler);
+
+		if (error != EREQFAILED)
+			break;
+		if (!retry_after_failure(&retries))
+			break;
+	} while (true);
+
+	free(stream.buffer);
+
+	if (error)
+		return ENSURE_NEGATIVE(error);
+	return cb_error;
 }
 
 /*
@@ -9,8 +9,22 @@
 int http_init(void);
 void http_cleanup(void);
 
+struct http_download;
+
+int http_download_start(struct rpki_uri *, long, bool,
+    struct http_download **);
+int http_download_start_hashed(struct rpki_uri *, unsigned char const *,
+    size_t, bool, struct http_download **);
+int http_download_finish(struct http_download *);
+void http_download_abort(struct http_download *);
+
 int http_download_file(struct rpki_uri *, bool);
-int http_download_file_with_ims(struct rpki_uri *, long, bool);
+
+struct http_stream;
+typedef int (*http_stream_cb)(struct http_stream *, void *);
+
+int http_stream(struct rpki_uri *, bool, http_stream_cb, void *);
+int http_stream_read(struct http_stream *, unsigned char *, size_t);
 
 int http_direct_download(char const *, char const *);
 
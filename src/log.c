@@ -4,7 +4,9 @@
 #include <openssl/bio.h>
 #include <openssl/err.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
@@ -51,6 +53,66 @@ static struct log_config val_config;
  */
 static pthread_mutex_t logck;
 
+/*
+ * Asynchronous logging.
+ *
+ * Once log_start_writer() is called, the pr_* functions stop writing messages
+ * themselves. Each thread formats its messages into a ring of records of its
+ * own, and a dedicated writer thread drains the rings, writing the records in
+ * batches. Each ring has a single producer (its thread) and a single consumer
+ * (the writer), so it doesn't need locks.
+ *
+ * Memory is bounded: when a ring is full, debug and info messages are dropped
+ * (and counted), while warnings and errors wait for the writer.
+ *
+ * Messages from different threads are not necessarily written in the order
+ * they were logged. Stack traces, pr_enomem() and everything logged while the
+ * writer is not running are written synchronously, as before.
+ */
+
+/* Records per ring. Must be a power of two. */
+#define RING_SIZE 256
+/* Messages longer than this are allocated separately. */
+#define RECORD_TEXT_SIZE 512
+
+struct log_record {
+	int level;
+	struct log_config *cfg;
+	time_t time;
+	/* The message, if it didn't fit in @text. */
+	char *long_text;
+	char text[RECORD_TEXT_SIZE];
+};
+
+struct log_ring {
+	struct log_record records[RING_SIZE];
+	/* Index of the next record the writer will read. */
+	atomic_uint head;
+	/* Index of the next record the thread will write. */
+	atomic_uint tail;
+	/* Messages that didn't fit since the writer last checked. */
+	atomic_ulong dropped;
+	/* The thread died; free the ring once it's drained. */
+	atomic_bool orphan;
+
+	struct log_ring *next; /* Protected by @rings_lock. */
+};
+
+static struct log_ring *rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+
+static pthread_t writer_thread;
+static atomic_bool writer_running;
+/* Protects the rest of the writer's state. */
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t flushed_cond = PTHREAD_COND_INITIALIZER;
+static atomic_bool writer_sleeping;
+static bool writer_stop;
+static unsigned long flush_requested;
+static unsigned long flush_done;
+
 /**
  * Important: -rdynamic needs to be enabled, otherwise this does not print
  * function names. See LDFLAGS_DEBUG in Makefile.am.
@@ -305,21 +367,6 @@ log_start(void)
 	val_config.facility = config_get_val_log_facility();
 }
 
-void
-log_teardown(void)
-{
-	log_disable_syslog();
-	pthread_mutex_destroy(&logck);
-}
-
-void
-log_flush(void)
-{
-	if (op_config.fprintf_enabled || val_config.fprintf_enabled) {
-		fflush(stdout);
-		fflush(stderr);
-	}
-}
 
 bool
 log_val_enabled(unsigned int level)
@@ -353,11 +400,11 @@ level2struct(int level)
 }
 
 static void
-lock_mutex(void)
+lock_mutex(pthread_mutex_t *lock)
 {
 	int error;
 
-	error = pthread_mutex_lock(&logck);
+	error = pthread_mutex_lock(lock);
 	if (error) {
 		/*
 		 * Despite being supposed to be impossible, failing to lock the
@@ -373,93 +420,446 @@ lock_mutex(void)
 }
 
 static void
-unlock_mutex(void)
+unlock_mutex(pthread_mutex_t *lock)
 {
 	int error;
 
-	error = pthread_mutex_unlock(&logck);
+	error = pthread_mutex_unlock(lock);
 	if (error)
 		print_stack_trace(strerror(error)); /* Same as above. */
 }
 
+/* Fills @record with everything but the time and the message itself. */
+static int
+format_header(struct log_record *record, int level, struct log_config *cfg,
+    char *buf, size_t size)
+{
+	char const *file_name;
+
+	record->level = level;
+	record->cfg = cfg;
+	file_name = fnstack_peek();
+
+	return snprintf(buf, size, "%s%s%s%s: %s%s",
+	    level2struct(level)->label,
+	    (cfg->prefix != NULL) ? " [" : "",
+	    (cfg->prefix != NULL) ? cfg->prefix : "",
+	    (cfg->prefix != NULL) ? "]" : "",
+	    (file_name != NULL) ? file_name : "",
+	    (file_name != NULL) ? ": " : "");
+}
+
+/*
+ * Formats "LVL [prefix]: file: message" into @record.
+ * If it doesn't fit in the record, tries to allocate it. If that fails, the
+ * message is truncated.
+ */
 static void
-__vfprintf(int level, struct log_config *cfg, char const *format, va_list args)
+format_record(struct log_record *record, int level, struct log_config *cfg,
+    char const *format, va_list args)
 {
-	char time_buff[20];
+	va_list copy;
+	int header_len;
+	int len;
+
+	record->time = time(NULL);
+	record->long_text = NULL;
+
+	va_copy(copy, args);
+	header_len = format_header(record, level, cfg, record->text,
+	    RECORD_TEXT_SIZE);
+	if (header_len < 0 || header_len >= RECORD_TEXT_SIZE)
+		goto end;
+	len = vsnprintf(record->text + header_len,
+	    RECORD_TEXT_SIZE - header_len, format, args);
+	if (len < 0 || header_len + len < RECORD_TEXT_SIZE)
+		goto end;
+
+	record->long_text = malloc(header_len + len + 1);
+	if (record->long_text == NULL)
+		goto end;
+	memcpy(record->long_text, record->text, header_len);
+	vsnprintf(record->long_text + header_len, len + 1, format, copy);
+
+end:
+	va_end(copy);
+}
+
+/* Call with @logck locked. */
+static void
+write_record(struct log_record const *record)
+{
+	struct log_config const *cfg = record->cfg;
 	struct level const *lvl;
-	time_t now;
+	char const *text;
+	char time_buff[20];
 	struct tm stm_buff;
-	char const *file_name;
 
-	lvl = level2struct(level);
+	text = (record->long_text != NULL) ? record->long_text : record->text;
 
-	lock_mutex();
+	/* Can't use vsyslog(); it's not portable. */
+	if (cfg->syslog_enabled)
+		syslog(record->level | cfg->facility, "%s", text);
+
+	if (cfg->fprintf_enabled) {
+		lvl = level2struct(record->level);
+		/* Don't mix lines if both streams go to the same file */
+		if (lvl->stream != stdout)
+			fflush(stdout);
+		if (cfg->color)
+			fprintf(lvl->stream, "%s", lvl->color);
+		if (record->time != ((time_t) -1)) {
+			localtime_r(&record->time, &stm_buff);
+			strftime(time_buff, sizeof(time_buff), "%b %e %T",
+			    &stm_buff);
+			fprintf(lvl->stream, "%s ", time_buff);
+		}
+		fprintf(lvl->stream, "%s", text);
+		if (cfg->color)
+			fprintf(lvl->stream, COLOR_RESET);
+		fprintf(lvl->stream, "\n");
+	}
+}
 
-	if (cfg->color)
-		fprintf(lvl->stream, "%s", lvl->color);
+static void
+release_ring(void *ring)
+{
+	atomic_store(&((struct log_ring *) ring)->orphan, true);
+}
 
-	now = time(0);
-	if (now != ((time_t) -1)) {
-		localtime_r(&now, &stm_buff);
-		strftime(time_buff, sizeof(time_buff), "%b %e %T", &stm_buff);
-		fprintf(lvl->stream, "%s ", time_buff);
+static struct log_ring *
+get_ring(void)
+{
+	struct log_ring *ring;
+
+	ring = pthread_getspecific(ring_key);
+	if (ring != NULL)
+		return ring;
+
+	ring = calloc(1, sizeof(struct log_ring));
+	if (ring == NULL)
+		return NULL;
+	if (pthread_setspecific(ring_key, ring) != 0) {
+		free(ring);
+		return NULL;
 	}
 
-	fprintf(lvl->stream, "%s", lvl->label);
-	if (cfg->prefix)
-		fprintf(lvl->stream, " [%s]", cfg->prefix);
-	fprintf(lvl->stream, ": ");
+	lock_mutex(&rings_lock);
+	ring->next = rings;
+	rings = ring;
+	unlock_mutex(&rings_lock);
 
-	file_name = fnstack_peek();
-	if (file_name != NULL)
-		fprintf(lvl->stream, "%s: ", file_name);
+	return ring;
+}
 
-	vfprintf(lvl->stream, format, args);
+static void
+wake_writer(void)
+{
+	if (atomic_load(&writer_sleeping)) {
+		lock_mutex(&writer_lock);
+		pthread_cond_signal(&writer_cond);
+		unlock_mutex(&writer_lock);
+	}
+}
 
-	if (cfg->color)
-		fprintf(lvl->stream, COLOR_RESET);
-	fprintf(lvl->stream, "\n");
+/*
+ * Queues the message for the writer.
+ * Returns false if the caller should write it by itself.
+ */
+static bool
+enqueue(int level, struct log_config *cfg, char const *format, va_list args)
+{
+	struct log_ring *ring;
+	unsigned int tail;
+
+	if (!atomic_load(&writer_running))
+		return false;
+	ring = get_ring();
+	if (ring == NULL)
+		return false;
+
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	while (tail - atomic_load(&ring->head) >= RING_SIZE) {
+		if (level > LOG_WARNING) {
+			atomic_fetch_add(&ring->dropped, 1);
+			return true;
+		}
+		if (!atomic_load(&writer_running))
+			return false;
+		lock_mutex(&writer_lock);
+		pthread_cond_signal(&writer_cond);
+		unlock_mutex(&writer_lock);
+		sched_yield();
+	}
+
+	format_record(&ring->records[tail & (RING_SIZE - 1)], level, cfg,
+	    format, args);
+	atomic_store(&ring->tail, tail + 1);
+
+	wake_writer();
+	return true;
+}
+
+static void
+__log(int level, struct log_config *cfg, char const *format, va_list args)
+{
+	struct log_record record;
+	va_list copy;
+	bool queued;
+
+	va_copy(copy, args);
+	queued = enqueue(level, cfg, format, copy);
+	va_end(copy);
+	if (queued)
+		return;
 
+	format_record(&record, level, cfg, format, args);
+
+	lock_mutex(&logck);
+	write_record(&record);
 	/* Force flush */
-	if (lvl->stream == stdout)
-		fflush(lvl->stream);
+	if (cfg->fprintf_enabled && level2struct(level)->stream == stdout)
+		fflush(stdout);
+	unlock_mutex(&logck);
+
+	free(record.long_text);
+}
+
+static void
+report_dropped(unsigned long dropped)
+{
+	struct log_record record;
+
+	if (LOG_WARNING > op_config.level)
+		return;
+
+	record.time = time(NULL);
+	record.long_text = NULL;
+	snprintf(record.text, RECORD_TEXT_SIZE,
+	    "%s: %lu log messages were dropped; the log writer could not keep up.",
+	    WRN.label, dropped);
+	record.level = LOG_WARNING;
+	record.cfg = &op_config;
+	write_record(&record);
+}
+
+/*
+ * Writes everything the rings contain, and frees the rings of the dead
+ * threads. Returns whether anything was written.
+ */
+static bool
+drain_rings(void)
+{
+	struct log_ring **prev;
+	struct log_ring *ring;
+	struct log_record *record;
+	unsigned int head, tail;
+	unsigned long dropped;
+	bool orphan;
+	bool written;
+
+	written = false;
+
+	lock_mutex(&rings_lock);
+	lock_mutex(&logck);
+
+	prev = &rings;
+	while ((ring = *prev) != NULL) {
+		/* (Check first; an orphan's tail no longer moves.) */
+		orphan = atomic_load(&ring->orphan);
+		head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+		tail = atomic_load(&ring->tail);
+
+		for (; head != tail; head++) {
+			record = &ring->records[head & (RING_SIZE - 1)];
+			write_record(record);
+			free(record->long_text);
+			written = true;
+		}
+		atomic_store(&ring->head, head);
+
+		dropped = atomic_exchange(&ring->dropped, 0);
+		if (dropped > 0) {
+			report_dropped(dropped);
+			written = true;
+		}
+
+		if (orphan) {
+			*prev = ring->next;
+			free(ring);
+		} else {
+			prev = &ring->next;
+		}
+	}
+
+	if (written && (op_config.fprintf_enabled || val_config.fprintf_enabled)) {
+		fflush(stdout);
+		fflush(stderr);
+	}
 
-	unlock_mutex();
+	unlock_mutex(&logck);
+	unlock_mutex(&rings_lock);
+	return written;
 }
 
-#define MSG_LEN 1024
+static bool
+rings_pending(void)
+{
+	struct log_ring *ring;
+	bool pending;
+
+	pending = false;
 
+	lock_mutex(&rings_lock);
+	for (ring = rings; ring != NULL; ring = ring->next) {
+		if (atomic_load(&ring->head) != atomic_load(&ring->tail)
+		    || atomic_load(&ring->dropped) != 0) {
+			pending = true;
+			break;
+		}
+	}
+	unlock_mutex(&rings_lock);
+
+	return pending;
+}
+
+static void *
+writer_loop(void *arg)
+{
+	unsigned long requested;
+	bool stop;
+
+	do {
+		lock_mutex(&writer_lock);
+		requested = flush_requested;
+		stop = writer_stop;
+		unlock_mutex(&writer_lock);
+
+		while (drain_rings())
+			;
+
+		lock_mutex(&writer_lock);
+		flush_done = requested;
+		pthread_cond_broadcast(&flushed_cond);
+		if (!writer_stop && flush_requested == requested) {
+			/*
+			 * The threads check @writer_sleeping after queuing, so
+			 * either they see it, or we see their records.
+			 */
+			atomic_store(&writer_sleeping, true);
+			if (!rings_pending())
+				pthread_cond_wait(&writer_cond, &writer_lock);
+			atomic_store(&writer_sleeping, false);
+		}
+		unlock_mutex(&writer_lock);
+	} while (!stop);
+
+	return NULL;
+}
+
+/* The writer doesn't survive fork()s. */
 static void
-__syslog(int level, struct log_config *cfg, const char *format, va_list args)
+stop_writer_in_child(void)
 {
-	static char msg[MSG_LEN];
-	char const *file_name;
-	struct level const *lvl;
+	atomic_store(&writer_running, false);
+}
 
-	file_name = fnstack_peek();
-	lvl = level2struct(level);
+/*
+ * Starts the asynchronous log writer. (See the comment at the top.)
+ *
+ * Call after log_start(), once the process won't fork to daemonize anymore.
+ */
+int
+log_start_writer(void)
+{
+	int error;
 
-	lock_mutex();
+	error = pthread_key_create(&ring_key, release_ring);
+	if (error) {
+		pr_op_err("pthread_key_create() returned error %d: %s", error,
+		    strerror(error));
+		return -error;
+	}
 
-	/* Can't use vsyslog(); it's not portable. */
-	vsnprintf(msg, MSG_LEN, format, args);
-	if (file_name != NULL) {
-		if (cfg->prefix != NULL)
-			syslog(level | cfg->facility, "%s [%s]: %s: %s",
-			    lvl->label, cfg->prefix, file_name, msg);
-		else
-			syslog(level | cfg->facility, "%s: %s: %s",
-			    lvl->label, file_name, msg);
-	} else {
-		if (cfg->prefix != NULL)
-			syslog(level | cfg->facility, "%s [%s]: %s",
-			    lvl->label, cfg->prefix, msg);
-		else
-			syslog(level | cfg->facility, "%s: %s",
-			    lvl->label, msg);
+	error = pthread_atfork(NULL, NULL, stop_writer_in_child);
+	if (error) {
+		pr_op_err("pthread_atfork() returned error %d: %s", error,
+		    strerror(error));
+		goto delete_key;
+	}
+
+	writer_stop = false;
+	error = pthread_create(&writer_thread, NULL, writer_loop, NULL);
+	if (error) {
+		pr_op_err("Could not spawn the log writer thread: %s",
+		    strerror(error));
+		goto delete_key;
 	}
 
-	unlock_mutex();
+	atomic_store(&writer_running, true);
+	return 0;
+
+delete_key:
+	pthread_key_delete(ring_key);
+	return -error;
+}
+
+static void
+stop_writer(void)
+{
+	struct log_ring *ring;
+
+	if (!atomic_load(&writer_running))
+		return;
+
+	/* From now on, the threads write by themselves. */
+	atomic_store(&writer_running, false);
+
+	lock_mutex(&writer_lock);
+	writer_stop = true;
+	pthread_cond_signal(&writer_cond);
+	unlock_mutex(&writer_lock);
+	pthread_join(writer_thread, NULL);
+
+	/* Leftovers from threads that were mid-enqueue */
+	drain_rings();
+
+	while (rings != NULL) {
+		ring = rings;
+		rings = ring->next;
+		free(ring);
+	}
+	pthread_key_delete(ring_key);
+}
+
+void
+log_teardown(void)
+{
+	stop_writer();
+	log_disable_syslog();
+	pthread_mutex_destroy(&logck);
+}
+
+/* Waits until the writer has written everything queued so far, if running. */
+void
+log_flush(void)
+{
+	unsigned long ticket;
+
+	if (atomic_load(&writer_running)) {
+		lock_mutex(&writer_lock);
+		ticket = ++flush_requested;
+		pthread_cond_signal(&writer_cond);
+		while (flush_done < ticket && atomic_load(&writer_running))
+			pthread_cond_wait(&flushed_cond, &writer_lock);
+		unlock_mutex(&writer_lock);
+		return;
+	}
+
+	if (op_config.fprintf_enabled || val_config.fprintf_enabled) {
+		fflush(stdout);
+		fflush(stderr);
+	}
 }
 
 #define PR_SIMPLE(lvl, config)						\
@@ -467,19 +867,13 @@ __syslog(int level, struct log_config *cfg, const char *format, va_list args)
 		va_list args;						\
 									\
 		if (lvl > config.level)					\
+			break;						\
+		if (!config.syslog_enabled && !config.fprintf_enabled)	\
 			break;						\
 									\
-		if (config.syslog_enabled) {				\
-			va_start(args, format);				\
-			__syslog(lvl, &config, format, args);		\
-			va_end(args);					\
-		}							\
-									\
-		if (config.fprintf_enabled) {				\
-			va_start(args, format);				\
-			__vfprintf(lvl, &config, format, args);		\
-			va_end(args);					\
-		}							\
+		va_start(args, format);					\
+		__log(lvl, &config, format, args);			\
+		va_end(args);						\
 	} while (0)
 
 void
@@ -509,9 +903,10 @@ int
 pr_op_err(const char *format, ...)
 {
 	PR_SIMPLE(LOG_ERR, op_config);
-	lock_mutex();
+	log_flush(); /* The trace goes after the message */
+	lock_mutex(&logck);
 	print_stack_trace(NULL);
-	unlock_mutex();
+	unlock_mutex(&logck);
 	return -EINVAL;
 }
 
@@ -630,21 +1025,21 @@ pr_enomem(void)
 		return -ENOMEM;
 
 	if (op_config.fprintf_enabled) {
-		lock_mutex();
+		lock_mutex(&logck);
 		/*
 		 * write() is AS-Safe, which implies it doesn't allocate,
 		 * unlike printf().
 		 */
 		garbage = write(STDERR_FILENO, ENOMEM_MSG, strlen(ENOMEM_MSG));
-		unlock_mutex();
+		unlock_mutex(&logck);
 		garbage++;
 	}
 
 	if (op_config.syslog_enabled) {
-		lock_mutex();
+		lock_mutex(&logck);
 		/* This allocates, but I don't think I have more options. */
 		syslog(LOG_ERR | op_config.facility, "Out of memory.");
-		unlock_mutex();
+		unlock_mutex(&logck);
 	}
 
 	return -ENOMEM;
@@ -654,6 +1049,7 @@ __dead void
 pr_crit(const char *format, ...)
 {
 	PR_SIMPLE(LOG_ERR, op_config);
+	log_flush();
 	print_stack_trace(NULL);
 	exit(-1);
 }
@@ -46,13 +46,15 @@
  * program starts. Logging can be performed after log_setup(), but it will use
  * default values.
  * log_init() finishes initialization by loading the user's intended config.
+ * log_start_writer() moves the writing to a dedicated thread.
  * log_teardown() reverts initialization.
  */
 int log_setup(bool);
 void log_start(void);
+int log_start_writer(void);
 void log_teardown(void);
 
-/* Call to flush the stdout/stderr streams */
+/* Call to make sure everything logged so far reached stdout/stderr. */
 void log_flush(void);
 
 /*
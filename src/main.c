@@ -1,10 +1,13 @@
 #include "config.h"
 #include "extension.h"
+#include "fetch_scheduler.h"
 #include "internal_pool.h"
 #include "nid.h"
 #include "reqs_errors.h"
+#include "rpp_memo.h"
 #include "thread_var.h"
 #include "validation_run.h"
+#include "crypto/sigcache.h"
 #include "http/http.h"
 #include "rtr/rtr.h"
 #include "rtr/db/vrps.h"
@@ -16,6 +19,8 @@ run_rtr_server(void)
 {
 	int error;
 
+	vrps_restore();
+
 	error = rtr_start();
 	if (error)
 		return error;
@@ -81,6 +86,9 @@ main(int argc, char **argv)
 	error = handle_flags_config(argc, argv);
 	if (error)
 		goto revert_log;
+	error = log_start_writer();
+	if (error)
+		goto revert_config;
 	error = nid_init();
 	if (error)
 		goto revert_config;
@@ -98,10 +106,13 @@ main(int argc, char **argv)
 	error = internal_pool_init();
 	if (error)
 		goto revert_http;
+	error = fetch_scheduler_init();
+	if (error)
+		goto revert_pool;
 
 	error = relax_ng_init();
 	if (error)
-		goto revert_pool;
+		goto revert_fetch;
 	error = vrps_init();
 	if (error)
 		goto revert_relax_ng;
@@ -111,6 +122,12 @@ main(int argc, char **argv)
 	error = reqs_errors_init();
 	if (error)
 		goto db_rrdp_cleanup;
+	error = rpp_memo_init();
+	if (error)
+		goto reqs_errors_cleanup;
+	error = sigcache_init();
+	if (error)
+		goto rpp_memo_cleanup;
 
 	/* Do stuff */
 	switch (config_get_mode()) {
@@ -124,6 +141,10 @@ main(int argc, char **argv)
 
 	/* End */
 
+	sigcache_cleanup();
+rpp_memo_cleanup:
+	rpp_memo_cleanup();
+reqs_errors_cleanup:
 	reqs_errors_cleanup();
 db_rrdp_cleanup:
 	db_rrdp_cleanup();
@@ -131,6 +152,8 @@ vrps_cleanup:
 	vrps_destroy();
 revert_relax_ng:
 	relax_ng_cleanup();
+revert_fetch:
+	fetch_scheduler_cleanup();
 revert_pool:
 	internal_pool_cleanup();
 revert_http:
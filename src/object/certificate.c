@@ -10,6 +10,7 @@
 #include "algorithm.h"
 #include "config.h"
 #include "extension.h"
+#include "fetch_scheduler.h"
 #include "log.h"
 #include "nid.h"
 #include "reqs_errors.h"
@@ -19,6 +20,7 @@
 #include "asn1/oid.h"
 #include "asn1/asn1c/IPAddrBlocks.h"
 #include "crypto/hash.h"
+#include "crypto/sigcache.h"
 #include "incidence/incidence.h"
 #include "object/bgpsec.h"
 #include "object/name.h"
@@ -209,7 +211,7 @@ cert_from_signed_object(struct rpki_uri *uri, uint8_t **result, int *size)
 	unsigned char *tmp;
 	int error;
 
-	error = signed_object_decode(&sobj, uri);
+	error = signed_object_decode(&sobj, uri, NULL);
 	if (error)
 		return error;
 
@@ -251,7 +253,7 @@ check_dup_public_key(bool *duplicated, char const *file, void *arg)
 
 	/* Check if it's '.cer', otherwise treat as a signed object */
 	if (uri_is_certificate(uri)) {
-		error = certificate_load(uri, &rcvd_cert);
+		error = certificate_load(uri, NULL, &rcvd_cert);
 		if (error)
 			goto free_uri;
 	} else {
@@ -690,6 +692,37 @@ find_signedAttrs(ANY_t *signedData, struct encoded_signedAttrs *result)
 	result->size += len_len;
 }
 
+/* Identifies the verification of @signature in the signature cache. */
+static int
+get_signature_key(X509 *cert, uint8_t tag,
+    struct encoded_signedAttrs const *signedAttrs,
+    SignatureValue_t const *signature, struct sigcache_key *key)
+{
+	EVP_MD_CTX *ctx;
+	int error;
+
+	error = sigcache_key_start(cert, &ctx);
+	if (error)
+		return error;
+
+	error = sigcache_key_update(ctx, &tag, sizeof(tag));
+	if (error)
+		goto fail;
+	error = sigcache_key_update(ctx, signedAttrs->buffer,
+	    signedAttrs->size);
+	if (error)
+		goto fail;
+	error = sigcache_key_update(ctx, signature->buf, signature->size);
+	if (error)
+		goto fail;
+
+	return sigcache_key_finish(ctx, key);
+
+fail:
+	EVP_MD_CTX_free(ctx);
+	return error;
+}
+
 /*
  * TODO (next iteration) there exists a thing called "PKCS7_NOVERIFY", which
  * skips unnecessary validations when using the PKCS7 API. Maybe the methods
@@ -704,23 +737,9 @@ certificate_validate_signature(X509 *cert, ANY_t *signedData,
 	X509_PUBKEY *public_key;
 	EVP_MD_CTX *ctx;
 	struct encoded_signedAttrs signedAttrs;
+	struct sigcache_key key;
 	int error;
 
-	public_key = X509_get_X509_PUBKEY(cert);
-	if (public_key == NULL)
-		return val_crypto_err("Certificate seems to lack a public key");
-
-	/* Create the Message Digest Context */
-	ctx = EVP_MD_CTX_create();
-	if (ctx == NULL)
-		return val_crypto_err("EVP_MD_CTX_create() error");
-
-	if (1 != EVP_DigestVerifyInit(ctx, NULL, EVP_sha256(), NULL,
-	    X509_PUBKEY_get0(public_key))) {
-		error = val_crypto_err("EVP_DigestVerifyInit() error");
-		goto end;
-	}
-
 	/*
 	 * When the [signedAttrs] field is present
 	 * (...),
@@ -771,6 +790,30 @@ certificate_validate_signature(X509 *cert, ANY_t *signedData,
 
 	find_signedAttrs(signedData, &signedAttrs);
 
+	if (sigcache_enabled()) {
+		error = get_signature_key(cert, EXPLICIT_SET_OF_TAG,
+		    &signedAttrs, signature, &key);
+		if (error)
+			return error;
+		if (sigcache_contains(&key))
+			return 0; /* Already verified */
+	}
+
+	public_key = X509_get_X509_PUBKEY(cert);
+	if (public_key == NULL)
+		return val_crypto_err("Certificate seems to lack a public key");
+
+	/* Create the Message Digest Context */
+	ctx = EVP_MD_CTX_create();
+	if (ctx == NULL)
+		return val_crypto_err("EVP_MD_CTX_create() error");
+
+	if (1 != EVP_DigestVerifyInit(ctx, NULL, EVP_sha256(), NULL,
+	    X509_PUBKEY_get0(public_key))) {
+		error = val_crypto_err("EVP_DigestVerifyInit() error");
+		goto end;
+	}
+
 	error = EVP_DigestVerifyUpdate(ctx, &EXPLICIT_SET_OF_TAG,
 	    sizeof(EXPLICIT_SET_OF_TAG));
 	if (1 != error) {
@@ -790,6 +833,8 @@ certificate_validate_signature(X509 *cert, ANY_t *signedData,
 		goto end;
 	}
 
+	if (sigcache_enabled())
+		sigcache_add(&key);
 	error = 0;
 
 end:
@@ -798,21 +843,19 @@ end:
 }
 
 int
-certificate_load(struct rpki_uri *uri, X509 **result)
+certificate_load(struct rpki_uri *uri, struct rpp *pp, X509 **result)
 {
-	X509 *cert = NULL;
-	BIO *bio;
+	struct file_contents fc;
+	unsigned char const *cursor;
+	X509 *cert;
 	int error;
 
-	bio = BIO_new(BIO_s_file());
-	if (bio == NULL)
-		return val_crypto_err("BIO_new(BIO_s_file()) returned NULL");
-	if (BIO_read_filename(bio, uri_get_local(uri)) <= 0) {
-		error = val_crypto_err("Error reading certificate");
-		goto end;
-	}
+	error = rpp_load_file(pp, uri, &fc);
+	if (error)
+		return error;
 
-	cert = d2i_X509_bio(bio, NULL);
+	cursor = fc.buffer;
+	cert = d2i_X509(NULL, &cursor, fc.buffer_size);
 	if (cert == NULL) {
 		error = val_crypto_err("Error parsing certificate");
 		goto end;
@@ -821,7 +864,7 @@ certificate_load(struct rpki_uri *uri, X509 **result)
 	*result = cert;
 	error = 0;
 end:
-	BIO_free(bio);
+	file_free(&fc);
 	return error;
 }
 
@@ -874,43 +917,67 @@ update_crl_time(STACK_OF(X509_CRL) *crls, X509_CRL *original_crl)
 }
 
 /*
- * Retry certificate validation without CRL time validation.
+ * Prepares the state's X509_STORE_CTX for the validation of @cert.
+ * Release it with X509_STORE_CTX_cleanup().
  */
-static int
-verify_cert_crl_stale(struct validation *state, X509 *cert,
-    STACK_OF(X509_CRL) *crls)
+static X509_STORE_CTX *
+init_store_ctx(struct validation *state, X509 *cert, STACK_OF(X509_CRL) *crls)
 {
 	X509_STORE_CTX *ctx;
-	X509_CRL *original_crl, *clone;
-	int error;
 	int ok;
 
-	ctx = X509_STORE_CTX_new();
-	if (ctx == NULL) {
-		val_crypto_err("X509_STORE_CTX_new() returned NULL");
-		return -EINVAL;
-	}
+	ctx = validation_store_ctx(state);
+	if (ctx == NULL)
+		return NULL;
 
 	/* Returns 0 or 1 , all callers test ! only. */
 	ok = X509_STORE_CTX_init(ctx, validation_store(state), cert, NULL);
 	if (!ok) {
-		error = val_crypto_err("X509_STORE_CTX_init() returned %d", ok);
-		goto release_ctx;
+		val_crypto_err("X509_STORE_CTX_init() returned %d", ok);
+		return NULL;
 	}
 
+	X509_STORE_CTX_trusted_stack(ctx,
+	    certstack_get_x509s(validation_certstack(state)));
+	X509_STORE_CTX_set0_crls(ctx, crls);
+	return ctx;
+}
+
+/*
+ * Retry certificate validation without CRL time validation.
+ *
+ * @rpp_crls is shared with other threads, so it's not modified; the clone is
+ * pushed to a private copy instead.
+ */
+static int
+verify_cert_crl_stale(struct validation *state, X509 *cert,
+    STACK_OF(X509_CRL) *rpp_crls)
+{
+	X509_STORE_CTX *ctx;
+	STACK_OF(X509_CRL) *crls;
+	X509_CRL *original_crl, *clone;
+	int error;
+	int ok;
+
+	crls = sk_X509_CRL_dup(rpp_crls);
+	if (crls == NULL)
+		return pr_enomem();
+
 	original_crl = sk_X509_CRL_pop(crls);
 	error = update_crl_time(crls, original_crl);
 	if (error)
-		goto push_original;
+		goto release_crls;
 
-	X509_STORE_CTX_trusted_stack(ctx,
-	    certstack_get_x509s(validation_certstack(state)));
-	X509_STORE_CTX_set0_crls(ctx, crls);
+	ctx = init_store_ctx(state, cert, crls);
+	if (ctx == NULL) {
+		error = -EINVAL;
+		goto pop_clone;
+	}
 
 	ok = X509_verify_cert(ctx);
 	if (ok > 0) {
 		error = 0; /* Happy path */
-		goto pop_clone;
+		goto release_ctx;
 	}
 
 	error = X509_STORE_CTX_get_error(ctx);
@@ -920,56 +987,49 @@ verify_cert_crl_stale(struct validation *state, X509 *cert,
 	else
 		error = val_crypto_err("Certificate validation failed: %d", ok);
 
+release_ctx:
+	X509_STORE_CTX_cleanup(ctx);
 pop_clone:
 	clone = sk_X509_CRL_pop(crls);
 	if (clone == NULL)
 		error = pr_val_err("Error calling sk_X509_CRL_pop()");
 	else
 		X509_CRL_free(clone);
-push_original:
-	/* Try to return to the "regular" CRL chain */
-	ok = sk_X509_CRL_push(crls, original_crl);
-	if (ok <= 0)
-		error = val_crypto_err("Could not return CRL to a CRL stack");
-release_ctx:
-	X509_STORE_CTX_free(ctx);
+release_crls:
+	sk_X509_CRL_free(crls);
 	return error;
-
 }
 
+/* @pp is the RPP @cert was found in. (NULL if @cert is the TA.) */
 int
-certificate_validate_chain(X509 *cert, STACK_OF(X509_CRL) *crls)
+certificate_validate_chain(X509 *cert, struct rpp *pp)
 {
 	/* Reference: openbsd/src/usr.bin/openssl/verify.c */
 
 	struct validation *state;
+	STACK_OF(X509_CRL) *crls;
 	X509_STORE_CTX *ctx;
 	int ok;
 	int error;
 
+	error = rpp_crl(pp, &crls);
+	if (error)
+		return error;
 	if (crls == NULL)
 		return 0; /* Certificate is TA; no chain validation needed. */
 
+	/* Revoked certificates don't need to bother libcrypto. */
+	if (rpp_crl_revokes(pp, cert))
+		return pr_val_err("Certificate validation failed: %s",
+		    X509_verify_cert_error_string(X509_V_ERR_CERT_REVOKED));
+
 	state = state_retrieve();
 	if (state == NULL)
 		return -EINVAL;
 
-	ctx = X509_STORE_CTX_new();
-	if (ctx == NULL) {
-		val_crypto_err("X509_STORE_CTX_new() returned NULL");
+	ctx = init_store_ctx(state, cert, crls);
+	if (ctx == NULL)
 		return -EINVAL;
-	}
-
-	/* Returns 0 or 1 , all callers test ! only. */
-	ok = X509_STORE_CTX_init(ctx, validation_store(state), cert, NULL);
-	if (!ok) {
-		val_crypto_err("X509_STORE_CTX_init() returned %d", ok);
-		goto abort;
-	}
-
-	X509_STORE_CTX_trusted_stack(ctx,
-	    certstack_get_x509s(validation_certstack(state)));
-	X509_STORE_CTX_set0_crls(ctx, crls);
 
 	/*
 	 * HERE'S THE MEAT OF LIBCRYPTO'S VALIDATION.
@@ -978,6 +1038,7 @@ certificate_validate_chain(X509 *cert, STACK_OF(X509_CRL) *crls)
 	 *
 	 * Debugging BTW: If you're looking for ctx->verify,
 	 * it might be internal_verify() from x509_vfy.c.
+	 * (Or sigcache_verify_chain(), if the signature cache is enabled.)
 	 */
 	ok = X509_verify_cert(ctx);
 	if (ok <= 0) {
@@ -996,7 +1057,7 @@ certificate_validate_chain(X509 *cert, STACK_OF(X509_CRL) *crls)
 			if (incidence(INID_CRL_STALE, "CRL is stale/expired"))
 				goto abort;
 
-			X509_STORE_CTX_free(ctx);
+			X509_STORE_CTX_cleanup(ctx);
 			if (incidence_get_action(INID_CRL_STALE) == INAC_WARN)
 				pr_val_info("Re-validating avoiding CRL time check");
 			return verify_cert_crl_stale(state, cert, crls);
@@ -1012,11 +1073,11 @@ certificate_validate_chain(X509 *cert, STACK_OF(X509_CRL) *crls)
 		goto abort;
 	}
 
-	X509_STORE_CTX_free(ctx);
+	X509_STORE_CTX_cleanup(ctx);
 	return 0;
 
 abort:
-	X509_STORE_CTX_free(ctx);
+	X509_STORE_CTX_cleanup(ctx);
 	return -EINVAL;
 }
 
@@ -1865,6 +1926,7 @@ get_certificate_type(X509 *cert, bool is_ta, enum cert_type *result)
 static int
 force_aia_validation(struct rpki_uri *caIssuers, X509 *son)
 {
+	struct validation *state;
 	X509 *parent;
 	struct rfc5280_name *son_name;
 	struct rfc5280_name *parent_name;
@@ -1872,6 +1934,10 @@ force_aia_validation(struct rpki_uri *caIssuers, X509 *son)
 
 	pr_val_debug("AIA's URI didn't matched parent URI, trying to SYNC");
 
+	state = state_retrieve();
+	if (state == NULL)
+		return -EINVAL;
+
 	/* RSYNC is still the preferred access mechanism, force the sync */
 	do {
 		error = rsync_download_files(caIssuers, false, true);
@@ -1884,7 +1950,7 @@ force_aia_validation(struct rpki_uri *caIssuers, X509 *son)
 		return error;
 	} while (0);
 
-	error = certificate_load(caIssuers, &parent);
+	error = certificate_load(caIssuers, NULL, &parent);
 	if (error)
 		return error;
 
@@ -2353,6 +2419,166 @@ end:
 	return 0;
 }
 
+/* A repository download, requested before its CA certificate is validated. */
+struct prefetch {
+	/* Forked from the state of the thread that found the certificate */
+	struct validation *state;
+	struct rpki_uri *cert_uri;
+	struct sia_ca_uris sia_uris;
+};
+
+/*
+ * Extracts the SIA URIs of @cert, without validating anything or complaining
+ * about anything. Returns whether there's a repository worth downloading.
+ */
+static bool
+peek_sia_ca(X509 *cert, struct sia_ca_uris *uris)
+{
+	SIGNATURE_INFO_ACCESS *sia;
+	ACCESS_DESCRIPTION *ad;
+	struct sia_uri *target;
+	struct rpki_uri *uri;
+	int flags;
+	int nid;
+	int i;
+
+	/* Skip the BGPsec certificates, mostly */
+	if (X509_check_ca(cert) != 1)
+		return false;
+
+	sia = X509_get_ext_d2i(cert, NID_sinfo_access, NULL, NULL);
+	if (sia == NULL)
+		return false;
+
+	for (i = 0; i < sk_ACCESS_DESCRIPTION_num(sia); i++) {
+		ad = sk_ACCESS_DESCRIPTION_value(sia, i);
+		nid = OBJ_obj2nid(ad->method);
+		if (nid == NID_caRepository) {
+			target = &uris->caRepository;
+			flags = URI_VALID_RSYNC;
+		} else if (nid == nid_rpkiNotify()) {
+			target = &uris->rpkiNotify;
+			flags = URI_VALID_HTTPS | URI_USE_RRDP_WORKSPACE;
+		} else if (nid == nid_rpkiManifest()) {
+			target = &uris->mft;
+			flags = URI_VALID_RSYNC;
+		} else {
+			continue;
+		}
+
+		if (target->uri != NULL || uri_create_ad(&uri, ad, flags) != 0)
+			continue;
+		target->position = i;
+		target->uri = uri;
+	}
+
+	AUTHORITY_INFO_ACCESS_free(sia);
+	return uris->caRepository.uri != NULL && uris->mft.uri != NULL;
+}
+
+static int
+__prefetch_peek(struct file_contents const *fc, void *arg)
+{
+	struct prefetch *prefetch = arg;
+	unsigned char const *cursor;
+	X509 *cert;
+	bool found;
+
+	cursor = fc->buffer;
+	cert = d2i_X509(NULL, &cursor, fc->buffer_size);
+	if (cert == NULL)
+		return -EINVAL;
+
+	found = peek_sia_ca(cert, &prefetch->sia_uris);
+
+	X509_free(cert);
+	return found ? 0 : -ESRCH;
+}
+
+static void
+do_prefetch(void *arg)
+{
+	struct prefetch *prefetch = arg;
+	bool new_level;
+	bool repo_retry;
+
+	fnstack_init();
+	fnstack_push_uri(prefetch->cert_uri);
+	working_repo_init();
+
+	/*
+	 * Same as certificate_traverse(), minus the validation. The results are
+	 * ignored; the download status is remembered by the rsync and RRDP
+	 * modules, and the traversal will pick them up (and report them).
+	 */
+	new_level = false;
+	if (state_store(prefetch->state) == 0 &&
+	    set_repository_level(false, prefetch->state, prefetch->cert_uri,
+	    &prefetch->sia_uris, &new_level) == 0)
+		use_access_method(&prefetch->sia_uris, exec_rsync_method,
+		    exec_rrdp_method, new_level, &repo_retry);
+
+	validation_destroy(prefetch->state);
+	sia_ca_uris_cleanup(&prefetch->sia_uris);
+	uri_refput(prefetch->cert_uri);
+	free(prefetch);
+
+	working_repo_cleanup();
+	fnstack_cleanup();
+}
+
+/*
+ * Queues the download of the repository of @cert_uri (a certificate listed by
+ * @pp's manifest) in the fetch thread pool, so it's hopefully ready by the time
+ * the certificate's subtree is traversed.
+ *
+ * The certificate has not been validated yet, which is why this doesn't report
+ * anything. Also, the download only starts after the certificate's manifest was
+ * validated, so it's not any less trustworthy than the file itself.
+ */
+void
+certificate_prefetch(struct rpp *pp, struct rpki_uri *cert_uri)
+{
+	struct validation *state;
+	struct prefetch *prefetch;
+	int error;
+
+	if (!config_get_rsync_enabled() && !config_get_http_enabled())
+		return;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return;
+
+	prefetch = malloc(sizeof(struct prefetch));
+	if (prefetch == NULL)
+		return;
+
+	sia_ca_uris_init(&prefetch->sia_uris);
+	if (rpp_peek_file(pp, cert_uri, __prefetch_peek, prefetch) != 0)
+		goto cleanup_uris;
+
+	error = validation_fork(state, &prefetch->state);
+	if (error)
+		goto cleanup_uris;
+
+	prefetch->cert_uri = cert_uri;
+	uri_refget(cert_uri);
+
+	error = fetch_scheduler_push("Prefetch", do_prefetch, prefetch);
+	if (error)
+		goto destroy_state;
+
+	return;
+
+destroy_state:
+	uri_refput(cert_uri);
+	validation_destroy(prefetch->state);
+cleanup_uris:
+	sia_ca_uris_cleanup(&prefetch->sia_uris);
+	free(prefetch);
+}
+
 /** Boilerplate code for CA certificate validation and recursive traversal. */
 int
 certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
@@ -2362,7 +2588,6 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 
 	struct validation *state;
 	int total_parents;
-	STACK_OF(X509_CRL) *rpp_parent_crl;
 	X509 *cert;
 	struct sia_ca_uris sia_uris;
 	struct certificate_refs refs;
@@ -2390,15 +2615,11 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 
 	fnstack_push_uri(cert_uri);
 
-	error = rpp_crl(rpp_parent, &rpp_parent_crl);
-	if (error)
-		goto revert_fnstack_and_debug;
-
 	/* -- Validate the certificate (@cert) -- */
-	error = certificate_load(cert_uri, &cert);
+	error = certificate_load(cert_uri, rpp_parent, &cert);
 	if (error)
 		goto revert_fnstack_and_debug;
-	error = certificate_validate_chain(cert, rpp_parent_crl);
+	error = certificate_validate_chain(cert, rpp_parent);
 	if (error)
 		goto revert_cert;
 
@@ -2504,7 +2725,7 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 
 		/* Cancel stack, reload certificate (no need to revalidate) */
 		x509stack_cancel(validation_certstack(state));
-		error = certificate_load(cert_uri, &cert);
+		error = certificate_load(cert_uri, NULL, &cert);
 		if (error)
 			goto revert_uris;
 
@@ -18,13 +18,13 @@ enum cert_type {
 	EE,		/* End Entity certificates */
 };
 
-int certificate_load(struct rpki_uri *, X509 **);
+int certificate_load(struct rpki_uri *, struct rpp *, X509 **);
 
 /**
  * Performs the basic (RFC 5280, presumably) chain validation.
  * (Ignores the IP and AS extensions.)
  */
-int certificate_validate_chain(X509 *, STACK_OF(X509_CRL) *);
+int certificate_validate_chain(X509 *, struct rpp *);
 /**
  * Validates RFC 6487 compliance.
  * (Except extensions.)
@@ -59,6 +59,7 @@ int certificate_validate_extensions_ee(X509 *, OCTET_STRING_t *,
  */
 int certificate_validate_aia(struct rpki_uri *, X509 *);
 
+void certificate_prefetch(struct rpp *, struct rpki_uri *);
 int certificate_traverse(struct rpp *, struct rpki_uri *);
 
 #endif /* SRC_OBJECT_CERTIFICATE_H_ */
@@ -1,30 +1,48 @@
 #include "crl.h"
 
 #include <errno.h>
+#include <stdlib.h>
 #include <syslog.h>
 #include "algorithm.h"
 #include "extension.h"
 #include "log.h"
 #include "thread_var.h"
+#include "data_structure/uthash_nonfatal.h"
 #include "object/name.h"
 
+struct revoked_serial {
+	/* Hash table key. Points to the CRL's copy of the serial. */
+	unsigned char const *data;
+	UT_hash_handle hh;
+};
+
+/*
+ * The serial numbers revoked by a CRL, indexed.
+ *
+ * libcrypto looks them up on its own during X509_verify_cert(), but this way
+ * the revoked certificates can be rejected without building their chains.
+ * Only borrows the serials, so it must not outlive its CRL.
+ */
+struct revoked_serials {
+	struct revoked_serial *table;
+	/* All the nodes of @table, allocated at once. */
+	struct revoked_serial *nodes;
+};
+
 static int
-__crl_load(struct rpki_uri *uri, X509_CRL **result)
+__crl_load(struct rpki_uri *uri, struct rpp *pp, X509_CRL **result)
 {
+	struct file_contents fc;
+	unsigned char const *cursor;
 	X509_CRL *crl;
-	BIO *bio;
 	int error;
 
-	bio = BIO_new(BIO_s_file());
-	if (bio == NULL)
-		return val_crypto_err("BIO_new(BIO_s_file()) returned NULL");
-	if (BIO_read_filename(bio, uri_get_local(uri)) <= 0) {
-		error = val_crypto_err("Error reading CRL '%s'",
-		    uri_val_get_printable(uri));
-		goto end;
-	}
+	error = rpp_load_file(pp, uri, &fc);
+	if (error)
+		return error;
 
-	crl = d2i_X509_CRL_bio(bio, NULL);
+	cursor = fc.buffer;
+	crl = d2i_X509_CRL(NULL, &cursor, fc.buffer_size);
 	if (crl == NULL) {
 		error = val_crypto_err("Error parsing CRL '%s'",
 		    uri_val_get_printable(uri));
@@ -35,7 +53,7 @@ __crl_load(struct rpki_uri *uri, X509_CRL **result)
 	error = 0;
 
 end:
-	BIO_free(bio);
+	file_free(&fc);
 	return error;
 }
 
@@ -63,13 +81,83 @@ debug_revoked(ASN1_INTEGER const *serial_int)
 end:	BN_free(serial_bn);
 }
 
+void
+revoked_serials_destroy(struct revoked_serials *serials)
+{
+	HASH_CLEAR(hh, serials->table);
+	free(serials->nodes);
+	free(serials);
+}
+
+static int
+revoked_serials_create(STACK_OF(X509_REVOKED) *revoked_stack,
+    struct revoked_serials **result)
+{
+	struct revoked_serials *serials;
+	int count;
+
+	serials = malloc(sizeof(struct revoked_serials));
+	if (serials == NULL)
+		return pr_enomem();
+
+	count = (revoked_stack != NULL) ? sk_X509_REVOKED_num(revoked_stack) : 0;
+	serials->table = NULL;
+	serials->nodes = calloc((count > 0) ? count : 1,
+	    sizeof(struct revoked_serial));
+	if (serials->nodes == NULL) {
+		free(serials);
+		return pr_enomem();
+	}
+
+	*result = serials;
+	return 0;
+}
+
+static int
+revoked_serials_add(struct revoked_serials *serials, int index,
+    ASN1_INTEGER const *serial_int)
+{
+	struct revoked_serial *node;
+
+	/* Negative serials are illegal; no certificate will match them. */
+	if (ASN1_STRING_type(serial_int) == V_ASN1_NEG_INTEGER)
+		return 0;
+
+	node = &serials->nodes[index];
+	node->data = ASN1_STRING_get0_data(serial_int);
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, serials->table, node->data,
+	    ASN1_STRING_length(serial_int), node);
+	if (errno)
+		return pr_enomem();
+
+	return 0;
+}
+
+/* Is @serial_int one of the serials revoked by the CRL? */
+bool
+revoked_serials_contains(struct revoked_serials const *serials,
+    ASN1_INTEGER const *serial_int)
+{
+	struct revoked_serial *node;
+
+	if (ASN1_STRING_type(serial_int) == V_ASN1_NEG_INTEGER)
+		return false;
+
+	HASH_FIND(hh, serials->table, ASN1_STRING_get0_data(serial_int),
+	    ASN1_STRING_length(serial_int), node);
+	return node != NULL;
+}
+
 static int
-validate_revoked(X509_CRL *crl)
+validate_revoked(X509_CRL *crl, struct revoked_serials *serials)
 {
 	STACK_OF(X509_REVOKED) *revoked_stack;
 	X509_REVOKED *revoked;
 	ASN1_INTEGER const *serial_int;
 	int i;
+	int error;
 
 	revoked_stack = X509_CRL_get_REVOKED(crl);
 	if (revoked_stack == NULL)
@@ -95,6 +183,10 @@ validate_revoked(X509_CRL *crl)
 			return pr_val_err("CRL's revoked entry #%d has extensions.",
 			    i + 1);
 		}
+
+		error = revoked_serials_add(serials, i, serial_int);
+		if (error)
+			return error;
 	}
 
 	return 0;
@@ -124,7 +216,7 @@ validate_extensions(X509_CRL *crl)
 }
 
 static int
-crl_validate(X509_CRL *crl)
+crl_validate(X509_CRL *crl, struct revoked_serials *serials)
 {
 	long version;
 	int error;
@@ -142,23 +234,40 @@ crl_validate(X509_CRL *crl)
 	if (error)
 		return error;
 
-	error = validate_revoked(crl);
+	error = validate_revoked(crl, serials);
 	if (error)
 		return error;
 
 	return validate_extensions(crl);
 }
 
+/*
+ * Loads and validates the CRL. Also indexes its revoked serials in @serials,
+ * which should be released with revoked_serials_destroy() (before the CRL).
+ */
 int
-crl_load(struct rpki_uri *uri, X509_CRL **result)
+crl_load(struct rpki_uri *uri, struct rpp *pp, X509_CRL **result,
+    struct revoked_serials **serials)
 {
 	int error;
 	pr_val_debug("CRL '%s' {", uri_val_get_printable(uri));
 
-	error = __crl_load(uri, result);
+	error = __crl_load(uri, pp, result);
+	if (error)
+		goto end;
+
+	error = revoked_serials_create(X509_CRL_get_REVOKED(*result), serials);
+	if (error)
+		goto free_crl;
+
+	error = crl_validate(*result, *serials);
 	if (!error)
-		error = crl_validate(*result);
+		goto end;
 
+	revoked_serials_destroy(*serials);
+free_crl:
+	X509_CRL_free(*result);
+end:
 	pr_val_debug("}");
 	return error;
 }
@@ -1,9 +1,18 @@
 #ifndef SRC_OBJECT_CRL_H_
 #define SRC_OBJECT_CRL_H_
 
+#include <stdbool.h>
 #include <openssl/x509.h>
+#include "rpp.h"
 #include "types/uri.h"
 
-int crl_load(struct rpki_uri *uri, X509_CRL **);
+struct revoked_serials;
+
+int crl_load(struct rpki_uri *uri, struct rpp *, X509_CRL **,
+    struct revoked_serials **);
+
+bool revoked_serials_contains(struct revoked_serials const *,
+    ASN1_INTEGER const *);
+void revoked_serials_destroy(struct revoked_serials *);
 
 #endif /* SRC_OBJECT_CRL_H_ */
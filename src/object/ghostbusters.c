@@ -21,7 +21,6 @@ ghostbusters_traverse(struct rpki_uri *uri, struct rpp *pp)
 	struct oid_arcs arcs = OID2ARCS("ghostbusters", oid);
 	struct signed_object sobj;
 	struct signed_object_args sobj_args;
-	STACK_OF(X509_CRL) *crl;
 	int error;
 
 	/* Prepare */
@@ -29,15 +28,12 @@ ghostbusters_traverse(struct rpki_uri *uri, struct rpp *pp)
 	fnstack_push_uri(uri);
 
 	/* Decode */
-	error = signed_object_decode(&sobj, uri);
+	error = signed_object_decode(&sobj, uri, pp);
 	if (error)
 		goto revert_log;
 
 	/* Prepare validation arguments */
-	error = rpp_crl(pp, &crl);
-	if (error)
-		goto revert_sobj;
-	error = signed_object_args_init(&sobj_args, uri, crl, true);
+	error = signed_object_args_init(&sobj_args, uri, pp, true);
 	if (error)
 		goto revert_sobj;
 
@@ -17,12 +17,15 @@
 #include "object/signed_object.h"
 
 static int
-decode_manifest(struct signed_object *sobj, struct Manifest **result)
+decode_manifest(struct signed_object *sobj, struct Manifest **result,
+    struct arena **pool)
 {
-	return asn1_decode_octet_string(
+	/* @result borrows from the eContent, which outlives it. */
+	return asn1_decode_octet_string_pooled(
 		sobj->sdata.decoded->encapContentInfo.eContent,
 		&asn_DEF_Manifest,
 		(void **) result,
+		pool,
 		true,
 		false
 	);
@@ -158,6 +161,9 @@ build_rpp(struct Manifest *mft, struct rpki_uri *mft_uri, bool rrdp_workspace,
 	int i;
 	struct FileAndHash *fah;
 	struct rpki_uri *uri;
+	struct file_contents fc;
+	unsigned char hash[EVP_MAX_MD_SIZE];
+	unsigned int hash_len;
 	int error;
 
 	*pp = rpp_create();
@@ -189,7 +195,8 @@ build_rpp(struct Manifest *mft, struct rpki_uri *mft_uri, bool rrdp_workspace,
 		 * - Positive value: file doesn't exist and keep validating
 		 *   manifest.
 		 */
-		error = hash_validate_mft_file("sha256", uri, &fah->hash);
+		error = hash_validate_mft_file("sha256", uri, &fah->hash, &fc,
+		    hash, &hash_len);
 		if (error < 0) {
 			uri_refput(uri);
 			goto fail;
@@ -202,18 +209,29 @@ build_rpp(struct Manifest *mft, struct rpki_uri *mft_uri, bool rrdp_workspace,
 		if (uri_has_extension(uri, ".cer"))
 			error = rpp_add_cert(*pp, uri);
 		else if (uri_has_extension(uri, ".roa"))
-			error = rpp_add_roa(*pp, uri);
+			error = rpp_add_roa(*pp, uri, hash, hash_len);
 		else if (uri_has_extension(uri, ".crl"))
 			error = rpp_add_crl(*pp, uri);
 		else if (uri_has_extension(uri, ".gbr"))
 			error = rpp_add_ghostbusters(*pp, uri);
-		else
+		else {
 			uri_refput(uri); /* ignore it. */
+			file_free(&fc);
+			continue;
+		}
 
 		if (error) {
 			uri_refput(uri);
+			file_free(&fc);
 			goto fail;
 		} /* Otherwise ownership was transferred to @pp. */
+
+		/* Keep the contents, so the file doesn't need to be read again */
+		error = rpp_add_file(*pp, uri, &fc);
+		if (error) {
+			file_free(&fc);
+			goto fail;
+		}
 	}
 
 	/* rfc6486#section-7 */
@@ -241,7 +259,7 @@ handle_manifest(struct rpki_uri *uri, bool rrdp_workspace, struct rpp **pp)
 	struct signed_object sobj;
 	struct signed_object_args sobj_args;
 	struct Manifest *mft;
-	STACK_OF(X509_CRL) *crl;
+	struct arena *pool;
 	int error;
 
 	/* Prepare */
@@ -249,10 +267,10 @@ handle_manifest(struct rpki_uri *uri, bool rrdp_workspace, struct rpp **pp)
 	fnstack_push_uri(uri);
 
 	/* Decode */
-	error = signed_object_decode(&sobj, uri);
+	error = signed_object_decode(&sobj, uri, NULL);
 	if (error)
 		goto revert_log;
-	error = decode_manifest(&sobj, &mft);
+	error = decode_manifest(&sobj, &mft, &pool);
 	if (error)
 		goto revert_sobj;
 
@@ -262,10 +280,7 @@ handle_manifest(struct rpki_uri *uri, bool rrdp_workspace, struct rpp **pp)
 		goto revert_manifest;
 
 	/* Prepare validation arguments */
-	error = rpp_crl(*pp, &crl);
-	if (error)
-		goto revert_rpp;
-	error = signed_object_args_init(&sobj_args, uri, crl, false);
+	error = signed_object_args_init(&sobj_args, uri, *pp, false);
 	if (error)
 		goto revert_rpp;
 
@@ -279,6 +294,11 @@ handle_manifest(struct rpki_uri *uri, bool rrdp_workspace, struct rpp **pp)
 	error = refs_validate_ee(&sobj_args.refs, *pp, uri);
 	if (error)
 		goto revert_args;
+	error = rpp_hash_manifest(*pp,
+	    sobj.sdata.decoded->encapContentInfo.eContent->buf,
+	    sobj.sdata.decoded->encapContentInfo.eContent->size);
+	if (error)
+		goto revert_args;
 
 	/* Success */
 	signed_object_args_cleanup(&sobj_args);
@@ -289,7 +309,7 @@ revert_args:
 revert_rpp:
 	rpp_refput(*pp);
 revert_manifest:
-	ASN_STRUCT_FREE(asn_DEF_Manifest, mft);
+	arena_destroy(pool); /* Releases @mft */
 revert_sobj:
 	signed_object_cleanup(&sobj);
 revert_log:
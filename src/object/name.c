@@ -1,6 +1,7 @@
 #include "object/name.h"
 
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <string.h>
 #include <syslog.h>
@@ -17,7 +18,7 @@ struct rfc5280_name {
 	char *commonName;
 	char *serialNumber;
 	/** Reference counter */
-	unsigned int references;
+	atomic_uint references;
 };
 
 static int
@@ -57,7 +58,7 @@ x509_name_decode(X509_NAME *name, char const *what,
 
 	result->commonName = NULL;
 	result->serialNumber = NULL;
-	result->references = 1;
+	atomic_init(&result->references, 1);
 
 	for (i = 0; i < X509_NAME_entry_count(name); i++) {
 		entry = X509_NAME_get_entry(name, i);
@@ -96,14 +97,13 @@ fail:
 void
 x509_name_get(struct rfc5280_name *name)
 {
-	name->references++;
+	atomic_fetch_add(&name->references, 1);
 }
 
 void
 x509_name_put(struct rfc5280_name *name)
 {
-	name->references--;
-	if (name->references == 0) {
+	if (atomic_fetch_sub(&name->references, 1) == 1) {
 		free(name->commonName);
 		free(name->serialNumber);
 		free(name);
@@ -13,12 +13,15 @@
 #include "object/signed_object.h"
 
 static int
-decode_roa(struct signed_object *sobj, struct RouteOriginAttestation **result)
+decode_roa(struct signed_object *sobj, struct RouteOriginAttestation **result,
+    struct arena **pool)
 {
-	return asn1_decode_octet_string(
+	/* @result borrows from the eContent, which outlives it. */
+	return asn1_decode_octet_string_pooled(
 		sobj->sdata.decoded->encapContentInfo.eContent,
 		&asn_DEF_RouteOriginAttestation,
 		(void **) result,
+		pool,
 		true,
 		false
 	);
@@ -259,7 +262,7 @@ roa_traverse(struct rpki_uri *uri, struct rpp *pp)
 	struct signed_object sobj;
 	struct signed_object_args sobj_args;
 	struct RouteOriginAttestation *roa;
-	STACK_OF(X509_CRL) *crl;
+	struct arena *pool;
 	int error;
 
 	/* Prepare */
@@ -267,18 +270,15 @@ roa_traverse(struct rpki_uri *uri, struct rpp *pp)
 	fnstack_push_uri(uri);
 
 	/* Decode */
-	error = signed_object_decode(&sobj, uri);
+	error = signed_object_decode(&sobj, uri, pp);
 	if (error)
 		goto revert_log;
-	error = decode_roa(&sobj, &roa);
+	error = decode_roa(&sobj, &roa, &pool);
 	if (error)
 		goto revert_sobj;
 
 	/* Prepare validation arguments */
-	error = rpp_crl(pp, &crl);
-	if (error)
-		goto revert_roa;
-	error = signed_object_args_init(&sobj_args, uri, crl, false);
+	error = signed_object_args_init(&sobj_args, uri, pp, false);
 	if (error)
 		goto revert_roa;
 
@@ -294,7 +294,7 @@ roa_traverse(struct rpki_uri *uri, struct rpp *pp)
 revert_args:
 	signed_object_args_cleanup(&sobj_args);
 revert_roa:
-	ASN_STRUCT_FREE(asn_DEF_RouteOriginAttestation, roa);
+	arena_destroy(pool); /* Releases @roa */
 revert_sobj:
 	signed_object_cleanup(&sobj);
 revert_log:
@@ -5,11 +5,12 @@
 #include "asn1/content_info.h"
 
 int
-signed_object_decode(struct signed_object *sobj, struct rpki_uri *uri)
+signed_object_decode(struct signed_object *sobj, struct rpki_uri *uri,
+    struct rpp *pp)
 {
 	int error;
 
-	error = content_info_load(uri, &sobj->cinfo);
+	error = content_info_load(uri, pp, &sobj->cinfo);
 	if (error)
 		return error;
 
@@ -15,10 +15,12 @@
 #include "cert_stack.h"
 #include "common.h"
 #include "config.h"
+#include "fetch_scheduler.h"
 #include "line_file.h"
 #include "log.h"
 #include "random.h"
 #include "reqs_errors.h"
+#include "rpp_memo.h"
 #include "state.h"
 #include "thread_var.h"
 #include "validation_handler.h"
@@ -58,6 +60,8 @@ struct validation_thread {
 	/* Try to sync the current TA URI? */
 	bool sync_files;
 	void *arg;
+	/* Pool where the subtrees of the TAL are traversed */
+	struct thread_pool *pool;
 	int exit_status;
 	/* This should also only be manipulated by the parent thread. */
 	SLIST_ENTRY(validation_thread) next;
@@ -66,6 +70,14 @@ struct validation_thread {
 /* List of threads, one per TAL file */
 SLIST_HEAD(threads_list, validation_thread);
 
+/* A CA certificate whose tree is traversed by a thread pool task */
+struct subtree {
+	struct validation_thread *thread;
+	/* Forked from the state that deferred the certificate */
+	struct validation *state;
+	struct deferred_cert deferred;
+};
+
 struct tal_param {
 	struct thread_pool *pool;
 	struct db_table *db;
@@ -492,6 +504,108 @@ tal_get_spki(struct tal *tal, unsigned char const **buffer, size_t *len)
 	*len = tal->spki_len;
 }
 
+static void spawn_subtrees(struct validation *, struct validation_thread *);
+
+static void
+do_subtree_validation(void *arg)
+{
+	struct subtree *subtree = arg;
+
+	fnstack_init();
+	fnstack_push(subtree->thread->tal_file);
+
+	working_repo_init();
+
+	if (state_store(subtree->state) == 0) {
+		/*
+		 * Ignore result code; remaining certificates are unrelated,
+		 * so they should not be affected.
+		 */
+		certificate_traverse(subtree->deferred.pp,
+		    subtree->deferred.uri);
+		spawn_subtrees(subtree->state, subtree->thread);
+	}
+
+	validation_destroy(subtree->state);
+	uri_refput(subtree->deferred.uri);
+	rpp_refput(subtree->deferred.pp);
+	free(subtree);
+
+	working_repo_cleanup();
+	fnstack_cleanup();
+}
+
+static int
+spawn_subtree(struct validation *state, struct validation_thread *thread,
+    struct deferred_cert *deferred)
+{
+	struct subtree *subtree;
+	int error;
+
+	subtree = malloc(sizeof(struct subtree));
+	if (subtree == NULL)
+		return pr_enomem();
+
+	error = validation_fork(state, &subtree->state);
+	if (error)
+		goto free_subtree;
+
+	subtree->thread = thread;
+	subtree->deferred = *deferred;
+
+	error = thread_pool_push(thread->pool, thread->tal_file,
+	    do_subtree_validation, subtree);
+	if (error)
+		goto destroy_state;
+
+	return 0;
+
+destroy_state:
+	validation_destroy(subtree->state);
+free_subtree:
+	free(subtree);
+	return error;
+}
+
+/**
+ * Hands the certificates deferred by @state's traversal over to the thread
+ * pool, so their trees can be traversed by any available thread.
+ *
+ * The subtrees are independent from each other, so the order in which they
+ * are traversed does not matter.
+ */
+static void
+spawn_subtrees(struct validation *state, struct validation_thread *thread)
+{
+	struct cert_stack *certstack;
+	struct deferred_cert deferred;
+	int error;
+
+	certstack = validation_certstack(state);
+	if (certstack == NULL)
+		pr_crit("Validation state has no certificate stack");
+
+	do {
+		error = deferstack_pop(certstack, &deferred);
+		if (error == -ENOENT)
+			return; /* No more certificates left; we're done. */
+		else if (error) /* All other errors are critical, currently */
+			pr_crit("deferstack_pop() returned illegal %d.", error);
+
+		/* The task steals the references */
+		if (spawn_subtree(state, thread, &deferred) == 0)
+			continue;
+
+		/* Couldn't delegate; traverse it in this thread. */
+		pr_val_debug("Couldn't spawn a subtree task; traversing '%s' locally.",
+		    uri_val_get_printable(deferred.uri));
+		certificate_traverse(deferred.pp, deferred.uri);
+
+		uri_refput(deferred.uri);
+		rpp_refput(deferred.pp);
+	} while (true);
+}
+
 /**
  * Performs the whole validation walkthrough on uri @uri, which is assumed to
  * have been extracted from a TAL.
@@ -516,8 +630,6 @@ handle_tal_uri(struct tal *tal, struct rpki_uri *uri,
 
 	struct validation_handler validation_handler;
 	struct validation *state;
-	struct cert_stack *certstack;
-	struct deferred_cert deferred;
 	int error;
 
 	validation_handler.handle_roa_v4 = handle_roa_v4;
@@ -606,29 +718,14 @@ handle_tal_uri(struct tal *tal, struct rpki_uri *uri,
 	 * (the root validated successfully; subtrees are isolated problems.)
 	 */
 
-	/* Handle every other certificate. */
-	certstack = validation_certstack(state);
-	if (certstack == NULL)
-		pr_crit("Validation state has no certificate stack");
-
-	do {
-		error = deferstack_pop(certstack, &deferred);
-		if (error == -ENOENT) {
-			/* No more certificates left; we're done. */
-			error = 1;
-			goto end;
-		} else if (error) /* All other errors are critical, currently */
-			pr_crit("deferstack_pop() returned illegal %d.", error);
-
-		/*
-		 * Ignore result code; remaining certificates are unrelated,
-		 * so they should not be affected.
-		 */
-		certificate_traverse(deferred.pp, deferred.uri);
-
-		uri_refput(deferred.uri);
-		rpp_refput(deferred.pp);
-	} while (true);
+	/*
+	 * Handle every other certificate.
+	 * The subtrees are traversed by the thread pool; the caller waits for
+	 * them through thread_pool_wait().
+	 */
+	spawn_subtrees(state, thread);
+	error = 1;
+	goto end;
 
 fail:	error = ENSURE_NEGATIVE(error);
 end:	validation_destroy(state);
@@ -738,6 +835,7 @@ __do_file_validation(char const *tal_file, void *arg)
 		goto free_thread;
 	}
 	thread->arg = t_param->db;
+	thread->pool = t_param->pool;
 	thread->exit_status = -EINTR;
 	thread->retry_local = true;
 	thread->sync_files = true;
@@ -787,8 +885,13 @@ perform_standalone_validation(struct thread_pool *pool, struct db_table *table)
 		return error;
 	}
 
-	/* Wait for all */
+	/*
+	 * Wait for all. The subtrees wait for their own downloads, but some
+	 * prefetches might belong to certificates that didn't validate.
+	 */
 	thread_pool_wait(pool);
+	fetch_scheduler_wait();
+	rpp_memo_cycle_end();
 
 	while (!SLIST_EMPTY(&param.threads)) {
 		thread = SLIST_FIRST(&param.threads);
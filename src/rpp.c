@@ -1,11 +1,19 @@
 #include "rpp.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
 #include "cert_stack.h"
+#include "common.h"
 #include "log.h"
+#include "rpp_memo.h"
 #include "thread_var.h"
 #include "types/uri.h"
 #include "data_structure/array_list.h"
+#include "data_structure/uthash_nonfatal.h"
 #include "object/certificate.h"
 #include "object/crl.h"
 #include "object/ghostbusters.h"
@@ -13,6 +21,14 @@
 
 STATIC_ARRAY_LIST(uris, struct rpki_uri *)
 
+/* A file listed by the manifest, whose contents were already read. */
+struct rpp_file {
+	/* Hash table key. Does not hold a reference; the URI belongs to @pp. */
+	struct rpki_uri *uri;
+	struct file_contents fc;
+	UT_hash_handle hh;
+};
+
 /** A Repository Publication Point (RFC 6481), as described by some manifest. */
 struct rpp {
 	struct uris certs; /* Certificates */
@@ -29,25 +45,53 @@ struct rpp {
 		 * Initialized lazily; access via rpp_crl().
 		 */
 		STACK_OF(X509_CRL) *stack;
+		/* The CRL's revoked serials. Initialized along with @stack. */
+		struct revoked_serials *revoked;
 		/*
 		 * Some error code if we already tried to initialize @stack but
 		 * failed. Prevents us from wasting time doing it again, and
 		 * flooding the log with identical error messages.
 		 */
 		int error;
+		/*
+		 * Protects @stack and @error. The certificates of a RPP can be
+		 * traversed by different threads at the same time.
+		 */
+		pthread_mutex_t lock;
 	} crl;
 
-	/* The Manifest is not needed for now. */
+	/*
+	 * Hash of the manifest's eContent. Identifies the contents of the RPP.
+	 * (See rpp_memo.h.)
+	 */
+	struct {
+		unsigned char hash[SHA256_DIGEST_LENGTH];
+		bool hashed;
+	} mft;
 
 	struct uris roas; /* Route Origin Attestations */
+	/*
+	 * Hash of the URIs and file hashes of @roas, which are the ROAs the
+	 * manifest lists *and* could be read. (See rpp_memo.h.)
+	 */
+	unsigned char roas_hash[SHA256_DIGEST_LENGTH];
 
 	struct uris ghostbusters;
 
 	/*
-	 * Note that the reference counting functions are not prepared for
-	 * multithreading, because this is not atomic.
+	 * Contents of the files, as they were read (and hashed) during the
+	 * manifest validation.
+	 * Each of them is claimed (once) by the decoder of the corresponding
+	 * object, so the file doesn't have to be read again. (See
+	 * rpp_load_file().)
 	 */
-	unsigned int references;
+	struct {
+		struct rpp_file *table;
+		/* The certificates can be decoded by different threads. */
+		pthread_mutex_t lock;
+	} files;
+
+	atomic_uint references;
 };
 
 struct rpp *
@@ -59,13 +103,27 @@ rpp_create(void)
 	if (result == NULL)
 		return NULL;
 
+	if (pthread_mutex_init(&result->crl.lock, NULL) != 0) {
+		free(result);
+		return NULL;
+	}
+	if (pthread_mutex_init(&result->files.lock, NULL) != 0) {
+		pthread_mutex_destroy(&result->crl.lock);
+		free(result);
+		return NULL;
+	}
+
 	uris_init(&result->certs);
 	result->crl.uri = NULL;
 	result->crl.stack = NULL;
+	result->crl.revoked = NULL;
 	result->crl.error = 0;
+	result->mft.hashed = false;
 	uris_init(&result->roas);
+	memset(result->roas_hash, 0, sizeof(result->roas_hash));
 	uris_init(&result->ghostbusters);
-	result->references = 1;
+	result->files.table = NULL;
+	atomic_init(&result->references, 1);
 
 	return result;
 }
@@ -73,7 +131,7 @@ rpp_create(void)
 void
 rpp_refget(struct rpp *pp)
 {
-	pp->references++;
+	atomic_fetch_add(&pp->references, 1);
 }
 
 static void
@@ -85,13 +143,23 @@ __uri_refput(struct rpki_uri **uri)
 void
 rpp_refput(struct rpp *pp)
 {
-	pp->references--;
-	if (pp->references == 0) {
+	struct rpp_file *file, *tmp;
+
+	if (atomic_fetch_sub(&pp->references, 1) == 1) {
+		HASH_ITER(hh, pp->files.table, file, tmp) {
+			HASH_DEL(pp->files.table, file);
+			file_free(&file->fc);
+			free(file);
+		}
+		pthread_mutex_destroy(&pp->files.lock);
 		uris_cleanup(&pp->certs, __uri_refput);
 		if (pp->crl.uri != NULL)
 			uri_refput(pp->crl.uri);
+		if (pp->crl.revoked != NULL)
+			revoked_serials_destroy(pp->crl.revoked);
 		if (pp->crl.stack != NULL)
 			sk_X509_CRL_pop_free(pp->crl.stack, X509_CRL_free);
+		pthread_mutex_destroy(&pp->crl.lock);
 		uris_cleanup(&pp->roas, __uri_refput);
 		uris_cleanup(&pp->ghostbusters, __uri_refput);
 		free(pp);
@@ -105,10 +173,49 @@ rpp_add_cert(struct rpp *pp, struct rpki_uri *uri)
 	return uris_add(&pp->certs, &uri);
 }
 
-/** Steals ownership of @uri. */
+/* Folds @uri and the @hash of its file into @pp's ROA hash. */
+static int
+hash_roa(struct rpp *pp, struct rpki_uri *uri, unsigned char const *hash,
+    unsigned int hash_len)
+{
+	char const *global;
+	EVP_MD_CTX *ctx;
+	int error;
+
+	global = uri_get_global(uri);
+
+	ctx = EVP_MD_CTX_new();
+	if (ctx == NULL)
+		return pr_enomem();
+
+	error = 0;
+	if (!EVP_DigestInit_ex(ctx, EVP_sha256(), NULL)
+	    || !EVP_DigestUpdate(ctx, pp->roas_hash, sizeof(pp->roas_hash))
+	    || !EVP_DigestUpdate(ctx, global, strlen(global) + 1)
+	    || !EVP_DigestUpdate(ctx, hash, hash_len)
+	    || !EVP_DigestFinal_ex(ctx, pp->roas_hash, NULL))
+		error = val_crypto_err("Could not hash the ROA list.");
+
+	EVP_MD_CTX_free(ctx);
+	return error;
+}
+
+/**
+ * Steals ownership of @uri, unless it fails. @hash is the hash of the ROA's
+ * file.
+ */
 int
-rpp_add_roa(struct rpp *pp, struct rpki_uri *uri)
+rpp_add_roa(struct rpp *pp, struct rpki_uri *uri, unsigned char const *hash,
+    unsigned int hash_len)
 {
+	int error;
+
+	if (rpp_memo_enabled()) {
+		error = hash_roa(pp, uri, hash, hash_len);
+		if (error)
+			return error;
+	}
+
 	return uris_add(&pp->roas, &uri);
 }
 
@@ -131,6 +238,98 @@ rpp_add_crl(struct rpp *pp, struct rpki_uri *uri)
 	return 0;
 }
 
+/**
+ * Stores the contents of @uri's file, so the decoder of @uri doesn't need to
+ * read it again. @uri has to belong to @pp already.
+ * Steals ownership of @fc's buffer, unless it fails.
+ */
+int
+rpp_add_file(struct rpp *pp, struct rpki_uri *uri, struct file_contents *fc)
+{
+	struct rpp_file *file;
+
+	file = malloc(sizeof(struct rpp_file));
+	if (file == NULL)
+		return pr_enomem();
+
+	file->uri = uri;
+	file->fc = *fc;
+
+	mutex_lock(&pp->files.lock);
+	errno = 0;
+	HASH_ADD_PTR(pp->files.table, uri, file);
+	if (errno) {
+		mutex_unlock(&pp->files.lock);
+		free(file); /* The caller keeps @fc */
+		return pr_enomem();
+	}
+	mutex_unlock(&pp->files.lock);
+
+	return 0;
+}
+
+/**
+ * Loads the contents of @uri's file into @fc.
+ *
+ * If @pp already has them (see rpp_add_file()), they are handed over (and
+ * forgotten by @pp). Otherwise, or if @pp is NULL, the file is read from the
+ * disk.
+ *
+ * Don't forget to file_free() @fc.
+ */
+int
+rpp_load_file(struct rpp *pp, struct rpki_uri *uri, struct file_contents *fc)
+{
+	struct rpp_file *file;
+
+	if (pp != NULL) {
+		mutex_lock(&pp->files.lock);
+		HASH_FIND_PTR(pp->files.table, &uri, file);
+		if (file != NULL)
+			HASH_DEL(pp->files.table, file);
+		mutex_unlock(&pp->files.lock);
+
+		if (file != NULL) {
+			*fc = file->fc;
+			free(file);
+			return 0;
+		}
+	}
+
+	return file_load(uri_get_local(uri), fc);
+}
+
+/**
+ * Hands @uri's cached contents (see rpp_add_file()) over to @cb, without
+ * forgetting them. @cb must not keep them.
+ *
+ * Returns -ENOENT if @pp doesn't have them, otherwise @cb's result.
+ */
+int
+rpp_peek_file(struct rpp *pp, struct rpki_uri *uri, rpp_file_cb cb, void *arg)
+{
+	struct rpp_file *file;
+	int error;
+
+	mutex_lock(&pp->files.lock);
+	HASH_FIND_PTR(pp->files.table, &uri, file);
+	error = (file != NULL) ? cb(&file->fc, arg) : -ENOENT;
+	mutex_unlock(&pp->files.lock);
+
+	return error;
+}
+
+/** Records the hash of the manifest's @content. */
+int
+rpp_hash_manifest(struct rpp *pp, unsigned char const *content, size_t size)
+{
+	if (!EVP_Digest(content, size, pp->mft.hash, NULL, EVP_sha256(), NULL))
+		return val_crypto_err("EVP_Digest() returned error");
+
+	pp->mft.hashed = true;
+	return 0;
+}
+
 struct rpki_uri *
 rpp_get_crl(struct rpp const *pp)
 {
@@ -146,13 +345,15 @@ add_crl_to_stack(struct rpp *pp, STACK_OF(X509_CRL) *crls)
 
 	fnstack_push_uri(pp->crl.uri);
 
-	error = crl_load(pp->crl.uri, &crl);
+	error = crl_load(pp->crl.uri, pp, &crl, &pp->crl.revoked);
 	if (error)
 		goto end;
 
 	idx = sk_X509_CRL_push(crls, crl);
 	if (idx <= 0) {
 		error = val_crypto_err("Could not add CRL to a CRL stack");
+		revoked_serials_destroy(pp->crl.revoked);
+		pp->crl.revoked = NULL;
 		X509_CRL_free(crl);
 		goto end;
 	}
@@ -162,27 +363,12 @@ end:
 	return error;
 }
 
-/**
- * Returns the pp's CRL in stack form (which is how libcrypto functions want
- * it).
- * The stack belongs to @pp and should not be released. Can be NULL, in which
- * case you're currently validating the TA (since it lacks governing CRL).
- */
-int
-rpp_crl(struct rpp *pp, STACK_OF(X509_CRL) **result)
+static int
+__rpp_crl(struct rpp *pp, STACK_OF(X509_CRL) **result)
 {
 	STACK_OF(X509_CRL) *stack;
 
 	/* -- Short circuits -- */
-	if (pp == NULL) {
-		/* No pp = currently validating TA. There's no CRL. */
-		*result = NULL;
-		return 0;
-	}
-	if (pp->crl.uri == NULL) {
-		/* rpp_crl() assumes the rpp has been populated already. */
-		pr_crit("RPP lacks a CRL.");
-	}
 	if (pp->crl.stack != NULL) {
 		/* Result already cached. */
 		*result = pp->crl.stack;
@@ -210,6 +396,51 @@ rpp_crl(struct rpp *pp, STACK_OF(X509_CRL) **result)
 	return 0;
 }
 
+/**
+ * Returns the pp's CRL in stack form (which is how libcrypto functions want
+ * it).
+ * The stack belongs to @pp and should not be released nor modified, since
+ * other threads might be using it as well. Can be NULL, in which case you're
+ * currently validating the TA (since it lacks governing CRL).
+ */
+int
+rpp_crl(struct rpp *pp, STACK_OF(X509_CRL) **result)
+{
+	int error;
+
+	if (pp == NULL) {
+		/* No pp = currently validating TA. There's no CRL. */
+		*result = NULL;
+		return 0;
+	}
+	if (pp->crl.uri == NULL) {
+		/* rpp_crl() assumes the rpp has been populated already. */
+		pr_crit("RPP lacks a CRL.");
+	}
+
+	mutex_lock(&pp->crl.lock);
+	error = __rpp_crl(pp, result);
+	mutex_unlock(&pp->crl.lock);
+
+	return error;
+}
+
+/*
+ * Does @pp's CRL revoke @cert?
+ *
+ * Only an early check; libcrypto also looks for @cert in the CRL during the
+ * chain validation. Call rpp_crl() first.
+ */
+bool
+rpp_crl_revokes(struct rpp *pp, X509 *cert)
+{
+	if (pp == NULL || pp->crl.revoked == NULL)
+		return false;
+
+	return revoked_serials_contains(pp->crl.revoked,
+	    X509_get0_serialNumber(cert));
+}
+
 static int
 __cert_traverse(struct rpp *pp)
 {
@@ -240,9 +471,88 @@ __cert_traverse(struct rpp *pp)
 			return error;
 	}
 
+	/*
+	 * Start downloading their repositories already, so they're hopefully
+	 * ready by the time the certificates are popped.
+	 */
+	for (i = 0; i < pp->certs.len; i++)
+		certificate_prefetch(pp, pp->certs.array[i]);
+
 	return 0;
 }
 
+/*
+ * Starts recording @pp's VRPs, unless they were already recorded in a previous
+ * cycle, in which case they are reported again right away.
+ *
+ * Returns 0 if the VRPs were reported, otherwise the ROAs need to be validated,
+ * and @result is the memo that will record them (or NULL.)
+ */
+static int
+roas_replay(struct validation *state, struct rpp *pp,
+    struct rpp_memo **result)
+{
+	STACK_OF(X509_CRL) *crls;
+	X509_CRL *crl;
+	struct rpp_memo_key key;
+	int error;
+
+	*result = NULL;
+
+	if (!rpp_memo_enabled() || !pp->mft.hashed || pp->roas.len == 0)
+		return -ENOENT;
+
+	error = rpp_crl(pp, &crls);
+	if (error)
+		return error;
+	crl = sk_X509_CRL_value(crls, 0);
+
+	error = rpp_memo_key_init(&key, pp->mft.hash, pp->roas_hash, crl,
+	    certstack_get_x509s(validation_certstack(state)));
+	if (error)
+		return error;
+
+	error = rpp_memo_replay(&key);
+	if (error != -ENOENT)
+		return error;
+
+	*result = rpp_memo_create(&key, crl);
+	return -ENOENT;
+}
+
+static void
+roas_traverse(struct rpp *pp)
+{
+	struct validation *state;
+	struct rpp_memo *memo;
+	struct rpki_uri **uri;
+	array_index i;
+	int error;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return;
+
+	/*
+	 * If the replay fails halfway, the ROAs are validated anyway. The
+	 * repeated VRPs are dropped later.
+	 */
+	if (roas_replay(state, pp, &memo) == 0)
+		return;
+
+	validation_set_rpp_memo(state, memo);
+
+	error = 0;
+	ARRAYLIST_FOREACH(&pp->roas, uri, i)
+		if (roa_traverse(*uri, pp) != 0)
+			error = -EINVAL;
+
+	if (memo != NULL) {
+		validation_set_rpp_memo(state, NULL);
+		rpp_memo_finish(memo, error);
+	}
+}
+
 /**
  * Traverses through all of @pp's known files, validating them.
  */
@@ -267,8 +577,7 @@ rpp_traverse(struct rpp *pp)
 	__cert_traverse(pp);
 
 	/* Validate ROAs, apply validation_handler on them. */
-	ARRAYLIST_FOREACH(&pp->roas, uri, i)
-		roa_traverse(*uri, pp);
+	roas_traverse(pp);
 
 	/*
 	 * We don't do much with the ghostbusters right now.
@@ -1,6 +1,7 @@
 #ifndef SRC_RPP_H_
 #define SRC_RPP_H_
 
+#include "file.h"
 #include "types/uri.h"
 
 struct rpp;
@@ -11,11 +12,20 @@ void rpp_refput(struct rpp *pp);
 
 int rpp_add_cert(struct rpp *, struct rpki_uri *);
 int rpp_add_crl(struct rpp *, struct rpki_uri *);
-int rpp_add_roa(struct rpp *, struct rpki_uri *);
+int rpp_add_roa(struct rpp *, struct rpki_uri *, unsigned char const *,
+    unsigned int);
 int rpp_add_ghostbusters(struct rpp *, struct rpki_uri *);
+int rpp_add_file(struct rpp *, struct rpki_uri *, struct file_contents *);
+
+int rpp_load_file(struct rpp *, struct rpki_uri *, struct file_contents *);
+typedef int (*rpp_file_cb)(struct file_contents const *, void *);
+int rpp_peek_file(struct rpp *, struct rpki_uri *, rpp_file_cb, void *);
+
+int rpp_hash_manifest(struct rpp *, unsigned char const *, size_t);
 
 struct rpki_uri *rpp_get_crl(struct rpp const *);
 int rpp_crl(struct rpp *, STACK_OF(X509_CRL) **);
+bool rpp_crl_revokes(struct rpp *, X509 *);
 
 void rpp_traverse(struct rpp *);
 
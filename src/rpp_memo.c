@@ -0,0 +1,389 @@
+#include "rpp_memo.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
+#include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
+#include <openssl/evp.h>
+
+#include "common.h"
+#include "config.h"
+#include "log.h"
+#include "validation_handler.h"
+#include "config/mode.h"
+#include "data_structure/array_list.h"
+#include "data_structure/uthash_nonfatal.h"
+#include "types/vrp.h"
+
+STATIC_ARRAY_LIST(memo_vrps, struct vrp)
+
+struct rpp_memo {
+	/* Hash table key */
+	struct rpp_memo_key key;
+	struct memo_vrps vrps;
+	/* The VRPs can't be reported anymore once this moment arrives. */
+	time_t expiration;
+	/* Last validation cycle that built or used the memo */
+	unsigned int cycle;
+	/* Nonzero if something went wrong while recording the memo. */
+	int error;
+	UT_hash_handle hh;
+};
+
+/* Memos built by the previous cycles, indexed by key. */
+static struct rpp_memo *memos;
+/* Number of the current validation cycle. */
+static unsigned int cycle;
+/* Number of memos replayed during the current cycle. */
+static unsigned int hits;
+
+/*
+ * Protects @memos, @hits and the @cycle field of the memos.
+ *
+ * Memos are immutable once they are added to @memos, and they are only removed
+ * between validation cycles, so they can be read without the lock.
+ */
+static pthread_mutex_t lock;
+
+int
+rpp_memo_init(void)
+{
+	int error;
+
+	error = pthread_mutex_init(&lock, NULL);
+	if (error) {
+		pr_op_err("pthread_mutex_init() errored: %s", strerror(error));
+		return -error;
+	}
+
+	memos = NULL;
+	cycle = 0;
+	hits = 0;
+	return 0;
+}
+
+static void
+memo_destroy(struct rpp_memo *memo)
+{
+	memo_vrps_cleanup(&memo->vrps, NULL);
+	free(memo);
+}
+
+void
+rpp_memo_cleanup(void)
+{
+	struct rpp_memo *memo, *tmp;
+
+	HASH_ITER(hh, memos, memo, tmp) {
+		HASH_DEL(memos, memo);
+		memo_destroy(memo);
+	}
+
+	pthread_mutex_destroy(&lock);
+}
+
+/*
+ * Memos are only useful if there's going to be another validation cycle.
+ */
+bool
+rpp_memo_enabled(void)
+{
+	return config_get_mode() == SERVER;
+}
+
+int
+rpp_memo_key_init(struct rpp_memo_key *key, unsigned char const *mft_hash,
+    unsigned char const *roas_hash, X509_CRL *crl, STACK_OF(X509) *chain)
+{
+	unsigned char cert_hash[SHA256_DIGEST_LENGTH];
+	unsigned int len;
+	EVP_MD_CTX *ctx;
+	int i;
+	int error;
+
+	memcpy(key->mft, mft_hash, sizeof(key->mft));
+	memcpy(key->roas, roas_hash, sizeof(key->roas));
+
+	if (!X509_CRL_digest(crl, EVP_sha256(), key->crl, &len))
+		return val_crypto_err("X509_CRL_digest() returned error");
+
+	/*
+	 * The whole chain is needed, not only the CA: inherited resources and
+	 * RFC 8360 both make the CA's resources depend on its ancestors.
+	 */
+	ctx = EVP_MD_CTX_new();
+	if (ctx == NULL)
+		return pr_enomem();
+
+	if (!EVP_DigestInit_ex(ctx, EVP_sha256(), NULL)) {
+		error = val_crypto_err("EVP_DigestInit_ex() returned error");
+		goto end;
+	}
+	for (i = 0; i < sk_X509_num(chain); i++) {
+		if (!X509_digest(sk_X509_value(chain, i), EVP_sha256(),
+		    cert_hash, &len)) {
+			error = val_crypto_err("X509_digest() returned error");
+			goto end;
+		}
+		if (!EVP_DigestUpdate(ctx, cert_hash, len)) {
+			error = val_crypto_err("EVP_DigestUpdate() returned error");
+			goto end;
+		}
+	}
+	if (!EVP_DigestFinal_ex(ctx, key->chain, &len)) {
+		error = val_crypto_err("EVP_DigestFinal_ex() returned error");
+		goto end;
+	}
+
+	error = 0;
+end:
+	EVP_MD_CTX_free(ctx);
+	return error;
+}
+
+static int
+replay_vrp(struct vrp const *vrp)
+{
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		prefix4.addr = vrp->prefix.v4;
+		prefix4.len = vrp->prefix_length;
+		return vhandler_handle_roa_v4(vrp->asn, &prefix4,
+		    vrp->max_prefix_length);
+	case AF_INET6:
+		prefix6.addr = vrp->prefix.v6;
+		prefix6.len = vrp->prefix_length;
+		return vhandler_handle_roa_v6(vrp->asn, &prefix6,
+		    vrp->max_prefix_length);
+	}
+
+	pr_crit("Unknown address family: %u", vrp->addr_fam);
+}
+
+/*
+ * If there's an unexpired memo indexed by @key, reports its VRPs again.
+ *
+ * Returns -ENOENT if there's no such memo, in which case the ROAs have to be
+ * validated.
+ */
+int
+rpp_memo_replay(struct rpp_memo_key const *key)
+{
+	struct rpp_memo *memo;
+	struct vrp *vrp;
+	array_index i;
+	time_t now;
+	int error;
+
+	now = 0;
+	error = get_current_time(&now);
+	if (error)
+		return error;
+
+	mutex_lock(&lock);
+	HASH_FIND(hh, memos, key, sizeof(*key), memo);
+	if (memo != NULL && difftime(memo->expiration, now) > 0) {
+		memo->cycle = cycle;
+		hits++;
+	} else {
+		memo = NULL;
+	}
+	mutex_unlock(&lock);
+
+	if (memo == NULL)
+		return -ENOENT;
+
+	pr_val_debug("The ROAs didn't change; reusing their %zu VRPs.",
+	    memo->vrps.len);
+	ARRAYLIST_FOREACH(&memo->vrps, vrp, i) {
+		error = replay_vrp(vrp);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+static int
+get_expiration(ASN1_TIME const *asn1_time, time_t *result)
+{
+	time_t now;
+	int days;
+	int secs;
+	int error;
+
+	now = 0;
+	error = get_current_time(&now);
+	if (error)
+		return error;
+
+	/* A NULL "from" means "now." */
+	if (!ASN1_TIME_diff(&days, &secs, NULL, asn1_time))
+		return val_crypto_err("ASN1_TIME_diff() returned error");
+
+	*result = now + ((time_t) days) * 24 * 60 * 60 + secs;
+	return 0;
+}
+
+/*
+ * Starts recording the results of the RPP whose key is @key.
+ *
+ * Returns NULL if the memo can't be created; the RPP won't be memoized, but
+ * that's not an error.
+ */
+struct rpp_memo *
+rpp_memo_create(struct rpp_memo_key const *key, X509_CRL *crl)
+{
+	struct rpp_memo *memo;
+	ASN1_TIME const *next_update;
+
+	next_update = X509_CRL_get0_nextUpdate(crl);
+	if (next_update == NULL)
+		return NULL;
+
+	memo = malloc(sizeof(struct rpp_memo));
+	if (memo == NULL)
+		return NULL;
+
+	/* Needed by uthash */
+	memset(memo, 0, sizeof(struct rpp_memo));
+
+	memo->key = *key;
+	memo_vrps_init(&memo->vrps);
+	memo->error = get_expiration(next_update, &memo->expiration);
+	memo->cycle = cycle;
+
+	return memo;
+}
+
+static void
+add_vrp(struct rpp_memo *memo, struct vrp *vrp)
+{
+	if (memo->error)
+		return;
+	memo->error = memo_vrps_add(&memo->vrps, vrp);
+}
+
+void
+rpp_memo_add_roa_v4(struct rpp_memo *memo, uint32_t as,
+    struct ipv4_prefix const *prefix, uint8_t max_length)
+{
+	struct vrp vrp;
+
+	memset(&vrp, 0, sizeof(vrp));
+	vrp.asn = as;
+	vrp.prefix.v4 = prefix->addr;
+	vrp.prefix_length = prefix->len;
+	vrp.max_prefix_length = max_length;
+	vrp.addr_fam = AF_INET;
+
+	add_vrp(memo, &vrp);
+}
+
+void
+rpp_memo_add_roa_v6(struct rpp_memo *memo, uint32_t as,
+    struct ipv6_prefix const *prefix, uint8_t max_length)
+{
+	struct vrp vrp;
+
+	memset(&vrp, 0, sizeof(vrp));
+	vrp.asn = as;
+	vrp.prefix.v6 = prefix->addr;
+	vrp.prefix_length = prefix->len;
+	vrp.max_prefix_length = max_length;
+	vrp.addr_fam = AF_INET6;
+
+	add_vrp(memo, &vrp);
+}
+
+/* The memo can't be used after @not_after. */
+void
+rpp_memo_expire_at(struct rpp_memo *memo, ASN1_TIME const *not_after)
+{
+	time_t expiration;
+
+	if (memo == NULL || memo->error)
+		return;
+
+	memo->error = get_expiration(not_after, &expiration);
+	if (!memo->error && difftime(expiration, memo->expiration) < 0)
+		memo->expiration = expiration;
+}
+
+/*
+ * Ends the recording of @memo. @error is the result of the validation of the
+ * ROAs; the memo is only kept if all of them were valid.
+ */
+void
+rpp_memo_finish(struct rpp_memo *memo, int error)
+{
+	struct rpp_memo *old;
+
+	if (error || memo->error) {
+		memo_destroy(memo);
+		return;
+	}
+
+	mutex_lock(&lock);
+	HASH_FIND(hh, memos, &memo->key, sizeof(memo->key), old);
+	if (old != NULL && old->cycle == cycle) {
+		/* Somebody might be reading @old. Keep it. */
+		mutex_unlock(&lock);
+		memo_destroy(memo);
+		return;
+	}
+	if (old != NULL)
+		HASH_DEL(memos, old);
+	errno = 0;
+	HASH_ADD(hh, memos, key, sizeof(memo->key), memo);
+	if (errno) {
+		/* Memoizing is optional */
+		mutex_unlock(&lock);
+		memo_destroy(memo);
+		if (old != NULL)
+			memo_destroy(old);
+		return;
+	}
+	mutex_unlock(&lock);
+
+	if (old != NULL)
+		memo_destroy(old);
+}
+
+/*
+ * Forgets the memos that weren't used by the cycle that just ended; their
+ * RPPs either changed or disappeared.
+ *
+ * Must not be called while a validation cycle is running.
+ */
+void
+rpp_memo_cycle_end(void)
+{
+	struct rpp_memo *memo, *tmp;
+	unsigned int count;
+	unsigned int dropped;
+
+	count = 0;
+	dropped = 0;
+
+	mutex_lock(&lock);
+	HASH_ITER(hh, memos, memo, tmp) {
+		if (memo->cycle != cycle) {
+			HASH_DEL(memos, memo);
+			memo_destroy(memo);
+			dropped++;
+		} else {
+			count++;
+		}
+	}
+	pr_op_debug("RPP memos: %u reused, %u kept, %u dropped.", hits, count,
+	    dropped);
+	cycle++;
+	hits = 0;
+	mutex_unlock(&lock);
+}
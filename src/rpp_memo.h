@@ -0,0 +1,57 @@
+#ifndef SRC_RPP_MEMO_H_
+#define SRC_RPP_MEMO_H_
+
+#include <stdbool.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+#include "types/address.h"
+
+/*
+ * Memo of the VRPs produced by the ROAs of a Repository Publication Point.
+ *
+ * Most of the RPPs don't change from one validation cycle to the next. If the
+ * manifest, the CRL, the certificate chain above them and the ROA files that
+ * are actually present are byte-by-byte the same as last time, then their
+ * validation would yield the same VRPs. (The manifest alone is not enough; its
+ * files can go missing, or fail to match their hashes, without invalidating
+ * it.) The only thing that can change is time; a memo stops being used as soon
+ * as any of the EE certificates or the CRL it was built from expire.
+ *
+ * The rest of the RPP (manifest, CRL, child certificates) is still validated
+ * every cycle.
+ */
+
+struct rpp_memo_key {
+	/* Hash of the manifest's eContent */
+	unsigned char mft[SHA256_DIGEST_LENGTH];
+	/* Hash of the URIs and file hashes of the ROAs that were found */
+	unsigned char roas[SHA256_DIGEST_LENGTH];
+	/* Hash of the CRL */
+	unsigned char crl[SHA256_DIGEST_LENGTH];
+	/* Hash of the hashes of the certificates, from the TA down to the CA */
+	unsigned char chain[SHA256_DIGEST_LENGTH];
+};
+
+struct rpp_memo;
+
+int rpp_memo_init(void);
+void rpp_memo_cleanup(void);
+
+bool rpp_memo_enabled(void);
+
+int rpp_memo_key_init(struct rpp_memo_key *, unsigned char const *,
+    unsigned char const *, X509_CRL *, STACK_OF(X509) *);
+
+int rpp_memo_replay(struct rpp_memo_key const *);
+
+struct rpp_memo *rpp_memo_create(struct rpp_memo_key const *, X509_CRL *);
+void rpp_memo_add_roa_v4(struct rpp_memo *, uint32_t,
+    struct ipv4_prefix const *, uint8_t);
+void rpp_memo_add_roa_v6(struct rpp_memo *, uint32_t,
+    struct ipv6_prefix const *, uint8_t);
+void rpp_memo_expire_at(struct rpp_memo *, ASN1_TIME const *);
+void rpp_memo_finish(struct rpp_memo *, int);
+
+void rpp_memo_cycle_end(void);
+
+#endif /* SRC_RPP_MEMO_H_ */
@@ -1,5 +1,6 @@
 #include "rrdp/db/db_rrdp_uris.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -24,7 +25,11 @@ struct uris_table {
 
 struct db_rrdp_uri {
 	struct uris_table *table;
-	char const *current_workspace;
+	/*
+	 * Several threads can synchronize repositories of the same TAL at the
+	 * same time. (Though only one thread works on a given URI at a time.)
+	 */
+	pthread_mutex_t lock;
 };
 
 static int
@@ -84,11 +89,6 @@ find_rrdp_uri(struct db_rrdp_uri *uris, const char *search)
 	return found;
 }
 
-#define RET_NOT_FOUND_URI(uris, search, found)				\
-	found = find_rrdp_uri(uris, search);				\
-	if (found == NULL)						\
-		return -ENOENT;
-
 static void
 add_rrdp_uri(struct db_rrdp_uri *uris, struct uris_table *new_uri)
 {
@@ -120,30 +120,24 @@ get_thread_rrdp_uris(struct db_rrdp_uri **result)
 	return 0;
 }
 
-static int
-get_thread_rrdp_workspace(char const **result)
-{
-	struct validation *state;
-
-	state = state_retrieve();
-	if (state == NULL)
-		return pr_val_err("No state related to this thread");
-
-	*result = validation_get_rrdp_workspace(state);
-	return 0;
-}
-
 int
 db_rrdp_uris_create(struct db_rrdp_uri **uris)
 {
 	struct db_rrdp_uri *tmp;
+	int error;
 
 	tmp = malloc(sizeof(struct db_rrdp_uri));
 	if (tmp == NULL)
 		return pr_enomem();
 
+	error = pthread_mutex_init(&tmp->lock, NULL);
+	if (error) {
+		free(tmp);
+		return pr_op_err("pthread_mutex_init() returned error %d: %s",
+		    error, strerror(error));
+	}
+
 	tmp->table = NULL;
-	tmp->current_workspace = NULL;
 
 	*uris = tmp;
 	return 0;
@@ -158,6 +152,7 @@ db_rrdp_uris_destroy(struct db_rrdp_uri *uris)
 		HASH_DEL(uris->table, uri_node);
 		uris_table_destroy(uri_node);
 	}
+	pthread_mutex_destroy(&uris->lock);
 	free(uris);
 }
 
@@ -174,30 +169,34 @@ db_rrdp_uris_cmp(char const *uri, char const *session_id, unsigned long serial,
 	if (error)
 		return error;
 
+	mutex_lock(&uris->lock);
+
 	found = find_rrdp_uri(uris, uri);
 	if (found == NULL) {
 		pr_val_debug("I don't have state for this Update Notification; downloading snapshot...");
 		*result = RRDP_URI_NOTFOUND;
-		return 0;
+		goto end;
 	}
 
 	if (strcmp(session_id, found->data.session_id) != 0) {
 		pr_val_debug("session_id changed from '%s' to '%s'.",
 		    found->data.session_id, session_id);
 		*result = RRDP_URI_DIFF_SESSION;
-		return 0;
+		goto end;
 	}
 
 	if (serial != found->data.serial) {
 		pr_val_debug("The serial changed from %lu to %lu.",
 		    found->data.serial, serial);
 		*result = RRDP_URI_DIFF_SERIAL;
-		return 0;
+		goto end;
 	}
 
 	pr_val_debug("The new Update Notification has the same session_id (%s) and serial (%lu) as the old one.",
 	    session_id, serial);
 	*result = RRDP_URI_EQUAL;
+end:
+	mutex_unlock(&uris->lock);
 	return 0;
 }
 
@@ -223,7 +222,9 @@ db_rrdp_uris_update(char const *uri, char const *session_id,
 	/* Ownership transfered */
 	db_uri->visited_uris = visited_uris;
 
+	mutex_lock(&uris->lock);
 	add_rrdp_uri(uris, db_uri);
+	mutex_unlock(&uris->lock);
 
 	return 0;
 }
@@ -240,9 +241,13 @@ db_rrdp_uris_get_serial(char const *uri, unsigned long *serial)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-	*serial = found->data.serial;
-	return 0;
+	mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL)
+		*serial = found->data.serial;
+	mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
 int
@@ -257,9 +262,13 @@ db_rrdp_uris_get_last_update(char const *uri, long *date)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-	*date = found->last_update;
-	return 0;
+	mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL)
+		*date = found->last_update;
+	mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
 /* Set the last update to now */
@@ -276,15 +285,18 @@ db_rrdp_uris_set_last_update(char const *uri)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-
 	now = 0;
 	error = get_current_time(&now);
 	if (error)
 		return error;
 
-	found->last_update = (long)now;
-	return 0;
+	mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL)
+		found->last_update = (long)now;
+	mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
 int
@@ -299,9 +311,13 @@ db_rrdp_uris_get_request_status(char const *uri, rrdp_req_status_t *result)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-	*result = found->request_status;
-	return 0;
+	mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL)
+		*result = found->request_status;
+	mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
 int
@@ -316,9 +332,13 @@ db_rrdp_uris_set_request_status(char const *uri, rrdp_req_status_t value)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-	found->request_status = value;
-	return 0;
+	mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL)
+		found->request_status = value;
+	mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
 int
@@ -333,8 +353,10 @@ db_rrdp_uris_set_all_unvisited(void)
 	if (error)
 		return error;
 
+	mutex_lock(&uris->lock);
 	HASH_ITER(hh, uris->table, uri_node, uri_tmp)
 		uri_node->request_status = RRDP_URI_REQ_UNVISITED;
+	mutex_unlock(&uris->lock);
 
 	return 0;
 }
@@ -342,6 +364,9 @@ db_rrdp_uris_set_all_unvisited(void)
 /*
  * Returns a pointer (set in @result) to the visited_uris of the current
  * thread.
+ *
+ * The visited_uris will stay alive until @uri is updated; only the thread that
+ * is synchronizing @uri should use this. (See fetch_begin().)
  */
 int
 db_rrdp_uris_get_visited_uris(char const *uri, struct visited_uris **result)
@@ -355,9 +380,13 @@ db_rrdp_uris_get_visited_uris(char const *uri, struct visited_uris **result)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-	*result = found->visited_uris;
-	return 0;
+	mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL)
+		*result = found->visited_uris;
+	mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
 int
@@ -367,55 +396,59 @@ db_rrdp_uris_remove_all_local(struct db_rrdp_uri *uris, char const *workspace)
 	int error;
 
 	/* Remove each 'visited_uris' from all the table */
+	error = 0;
+	mutex_lock(&uris->lock);
 	HASH_ITER(hh, uris->table, uri_node, uri_tmp) {
 		error = visited_uris_delete_local(uri_node->visited_uris,
 		    workspace);
 		if (error)
-			return error;
+			break;
 	}
+	mutex_unlock(&uris->lock);
 
-	return 0;
+	return error;
 }
 
+/*
+ * The current workspace belongs to the validation state (not to the URIs
+ * table), since each thread traversing the tree might be working on a different
+ * repository.
+ */
 char const *
 db_rrdp_uris_workspace_get(void)
 {
-	struct db_rrdp_uri *uris;
-	int error;
+	struct validation *state;
 
-	uris = NULL;
-	error = get_thread_rrdp_uris(&uris);
-	if (error)
+	state = state_retrieve();
+	if (state == NULL)
 		return NULL;
 
-	return uris->current_workspace;
+	return validation_get_rrdp_current_workspace(state);
 }
 
 int
 db_rrdp_uris_workspace_enable(void)
 {
-	struct db_rrdp_uri *uris;
-	int error;
+	struct validation *state;
 
-	uris = NULL;
-	error = get_thread_rrdp_uris(&uris);
-	if (error)
-		return error;
+	state = state_retrieve();
+	if (state == NULL)
+		return pr_val_err("No state related to this thread");
 
-	return get_thread_rrdp_workspace(&uris->current_workspace);
+	validation_set_rrdp_current_workspace(state,
+	    validation_get_rrdp_workspace(state));
+	return 0;
 }
 
 int
 db_rrdp_uris_workspace_disable(void)
 {
-	struct db_rrdp_uri *uris;
-	int error;
+	struct validation *state;
 
-	uris = NULL;
-	error = get_thread_rrdp_uris(&uris);
-	if (error)
-		return error;
+	state = state_retrieve();
+	if (state == NULL)
+		return pr_val_err("No state related to this thread");
 
-	uris->current_workspace = NULL;
+	validation_set_rrdp_current_workspace(state, NULL);
 	return 0;
 }
@@ -6,6 +6,7 @@
 #include "rsync/rsync.h"
 #include "common.h"
 #include "config.h"
+#include "fetch_scheduler.h"
 #include "log.h"
 #include "reqs_errors.h"
 #include "thread_var.h"
@@ -151,7 +152,7 @@ __rrdp_load(struct rpki_uri *uri, bool force_snapshot, bool *data_updated)
 	 *
 	 * That's why DEBUG_RRDP exists. When it's enabled, RRDP files will not
 	 * be deleted, and config_get_http_enabled() will kick off during
-	 * __http_download_file(). This will allow you to reach the RRDP file
+	 * http_download_start(). This will allow you to reach the RRDP file
 	 * parsing code in offline mode.
 	 *
 	 * I know this is somewhat convoluted, but I haven't found a more
@@ -301,6 +302,26 @@ upd_end:
 	return error;
 }
 
+/*
+ * Same as __rrdp_load(), except it waits if some other thread is already
+ * working on @uri's repository. (Which is why the request status has to be
+ * checked afterwards.)
+ */
+static int
+sync_rrdp_load(struct rpki_uri *uri, bool force_snapshot, bool *data_updated)
+{
+	int error;
+
+	error = fetch_begin(uri_get_global(uri));
+	if (error)
+		return error;
+
+	error = __rrdp_load(uri, force_snapshot, data_updated);
+
+	fetch_end(uri_get_global(uri));
+	return error;
+}
+
 /*
  * Try to get RRDP Update Notification file and process it accordingly.
  *
@@ -321,7 +342,7 @@ upd_end:
 int
 rrdp_load(struct rpki_uri *uri, bool *data_updated)
 {
-	return __rrdp_load(uri, false, data_updated);
+	return sync_rrdp_load(uri, false, data_updated);
 }
 
 /*
@@ -337,5 +358,5 @@ rrdp_reload_snapshot(struct rpki_uri *uri)
 	bool tmp;
 
 	tmp = false;
-	return __rrdp_load(uri, true, &tmp);
+	return sync_rrdp_load(uri, true, &tmp);
 }
@@ -15,6 +15,7 @@
 #include "http/http.h"
 #include "xml/relax_ng.h"
 #include "common.h"
+#include "config.h"
 #include "file.h"
 #include "log.h"
 #include "thread_var.h"
@@ -58,6 +59,42 @@ struct rdr_delta_ctx {
 	struct visited_uris *visited_uris;
 };
 
+/* A snapshot, parsed while it's being downloaded */
+struct rdr_stream_ctx {
+	struct rpki_uri *uri;
+	/* Expected hash of the whole file */
+	unsigned char const *hash;
+	size_t hash_len;
+	/* Element parser */
+	xml_read_cb cb;
+	void *arg;
+
+	/* The following are reset on every download attempt */
+	struct http_stream *stream;
+	EVP_MD_CTX *hash_ctx;
+};
+
+/*
+ * How many deltas of a notification can be downloading at the same time. (Each
+ * one is a concurrent request to the same host.)
+ */
+#define DELTA_WINDOW 8
+
+/* A delta whose download can run ahead of its predecessors' application */
+struct delta_fetch {
+	struct delta_head *head;
+	struct rpki_uri *uri;
+	/* NULL if not started yet, or already finished. */
+	struct http_download *download;
+};
+
+/* The deltas that have to be applied, in serial order */
+struct delta_queue {
+	struct delta_fetch *fetches;
+	size_t count;
+	size_t capacity;
+};
+
 /* Args to send on update (snapshot/delta) files parsing */
 struct proc_upd_args {
 	struct update_notification *parent;
@@ -86,13 +123,15 @@ rem_mft_from_list(struct visited_uris *visited_uris, char const *uri)
 static int
 download_file(struct rpki_uri *uri, long last_update, bool log_operation)
 {
+	struct http_download *download;
 	int error;
 
-	if (last_update > 0)
-		error = http_download_file_with_ims(uri, last_update,
-		    log_operation);
-	else
-		error = http_download_file(uri, log_operation);
+	error = http_download_start(uri, last_update, log_operation,
+	    &download);
+	if (error)
+		return error;
+
+	error = http_download_finish(download);
 
 	/*
 	 * Since distinct files can be downloaded (notification, snapshot,
@@ -741,6 +780,97 @@ xml_read_notification(xmlTextReaderPtr reader, void *arg)
 	return 0;
 }
 
+/* libxml2 input callback; pulls the file from the network. */
+static int
+read_stream(void *context, char *buffer, int len)
+{
+	struct rdr_stream_ctx *ctx = context;
+	int read;
+
+	read = http_stream_read(ctx->stream, (unsigned char *) buffer, len);
+	if (read <= 0)
+		return (read < 0) ? -1 : 0;
+
+	if (hash_stream_update(ctx->hash_ctx, (unsigned char *) buffer,
+	    read) != 0)
+		return -1;
+
+	return read;
+}
+
+static int
+parse_stream(struct http_stream *stream, void *arg)
+{
+	struct rdr_stream_ctx *ctx = arg;
+	unsigned char buffer[4096];
+	int read;
+	int error;
+
+	error = hash_stream_create("sha256", &ctx->hash_ctx);
+	if (error)
+		return error;
+	ctx->stream = stream;
+
+	error = relax_ng_parse_io(uri_get_global(ctx->uri), read_stream, ctx,
+	    ctx->cb, ctx->arg);
+	if (error)
+		goto end;
+
+	/* The hash covers whatever follows the root element as well */
+	while ((read = read_stream(ctx, (char *) buffer, sizeof(buffer))) > 0)
+		;
+	if (read < 0) {
+		error = pr_val_err("Couldn't read the rest of the file.");
+		goto end;
+	}
+
+	/*
+	 * Unlike the original flow (download, check hash, parse), the elements
+	 * have already been exploded by now. A file that doesn't match its hash
+	 * is still an error, and the caller will react as usual (ie. by
+	 * falling back to the snapshot, or to rsync).
+	 */
+	error = hash_stream_validate(ctx->hash_ctx, ctx->hash, ctx->hash_len);
+	if (error)
+		error = pr_val_err("File '%s' does not match its expected hash.",
+		    uri_val_get_printable(ctx->uri));
+
+end:
+	hash_stream_destroy(ctx->hash_ctx);
+	return error;
+}
+
+/*
+ * Downloads the snapshot @uri, and parses it (with @cb, which will
+ * receive @arg) while it arrives. The file is never written to the disk.
+ */
+static int
+parse_rrdp_file(struct rpki_uri *uri, unsigned char const *hash,
+    size_t hash_len, bool log_operation, xml_read_cb cb, void *arg)
+{
+	struct rdr_stream_ctx ctx;
+	int error;
+
+	if (!config_get_http_enabled()) {
+		/* Offline debugging; see DEBUG_RRDP. The file is already here. */
+		error = hash_validate_file("sha256", uri, hash, hash_len);
+		if (error)
+			return error;
+		return relax_ng_parse(uri_get_local(uri), cb, arg);
+	}
+
+	ctx.uri = uri;
+	ctx.hash = hash;
+	ctx.hash_len = hash_len;
+	ctx.cb = cb;
+	ctx.arg = arg;
+
+	error = http_stream(uri, log_operation, parse_stream, &ctx);
+	if (error == -EREQFAILED)
+		return EREQFAILED;
+	return error;
+}
+
 static int
 parse_notification(struct rpki_uri *uri, struct update_notification **file)
 {
@@ -803,11 +933,6 @@ parse_snapshot(struct rpki_uri *uri, struct proc_upd_args *args)
 	int error;
 
 	fnstack_push_uri(uri);
-	/* Hash validation */
-	error = hash_validate_file("sha256", uri, args->parent->snapshot.hash,
-	    args->parent->snapshot.hash_len);
-	if (error)
-		goto pop;
 
 	error = snapshot_create(&snapshot);
 	if (error)
@@ -816,7 +941,9 @@ parse_snapshot(struct rpki_uri *uri, struct proc_upd_args *args)
 	ctx.snapshot = snapshot;
 	ctx.parent = args->parent;
 	ctx.visited_uris = args->visited_uris;
-	error = relax_ng_parse(uri_get_local(uri), xml_read_snapshot, &ctx);
+	error = parse_rrdp_file(uri, args->parent->snapshot.hash,
+	    args->parent->snapshot.hash_len, args->log_operation,
+	    xml_read_snapshot, &ctx);
 
 	/* Error 0 is ok */
 	snapshot_destroy(snapshot);
@@ -860,71 +987,97 @@ xml_read_delta(xmlTextReaderPtr reader, void *arg)
 	return 0;
 }
 
+/* Applies the delta @fetch, which is already (being) downloaded. */
 static int
-parse_delta(struct rpki_uri *uri, struct delta_head *parents_data,
-    struct proc_upd_args *args)
+parse_delta(struct delta_fetch *fetch, struct proc_upd_args *args)
 {
 	struct rdr_delta_ctx ctx;
 	struct delta *delta;
-	struct doc_data *expected_data;
 	int error;
 
-	expected_data = &parents_data->doc_data;
-
-	fnstack_push_uri(uri);
-	error = hash_validate_file("sha256", uri, expected_data->hash,
-	    expected_data->hash_len);
+	/* Also checks the hash */
+	error = http_download_finish(fetch->download);
+	fetch->download = NULL;
+	if (error == -EREQFAILED)
+		return EREQFAILED;
 	if (error)
-		goto pop_fnstack;
+		return error;
 
 	error = delta_create(&delta);
 	if (error)
-		goto pop_fnstack;
+		goto delete_file;
 
 	ctx.delta = delta;
 	ctx.parent = args->parent;
 	ctx.visited_uris = args->visited_uris;
-	ctx.expected_serial = parents_data->serial;
-	error = relax_ng_parse(uri_get_local(uri), xml_read_delta, &ctx);
+	ctx.expected_serial = fetch->head->serial;
+	error = relax_ng_parse(uri_get_local(fetch->uri), xml_read_delta,
+	    &ctx);
 
 	delta_destroy(delta);
 	/* Error 0 is ok */
 
-pop_fnstack:
+delete_file:
+	/* Offline debugging; see DEBUG_RRDP. Leave the file alone. */
+	if (config_get_http_enabled())
+		delete_from_uri(fetch->uri, NULL);
+	return error;
+}
+
+static int
+process_delta(struct delta_fetch *fetch, struct proc_upd_args *args)
+{
+	int error;
+
+	pr_val_debug("Processing delta '%s'.", fetch->head->doc_data.uri);
+	fnstack_push_uri(fetch->uri);
+	error = parse_delta(fetch, args);
 	fnstack_pop();
 	return error;
 }
 
 static int
-process_delta(struct delta_head *delta_head, void *arg)
+queue_delta(struct delta_head *delta_head, void *arg)
 {
-	struct proc_upd_args *args = arg;
-	struct rpki_uri *uri;
-	struct doc_data *head_data;
+	struct delta_queue *queue = arg;
+	struct delta_fetch *fetch;
 	int error;
 
-	head_data = &delta_head->doc_data;
+	if (queue->count == queue->capacity)
+		pr_crit("The delta range is larger than the delta list.");
 
-	pr_val_debug("Processing delta '%s'.", head_data->uri);
-	error = uri_create_https_str_rrdp(&uri, head_data->uri,
-	    strlen(head_data->uri));
+	fetch = &queue->fetches[queue->count];
+	error = uri_create_https_str_rrdp(&fetch->uri,
+	    delta_head->doc_data.uri, strlen(delta_head->doc_data.uri));
 	if (error)
 		return error;
+	fetch->head = delta_head;
+	fetch->download = NULL;
 
-	fnstack_push_uri(uri);
+	queue->count++;
+	return 0;
+}
 
-	error = download_file(uri, 0, args->log_operation);
-	if (error)
-		goto release_uri;
+static int
+start_delta(struct delta_fetch *fetch, bool log_operation)
+{
+	struct doc_data *head_data = &fetch->head->doc_data;
 
-	error = parse_delta(uri, delta_head, args);
+	return http_download_start_hashed(fetch->uri, head_data->hash,
+	    head_data->hash_len, log_operation, &fetch->download);
+}
 
-	delete_from_uri(uri, NULL);
-	/* Error 0 its ok */
-release_uri:
-	fnstack_pop();
-	uri_refput(uri);
-	return error;
+static void
+delta_queue_cleanup(struct delta_queue *queue)
+{
+	size_t i;
+
+	for (i = 0; i < queue->count; i++) {
+		if (queue->fetches[i].download != NULL)
+			http_download_abort(queue->fetches[i].download);
+		uri_refput(queue->fetches[i].uri);
+	}
+	free(queue->fetches);
 }
 
 /*
@@ -1002,6 +1155,7 @@ rrdp_parse_snapshot(struct update_notification *parent,
 
 	args.parent = parent;
 	args.visited_uris = visited_uris;
+	args.log_operation = log_operation;
 
 	pr_val_debug("Processing snapshot '%s'.", parent->snapshot.uri);
 	error = uri_create_https_str_rrdp(&uri, parent->snapshot.uri,
@@ -1010,32 +1164,61 @@ rrdp_parse_snapshot(struct update_notification *parent,
 		return error;
 
 	fnstack_push_uri(uri);
-
-	error = download_file(uri, 0, log_operation);
-	if (error)
-		goto release_uri;
-
 	error = parse_snapshot(uri, &args);
-
-	delete_from_uri(uri, NULL);
-	/* Error 0 is ok */
-release_uri:
 	fnstack_pop();
 	uri_refput(uri);
 	return error;
 }
 
+/*
+ * Applies the deltas from @cur_serial onwards. They are downloaded (and their
+ * hashes checked) DELTA_WINDOW at a time, but applied one by one, in order.
+ */
 int
 rrdp_process_deltas(struct update_notification *parent,
     unsigned long cur_serial, struct visited_uris *visited_uris,
     bool log_operation)
 {
 	struct proc_upd_args args;
+	struct delta_queue queue;
+	size_t started;
+	size_t applied;
+	int error;
 
 	args.parent = parent;
 	args.visited_uris = visited_uris;
 	args.log_operation = log_operation;
 
-	return deltas_head_for_each(&parent->deltas_list,
-	    parent->global_data.serial, cur_serial, process_delta, &args);
+	/* (The range can't be any larger than the list.) */
+	queue.capacity = parent->deltas_list.len;
+	queue.count = 0;
+	queue.fetches = calloc(queue.capacity, sizeof(struct delta_fetch));
+	if (queue.fetches == NULL && queue.capacity > 0)
+		return pr_enomem();
+
+	error = deltas_head_for_each(&parent->deltas_list,
+	    parent->global_data.serial, cur_serial, queue_delta, &queue);
+	if (error)
+		goto end;
+
+	started = 0;
+	for (applied = 0; applied < queue.count; applied++) {
+		for (; started < queue.count; started++) {
+			if (started - applied == DELTA_WINDOW)
+				break;
+			error = start_delta(&queue.fetches[started],
+			    log_operation);
+			if (error)
+				goto end;
+		}
+
+		error = process_delta(&queue.fetches[applied], &args);
+		if (error)
+			goto end;
+	}
+
+end:
+	/* Drops the downloads that were running ahead, if any */
+	delta_queue_cleanup(&queue);
+	return error;
 }
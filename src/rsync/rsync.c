@@ -5,24 +5,45 @@
 #include <unistd.h>
 #include <signal.h> /* SIGINT, SIGQUIT, etc */
 #include <syslog.h>
-#include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
 #include "common.h"
 #include "config.h"
+#include "fetch_scheduler.h"
 #include "log.h"
 #include "reqs_errors.h"
 #include "str_token.h"
 #include "thread_var.h"
+#include "data_structure/uthash_nonfatal.h"
+
+/* A component of the path of a downloaded URI. */
+struct path_node {
+	char *name;
+	/* Was the URI that ends in this component downloaded? */
+	bool downloaded;
+	/* Next components. (Hash table, indexed by @name.) */
+	struct path_node *children;
+	UT_hash_handle hh;
+};
 
-struct uri {
-	struct rpki_uri *uri;
-	SLIST_ENTRY(uri) next;
+/* A downloaded URI, exactly as it was requested. */
+struct visited_uri {
+	char *global;
+	UT_hash_handle hh;
 };
 
-/** URIs that we have already downloaded. */
-SLIST_HEAD(uri_list, uri);
+/*
+ * URIs that we have already downloaded.
+ *
+ * The root strategies need to know whether an ancestor was downloaded, so
+ * they look up @root, one path component at a time. The strict strategy only
+ * cares about the exact URI, so it looks up @table.
+ */
+struct uri_list {
+	struct path_node root;
+	struct visited_uri *table;
+};
 
 /* static char const *const RSYNC_PREFIX = "rsync://"; */
 
@@ -35,23 +56,47 @@ rsync_create(struct uri_list **result)
 	if (visited_uris == NULL)
 		return pr_enomem();
 
-	SLIST_INIT(visited_uris);
+	memset(&visited_uris->root, 0, sizeof(visited_uris->root));
+	visited_uris->table = NULL;
 
 	*result = visited_uris;
 	return 0;
 }
 
-void
-rsync_destroy(struct uri_list *list)
+static void
+path_node_cleanup(struct path_node *node)
 {
-	struct uri *uri;
+	struct path_node *child;
+	struct path_node *tmp;
+
+	HASH_ITER(hh, node->children, child, tmp) {
+		HASH_DEL(node->children, child);
+		path_node_cleanup(child);
+		free(child->name);
+		free(child);
+	}
+	node->downloaded = false;
+}
 
-	while (!SLIST_EMPTY(list)) {
-		uri = SLIST_FIRST(list);
-		SLIST_REMOVE_HEAD(list, next);
-		uri_refput(uri->uri);
-		free(uri);
+static void
+forget_downloaded(struct uri_list *list)
+{
+	struct visited_uri *node;
+	struct visited_uri *tmp;
+
+	path_node_cleanup(&list->root);
+
+	HASH_ITER(hh, list->table, node, tmp) {
+		HASH_DEL(list->table, node);
+		free(node->global);
+		free(node);
 	}
+}
+
+void
+rsync_destroy(struct uri_list *list)
+{
+	forget_downloaded(list);
 	free(list);
 }
 
@@ -91,29 +136,112 @@ is_descendant(struct rpki_uri *ancestor, struct rpki_uri *descendant)
 static bool
 is_already_downloaded(struct rpki_uri *uri, struct uri_list *visited_uris)
 {
-	struct uri *cursor;
+	struct string_tokenizer tokenizer;
+	struct visited_uri *visited;
+	struct path_node *node;
+	struct path_node *child;
+
+	if (config_get_rsync_strategy() == RSYNC_STRICT) {
+		HASH_FIND_STR(visited_uris->table, uri_get_global(uri),
+		    visited);
+		return visited != NULL;
+	}
 
-	/* TODO (next iteration) this is begging for a hash set. */
-	SLIST_FOREACH(cursor, visited_uris, next)
-		if (is_descendant(cursor->uri, uri))
-			return true;
+	/* Same as is_descendant(), against all the visited URIs at once. */
+	string_tokenizer_init(&tokenizer, uri_get_global(uri),
+	    uri_get_global_len(uri), '/');
+
+	node = &visited_uris->root;
+	while (!node->downloaded) {
+		if (!string_tokenizer_next(&tokenizer))
+			return false;
+		HASH_FIND(hh, node->children, tokenizer.str + tokenizer.start,
+		    tokenizer.end - tokenizer.start, child);
+		if (child == NULL)
+			return false;
+		node = child;
+	}
 
-	return false;
+	return true;
 }
 
 static int
-mark_as_downloaded(struct rpki_uri *uri, struct uri_list *visited_uris)
+add_path_node(struct path_node *parent, struct string_tokenizer *tokenizer,
+    struct path_node **result)
 {
-	struct uri *node;
+	struct path_node *node;
+	int error;
+
+	HASH_FIND(hh, parent->children, tokenizer->str + tokenizer->start,
+	    tokenizer->end - tokenizer->start, node);
+	if (node != NULL) {
+		*result = node;
+		return 0;
+	}
 
-	node = malloc(sizeof(struct uri));
+	node = malloc(sizeof(struct path_node));
 	if (node == NULL)
 		return pr_enomem();
+	memset(node, 0, sizeof(struct path_node));
 
-	node->uri = uri;
-	uri_refget(uri);
+	error = token_read(tokenizer, &node->name);
+	if (error) {
+		free(node);
+		return error;
+	}
 
-	SLIST_INSERT_HEAD(visited_uris, node, next);
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, parent->children, node->name, strlen(node->name),
+	    node);
+	if (errno) {
+		free(node->name);
+		free(node);
+		return pr_enomem();
+	}
+
+	*result = node;
+	return 0;
+}
+
+static int
+mark_as_downloaded(struct rpki_uri *uri, struct uri_list *visited_uris)
+{
+	struct string_tokenizer tokenizer;
+	struct visited_uri *visited;
+	struct path_node *node;
+	int error;
+
+	HASH_FIND_STR(visited_uris->table, uri_get_global(uri), visited);
+	if (visited == NULL) {
+		visited = malloc(sizeof(struct visited_uri));
+		if (visited == NULL)
+			return pr_enomem();
+		visited->global = strdup(uri_get_global(uri));
+		if (visited->global == NULL) {
+			free(visited);
+			return pr_enomem();
+		}
+
+		errno = 0;
+		HASH_ADD_KEYPTR(hh, visited_uris->table, visited->global,
+		    strlen(visited->global), visited);
+		if (errno) {
+			free(visited->global);
+			free(visited);
+			return pr_enomem();
+		}
+	}
+
+	string_tokenizer_init(&tokenizer, uri_get_global(uri),
+	    uri_get_global_len(uri), '/');
+
+	node = &visited_uris->root;
+	while (string_tokenizer_next(&tokenizer)) {
+		error = add_path_node(node, &tokenizer, &node);
+		if (error)
+			return error;
+	}
+	node->downloaded = true;
 
 	return 0;
 }
@@ -590,6 +718,7 @@ rsync_download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 	struct validation *state;
 	struct uri_list *visited_uris;
 	struct rpki_uri *rsync_uri;
+	bool downloaded;
 	bool to_op_log;
 	int error;
 
@@ -602,10 +731,15 @@ rsync_download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 
 	visited_uris = validation_rsync_visited_uris(state);
 
-	if (!force && is_already_downloaded(requested_uri, visited_uris)) {
-		pr_val_debug("No need to redownload '%s'.",
-		    uri_val_get_printable(requested_uri));
-		return check_ancestor_error(requested_uri);
+	if (!force) {
+		validation_sync_lock(state);
+		downloaded = is_already_downloaded(requested_uri, visited_uris);
+		validation_sync_unlock(state);
+		if (downloaded) {
+			pr_val_debug("No need to redownload '%s'.",
+			    uri_val_get_printable(requested_uri));
+			return check_ancestor_error(requested_uri);
+		}
 	}
 
 	if (!force) {
@@ -620,6 +754,23 @@ rsync_download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 	if (error)
 		return error;
 
+	/* Some other thread might be rsync'ing the same files right now */
+	error = fetch_begin(uri_get_global(rsync_uri));
+	if (error)
+		goto release_uri;
+
+	if (!force) {
+		validation_sync_lock(state);
+		downloaded = is_already_downloaded(rsync_uri, visited_uris);
+		validation_sync_unlock(state);
+		if (downloaded) {
+			pr_val_debug("'%s' was downloaded by another thread.",
+			    uri_val_get_printable(rsync_uri));
+			error = check_ancestor_error(requested_uri);
+			goto end_fetch;
+		}
+	}
+
 	pr_val_debug("Going to RSYNC '%s'.", uri_val_get_printable(rsync_uri));
 
 	to_op_log = reqs_errors_log_uri(uri_get_global(rsync_uri));
@@ -627,8 +778,10 @@ rsync_download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 	switch(error) {
 	case 0:
 		/* Don't store when "force" and if its already downloaded */
+		validation_sync_lock(state);
 		if (!(force && is_already_downloaded(rsync_uri, visited_uris)))
 			error = mark_as_downloaded(rsync_uri, visited_uris);
+		validation_sync_unlock(state);
 		reqs_errors_rem_uri(uri_get_global(rsync_uri));
 		break;
 	case EREQFAILED:
@@ -636,13 +789,18 @@ rsync_download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 		error = reqs_errors_add_uri(uri_get_global(rsync_uri));
 		if (error)
 			break;
+		validation_sync_lock(state);
 		error = mark_as_downloaded(rsync_uri, visited_uris);
+		validation_sync_unlock(state);
 		/* Everything went ok? Return the original error */
 		if (!error)
 			error = EREQFAILED;
 		break;
 	}
 
+end_fetch:
+	fetch_end(uri_get_global(rsync_uri));
+release_uri:
 	uri_refput(rsync_uri);
 	return error;
 }
@@ -651,19 +809,12 @@ void
 reset_downloaded(void)
 {
 	struct validation *state;
-	struct uri_list *list;
-	struct uri *uri;
 
 	state = state_retrieve();
 	if (state == NULL)
 		return;
 
-	list = validation_rsync_visited_uris(state);
-
-	while (!SLIST_EMPTY(list)) {
-		uri = SLIST_FIRST(list);
-		SLIST_REMOVE_HEAD(list, next);
-		uri_refput(uri->uri);
-		free(uri);
-	}
+	validation_sync_lock(state);
+	forget_downloaded(validation_rsync_visited_uris(state));
+	validation_sync_unlock(state);
 }
@@ -2,25 +2,182 @@
 
 #include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "log.h"
-#include "data_structure/uthash_nonfatal.h"
+#include "data_structure/array_list.h"
 
-struct hashable_roa {
-	struct vrp data;
-	UT_hash_handle hh;
+/*
+ * The table is a few flat arrays of packed records, rather than a hash table of
+ * individually allocated nodes. This keeps a full validation's worth of VRPs
+ * compact and contiguous, which is what the table's main users (the full walks
+ * of the RTR snapshots, the output printer and the delta computation) want.
+ *
+ * Records are appended as they're found, so the arrays start out unsorted and
+ * with duplicates. db_table_seal() sorts and deduplicates them; after that,
+ * lookups are binary searches, and the deltas between two tables can be
+ * computed by merging them.
+ *
+ * Removals (which only SLURM does, and usually only a handful of times) leave
+ * tombstones, so they can happen while the table is being iterated. The next
+ * seal drops them.
+ *
+ * Sealed tables are stored in files as is (see db_table_store()), so they can
+ * be loaded with little more than a memcpy().
+ */
+
+struct v4_roa {
+	/* Host byte order, so the records sort numerically. */
+	uint32_t addr;
+	uint32_t asn;
+	uint8_t prefix_length;
+	uint8_t max_prefix_length;
+	bool removed;
 };
 
-struct hashable_key {
+struct v6_roa {
+	/* Network byte order; memcmp() sorts it numerically already. */
+	struct in6_addr addr;
+	uint32_t asn;
+	uint8_t prefix_length;
+	uint8_t max_prefix_length;
+	bool removed;
+};
+
+struct table_key {
 	struct router_key data;
-	UT_hash_handle hh;
+	bool removed;
 };
 
+STATIC_ARRAY_LIST(v4_roas, struct v4_roa)
+STATIC_ARRAY_LIST(v6_roas, struct v6_roa)
+STATIC_ARRAY_LIST(table_keys, struct table_key)
+
 struct db_table {
-	struct hashable_roa *roas;
-	struct hashable_key *router_keys;
+	struct v4_roas v4;
+	struct v6_roas v6;
+	struct table_keys keys;
+
+	/* Tombstones in the arrays. */
+	unsigned int removed_roas;
+	unsigned int removed_keys;
+
+	/* Are the arrays sorted and free of duplicates? */
+	bool sealed;
 };
 
+/* The operations that can be done on any of the record arrays. */
+struct record_type {
+	size_t size;
+	int (*cmp)(void const *, void const *);
+	bool (*is_removed)(void const *);
+};
+
+static int
+v4_roa_cmp(void const *arg1, void const *arg2)
+{
+	struct v4_roa const *roa1 = arg1;
+	struct v4_roa const *roa2 = arg2;
+
+	if (roa1->addr != roa2->addr)
+		return (roa1->addr < roa2->addr) ? -1 : 1;
+	if (roa1->prefix_length != roa2->prefix_length)
+		return roa1->prefix_length - roa2->prefix_length;
+	if (roa1->max_prefix_length != roa2->max_prefix_length)
+		return roa1->max_prefix_length - roa2->max_prefix_length;
+	if (roa1->asn != roa2->asn)
+		return (roa1->asn < roa2->asn) ? -1 : 1;
+	return 0;
+}
+
+static bool
+v4_roa_is_removed(void const *arg)
+{
+	return ((struct v4_roa const *) arg)->removed;
+}
+
+static int
+v6_roa_cmp(void const *arg1, void const *arg2)
+{
+	struct v6_roa const *roa1 = arg1;
+	struct v6_roa const *roa2 = arg2;
+	int result;
+
+	result = memcmp(&roa1->addr, &roa2->addr, sizeof(roa1->addr));
+	if (result != 0)
+		return result;
+	if (roa1->prefix_length != roa2->prefix_length)
+		return roa1->prefix_length - roa2->prefix_length;
+	if (roa1->max_prefix_length != roa2->max_prefix_length)
+		return roa1->max_prefix_length - roa2->max_prefix_length;
+	if (roa1->asn != roa2->asn)
+		return (roa1->asn < roa2->asn) ? -1 : 1;
+	return 0;
+}
+
+static bool
+v6_roa_is_removed(void const *arg)
+{
+	return ((struct v6_roa const *) arg)->removed;
+}
+
+static int
+table_key_cmp(void const *arg1, void const *arg2)
+{
+	struct router_key const *key1 = &((struct table_key const *) arg1)->data;
+	struct router_key const *key2 = &((struct table_key const *) arg2)->data;
+	int result;
+
+	result = memcmp(key1->ski, key2->ski, RK_SKI_LEN);
+	if (result != 0)
+		return result;
+	if (key1->as != key2->as)
+		return (key1->as < key2->as) ? -1 : 1;
+	return memcmp(key1->spk, key2->spk, RK_SPKI_LEN);
+}
+
+static bool
+table_key_is_removed(void const *arg)
+{
+	return ((struct table_key const *) arg)->removed;
+}
+
+static struct record_type const V4_ROA = {
+	sizeof(struct v4_roa), v4_roa_cmp, v4_roa_is_removed
+};
+static struct record_type const V6_ROA = {
+	sizeof(struct v6_roa), v6_roa_cmp, v6_roa_is_removed
+};
+static struct record_type const TABLE_KEY = {
+	sizeof(struct table_key), table_key_cmp, table_key_is_removed
+};
+
+static void
+v4_roa_to_vrp(struct v4_roa const *roa, struct vrp *vrp)
+{
+	memset(vrp, 0, sizeof(*vrp));
+	vrp->asn = roa->asn;
+	vrp->prefix.v4.s_addr = htonl(roa->addr);
+	vrp->prefix_length = roa->prefix_length;
+	vrp->max_prefix_length = roa->max_prefix_length;
+	vrp->addr_fam = AF_INET;
+}
+
+static void
+v6_roa_to_vrp(struct v6_roa const *roa, struct vrp *vrp)
+{
+	memset(vrp, 0, sizeof(*vrp));
+	vrp->asn = roa->asn;
+	vrp->prefix.v6 = roa->addr;
+	vrp->prefix_length = roa->prefix_length;
+	vrp->max_prefix_length = roa->max_prefix_length;
+	vrp->addr_fam = AF_INET6;
+}
+
 struct db_table *
 db_table_create(void)
 {
@@ -30,56 +187,281 @@ db_table_create(void)
 	if (table == NULL)
 		return NULL;
 
-	table->roas = NULL;
-	table->router_keys = NULL;
+	v4_roas_init(&table->v4);
+	v6_roas_init(&table->v6);
+	table_keys_init(&table->keys);
+	table->removed_roas = 0;
+	table->removed_keys = 0;
+	table->sealed = true;
 	return table;
 }
 
 void
 db_table_destroy(struct db_table *table)
 {
-	struct hashable_roa *node;
-	struct hashable_roa *tmp;
-	struct hashable_key *node_key;
-	struct hashable_key *tmp_key;
+	v4_roas_cleanup(&table->v4, NULL);
+	v6_roas_cleanup(&table->v6, NULL);
+	table_keys_cleanup(&table->keys, NULL);
+	free(table);
+}
 
-	HASH_ITER(hh, table->roas, node, tmp) {
-		HASH_DEL(table->roas, node);
-		free(node);
-	}
+static void
+check_sealed(struct db_table const *table)
+{
+	if (!table->sealed)
+		pr_crit("The DB table needs to be sealed first.");
+}
 
-	HASH_ITER(hh, table->router_keys, node_key, tmp_key) {
-		HASH_DEL(table->router_keys, node_key);
-		free(node_key);
+/*
+ * Drops the tombstones, sorts, and drops the duplicates of @array (whose length
+ * is @len). Returns the new length.
+ */
+static size_t
+seal_array(void *array, size_t len, struct record_type const *type)
+{
+	unsigned char *records = array;
+	size_t i, j;
+
+	j = 0;
+	for (i = 0; i < len; i++) {
+		if (type->is_removed(records + i * type->size))
+			continue;
+		if (i != j)
+			memcpy(records + j * type->size,
+			    records + i * type->size, type->size);
+		j++;
+	}
+	len = j;
+
+	if (len < 2)
+		return len;
+
+	qsort(records, len, type->size, type->cmp);
+
+	j = 1;
+	for (i = 1; i < len; i++) {
+		if (type->cmp(records + (j - 1) * type->size,
+		    records + i * type->size) == 0)
+			continue;
+		if (i != j)
+			memcpy(records + j * type->size,
+			    records + i * type->size, type->size);
+		j++;
 	}
 
-	free(table);
+	return j;
+}
+
+/*
+ * Sorts the table and removes its duplicates. Needed after adding records, and
+ * before reading them.
+ */
+void
+db_table_seal(struct db_table *table)
+{
+	if (table->sealed && table->removed_roas == 0
+	    && table->removed_keys == 0)
+		return;
+
+	table->v4.len = seal_array(table->v4.array, table->v4.len, &V4_ROA);
+	table->v6.len = seal_array(table->v6.array, table->v6.len, &V6_ROA);
+	table->keys.len = seal_array(table->keys.array, table->keys.len,
+	    &TABLE_KEY);
+	table->removed_roas = 0;
+	table->removed_keys = 0;
+	table->sealed = true;
+}
+
+/*
+ * Writes @array's records (whose length is @len) to @file. The table has to be
+ * sealed and free of tombstones.
+ */
+static int
+store_array(void const *array, size_t len, struct record_type const *type,
+    FILE *file)
+{
+	uint32_t count;
+
+	count = len;
+	if (fwrite(&count, sizeof(count), 1, file) != 1)
+		return -EIO;
+	if (len > 0 && fwrite(array, type->size, len, file) != len)
+		return -EIO;
+	return 0;
 }
 
+/*
+ * Appends @table's contents to @file. (Use db_table_load() to read them back.)
+ *
+ * The records are written in this machine's representation, so the file is
+ * only meant to be read by the same build.
+ */
 int
-db_table_foreach_roa(struct db_table const *table, vrp_foreach_cb cb, void *arg)
+db_table_store(struct db_table *table, FILE *file)
 {
-	struct hashable_roa *node, *tmp;
 	int error;
 
-	HASH_ITER(hh, table->roas, node, tmp) {
-		error = cb(&node->data, arg);
-		if (error)
-			return error;
+	db_table_seal(table);
+
+	error = store_array(table->v4.array, table->v4.len, &V4_ROA, file);
+	if (error)
+		return error;
+	error = store_array(table->v6.array, table->v6.len, &V6_ROA, file);
+	if (error)
+		return error;
+	return store_array(table->keys.array, table->keys.len, &TABLE_KEY,
+	    file);
+}
+
+static bool
+v4_roa_is_valid(void const *arg)
+{
+	struct v4_roa const *roa = arg;
+	return roa->prefix_length <= roa->max_prefix_length
+	    && roa->max_prefix_length <= 32;
+}
+
+static bool
+v6_roa_is_valid(void const *arg)
+{
+	struct v6_roa const *roa = arg;
+	return roa->prefix_length <= roa->max_prefix_length
+	    && roa->max_prefix_length <= 128;
+}
+
+static bool
+table_key_is_valid(void const *arg)
+{
+	return true;
+}
+
+/*
+ * Reads an array stored by store_array() from @data (whose length is @left).
+ * Advances both.
+ *
+ * The array has to be sorted and free of duplicates and tombstones, like any
+ * sealed table.
+ */
+static int
+load_array(unsigned char const **data, size_t *left,
+    struct record_type const *type, bool (*is_valid)(void const *),
+    void **result, size_t *result_len)
+{
+	unsigned char *records;
+	uint32_t count;
+	size_t size;
+	size_t i;
+
+	if (*left < sizeof(count))
+		return -EINVAL;
+	memcpy(&count, *data, sizeof(count));
+	*data += sizeof(count);
+	*left -= sizeof(count);
+
+	if (count > *left / type->size)
+		return -EINVAL;
+	size = count * type->size;
+
+	if (count == 0) {
+		*result = NULL;
+		*result_len = 0;
+		return 0;
+	}
+
+	records = malloc(size);
+	if (records == NULL)
+		return pr_enomem();
+	memcpy(records, *data, size);
+
+	for (i = 0; i < count; i++) {
+		if (type->is_removed(records + i * type->size)
+		    || !is_valid(records + i * type->size))
+			goto corrupt;
+		if (i > 0 && type->cmp(records + (i - 1) * type->size,
+		    records + i * type->size) >= 0)
+			goto corrupt;
 	}
 
+	*data += size;
+	*left -= size;
+	*result = records;
+	*result_len = count;
 	return 0;
+
+corrupt:
+	free(records);
+	return -EINVAL;
 }
 
+#define LOAD_LIST(list, type, is_valid) do {				\
+	void *array;							\
+	size_t len;							\
+	int error;							\
+									\
+	error = load_array(data, left, type, is_valid, &array, &len);	\
+	if (error)							\
+		return error;						\
+	(list)->array = array;						\
+	(list)->len = len;						\
+	(list)->capacity = len;						\
+} while (0)
+
+/*
+ * Reads a table stored by db_table_store() from @data (whose length is @left)
+ * into the empty @table. Advances @data and @left.
+ *
+ * Returns -EINVAL if the data is corrupted.
+ */
 int
-db_table_foreach_router_key(struct db_table const *table,
-    router_key_foreach_cb cb, void *arg)
+db_table_load(struct db_table *table, unsigned char const **data,
+    size_t *left)
+{
+	if (table->v4.len != 0 || table->v6.len != 0 || table->keys.len != 0)
+		pr_crit("The DB table needs to be empty.");
+
+	/* Drop the empty arrays; the loaded ones replace them. */
+	v4_roas_cleanup(&table->v4, NULL);
+	v4_roas_init(&table->v4);
+	v6_roas_cleanup(&table->v6, NULL);
+	v6_roas_init(&table->v6);
+	table_keys_cleanup(&table->keys, NULL);
+	table_keys_init(&table->keys);
+
+	LOAD_LIST(&table->v4, &V4_ROA, v4_roa_is_valid);
+	LOAD_LIST(&table->v6, &V6_ROA, v6_roa_is_valid);
+	LOAD_LIST(&table->keys, &TABLE_KEY, table_key_is_valid);
+
+	table->removed_roas = 0;
+	table->removed_keys = 0;
+	table->sealed = true;
+	return 0;
+}
+
+int
+db_table_foreach_roa(struct db_table const *table, vrp_foreach_cb cb, void *arg)
 {
-	struct hashable_key *node, *tmp;
+	struct v4_roa *v4;
+	struct v6_roa *v6;
+	struct vrp vrp;
+	array_index i;
 	int error;
 
-	HASH_ITER(hh, table->router_keys, node, tmp) {
-		error = cb(&node->data, arg);
+	check_sealed(table);
+
+	ARRAYLIST_FOREACH(&table->v4, v4, i) {
+		if (v4->removed)
+			continue;
+		v4_roa_to_vrp(v4, &vrp);
+		error = cb(&vrp, arg);
+		if (error)
+			return error;
+	}
+
+	ARRAYLIST_FOREACH(&table->v6, v6, i) {
+		if (v6->removed)
+			continue;
+		v6_roa_to_vrp(v6, &vrp);
+		error = cb(&vrp, arg);
 		if (error)
 			return error;
 	}
@@ -87,59 +469,118 @@ db_table_foreach_router_key(struct db_table const *table,
 	return 0;
 }
 
-static struct hashable_roa *
-create_roa(uint32_t asn, uint8_t max_length)
+int
+db_table_foreach_router_key(struct db_table const *table,
+    router_key_foreach_cb cb, void *arg)
 {
-	struct hashable_roa *roa;
+	struct table_key *key;
+	array_index i;
+	int error;
 
-	roa = malloc(sizeof(struct hashable_roa));
-	if (roa == NULL)
-		return NULL;
-	/* Needed by uthash */
-	memset(roa, 0, sizeof(struct hashable_roa));
+	check_sealed(table);
 
-	roa->data.asn = asn;
-	roa->data.max_prefix_length = max_length;
+	ARRAYLIST_FOREACH(&table->keys, key, i) {
+		if (key->removed)
+			continue;
+		error = cb(&key->data, arg);
+		if (error)
+			return error;
+	}
 
-	return roa;
+	return 0;
 }
 
+/*
+ * Merges the sorted arrays @a and @b (of lengths @a_len and @b_len) into a new
+ * sorted array, dropping the records they share.
+ */
 static int
-add_roa(struct db_table *table, struct hashable_roa *new)
+merge_arrays(void const *a, size_t a_len, void const *b, size_t b_len,
+    struct record_type const *type, void **result, size_t *result_len)
 {
-	struct hashable_roa *old;
-	int error;
+	unsigned char const *ra = a;
+	unsigned char const *rb = b;
+	unsigned char *merged;
+	size_t i, j, k;
+	int cmp;
+
+	merged = malloc((a_len + b_len) * type->size);
+	if (merged == NULL)
+		return pr_enomem();
 
-	errno = 0;
-	HASH_REPLACE(hh, table->roas, data, sizeof(new->data), new, old);
-	error = errno;
-	if (error) {
-		pr_val_err("ROA couldn't be added to hash table: %s",
-		    strerror(error));
-		return -error;
+	i = j = k = 0;
+	while (i < a_len && j < b_len) {
+		cmp = type->cmp(ra + i * type->size, rb + j * type->size);
+		if (cmp <= 0) {
+			memcpy(merged + k * type->size, ra + i * type->size,
+			    type->size);
+			i++;
+			if (cmp == 0)
+				j++;
+		} else {
+			memcpy(merged + k * type->size, rb + j * type->size,
+			    type->size);
+			j++;
+		}
+		k++;
+	}
+	if (i < a_len) {
+		memcpy(merged + k * type->size, ra + i * type->size,
+		    (a_len - i) * type->size);
+		k += a_len - i;
+	}
+	if (j < b_len) {
+		memcpy(merged + k * type->size, rb + j * type->size,
+		    (b_len - j) * type->size);
+		k += b_len - j;
 	}
-	if (old != NULL)
-		free(old);
 
+	*result = merged;
+	*result_len = k;
 	return 0;
 }
 
-static int
-add_router_key(struct db_table *table, struct hashable_key *new)
+#define MERGE_LIST(dst, src, type) do {					\
+	void *merged;							\
+	size_t merged_len;						\
+	int error;							\
+									\
+	if ((src)->len == 0)						\
+		break;							\
+	if ((dst)->len == 0) {						\
+		free((dst)->array);					\
+		*(dst) = *(src);					\
+		(src)->array = NULL;					\
+		(src)->len = 0;						\
+		(src)->capacity = 0;					\
+		break;							\
+	}								\
+									\
+	error = merge_arrays((dst)->array, (dst)->len, (src)->array,	\
+	    (src)->len, type, &merged, &merged_len);			\
+	if (error)							\
+		return error;						\
+									\
+	free((dst)->array);						\
+	(dst)->array = merged;						\
+	(dst)->capacity = (dst)->len + (src)->len;			\
+	(dst)->len = merged_len;					\
+	(src)->len = 0;							\
+} while (0)
+
+/*
+ * Moves all of @src's ROAs and Router Keys into @dst, dropping duplicates.
+ * @src is left empty. Both tables end up sealed.
+ */
+int
+db_table_merge(struct db_table *dst, struct db_table *src)
 {
-	struct hashable_key *old;
-	int error;
+	db_table_seal(dst);
+	db_table_seal(src);
 
-	errno = 0;
-	HASH_REPLACE(hh, table->router_keys, data, sizeof(new->data), new, old);
-	error = errno;
-	if (error) {
-		pr_val_err("Router Key couldn't be added to hash table: %s",
-		    strerror(error));
-		return -error;
-	}
-	if (old != NULL)
-		free(old);
+	MERGE_LIST(&dst->v4, &src->v4, &V4_ROA);
+	MERGE_LIST(&dst->v6, &src->v6, &V6_ROA);
+	MERGE_LIST(&dst->keys, &src->keys, &TABLE_KEY);
 
 	return 0;
 }
@@ -147,24 +588,54 @@ add_router_key(struct db_table *table, struct hashable_key *new)
 unsigned int
 db_table_roa_count(struct db_table *table)
 {
-	return HASH_COUNT(table->roas);
+	check_sealed(table);
+	return table->v4.len + table->v6.len - table->removed_roas;
 }
 
 unsigned int
 db_table_router_key_count(struct db_table *table)
 {
-	return HASH_COUNT(table->router_keys);
+	check_sealed(table);
+	return table->keys.len - table->removed_keys;
 }
 
 void
 db_table_remove_roa(struct db_table *table, struct vrp const *del)
 {
-	struct hashable_roa *ptr;
+	struct v4_roa key4;
+	struct v6_roa key6;
+	struct v4_roa *found4;
+	struct v6_roa *found6;
+	bool *removed;
+
+	check_sealed(table);
+
+	switch (del->addr_fam) {
+	case AF_INET:
+		key4.addr = ntohl(del->prefix.v4.s_addr);
+		key4.asn = del->asn;
+		key4.prefix_length = del->prefix_length;
+		key4.max_prefix_length = del->max_prefix_length;
+		found4 = bsearch(&key4, table->v4.array, table->v4.len,
+		    sizeof(key4), v4_roa_cmp);
+		removed = (found4 != NULL) ? &found4->removed : NULL;
+		break;
+	case AF_INET6:
+		key6.addr = del->prefix.v6;
+		key6.asn = del->asn;
+		key6.prefix_length = del->prefix_length;
+		key6.max_prefix_length = del->max_prefix_length;
+		found6 = bsearch(&key6, table->v6.array, table->v6.len,
+		    sizeof(key6), v6_roa_cmp);
+		removed = (found6 != NULL) ? &found6->removed : NULL;
+		break;
+	default:
+		return;
+	}
 
-	HASH_FIND(hh, table->roas, del, sizeof(*del), ptr);
-	if (ptr != NULL) {
-		HASH_DELETE(hh, table->roas, ptr);
-		free(ptr);
+	if (removed != NULL && !(*removed)) {
+		*removed = true;
+		table->removed_roas++;
 	}
 }
 
@@ -172,12 +643,17 @@ void
 db_table_remove_router_key(struct db_table *table,
     struct router_key const *del)
 {
-	struct hashable_key *ptr;
+	struct table_key key;
+	struct table_key *found;
 
-	HASH_FIND(hh, table->router_keys, del, sizeof(*del), ptr);
-	if (ptr != NULL) {
-		HASH_DELETE(hh, table->router_keys, ptr);
-		free(ptr);
+	check_sealed(table);
+
+	key.data = *del;
+	found = bsearch(&key, table->keys.array, table->keys.len, sizeof(key),
+	    table_key_cmp);
+	if (found != NULL && !found->removed) {
+		found->removed = true;
+		table->removed_keys++;
 	}
 }
 
@@ -185,119 +661,126 @@ int
 rtrhandler_handle_roa_v4(struct db_table *table, uint32_t asn,
     struct ipv4_prefix const *prefix4, uint8_t max_length)
 {
-	struct hashable_roa *roa;
-	int error;
+	struct v4_roa roa;
 
-	roa = create_roa(asn, max_length);
-	if (roa == NULL)
-		return pr_enomem();
-	roa->data.prefix.v4 = prefix4->addr;
-	roa->data.prefix_length = prefix4->len;
-	roa->data.addr_fam = AF_INET;
+	memset(&roa, 0, sizeof(roa));
+	roa.addr = ntohl(prefix4->addr.s_addr);
+	roa.asn = asn;
+	roa.prefix_length = prefix4->len;
+	roa.max_prefix_length = max_length;
+	roa.removed = false;
 
-	error = add_roa(table, roa);
-	if (error)
-		free(roa);
-	return error;
+	table->sealed = false;
+	return v4_roas_add(&table->v4, &roa);
 }
 
 int
 rtrhandler_handle_roa_v6(struct db_table *table, uint32_t asn,
     struct ipv6_prefix const *prefix6, uint8_t max_length)
 {
-	struct hashable_roa *roa;
-	int error;
+	struct v6_roa roa;
 
-	roa = create_roa(asn, max_length);
-	if (roa == NULL)
-		return pr_enomem();
-	roa->data.prefix.v6 = prefix6->addr;
-	roa->data.prefix_length = prefix6->len;
-	roa->data.addr_fam = AF_INET6;
+	memset(&roa, 0, sizeof(roa));
+	roa.addr = prefix6->addr;
+	roa.asn = asn;
+	roa.prefix_length = prefix6->len;
+	roa.max_prefix_length = max_length;
+	roa.removed = false;
 
-	error = add_roa(table, roa);
-	if (error)
-		free(roa);
-	return error;
+	table->sealed = false;
+	return v6_roas_add(&table->v6, &roa);
 }
 
 int
 rtrhandler_handle_router_key(struct db_table *table,
     unsigned char const *ski, uint32_t as, unsigned char const *spk)
 {
-	struct hashable_key *key;
-	int error;
-
-	key = malloc(sizeof(struct hashable_key));
-	if (key == NULL)
-		return pr_enomem();
-	/* Needed by uthash */
-	memset(key, 0, sizeof(struct hashable_key));
-
-	router_key_init(&key->data, ski, as, spk);
+	struct table_key key;
 
-	error = add_router_key(table, key);
-	if (error)
-		free(key);
+	memset(&key, 0, sizeof(key));
+	router_key_init(&key.data, ski, as, spk);
+	key.removed = false;
 
-	return error;
+	table->sealed = false;
+	return table_keys_add(&table->keys, &key);
 }
 
 /*
- * Copies `@roas1 - roas2` into @deltas.
- *
- * (Places the ROAs that exist in @roas1 but not in @roas2 in @deltas.)
+ * Calls @cb on every record that's in only one of the sorted arrays @old and
+ * @new. The operation will be FLAG_WITHDRAWAL for the ones that are only in
+ * @old, and FLAG_ANNOUNCEMENT for the ones that are only in @new.
  */
 static int
-add_roa_deltas(struct hashable_roa *roas1, struct hashable_roa *roas2,
-    struct deltas *deltas, int op)
+diff_arrays(void const *old, size_t old_len, void const *new, size_t new_len,
+    struct record_type const *type,
+    int (*cb)(void const *, struct deltas *, int), struct deltas *deltas)
 {
-	struct hashable_roa *n1; /* A node from @roas1 */
-	struct hashable_roa *n2; /* A node from @roas2 */
-	struct hashable_roa *tmp;
+	unsigned char const *ro = old;
+	unsigned char const *rn = new;
+	size_t i, j;
+	int cmp;
 	int error;
 
-	HASH_ITER(hh, roas1, n1, tmp) {
-		HASH_FIND(hh, roas2, &n1->data, sizeof(n1->data), n2);
-		if (n2 == NULL) {
-			error = deltas_add_roa(deltas, &n1->data, op);
-			if (error)
-				return error;
+	i = j = 0;
+	while (i < old_len || j < new_len) {
+		if (i < old_len && type->is_removed(ro + i * type->size)) {
+			i++;
+			continue;
+		}
+		if (j < new_len && type->is_removed(rn + j * type->size)) {
+			j++;
+			continue;
+		}
+
+		if (i == old_len)
+			cmp = 1;
+		else if (j == new_len)
+			cmp = -1;
+		else
+			cmp = type->cmp(ro + i * type->size,
+			    rn + j * type->size);
+
+		if (cmp < 0) {
+			error = cb(ro + i * type->size, deltas,
+			    FLAG_WITHDRAWAL);
+			i++;
+		} else if (cmp > 0) {
+			error = cb(rn + j * type->size, deltas,
+			    FLAG_ANNOUNCEMENT);
+			j++;
+		} else {
+			error = 0;
+			i++;
+			j++;
 		}
+		if (error)
+			return error;
 	}
 
 	return 0;
 }
 
 static int
-add_router_key_delta(struct deltas *deltas, struct hashable_key *key, int op)
+add_v4_delta(void const *roa, struct deltas *deltas, int op)
 {
-	return deltas_add_router_key(deltas, &key->data, op);
+	struct vrp vrp;
+	v4_roa_to_vrp(roa, &vrp);
+	return deltas_add_roa(deltas, &vrp, op);
 }
 
-/*
- * Copies `@keys1 - keys2` into @deltas.
- *
- * (Places the Router Keys that exist in @keys1 but not in @key2 in @deltas.)
- */
 static int
-add_router_key_deltas(struct hashable_key *keys1, struct hashable_key *keys2,
-    struct deltas *deltas, int op)
+add_v6_delta(void const *roa, struct deltas *deltas, int op)
 {
-	struct hashable_key *n1; /* A node from @keys1 */
-	struct hashable_key *n2; /* A node from @keys2 */
-	int error;
-
-	for (n1 = keys1; n1 != NULL; n1 = n1->hh.next) {
-		HASH_FIND(hh, keys2, &n1->data, sizeof(n1->data), n2);
-		if (n2 == NULL) {
-			error = add_router_key_delta(deltas, n1, op);
-			if (error)
-				return error;
-		}
-	}
+	struct vrp vrp;
+	v6_roa_to_vrp(roa, &vrp);
+	return deltas_add_roa(deltas, &vrp, op);
+}
 
-	return 0;
+static int
+add_router_key_delta(void const *key, struct deltas *deltas, int op)
+{
+	return deltas_add_router_key(deltas,
+	    &((struct table_key const *) key)->data, op);
 }
 
 int
@@ -307,22 +790,23 @@ compute_deltas(struct db_table *old, struct db_table *new,
 	struct deltas *deltas;
 	int error;
 
+	check_sealed(old);
+	check_sealed(new);
+
 	error = deltas_create(&deltas);
 	if (error)
 		return error;
 
-	error = add_roa_deltas(new->roas, old->roas, deltas, FLAG_ANNOUNCEMENT);
-	if (error)
-		goto fail;
-	error = add_roa_deltas(old->roas, new->roas, deltas, FLAG_WITHDRAWAL);
+	error = diff_arrays(old->v4.array, old->v4.len, new->v4.array,
+	    new->v4.len, &V4_ROA, add_v4_delta, deltas);
 	if (error)
 		goto fail;
-	error = add_router_key_deltas(new->router_keys, old->router_keys,
-	    deltas, FLAG_ANNOUNCEMENT);
+	error = diff_arrays(old->v6.array, old->v6.len, new->v6.array,
+	    new->v6.len, &V6_ROA, add_v6_delta, deltas);
 	if (error)
 		goto fail;
-	error = add_router_key_deltas(old->router_keys, new->router_keys,
-	    deltas, FLAG_WITHDRAWAL);
+	error = diff_arrays(old->keys.array, old->keys.len, new->keys.array,
+	    new->keys.len, &TABLE_KEY, add_router_key_delta, deltas);
 	if (error)
 		goto fail;
 
@@ -1,6 +1,7 @@
 #ifndef SRC_RTR_DB_DB_TABLE_H_
 #define SRC_RTR_DB_DB_TABLE_H_
 
+#include <stdio.h>
 #include "types/address.h"
 #include "types/vrp.h"
 #include "rtr/db/delta.h"
@@ -10,6 +11,13 @@ struct db_table;
 struct db_table *db_table_create(void);
 void db_table_destroy(struct db_table *);
 
+void db_table_seal(struct db_table *);
+
+int db_table_merge(struct db_table *, struct db_table *);
+
+int db_table_store(struct db_table *, FILE *);
+int db_table_load(struct db_table *, unsigned char const **, size_t *);
+
 unsigned int db_table_roa_count(struct db_table *);
 unsigned int db_table_router_key_count(struct db_table *);
 
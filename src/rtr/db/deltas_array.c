@@ -31,6 +31,26 @@ darray_create(void)
 	return result;
 }
 
+/* Returns a new array that holds references to the same deltas as @src. */
+struct deltas_array *
+darray_copy(struct deltas_array const *src)
+{
+	struct deltas_array *result;
+	unsigned int i;
+
+	result = darray_create();
+	if (result == NULL)
+		return NULL;
+
+	for (i = 0; i < src->len; i++) {
+		result->array[i] = src->array[i];
+		deltas_refget(result->array[i]);
+	}
+	result->len = src->len;
+	result->last = src->last;
+	return result;
+}
+
 void
 darray_destroy(struct deltas_array *darray)
 {
@@ -7,6 +7,7 @@
 struct deltas_array;
 
 struct deltas_array *darray_create(void);
+struct deltas_array *darray_copy(struct deltas_array const *);
 void darray_destroy(struct deltas_array *);
 
 unsigned int darray_len(struct deltas_array *);
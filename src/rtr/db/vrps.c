@@ -1,91 +1,207 @@
 #include "vrps.h"
 
+#include <sys/queue.h>
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <time.h>
-#include <sys/queue.h>
+#include <unistd.h>
+#include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
+#include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 
 #include "common.h"
 #include "output_printer.h"
 #include "validation_handler.h"
 #include "types/router_key.h"
 #include "data_structure/array_list.h"
+#include "data_structure/uthash_nonfatal.h"
 #include "object/tal.h"
+#include "rtr/pdu.h"
 #include "rtr/rtr.h"
 #include "rtr/db/db_table.h"
+#include "rtr/db/vrps_file.h"
 #include "slurm/slurm_loader.h"
 #include "thread/thread_pool.h"
 
+/* The hash key is @delta.vrp or @delta.router_key; the flags are the value. */
 struct vrp_node {
 	struct delta_vrp delta;
-	SLIST_ENTRY(vrp_node) next;
+	UT_hash_handle hh;
 };
 
 struct rk_node {
 	struct delta_router_key delta;
-	SLIST_ENTRY(rk_node) next;
+	UT_hash_handle hh;
 };
 
-/** Sorted list to filter deltas */
-SLIST_HEAD(vrp_slist, vrp_node);
-SLIST_HEAD(rk_slist, rk_node);
+/** Hash sets to filter deltas */
+struct delta_filter {
+	struct vrp_node *prefixes;
+	struct rk_node *router_keys;
+	/*
+	 * Deltas that share a serial never cancel each other, so the first
+	 * serial's entries do not need to be looked up.
+	 */
+	bool lookup;
+};
 
-struct sorted_lists {
-	struct vrp_slist prefixes;
-	struct rk_slist router_keys;
+/*
+ * The deltas from serial @from to the current serial, minus the ones that
+ * cancel each other.
+ */
+struct coalesced_deltas {
+	serial_t from;
+	struct deltas *deltas;
+	UT_hash_handle hh;
 };
 
-struct state {
-	/**
-	 * All the current valid ROAs.
-	 *
-	 * Can be NULL, so handle gracefully.
-	 * (We use this to know we're supposed to generate a @deltas entry
-	 * during the current iteration.)
-	 */
+/*
+ * The result of a validation cycle, as seen by the RTR server.
+ *
+ * Versions are immutable once published (except for the @coalesced cache), so
+ * readers don't need to lock them. They're refcounted instead; a reader that
+ * has a reference can take as long as it wants, and the version is released
+ * when the last reader is done with it.
+ */
+struct vrps_version {
+	/** All the valid ROAs and Router Keys. Sealed. */
 	struct db_table *base;
 	/** DB changes to @base over time. */
 	struct deltas_array *deltas;
-
 	/*
-	 * Last valid SLURM applied to base.
-	 *
-	 * Doesn't need locking, because the only writer is also the only
-	 * reader.
+	 * @deltas, already coalesced for the serials routers have asked for.
+	 * (Indexed by starting serial.)
+	 * Routers tend to share serials, so this saves most of the filtering.
 	 */
-	struct db_slurm *slurm;
+	struct coalesced_deltas *coalesced;
+	/*
+	 * @base, already serialized for every RTR version. (Indexed by
+	 * version.) An entry is NULL if it could not be built; in that case,
+	 * Reset Queries need to serialize @base themselves.
+	 */
+	struct pdu_snapshot *snapshots[RTR_V1 + 1];
 
 	/*
 	 * This is the serial number of base.
 	 *
 	 * At least one RTR client implementation (Cloudflare's rpki-rtr-client)
-	 * malfunctions if the validator uses zero as the first serial, so this
-	 * value behaves as follows:
+	 * malfunctions if the validator uses zero as the first serial, so the
+	 * first version's serial is 1, and every following version's serial is
+	 * its predecessor's plus 1.
 	 *
-	 * serial = 0. After every successful validation cycle, serial++.
+	 * Zero is totally a valid serial, though, particularly when the integer
+	 * wraps.
+	 */
+	serial_t serial;
+
+	atomic_uint references;
+};
+
+struct state {
+	/*
+	 * The latest version. NULL until the first validation cycle ends.
 	 *
-	 * Do not use this value to check whether we already finished our first
-	 * validation. (Use base != NULL for that.) Zero is totally a valid
-	 * serial, particularly when the integer wraps.
+	 * Only vrps_update() replaces it. Readers need to pin it
+	 * (version_pin()) before using it.
+	 */
+	_Atomic(struct vrps_version *) current;
+
+	/*
+	 * Last valid SLURM applied to base.
 	 *
-	 * TODO (fine) this should probably be moved to struct db_table.
+	 * Doesn't need locking, because the only writer is also the only
+	 * reader.
 	 */
-	serial_t serial;
+	struct db_slurm *slurm;
+
 	uint16_t v0_session_id;
 	uint16_t v1_session_id;
 };
 
 static struct state state;
 
+/*
+ * The VRPs and Router Keys a thread has found during the current validation
+ * cycle. Every thread fills its own table, so adding to them doesn't need any
+ * locking; they're merged once the validation is over.
+ */
+struct thread_table {
+	/* NULL if the thread hasn't found anything during this cycle. */
+	struct db_table *db;
+	SLIST_ENTRY(thread_table) next;
+};
+
+SLIST_HEAD(thread_tables, thread_table);
+
 /* Thread pool to use when the TALs will be processed */
 static struct thread_pool *pool;
 
-/** Protects @state.base, @state.deltas and @state.serial. */
-static pthread_rwlock_t state_lock;
+/*
+ * A reader's announcement that it's about to take a reference to @version.
+ *
+ * Between loading @state.current and incrementing its reference count, a
+ * reader holds a pointer to a version it doesn't own yet. So that the writer
+ * doesn't release the version in the meantime, the reader publishes the
+ * pointer here first, and the writer waits for the hazards that point to the
+ * version it's replacing. (The window is a handful of instructions long, so
+ * the writer practically never waits.)
+ *
+ * Hazards are never freed while the module is alive; they're recycled when
+ * their threads die.
+ */
+struct hazard {
+	_Atomic(struct vrps_version *) version;
+	/* Does some thread own this hazard? */
+	atomic_bool used;
+	/* Immutable once the hazard is in @hazards. */
+	struct hazard *next;
+};
+
+/* Every hazard that has ever been needed. Push-only. */
+static _Atomic(struct hazard *) hazards;
+/* Each thread's hazard. */
+static pthread_key_t hazard_key;
+
+/* Each thread's struct thread_table. */
+static pthread_key_t thread_table_key;
+/* The thread tables that have a @db. */
+static struct thread_tables thread_tables;
+/*
+ * Protects @thread_tables. Threads only need it the first time they find
+ * something during a cycle.
+ */
+static pthread_mutex_t thread_tables_lock;
+
+/* Protects the @coalesced of every version. */
+static pthread_mutex_t coalesced_lock;
+
+/* Thread exit destructor. */
+static void
+hazard_release(void *arg)
+{
+	struct hazard *hazard = arg;
+	atomic_store(&hazard->used, false);
+}
 
-/** Lock to protect ROA table during construction. */
-static pthread_rwlock_t table_lock;
+/* Thread exit destructor. */
+static void
+thread_table_discard(void *arg)
+{
+	struct thread_table *table = arg;
+
+	if (table->db != NULL) {
+		mutex_lock(&thread_tables_lock);
+		SLIST_REMOVE(&thread_tables, table, thread_table, next);
+		mutex_unlock(&thread_tables_lock);
+		db_table_destroy(table->db);
+	}
+
+	free(table);
+}
 
 int
 vrps_init(void)
@@ -99,25 +215,18 @@ vrps_init(void)
 	if (error)
 		return error;
 
-	state.base = NULL;
-	state.deltas = darray_create();
-	if (state.deltas == NULL) {
-		error = pr_enomem();
-		goto revert_thread_pool;
-	}
-
 	/*
-	 * Use the same start serial, the session ID will avoid
+	 * Every run uses the same start serial; the session ID will avoid
 	 * "desynchronization" (more at RFC 6810 'Glossary' and
 	 * 'Fields of a PDU')
 	 */
-	state.serial = 0;
+	atomic_init(&state.current, NULL);
 
 	/* Get the bits that'll fit in session_id */
 	now = 0;
 	error = get_current_time(&now);
 	if (error)
-		goto revert_deltas;
+		goto revert_thread_pool;
 	state.v0_session_id = now & 0xFFFF;
 
 	/* Minus 1 to prevent same ID */
@@ -127,73 +236,436 @@ vrps_init(void)
 
 	state.slurm = NULL;
 
-	error = pthread_rwlock_init(&state_lock, NULL);
+	atomic_init(&hazards, NULL);
+	error = pthread_key_create(&hazard_key, hazard_release);
 	if (error) {
-		pr_op_err("state pthread_rwlock_init() errored: %s",
+		pr_op_err("hazard pthread_key_create() errored: %s",
 		    strerror(error));
-		goto revert_deltas;
+		goto revert_thread_pool;
 	}
 
-	error = pthread_rwlock_init(&table_lock, NULL);
+	SLIST_INIT(&thread_tables);
+	error = pthread_mutex_init(&thread_tables_lock, NULL);
 	if (error) {
-		pr_op_err("table pthread_rwlock_init() errored: %s",
+		pr_op_err("thread tables pthread_mutex_init() errored: %s",
 		    strerror(error));
-		goto revert_state_lock;
+		goto revert_hazard_key;
+	}
+
+	error = pthread_key_create(&thread_table_key, thread_table_discard);
+	if (error) {
+		pr_op_err("thread table pthread_key_create() errored: %s",
+		    strerror(error));
+		goto revert_thread_tables_lock;
+	}
+
+	error = pthread_mutex_init(&coalesced_lock, NULL);
+	if (error) {
+		pr_op_err("coalesced deltas pthread_mutex_init() errored: %s",
+		    strerror(error));
+		goto revert_thread_table_key;
 	}
 
 	return 0;
 
-revert_state_lock:
-	pthread_rwlock_destroy(&state_lock);
-revert_deltas:
-	darray_destroy(state.deltas);
+revert_thread_table_key:
+	pthread_key_delete(thread_table_key);
+revert_thread_tables_lock:
+	pthread_mutex_destroy(&thread_tables_lock);
+revert_hazard_key:
+	pthread_key_delete(hazard_key);
 revert_thread_pool:
 	thread_pool_destroy(pool);
 	return error;
 }
 
+static void
+snapshots_release(struct pdu_snapshot **snapshots)
+{
+	uint8_t version;
+
+	for (version = RTR_V0; version <= RTR_V1; version++)
+		if (snapshots[version] != NULL)
+			pdu_snapshot_refput(snapshots[version]);
+}
+
+static void
+version_refput(struct vrps_version *version)
+{
+	struct coalesced_deltas *node;
+	struct coalesced_deltas *tmp;
+
+	if (atomic_fetch_sub(&version->references, 1) != 1)
+		return;
+
+	HASH_ITER(hh, version->coalesced, node, tmp) {
+		HASH_DEL(version->coalesced, node);
+		deltas_refput(node->deltas);
+		free(node);
+	}
+	darray_destroy(version->deltas);
+	snapshots_release(version->snapshots);
+	db_table_destroy(version->base);
+	free(version);
+}
+
+/* Returns the calling thread's hazard, allocating it if necessary. */
+static int
+get_hazard(struct hazard **result)
+{
+	struct hazard *hazard;
+	bool unused;
+	int error;
+
+	hazard = pthread_getspecific(hazard_key);
+	if (hazard != NULL) {
+		*result = hazard;
+		return 0;
+	}
+
+	/* Try to recycle a dead thread's hazard first */
+	for (hazard = atomic_load(&hazards); hazard != NULL;
+	    hazard = hazard->next) {
+		unused = false;
+		if (atomic_compare_exchange_strong(&hazard->used, &unused,
+		    true))
+			goto found;
+	}
+
+	hazard = malloc(sizeof(struct hazard));
+	if (hazard == NULL)
+		return pr_enomem();
+	atomic_init(&hazard->version, NULL);
+	atomic_init(&hazard->used, true);
+	hazard->next = atomic_load(&hazards);
+	while (!atomic_compare_exchange_weak(&hazards, &hazard->next, hazard))
+		;
+
+found:
+	error = pthread_setspecific(hazard_key, hazard);
+	if (error) {
+		atomic_store(&hazard->used, false);
+		pr_op_err("pthread_setspecific() returned error %d: %s", error,
+		    strerror(error));
+		return -error;
+	}
+
+	*result = hazard;
+	return 0;
+}
+
+/*
+ * Takes a reference to the current version. Don't forget to version_refput()
+ * it.
+ *
+ * Returns -EAGAIN if there is no version yet.
+ */
+static int
+version_pin(struct vrps_version **result)
+{
+	struct hazard *hazard;
+	struct vrps_version *version;
+	int error;
+
+	error = get_hazard(&hazard);
+	if (error)
+		return error;
+
+	/*
+	 * If @state.current didn't change after the hazard was published, the
+	 * writer is either going to see the hazard, or hasn't replaced the
+	 * version yet.
+	 */
+	do {
+		version = atomic_load(&state.current);
+		if (version == NULL)
+			break;
+		atomic_store(&hazard->version, version);
+	} while (version != atomic_load(&state.current));
+
+	if (version != NULL)
+		atomic_fetch_add(&version->references, 1);
+	atomic_store(&hazard->version, NULL);
+
+	if (version == NULL)
+		return -EAGAIN;
+
+	*result = version;
+	return 0;
+}
+
+/*
+ * Replaces the current version with @version (whose reference is transferred
+ * to the state).
+ *
+ * The readers that have already pinned the old version keep using it; it will
+ * be released once they're done. Only the single writer may call this.
+ */
+static void
+version_publish(struct vrps_version *version)
+{
+	struct vrps_version *old;
+	struct hazard *hazard;
+
+	old = atomic_exchange(&state.current, version);
+	if (old == NULL)
+		return;
+
+	/* Wait for the readers that are about to take a reference to @old. */
+	for (hazard = atomic_load(&hazards); hazard != NULL;
+	    hazard = hazard->next)
+		while (atomic_load(&hazard->version) == old)
+			sched_yield();
+
+	version_refput(old);
+}
+
+/*
+ * Detaches the thread tables from their threads. Returns them in @result
+ * (and their count in @count). Call while no thread is validating.
+ */
+static int
+collect_thread_tables(struct db_table ***result, unsigned int *count)
+{
+	struct thread_table *table;
+	struct db_table **dbs;
+	unsigned int n;
+
+	n = 0;
+	SLIST_FOREACH(table, &thread_tables, next)
+		n++;
+
+	dbs = NULL;
+	if (n > 0) {
+		dbs = calloc(n, sizeof(struct db_table *));
+		if (dbs == NULL)
+			return pr_enomem();
+	}
+
+	n = 0;
+	while (!SLIST_EMPTY(&thread_tables)) {
+		table = SLIST_FIRST(&thread_tables);
+		SLIST_REMOVE_HEAD(&thread_tables, next);
+		dbs[n++] = table->db;
+		table->db = NULL;
+	}
+
+	*result = dbs;
+	*count = n;
+	return 0;
+}
+
+/* Drops whatever the threads found during the cycle. */
+static void
+discard_thread_tables(void)
+{
+	struct db_table **dbs;
+	unsigned int count;
+	unsigned int i;
+
+	if (collect_thread_tables(&dbs, &count) != 0) {
+		/* Can't even allocate the array; do it the slow way. */
+		while (!SLIST_EMPTY(&thread_tables)) {
+			db_table_destroy(SLIST_FIRST(&thread_tables)->db);
+			SLIST_FIRST(&thread_tables)->db = NULL;
+			SLIST_REMOVE_HEAD(&thread_tables, next);
+		}
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		db_table_destroy(dbs[i]);
+	free(dbs);
+}
+
 void
 vrps_destroy(void)
 {
+	struct vrps_version *version;
+	struct hazard *hazard, *next;
+
 	thread_pool_destroy(pool);
 
-	pthread_rwlock_destroy(&state_lock);
-	pthread_rwlock_destroy(&table_lock);
+	discard_thread_tables();
+	pthread_key_delete(thread_table_key);
+	pthread_mutex_destroy(&thread_tables_lock);
+
+	pthread_mutex_destroy(&coalesced_lock);
 
 	if (state.slurm != NULL)
 		db_slurm_destroy(state.slurm);
 
-	darray_destroy(state.deltas);
-	if (state.base != NULL)
-		db_table_destroy(state.base);
+	/* There should be no readers left at this point. */
+	version = atomic_exchange(&state.current, NULL);
+	if (version != NULL)
+		version_refput(version);
+
+	pthread_key_delete(hazard_key);
+	hazard = atomic_exchange(&hazards, NULL);
+	while (hazard != NULL) {
+		next = hazard->next;
+		free(hazard);
+		hazard = next;
+	}
 }
 
-#define WLOCK_HANDLER(cb)						\
-	int error;							\
-	rwlock_write_lock(&table_lock);					\
-	error = cb;							\
-	rwlock_unlock(&table_lock);					\
-	return error;
+/* Returns the calling thread's table for the current cycle. */
+static struct db_table *
+get_thread_db(void)
+{
+	struct thread_table *table;
+	int error;
+
+	table = pthread_getspecific(thread_table_key);
+	if (table == NULL) {
+		table = malloc(sizeof(struct thread_table));
+		if (table == NULL)
+			return NULL;
+		table->db = NULL;
+
+		error = pthread_setspecific(thread_table_key, table);
+		if (error) {
+			pr_op_err("pthread_setspecific() returned error %d: %s",
+			    error, strerror(error));
+			free(table);
+			return NULL;
+		}
+	}
+
+	if (table->db == NULL) {
+		table->db = db_table_create();
+		if (table->db == NULL)
+			return NULL;
+
+		mutex_lock(&thread_tables_lock);
+		SLIST_INSERT_HEAD(&thread_tables, table, next);
+		mutex_unlock(&thread_tables_lock);
+	}
+
+	return table->db;
+}
+
+/*
+ * The handlers' @arg is the final table, which is not touched until the
+ * validation is over. (See merge_thread_tables().)
+ */
 
 int
 handle_roa_v4(uint32_t as, struct ipv4_prefix const *prefix,
     uint8_t max_length, void *arg)
 {
-	WLOCK_HANDLER(rtrhandler_handle_roa_v4(arg, as, prefix, max_length))
+	struct db_table *db;
+
+	db = get_thread_db();
+	if (db == NULL)
+		return pr_enomem();
+
+	return rtrhandler_handle_roa_v4(db, as, prefix, max_length);
 }
 
 int
 handle_roa_v6(uint32_t as, struct ipv6_prefix const * prefix,
     uint8_t max_length, void *arg)
 {
-	WLOCK_HANDLER(rtrhandler_handle_roa_v6(arg, as, prefix, max_length))
+	struct db_table *db;
+
+	db = get_thread_db();
+	if (db == NULL)
+		return pr_enomem();
+
+	return rtrhandler_handle_roa_v6(db, as, prefix, max_length);
 }
 
 int
 handle_router_key(unsigned char const *ski, uint32_t as,
     unsigned char const *spk, void *arg)
 {
-	WLOCK_HANDLER(rtrhandler_handle_router_key(arg, ski, as, spk))
+	struct db_table *db;
+
+	db = get_thread_db();
+	if (db == NULL)
+		return pr_enomem();
+
+	return rtrhandler_handle_router_key(db, ski, as, spk);
+}
+
+struct merge_task {
+	struct db_table *dst;
+	struct db_table *src;
+	int error;
+};
+
+static void
+merge_task(void *arg)
+{
+	struct merge_task *task = arg;
+
+	task->error = db_table_merge(task->dst, task->src);
+	db_table_destroy(task->src);
+}
+
+/*
+ * Moves the contents of the thread tables into @db.
+ *
+ * The tables are merged in pairs, in parallel, until only one is left.
+ */
+static int
+merge_thread_tables(struct db_table *db)
+{
+	struct db_table **dbs;
+	struct merge_task *tasks;
+	unsigned int count;
+	unsigned int step;
+	unsigned int t;
+	unsigned int i;
+	int error;
+
+	error = collect_thread_tables(&dbs, &count);
+	if (error) {
+		discard_thread_tables();
+		return error;
+	}
+	if (count == 0)
+		return 0;
+
+	tasks = calloc(count / 2 + 1, sizeof(struct merge_task));
+	if (tasks == NULL) {
+		error = pr_enomem();
+		goto end;
+	}
+
+	for (step = 1; step < count; step *= 2) {
+		t = 0;
+		for (i = 0; i + step < count; i += 2 * step) {
+			tasks[t].dst = dbs[i];
+			tasks[t].src = dbs[i + step];
+			tasks[t].error = 0;
+			dbs[i + step] = NULL;
+			if (thread_pool_push(pool, "VRP merge", merge_task,
+			    &tasks[t]) != 0) {
+				/* Just do it here */
+				merge_task(&tasks[t]);
+			}
+			t++;
+		}
+		thread_pool_wait(pool);
+
+		for (i = 0; i < t; i++)
+			if (tasks[i].error)
+				error = tasks[i].error;
+		if (error)
+			goto end;
+	}
+
+	error = db_table_merge(db, dbs[0]);
+
+end:
+	for (i = 0; i < count; i++)
+		if (dbs[i] != NULL)
+			db_table_destroy(dbs[i]);
+	free(tasks);
+	free(dbs);
+	return error;
 }
 
 static int
@@ -208,10 +680,18 @@ __perform_standalone_validation(struct db_table **result)
 
 	error = perform_standalone_validation(pool, db);
 	if (error) {
+		discard_thread_tables();
 		db_table_destroy(db);
 		return error;
 	}
 
+	error = merge_thread_tables(db);
+	if (error) {
+		db_table_destroy(db);
+		return error;
+	}
+	db_table_seal(db);
+
 	*result = db;
 	return 0;
 }
@@ -244,23 +724,199 @@ __compute_deltas(struct db_table *old_base, struct db_table *new_base,
 	return 0;
 }
 
+/*
+ * Like deltas, the snapshots are nice-to-haves, so errors are not fatal.
+ * Reset Queries will fall back to serializing the base on their own.
+ */
+static void
+build_snapshots(struct db_table *base, struct pdu_snapshot **snapshots)
+{
+	uint8_t version;
+	int error;
+
+	for (version = RTR_V0; version <= RTR_V1; version++) {
+		error = pdu_snapshot_create(base, version, &snapshots[version]);
+		if (error) {
+			pr_op_warn("RTRv%u snapshot could not be built: %s",
+			    version, strerror(abs(error)));
+			snapshots[version] = NULL;
+		}
+	}
+}
+
+/*
+ * Builds the version that follows @old. Takes over @base, @deltas and
+ * @snapshots, unless it fails.
+ */
+static int
+version_create(struct vrps_version *old, struct db_table *base,
+    struct deltas *deltas, struct pdu_snapshot **snapshots,
+    struct vrps_version **result)
+{
+	struct vrps_version *version;
+
+	version = malloc(sizeof(struct vrps_version));
+	if (version == NULL)
+		return pr_enomem();
+
+	/*
+	 * If the latest base has no deltas, all existing deltas are rendered
+	 * useless. This is because clients always want to reach the latest
+	 * serial, no matter where they are.
+	 */
+	version->deltas = (old != NULL && deltas != NULL)
+	    ? darray_copy(old->deltas)
+	    : darray_create();
+	if (version->deltas == NULL) {
+		free(version);
+		return pr_enomem();
+	}
+	if (deltas != NULL)
+		darray_add(version->deltas, deltas);
+
+	version->base = base;
+	version->coalesced = NULL;
+	memcpy(version->snapshots, snapshots, sizeof(version->snapshots));
+	version->serial = (old != NULL) ? (old->serial + 1) : 1;
+	atomic_init(&version->references, 1);
+
+	*result = version;
+	return 0;
+}
+
+/*
+ * Saves @version in the state file, if there is one. Needs to happen before
+ * @version is published: a restart must not resume the session from an older
+ * serial than the routers may have already received, or the next cycle would
+ * serve them different VRPs under a serial they already have.
+ *
+ * Errors aren't fatal; the file is just a head start for the next run. But the
+ * old file cannot stay, for the same reason.
+ */
+static void
+state_file_store(struct vrps_version *version)
+{
+	struct vrps_file contents;
+	char const *path;
+
+	path = config_get_state_file();
+	if (path == NULL || config_get_mode() != SERVER)
+		return;
+
+	contents.base = version->base;
+	contents.deltas = version->deltas;
+	contents.serial = version->serial;
+	contents.v0_session_id = state.v0_session_id;
+	contents.v1_session_id = state.v1_session_id;
+
+	if (vrps_file_store(path, &contents) == 0)
+		return;
+
+	if (unlink(path) == 0 || errno == ENOENT)
+		pr_op_warn("The VRPs could not be saved; a restart will have to wait for a full validation cycle.");
+	else
+		pr_op_err("The VRPs could not be saved, and the outdated state file '%s' could not be deleted: %s. Please delete it before restarting Fort.",
+		    path, strerror(errno));
+}
+
+/*
+ * Loads the VRPs stored in the state file by a previous run, so they can be
+ * served until the first validation cycle ends.
+ *
+ * Meant to be called before the first vrps_update() and before the RTR server
+ * starts. Errors aren't fatal; the routers will just have to wait for the
+ * first validation cycle, as usual.
+ */
+void
+vrps_restore(void)
+{
+	struct vrps_file contents;
+	struct vrps_version *version;
+	struct pdu_snapshot *snapshots[RTR_V1 + 1];
+	char const *path;
+	time_t now;
+	int error;
+
+	path = config_get_state_file();
+	if (path == NULL)
+		return;
+
+	error = vrps_file_load(path, &contents);
+	if (error == -ENOENT) {
+		pr_op_info("State file '%s' does not exist yet.", path);
+		return;
+	}
+	if (error) {
+		pr_op_warn("State file '%s' could not be loaded; ignoring it.",
+		    path);
+		return;
+	}
+
+	now = 0;
+	error = get_current_time(&now);
+	if (error)
+		goto fail;
+	if (now < contents.timestamp) {
+		pr_op_warn("State file '%s' was written in the future. Ignoring it.",
+		    path);
+		goto fail;
+	}
+	if (now - contents.timestamp > config_get_interval_expire()) {
+		pr_op_warn("State file '%s' is %ld seconds old; the routers have already expired its data. Ignoring it.",
+		    path, (long)(now - contents.timestamp));
+		goto fail;
+	}
+
+	version = malloc(sizeof(struct vrps_version));
+	if (version == NULL) {
+		pr_enomem();
+		goto fail;
+	}
+
+	build_snapshots(contents.base, snapshots);
+	version->base = contents.base;
+	version->deltas = contents.deltas;
+	version->coalesced = NULL;
+	memcpy(version->snapshots, snapshots, sizeof(version->snapshots));
+	version->serial = contents.serial;
+	atomic_init(&version->references, 1);
+
+	/* Keep the session, so synchronized routers can ask for deltas. */
+	state.v0_session_id = contents.v0_session_id;
+	state.v1_session_id = contents.v1_session_id;
+	version_publish(version);
+
+	pr_op_warn("Serving %u ROAs and %u Router Keys (serial %u) from state file '%s' until the first validation cycle ends. They are %ld seconds old.",
+	    db_table_roa_count(version->base),
+	    db_table_router_key_count(version->base), version->serial, path,
+	    (long)(now - contents.timestamp));
+	return;
+
+fail:
+	darray_destroy(contents.deltas);
+	db_table_destroy(contents.base);
+}
+
 static int
 __vrps_update(bool *notify_clients)
 {
 	/*
 	 * This function is the only writer, and it runs once at a time.
-	 * Therefore, it's going to worry about write locking, but not read
-	 * locking.
+	 * Therefore, it can use the current version without pinning it;
+	 * nobody else is going to release it.
 	 */
 
-	struct db_table *old_base;
+	struct vrps_version *old_version;
+	struct vrps_version *new_version;
 	struct db_table *new_base;
 	struct deltas *new_deltas;
+	struct pdu_snapshot *new_snapshots[RTR_V1 + 1];
 	int error;
 
 	if (notify_clients)
 		*notify_clients = false;
-	old_base = state.base;
+	old_version = atomic_load(&state.current);
+	new_version = NULL;
 	new_base = NULL;
 
 	error = __perform_standalone_validation(&new_base);
@@ -271,6 +927,8 @@ __vrps_update(bool *notify_clients)
 		db_table_destroy(new_base);
 		return error;
 	}
+	/* Drops the filtered VRPs and sorts the asserted ones. */
+	db_table_seal(new_base);
 
 	/*
 	 * At this point, new_base is completely valid. Even if we error out
@@ -281,11 +939,12 @@ __vrps_update(bool *notify_clients)
 	 */
 	output_print_data(new_base);
 
-	error = __compute_deltas(old_base, new_base, notify_clients,
-	    &new_deltas);
+	error = __compute_deltas(
+	    (old_version != NULL) ? old_version->base : NULL,
+	    new_base, notify_clients, &new_deltas);
 	if (error) {
 		/*
-		 * Deltas are nice-to haves. As long as state.base is correct,
+		 * Deltas are nice-to haves. As long as the base is correct,
 		 * the validator can continue serving the routers.
 		 * (Albeit less efficiently.)
 		 * So drop a warning and keep going.
@@ -293,33 +952,30 @@ __vrps_update(bool *notify_clients)
 		pr_op_warn("Deltas could not be computed: %s", strerror(error));
 	}
 
-	rwlock_write_lock(&state_lock);
+	build_snapshots(new_base, new_snapshots);
 
-	state.base = new_base;
-	state.serial++;
-	if (new_deltas != NULL) {
-		/* Ownership transferred */
-		darray_add(state.deltas, new_deltas);
-	} else {
-		/*
-		 * If the latest base has no deltas, all existing deltas are
-		 * rendered useless. This is because clients always want to
-		 * reach the latest serial, no matter where they are.
-		 */
-		darray_clear(state.deltas);
+	error = version_create(old_version, new_base, new_deltas,
+	    new_snapshots, &new_version);
+	if (error) {
+		snapshots_release(new_snapshots);
+		if (new_deltas != NULL)
+			deltas_refput(new_deltas);
+		db_table_destroy(new_base);
+		return error;
 	}
 
-	rwlock_unlock(&state_lock);
-
-	if (old_base != NULL)
-		db_table_destroy(old_base);
+	/* Before publishing; see state_file_store(). */
+	state_file_store(new_version);
 
+	/* Clients might still be using the old one; they hold references. */
+	version_publish(new_version);
 	return 0;
 }
 
 int
 vrps_update(bool *changed)
 {
+	struct vrps_version *version;
 	time_t start, finish;
 	long int exec_time;
 	serial_t serial;
@@ -345,24 +1001,20 @@ vrps_update(bool *changed)
 	exec_time = finish - start;
 
 	pr_op_info("Validation finished:");
-	rwlock_read_lock(&state_lock);
-	do {
-		if (state.base == NULL) {
-			rwlock_unlock(&state_lock);
-			pr_op_info("- Valid ROAs: 0");
-			pr_op_info("- Valid Router Keys: 0");
-			if (config_get_mode() == SERVER)
-				pr_op_info("- No serial number.");
-			break;
-		}
-
-		pr_op_info("- Valid ROAs: %u", db_table_roa_count(state.base));
+	if (version_pin(&version) == 0) {
+		pr_op_info("- Valid ROAs: %u",
+		    db_table_roa_count(version->base));
 		pr_op_info("- Valid Router Keys: %u",
-		    db_table_router_key_count(state.base));
+		    db_table_router_key_count(version->base));
+		if (config_get_mode() == SERVER)
+			pr_op_info("- Serial: %u", version->serial);
+		version_refput(version);
+	} else {
+		pr_op_info("- Valid ROAs: 0");
+		pr_op_info("- Valid Router Keys: 0");
 		if (config_get_mode() == SERVER)
-			pr_op_info("- Serial: %u", state.serial);
-		rwlock_unlock(&state_lock);
-	} while(0);
+			pr_op_info("- No serial number.");
+	}
 	pr_op_info("- Real execution time: %ld secs.", exec_time);
 
 	return error;
@@ -377,23 +1029,51 @@ vrps_update(bool *changed)
 int
 vrps_foreach_base(vrp_foreach_cb cb_roa, router_key_foreach_cb cb_rk, void *arg)
 {
+	struct vrps_version *version;
 	int error;
 
-	error = rwlock_read_lock(&state_lock);
+	error = version_pin(&version);
 	if (error)
 		return error;
 
-	if (state.base != NULL) {
-		error = db_table_foreach_roa(state.base, cb_roa, arg);
-		if (error)
-			goto unlock;
-		error = db_table_foreach_router_key(state.base, cb_rk, arg);
-	} else
-		error = -EAGAIN;
+	error = db_table_foreach_roa(version->base, cb_roa, arg);
+	if (!error)
+		error = db_table_foreach_router_key(version->base, cb_rk, arg);
+
+	version_refput(version);
+	return error;
+}
+
+/**
+ * Returns the current base, serialized for RTR version @version, along with
+ * its serial. Don't forget to pdu_snapshot_refput() it.
+ *
+ * Please keep in mind that there is at least one errcode-aware caller. The most
+ * important ones are
+ * 1. 0: No errors.
+ * 2. -EAGAIN: No data available; database still under construction.
+ * 3. -ENOENT: The snapshot is not available. Use vrps_foreach_base() instead.
+ */
+int
+vrps_get_base_snapshot(uint8_t version, serial_t *serial,
+    struct pdu_snapshot **result)
+{
+	struct vrps_version *current;
+	int error;
 
-unlock:
-	rwlock_unlock(&state_lock);
+	error = version_pin(&current);
+	if (error)
+		return error;
+
+	if (version > RTR_V1 || current->snapshots[version] == NULL) {
+		error = -ENOENT;
+	} else {
+		*result = current->snapshots[version];
+		pdu_snapshot_refget(*result);
+		*serial = current->serial;
+	}
 
+	version_refput(current);
 	return error;
 }
 
@@ -406,70 +1086,245 @@ unlock:
 static int
 vrp_ovrd_remove(struct delta_vrp const *delta, void *arg)
 {
-	struct sorted_lists *lists = arg;
+	struct delta_filter *filter = arg;
 	struct vrp_node *ptr;
-	struct vrp_slist *filtered_vrps;
 
-	filtered_vrps = &lists->prefixes;
-	SLIST_FOREACH(ptr, filtered_vrps, next)
-		if (vrp_equals(&delta->vrp, &ptr->delta.vrp) &&
-		    delta->flags != ptr->delta.flags) {
-			SLIST_REMOVE(filtered_vrps, ptr, vrp_node, next);
+	ptr = malloc(sizeof(struct vrp_node));
+	if (ptr == NULL)
+		return pr_enomem();
+
+	/* The key is hashed raw, so don't leave garbage in the padding. */
+	memset(ptr, 0, sizeof(struct vrp_node));
+	ptr->delta.vrp.asn = delta->vrp.asn;
+	ptr->delta.vrp.prefix_length = delta->vrp.prefix_length;
+	ptr->delta.vrp.max_prefix_length = delta->vrp.max_prefix_length;
+	ptr->delta.vrp.addr_fam = delta->vrp.addr_fam;
+	switch (delta->vrp.addr_fam) {
+	case AF_INET:
+		ptr->delta.vrp.prefix.v4 = delta->vrp.prefix.v4;
+		break;
+	case AF_INET6:
+		ptr->delta.vrp.prefix.v6 = delta->vrp.prefix.v6;
+		break;
+	default:
+		pr_crit("Unknown address family: %u", delta->vrp.addr_fam);
+	}
+	ptr->delta.flags = delta->flags;
+
+	if (filter->lookup) {
+		struct vrp_node *old;
+
+		HASH_FIND(hh, filter->prefixes, &ptr->delta.vrp,
+		    sizeof(struct vrp), old);
+		if (old != NULL) {
+			if (old->delta.flags != ptr->delta.flags) {
+				HASH_DEL(filter->prefixes, old);
+				free(old);
+			}
 			free(ptr);
 			return 0;
 		}
+	}
 
-	ptr = malloc(sizeof(struct vrp_node));
-	if (ptr == NULL)
+	errno = 0;
+	HASH_ADD(hh, filter->prefixes, delta.vrp, sizeof(struct vrp), ptr);
+	if (errno) {
+		free(ptr);
 		return pr_enomem();
+	}
 
-	ptr->delta = *delta;
-	SLIST_INSERT_HEAD(filtered_vrps, ptr, next);
 	return 0;
 }
 
 static int
 router_key_ovrd_remove(struct delta_router_key const *delta, void *arg)
 {
-	struct sorted_lists *lists = arg;
+	struct delta_filter *filter = arg;
 	struct rk_node *ptr;
-	struct rk_slist *filtered_keys;
-	struct router_key const *key;
-
-	filtered_keys = &lists->router_keys;
-	SLIST_FOREACH(ptr, filtered_keys, next) {
-		key = &delta->router_key;
-		if (key->as == ptr->delta.router_key.as &&
-		    memcmp(key->ski, ptr->delta.router_key.ski, RK_SKI_LEN) == 0
-		    && memcmp(key->spk, ptr->delta.router_key.spk,
-		    RK_SPKI_LEN) == 0 &&
-		    delta->flags != ptr->delta.flags) {
-			SLIST_REMOVE(filtered_keys, ptr, rk_node, next);
+
+	ptr = malloc(sizeof(struct rk_node));
+	if (ptr == NULL)
+		return pr_enomem();
+
+	memset(ptr, 0, sizeof(struct rk_node));
+	ptr->delta.router_key.as = delta->router_key.as;
+	memcpy(ptr->delta.router_key.ski, delta->router_key.ski, RK_SKI_LEN);
+	memcpy(ptr->delta.router_key.spk, delta->router_key.spk, RK_SPKI_LEN);
+	ptr->delta.flags = delta->flags;
+
+	if (filter->lookup) {
+		struct rk_node *old;
+
+		HASH_FIND(hh, filter->router_keys, &ptr->delta.router_key,
+		    sizeof(struct router_key), old);
+		if (old != NULL) {
+			if (old->delta.flags != ptr->delta.flags) {
+				HASH_DEL(filter->router_keys, old);
+				free(old);
+			}
 			free(ptr);
 			return 0;
 		}
 	}
 
-	ptr = malloc(sizeof(struct rk_node));
-	if (ptr == NULL)
+	errno = 0;
+	HASH_ADD(hh, filter->router_keys, delta.router_key,
+	    sizeof(struct router_key), ptr);
+	if (errno) {
+		free(ptr);
 		return pr_enomem();
+	}
 
-	ptr->delta = *delta;
-	SLIST_INSERT_HEAD(filtered_keys, ptr, next);
 	return 0;
 }
 
 static int
 __deltas_foreach(struct deltas *deltas, void *arg)
 {
-	return deltas_foreach(deltas, vrp_ovrd_remove, router_key_ovrd_remove,
+	struct delta_filter *filter = arg;
+	int error;
+
+	error = deltas_foreach(deltas, vrp_ovrd_remove, router_key_ovrd_remove,
 	    arg);
+	filter->lookup = true;
+	return error;
+}
+
+static int
+get_single_deltas(struct deltas *deltas, void *arg)
+{
+	struct deltas **result = arg;
+	*result = deltas;
+	return 0;
+}
+
+/*
+ * Merges the deltas from @from to @version's serial into a single deltas,
+ * dropping the entries that cancel each other.
+ */
+static int
+coalesce_deltas(struct vrps_version *version, serial_t from,
+    struct deltas **result)
+{
+	struct delta_filter filter;
+	struct deltas *deltas;
+	struct vrp_node *vnode, *vtmp;
+	struct rk_node *rnode, *rtmp;
+	int error;
+
+	if (version->serial - from == 1) {
+		/* One serial; nothing to cancel. */
+		deltas = NULL;
+		error = darray_foreach_since(version->deltas, 1,
+		    get_single_deltas, &deltas);
+		if (error)
+			return error;
+		deltas_refget(deltas);
+		*result = deltas;
+		return 0;
+	}
+
+	error = deltas_create(&deltas);
+	if (error)
+		return error;
+
+	filter.prefixes = NULL;
+	filter.router_keys = NULL;
+	filter.lookup = false;
+
+	error = darray_foreach_since(version->deltas, version->serial - from,
+	    __deltas_foreach, &filter);
+
+	HASH_ITER(hh, filter.prefixes, vnode, vtmp) {
+		if (!error)
+			error = deltas_add_roa(deltas, &vnode->delta.vrp,
+			    vnode->delta.flags);
+		HASH_DEL(filter.prefixes, vnode);
+		free(vnode);
+	}
+	HASH_ITER(hh, filter.router_keys, rnode, rtmp) {
+		if (!error)
+			error = deltas_add_router_key(deltas,
+			    &rnode->delta.router_key, rnode->delta.flags);
+		HASH_DEL(filter.router_keys, rnode);
+		free(rnode);
+	}
+
+	if (error) {
+		deltas_refput(deltas);
+		return error;
+	}
+
+	*result = deltas;
+	return 0;
+}
+
+/*
+ * Returns the coalesced deltas from @from to @version's serial, computing them
+ * if no other router has asked for them yet.
+ * Don't forget to deltas_refput() the result.
+ */
+static int
+get_coalesced_deltas(struct vrps_version *version, serial_t from,
+    struct deltas **result)
+{
+	struct coalesced_deltas *node;
+	struct deltas *deltas;
+	int error;
+
+	mutex_lock(&coalesced_lock);
+	HASH_FIND(hh, version->coalesced, &from, sizeof(from), node);
+	if (node != NULL) {
+		deltas_refget(node->deltas);
+		*result = node->deltas;
+		mutex_unlock(&coalesced_lock);
+		return 0;
+	}
+	mutex_unlock(&coalesced_lock);
+
+	/* Don't block the other routers while computing. */
+	error = coalesce_deltas(version, from, &deltas);
+	if (error)
+		return error;
+
+	mutex_lock(&coalesced_lock);
+
+	HASH_FIND(hh, version->coalesced, &from, sizeof(from), node);
+	if (node != NULL) {
+		/* Somebody beat us to it */
+		deltas_refput(deltas);
+		deltas = node->deltas;
+		deltas_refget(deltas); /* For the caller */
+		goto end;
+	}
+
+	node = malloc(sizeof(struct coalesced_deltas));
+	if (node == NULL)
+		goto end; /* Caching is optional */
+	node->from = from;
+	node->deltas = deltas;
+
+	errno = 0;
+	HASH_ADD(hh, version->coalesced, from, sizeof(node->from), node);
+	if (errno) {
+		free(node);
+		goto end;
+	}
+	deltas_refget(deltas); /* One for the cache, one for the caller */
+
+end:
+	mutex_unlock(&coalesced_lock);
+	*result = deltas;
+	return 0;
 }
 
 /**
  * Runs @vrp_cb and @rk_cb on all the deltas from the database whose
  * serial > @from, excluding those that cancel each other.
  *
+ * The callbacks are run after the deltas are detached from the database, so
+ * they are free to block.
+ *
  * Please keep in mind that there is at least one errcode-aware caller. The most
  * important ones are
  * 1. 0: No errors.
@@ -481,106 +1336,59 @@ vrps_foreach_delta_since(serial_t from, serial_t *to,
     delta_vrp_foreach_cb vrp_cb, delta_router_key_foreach_cb rk_cb,
     void *arg)
 {
-	struct sorted_lists filtered_lists;
-	struct vrp_node *vnode;
-	struct rk_node *rnode;
+	struct vrps_version *version;
+	struct deltas *deltas;
 	int error;
 
-	error = rwlock_read_lock(&state_lock);
+	error = version_pin(&version);
 	if (error)
-		return error;
-
-	if (state.base == NULL) {
-		/* Database still under construction. */
-		rwlock_unlock(&state_lock);
-		return -EAGAIN;
-	}
+		return error; /* -EAGAIN: Database still under construction. */
 
-	if (from == state.serial) {
+	if (from == version->serial) {
 		/* Client already has the latest serial. */
-		rwlock_unlock(&state_lock);
 		*to = from;
-		return 0;
+		goto end;
 	}
 
 	/* if from < first serial */
-	if (serial_lt(from, state.serial - darray_len(state.deltas)))
+	if (serial_lt(from, version->serial - darray_len(version->deltas)))
 		goto cache_reset; /* Delta was already deleted. */
 	/* if from > last serial */
-	if (serial_lt(state.serial, from))
+	if (serial_lt(version->serial, from))
 		goto cache_reset; /* Serial is invalid. */
 
-	/*
-	 * TODO (performance) this implementation is naive.
-	 * Either use a hash set, or sort the resources.
-	 * Also, deltas that share a serial do not need to be compared to each
-	 * other. (Corollary: If there's one serial, no comparisons whatsoever
-	 * need to be made.)
-	 */
-
-	/*
-	 * Filter: Remove entries that cancel each other.
-	 * (We'll have to build a separate list because the database nodes
-	 * are immutable.)
-	 */
-	SLIST_INIT(&filtered_lists.prefixes);
-	SLIST_INIT(&filtered_lists.router_keys);
-
-	error = darray_foreach_since(state.deltas, state.serial - from,
-	    __deltas_foreach, &filtered_lists);
+	error = get_coalesced_deltas(version, from, &deltas);
 	if (error)
-		goto release_list;
+		goto end;
 
-	/* Now do the corresponding callback on the filtered deltas */
-	SLIST_FOREACH(vnode, &filtered_lists.prefixes, next) {
-		error = vrp_cb(&vnode->delta, arg);
-		if (error)
-			break;
-	}
-	SLIST_FOREACH(rnode, &filtered_lists.router_keys, next) {
-		error = rk_cb(&rnode->delta, arg);
-		if (error)
-			break;
-	}
+	*to = version->serial;
+	version_refput(version);
 
-release_list:
-	while (!SLIST_EMPTY(&filtered_lists.prefixes)) {
-		vnode = filtered_lists.prefixes.slh_first;
-		SLIST_REMOVE_HEAD(&filtered_lists.prefixes, next);
-		free(vnode);
-	}
-	while (!SLIST_EMPTY(&filtered_lists.router_keys)) {
-		rnode = filtered_lists.router_keys.slh_first;
-		SLIST_REMOVE_HEAD(&filtered_lists.router_keys, next);
-		free(rnode);
-	}
-
-	*to = state.serial;
-	rwlock_unlock(&state_lock);
-	return 0;
+	error = deltas_foreach(deltas, vrp_cb, rk_cb, arg);
+	deltas_refput(deltas);
+	return error;
 
 cache_reset:
-	rwlock_unlock(&state_lock);
-	return -ESRCH;
+	error = -ESRCH;
+end:
+	version_refput(version);
+	return error;
 }
 
 int
 get_last_serial_number(serial_t *result)
 {
+	struct vrps_version *version;
 	int error;
 
-	error = rwlock_read_lock(&state_lock);
+	error = version_pin(&version);
 	if (error)
 		return error;
 
-	if (state.base != NULL)
-		*result = state.serial;
-	else
-		error = -EAGAIN;
-
-	rwlock_unlock(&state_lock);
+	*result = version->serial;
 
-	return error;
+	version_refput(version);
+	return 0;
 }
 
 uint16_t
@@ -9,20 +9,23 @@
 
 #include <stdbool.h>
 #include "types/address.h"
+#include "rtr/pdu_snapshot.h"
 #include "rtr/db/deltas_array.h"
 
 int vrps_init(void);
 void vrps_destroy(void);
 
+void vrps_restore(void);
 int vrps_update(bool *);
 
 /*
- * The following three functions return -EAGAIN when vrps_update() has never
+ * The following four functions return -EAGAIN when vrps_update() has never
  * been called, or while it's still building the database.
  * Handle gracefully.
  */
 
 int vrps_foreach_base(vrp_foreach_cb, router_key_foreach_cb, void *);
+int vrps_get_base_snapshot(uint8_t, serial_t *, struct pdu_snapshot **);
 int vrps_foreach_delta_since(serial_t, serial_t *, delta_vrp_foreach_cb,
     delta_router_key_foreach_cb, void *);
 int get_last_serial_number(serial_t *);
@@ -0,0 +1,378 @@
+#include "rtr/db/vrps_file.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
+#include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
+
+#include "common.h"
+#include "file.h"
+#include "log.h"
+
+/*
+ * File layout:
+ *
+ * 1. struct file_header.
+ * 2. The base, as written by db_table_store().
+ * 3. For each deltas (oldest first), its announcements and its withdrawals,
+ *    also written by db_table_store().
+ *
+ * Everything is written in the machine's representation, so the file can be
+ * mapped and loaded with very little parsing. It's not meant to be portable.
+ */
+
+#define FILE_MAGIC "FORTVRPS"
+/* Increase whenever the layout (including db_table's records) changes. */
+#define FILE_FORMAT 1
+
+struct file_header {
+	char magic[8];
+	uint32_t format;
+	uint32_t serial;
+	int64_t timestamp;
+	uint16_t v0_session_id;
+	uint16_t v1_session_id;
+	uint32_t deltas;
+};
+
+static int
+add_vrp(struct db_table *table, struct vrp const *vrp)
+{
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		prefix4.addr = vrp->prefix.v4;
+		prefix4.len = vrp->prefix_length;
+		return rtrhandler_handle_roa_v4(table, vrp->asn, &prefix4,
+		    vrp->max_prefix_length);
+	case AF_INET6:
+		prefix6.addr = vrp->prefix.v6;
+		prefix6.len = vrp->prefix_length;
+		return rtrhandler_handle_roa_v6(table, vrp->asn, &prefix6,
+		    vrp->max_prefix_length);
+	}
+
+	pr_crit("Unknown address family: %u", vrp->addr_fam);
+}
+
+/* A deltas, split in two tables. */
+struct delta_tables {
+	struct db_table *announcements;
+	struct db_table *withdrawals;
+};
+
+static int
+split_vrp(struct delta_vrp const *delta, void *arg)
+{
+	struct delta_tables *tables = arg;
+	return add_vrp((delta->flags == FLAG_ANNOUNCEMENT)
+	    ? tables->announcements
+	    : tables->withdrawals, &delta->vrp);
+}
+
+static int
+split_router_key(struct delta_router_key const *delta, void *arg)
+{
+	struct delta_tables *tables = arg;
+	struct router_key const *key = &delta->router_key;
+
+	return rtrhandler_handle_router_key((delta->flags == FLAG_ANNOUNCEMENT)
+	    ? tables->announcements
+	    : tables->withdrawals, key->ski, key->as, key->spk);
+}
+
+static int
+store_deltas(struct deltas *deltas, void *arg)
+{
+	FILE *file = arg;
+	struct delta_tables tables;
+	int error;
+
+	tables.announcements = db_table_create();
+	if (tables.announcements == NULL)
+		return pr_enomem();
+	tables.withdrawals = db_table_create();
+	if (tables.withdrawals == NULL) {
+		error = pr_enomem();
+		goto end;
+	}
+
+	error = deltas_foreach(deltas, split_vrp, split_router_key, &tables);
+	if (error)
+		goto end;
+
+	error = db_table_store(tables.announcements, file);
+	if (error)
+		goto end;
+	error = db_table_store(tables.withdrawals, file);
+
+end:
+	if (tables.withdrawals != NULL)
+		db_table_destroy(tables.withdrawals);
+	db_table_destroy(tables.announcements);
+	return error;
+}
+
+static int
+write_contents(FILE *file, struct vrps_file const *contents)
+{
+	struct file_header header;
+	time_t now;
+	int error;
+
+	now = 0;
+	error = get_current_time(&now);
+	if (error)
+		return error;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+	header.format = FILE_FORMAT;
+	header.serial = contents->serial;
+	header.timestamp = now;
+	header.v0_session_id = contents->v0_session_id;
+	header.v1_session_id = contents->v1_session_id;
+	header.deltas = darray_len(contents->deltas);
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		return -EIO;
+
+	error = db_table_store(contents->base, file);
+	if (error)
+		return error;
+
+	return darray_foreach_since(contents->deltas, header.deltas,
+	    store_deltas, file);
+}
+
+/*
+ * Writes @contents into the file @path.
+ *
+ * The file is replaced atomically, so a crash during the write leaves the
+ * previous version behind.
+ */
+int
+vrps_file_store(char const *path, struct vrps_file const *contents)
+{
+	char *tmp;
+	FILE *file;
+	int error;
+
+	tmp = malloc(strlen(path) + sizeof(".tmp"));
+	if (tmp == NULL)
+		return pr_enomem();
+	strcpy(tmp, path);
+	strcat(tmp, ".tmp");
+
+	error = file_write(tmp, &file);
+	if (error)
+		goto free_tmp;
+
+	error = write_contents(file, contents);
+	if (!error && fflush(file) != 0)
+		error = -errno;
+	if (!error && fsync(fileno(file)) != 0)
+		error = -errno;
+	file_close(file);
+	if (error) {
+		pr_op_err("Could not write the state file '%s': %s", tmp,
+		    strerror(abs(error)));
+		goto delete_tmp;
+	}
+
+	if (rename(tmp, path) != 0) {
+		error = errno;
+		pr_op_err("Could not rename '%s' to '%s': %s", tmp, path,
+		    strerror(error));
+		error = -error;
+		goto delete_tmp;
+	}
+
+	free(tmp);
+	return 0;
+
+delete_tmp:
+	unlink(tmp);
+free_tmp:
+	free(tmp);
+	return error;
+}
+
+static int
+add_announcement(struct vrp const *vrp, void *arg)
+{
+	return deltas_add_roa(arg, vrp, FLAG_ANNOUNCEMENT);
+}
+
+static int
+add_withdrawal(struct vrp const *vrp, void *arg)
+{
+	return deltas_add_roa(arg, vrp, FLAG_WITHDRAWAL);
+}
+
+static int
+add_rk_announcement(struct router_key const *key, void *arg)
+{
+	return deltas_add_router_key(arg, key, FLAG_ANNOUNCEMENT);
+}
+
+static int
+add_rk_withdrawal(struct router_key const *key, void *arg)
+{
+	return deltas_add_router_key(arg, key, FLAG_WITHDRAWAL);
+}
+
+static int
+load_deltas(unsigned char const **data, size_t *left, struct deltas **result)
+{
+	struct delta_tables tables;
+	struct deltas *deltas;
+	int error;
+
+	tables.announcements = NULL;
+	tables.withdrawals = NULL;
+
+	error = deltas_create(&deltas);
+	if (error)
+		return error;
+
+	tables.announcements = db_table_create();
+	tables.withdrawals = db_table_create();
+	if (tables.announcements == NULL || tables.withdrawals == NULL) {
+		error = pr_enomem();
+		goto end;
+	}
+
+	error = db_table_load(tables.announcements, data, left);
+	if (error)
+		goto end;
+	error = db_table_load(tables.withdrawals, data, left);
+	if (error)
+		goto end;
+
+	error = db_table_foreach_roa(tables.announcements, add_announcement,
+	    deltas);
+	if (error)
+		goto end;
+	error = db_table_foreach_roa(tables.withdrawals, add_withdrawal,
+	    deltas);
+	if (error)
+		goto end;
+	error = db_table_foreach_router_key(tables.announcements,
+	    add_rk_announcement, deltas);
+	if (error)
+		goto end;
+	error = db_table_foreach_router_key(tables.withdrawals,
+	    add_rk_withdrawal, deltas);
+
+end:
+	if (tables.withdrawals != NULL)
+		db_table_destroy(tables.withdrawals);
+	if (tables.announcements != NULL)
+		db_table_destroy(tables.announcements);
+	if (error) {
+		deltas_refput(deltas);
+		return error;
+	}
+
+	*result = deltas;
+	return 0;
+}
+
+static int
+read_contents(unsigned char const *data, size_t left,
+    struct vrps_file *result)
+{
+	struct file_header header;
+	struct deltas *deltas;
+	uint32_t i;
+	int error;
+
+	if (left < sizeof(header))
+		return -EINVAL;
+	memcpy(&header, data, sizeof(header));
+	data += sizeof(header);
+	left -= sizeof(header);
+
+	if (memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0)
+		return -EINVAL;
+	if (header.format != FILE_FORMAT)
+		return -EINVAL;
+
+	result->base = db_table_create();
+	if (result->base == NULL)
+		return pr_enomem();
+	result->deltas = darray_create();
+	if (result->deltas == NULL) {
+		error = pr_enomem();
+		goto destroy_base;
+	}
+
+	error = db_table_load(result->base, &data, &left);
+	if (error)
+		goto destroy_deltas;
+
+	/* If there are more deltas than the lifetime, the oldest ones go. */
+	for (i = 0; i < header.deltas; i++) {
+		error = load_deltas(&data, &left, &deltas);
+		if (error)
+			goto destroy_deltas;
+		darray_add(result->deltas, deltas);
+	}
+
+	if (left != 0) {
+		error = -EINVAL;
+		goto destroy_deltas;
+	}
+
+	result->serial = header.serial;
+	result->timestamp = header.timestamp;
+	result->v0_session_id = header.v0_session_id;
+	result->v1_session_id = header.v1_session_id;
+	return 0;
+
+destroy_deltas:
+	darray_destroy(result->deltas);
+destroy_base:
+	db_table_destroy(result->base);
+	return error;
+}
+
+/*
+ * Reads the file @path into @result.
+ *
+ * Returns -ENOENT if the file doesn't exist, and -EINVAL if it doesn't look
+ * like a state file written by this build.
+ */
+int
+vrps_file_load(char const *path, struct vrps_file *result)
+{
+	struct file_contents fc;
+	struct stat st;
+	int error;
+
+	if (stat(path, &st) != 0) {
+		error = errno;
+		if (error == ENOENT)
+			return -ENOENT;
+		pr_op_err("stat(%s) failed: %s", path, strerror(error));
+		return -error;
+	}
+
+	error = file_map(path, &fc);
+	if (error)
+		return (error > 0) ? -error : error;
+
+	error = read_contents(fc.buffer, fc.buffer_size, result);
+	if (error == -EINVAL)
+		pr_op_err("'%s' is not a valid state file.", path);
+
+	file_unmap(&fc);
+	return error;
+}
@@ -0,0 +1,28 @@
+#ifndef SRC_RTR_DB_VRPS_FILE_H_
+#define SRC_RTR_DB_VRPS_FILE_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "types/serial.h"
+#include "rtr/db/db_table.h"
+#include "rtr/db/deltas_array.h"
+
+/*
+ * The contents of the state file: the parts of the VRP database that need to
+ * survive a restart so the RTR server can answer routers right away.
+ */
+struct vrps_file {
+	/* Sealed. */
+	struct db_table *base;
+	struct deltas_array *deltas;
+	serial_t serial;
+	uint16_t v0_session_id;
+	uint16_t v1_session_id;
+	/* When the file was written. (Ignored by vrps_file_store().) */
+	time_t timestamp;
+};
+
+int vrps_file_store(char const *, struct vrps_file const *);
+int vrps_file_load(char const *, struct vrps_file *);
+
+#endif /* SRC_RTR_DB_VRPS_FILE_H_ */
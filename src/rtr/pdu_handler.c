@@ -23,7 +23,7 @@ handle_serial_notify_pdu(int fd, struct rtr_request const *request)
 }
 
 struct send_delta_args {
-	int fd;
+	struct pdu_stream stream;
 	uint8_t rtr_version;
 	bool cache_response_sent;
 };
@@ -34,7 +34,8 @@ send_cache_response_maybe(struct send_delta_args *args)
 	int error;
 
 	if (!args->cache_response_sent) {
-		error = send_cache_response_pdu(args->fd, args->rtr_version);
+		error = send_cache_response_pdu(&args->stream,
+		    args->rtr_version);
 		if (error)
 			return error;
 		args->cache_response_sent = true;
@@ -53,7 +54,7 @@ send_delta_vrp(struct delta_vrp const *delta, void *arg)
 	if (error)
 		return error;
 
-	return send_prefix_pdu(args->fd, args->rtr_version, &delta->vrp,
+	return send_prefix_pdu(&args->stream, args->rtr_version, &delta->vrp,
 	    delta->flags);
 }
 
@@ -67,7 +68,7 @@ send_delta_rk(struct delta_router_key const *delta, void *arg)
 	if (error)
 		return error;
 
-	return send_router_key_pdu(args->fd, args->rtr_version,
+	return send_router_key_pdu(&args->stream, args->rtr_version,
 	    &delta->router_key, delta->flags);
 }
 
@@ -92,16 +93,15 @@ handle_serial_query_pdu(int fd, struct rtr_request const *request)
 		return err_pdu_send_corrupt_data(fd, args.rtr_version, request,
 		    "Session ID doesn't match.");
 
-	args.fd = fd;
+	error = pdu_stream_init(&args.stream, fd, PDU_STREAM_CAPACITY);
+	if (error)
+		return error;
 	args.cache_response_sent = false;
 
 	/*
-	 * For the record, there are two reasons why we want to work on a
-	 * (shallow) copy of the deltas (as opposed to eg. a foreach):
-	 * 1. We need to remove deltas that cancel each other.
-	 *    (Which can't be done directly on the DB.)
-	 * 2. It's probably best not to hold the VRPS read lock while writing
-	 *    PDUs, to minimize writer stagnation.
+	 * For the record, we work on a (shallow) copy of the deltas (as opposed
+	 * to eg. a foreach) because we need to remove deltas that cancel each
+	 * other. (Which can't be done directly on the DB.)
 	 */
 
 	error = vrps_foreach_delta_since(query->serial_number, &final_serial,
@@ -115,19 +115,24 @@ handle_serial_query_pdu(int fd, struct rtr_request const *request)
 		 * and programming errors. Best avoid error PDUs.
 		 */
 		if (!args.cache_response_sent) {
-			error = send_cache_response_pdu(fd, args.rtr_version);
+			error = send_cache_response_pdu(&args.stream,
+			    args.rtr_version);
 			if (error)
-				return error;
+				goto end;
 		}
-		return send_end_of_data_pdu(fd, args.rtr_version, final_serial);
+		error = send_end_of_data_pdu(&args.stream, args.rtr_version,
+		    final_serial);
+		goto end;
 	case -EAGAIN: /* Database still under construction */
 		error = err_pdu_send_no_data_available(fd, args.rtr_version);
-		return error;
+		goto end;
 	case -ESRCH: /* Invalid serial */
 		/* https://tools.ietf.org/html/rfc6810#section-6.3 */
-		return send_cache_reset_pdu(fd, args.rtr_version);
+		error = send_cache_reset_pdu(fd, args.rtr_version);
+		goto end;
 	case -ENOMEM: /* Memory allocation failure */
-		return pr_enomem();
+		error = pr_enomem();
+		goto end;
 	case EAGAIN: /* Too many threads */
 		/*
 		 * I think this should be more of a "try again" thing, but
@@ -136,12 +141,17 @@ handle_serial_query_pdu(int fd, struct rtr_request const *request)
 		break;
 	}
 
-	return err_pdu_send_internal_error(fd, args.rtr_version);
+	/* Whatever was queued goes first */
+	pdu_stream_flush(&args.stream);
+	error = err_pdu_send_internal_error(fd, args.rtr_version);
+end:
+	pdu_stream_cleanup(&args.stream);
+	return error;
 }
 
 struct base_roa_args {
 	bool started;
-	int fd;
+	struct pdu_stream stream;
 	uint8_t version;
 };
 
@@ -152,17 +162,16 @@ send_base_roa(struct vrp const *vrp, void *arg)
 	int error;
 
 	if (!args->started) {
-		error = send_cache_response_pdu(args->fd, args->version);
+		error = send_cache_response_pdu(&args->stream, args->version);
 		if (error)
 			return error;
 		args->started = true;
 	}
 
-	return send_prefix_pdu(args->fd, args->version, vrp, FLAG_ANNOUNCEMENT);
+	return send_prefix_pdu(&args->stream, args->version, vrp,
+	    FLAG_ANNOUNCEMENT);
 }
 
-
-
 static int
 send_base_router_key(struct router_key const *key, void *arg)
 {
@@ -170,16 +179,52 @@ send_base_router_key(struct router_key const *key, void *arg)
 	int error;
 
 	if (!args->started) {
-		error = send_cache_response_pdu(args->fd, args->version);
+		error = send_cache_response_pdu(&args->stream, args->version);
 		if (error)
 			return error;
 		args->started = true;
 	}
 
-	return send_router_key_pdu(args->fd, args->version, key,
+	return send_router_key_pdu(&args->stream, args->version, key,
 	    FLAG_ANNOUNCEMENT);
 }
 
+/*
+ * Sends the pre-serialized base. No locks are held during the writes.
+ *
+ * Returns -ENOENT if the snapshot is not available.
+ */
+static int
+send_snapshot_response(int fd, uint8_t version)
+{
+	struct pdu_stream stream;
+	struct pdu_snapshot *snapshot;
+	serial_t serial;
+	int error;
+
+	error = vrps_get_base_snapshot(version, &serial, &snapshot);
+	if (error)
+		return error;
+
+	error = pdu_stream_init(&stream, fd, PDU_STREAM_CAPACITY);
+	if (error)
+		goto release_snapshot;
+
+	error = send_cache_response_pdu(&stream, version);
+	if (error)
+		goto cleanup_stream;
+	error = send_base_snapshot(&stream, snapshot);
+	if (error)
+		goto cleanup_stream;
+	error = send_end_of_data_pdu(&stream, version, serial);
+
+cleanup_stream:
+	pdu_stream_cleanup(&stream);
+release_snapshot:
+	pdu_snapshot_refput(snapshot);
+	return error;
+}
+
 int
 handle_reset_query_pdu(int fd, struct rtr_request const *request)
 {
@@ -189,9 +234,20 @@ handle_reset_query_pdu(int fd, struct rtr_request const *request)
 	int error;
 
 	args.started = false;
-	args.fd = fd;
 	args.version = pdu->header.protocol_version;
 
+	/* Every client gets the same bytes, so try to reuse them first. */
+	error = send_snapshot_response(fd, args.version);
+	switch (error) {
+	case -ENOENT:
+		break; /* Serialize the base ourselves. */
+	case -EAGAIN:
+		return err_pdu_send_no_data_available(fd, args.version);
+	default:
+		/* Success, or write error (which must stop sending PDUs) */
+		return error;
+	}
+
 	error = get_last_serial_number(&current_serial);
 	switch (error) {
 	case 0:
@@ -203,11 +259,14 @@ handle_reset_query_pdu(int fd, struct rtr_request const *request)
 		return error;
 	}
 
+	error = pdu_stream_init(&args.stream, fd, PDU_STREAM_CAPACITY);
+	if (error)
+		return error;
+
 	/*
-	 * It's probably best not to work on a copy, because the tree is large.
-	 * Unfortunately, this means we'll have to encourage writer stagnation,
-	 * but thankfully, most clients are supposed to request far more serial
-	 * queries than reset queries.
+	 * This pins the current base, so a slow client doesn't delay the
+	 * publication of new serials; it only delays the release of the base
+	 * it's reading.
 	 */
 
 	error = vrps_foreach_base(send_base_roa, send_base_router_key, &args);
@@ -218,21 +277,28 @@ handle_reset_query_pdu(int fd, struct rtr_request const *request)
 		/* Assure that cache response is (or was) sent */
 		if (args.started)
 			break;
-		error = send_cache_response_pdu(fd, args.version);
+		error = send_cache_response_pdu(&args.stream, args.version);
 		if (error)
-			return error;
+			goto end;
 		break;
 	case -EAGAIN:
-		return err_pdu_send_no_data_available(fd, args.version);
+		error = err_pdu_send_no_data_available(fd, args.version);
+		goto end;
 	case EAGAIN:
+		/* Whatever was queued goes first */
+		pdu_stream_flush(&args.stream);
 		err_pdu_send_internal_error(fd, args.version);
-		return error;
+		goto end;
 	default:
 		/* Any other error must stop sending more PDUs */
-		return error;
+		goto end;
 	}
 
-	return send_end_of_data_pdu(fd, args.version, current_serial);
+	error = send_end_of_data_pdu(&args.stream, args.version,
+	    current_serial);
+end:
+	pdu_stream_cleanup(&args.stream);
+	return error;
 }
 
 int
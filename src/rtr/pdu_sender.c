@@ -59,6 +59,18 @@ send_response(int fd, uint8_t pdu_type, unsigned char *data, size_t data_len)
 	return 0;
 }
 
+/*
+ * Like send_response(), except the PDU is only queued in @stream. It will be
+ * sent during the next flush.
+ */
+static int
+queue_response(struct pdu_stream *stream, uint8_t pdu_type,
+    unsigned char *data, size_t data_len)
+{
+	pr_op_debug("Queueing %s for client.", pdutype2str(pdu_type));
+	return pdu_stream_write(stream, data, data_len);
+}
+
 int
 send_serial_notify_pdu(int fd, uint8_t version, serial_t start_serial)
 {
@@ -98,7 +110,7 @@ send_cache_reset_pdu(int fd, uint8_t version)
 }
 
 int
-send_cache_response_pdu(int fd, uint8_t version)
+send_cache_response_pdu(struct pdu_stream *stream, uint8_t version)
 {
 	struct cache_response_pdu pdu;
 	unsigned char data[RTRPDU_CACHE_RESPONSE_LEN];
@@ -113,137 +125,90 @@ send_cache_response_pdu(int fd, uint8_t version)
 	if (len != RTRPDU_CACHE_RESPONSE_LEN)
 		pr_crit("Serialized Cache Response is %zu bytes.", len);
 
-	return send_response(fd, pdu.header.pdu_type, data, len);
-}
-
-static void
-pr_debug_prefix4(struct ipv4_prefix_pdu *pdu)
-{
-	char buffer[INET_ADDRSTRLEN];
-
-	pr_op_debug("Encoded prefix %s/%u into a PDU.",
-	    addr2str4(&pdu->ipv4_prefix, buffer), pdu->prefix_length);
-}
-
-static int
-send_ipv4_prefix_pdu(int fd, uint8_t version, struct vrp const *vrp,
-    uint8_t flags)
-{
-	struct ipv4_prefix_pdu pdu;
-	unsigned char data[RTRPDU_IPV4_PREFIX_LEN];
-	size_t len;
-
-	set_header_values(&pdu.header, version, PDU_TYPE_IPV4_PREFIX, 0);
-	pdu.header.length = RTRPDU_IPV4_PREFIX_LEN;
-
-	pdu.flags = flags;
-	pdu.prefix_length = vrp->prefix_length;
-	pdu.max_length = vrp->max_prefix_length;
-	pdu.zero = 0;
-	pdu.ipv4_prefix = vrp->prefix.v4;
-	pdu.asn = vrp->asn;
-
-	len = serialize_ipv4_prefix_pdu(&pdu, data);
-	if (len != RTRPDU_IPV4_PREFIX_LEN)
-		pr_crit("Serialized IPv4 Prefix is %zu bytes.", len);
-	if (log_op_enabled(LOG_DEBUG))
-		pr_debug_prefix4(&pdu);
-
-	return send_response(fd, pdu.header.pdu_type, data, len);
+	return queue_response(stream, pdu.header.pdu_type, data, len);
 }
 
 static void
-pr_debug_prefix6(struct ipv6_prefix_pdu *pdu)
+pr_debug_prefix(struct vrp const *vrp)
 {
 	char buffer[INET6_ADDRSTRLEN];
 
-	pr_op_debug("Encoded prefix %s/%u into a PDU.",
-	    addr2str6(&pdu->ipv6_prefix, buffer), pdu->prefix_length);
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		pr_op_debug("Encoded prefix %s/%u into a PDU.",
+		    addr2str4(&vrp->prefix.v4, buffer), vrp->prefix_length);
+		break;
+	case AF_INET6:
+		pr_op_debug("Encoded prefix %s/%u into a PDU.",
+		    addr2str6(&vrp->prefix.v6, buffer), vrp->prefix_length);
+		break;
+	}
 }
 
-static int
-send_ipv6_prefix_pdu(int fd, uint8_t version, struct vrp const *vrp,
-    uint8_t flags)
+int
+send_prefix_pdu(struct pdu_stream *stream, uint8_t version,
+    struct vrp const *vrp, uint8_t flags)
 {
-	struct ipv6_prefix_pdu pdu;
 	unsigned char data[RTRPDU_IPV6_PREFIX_LEN];
 	size_t len;
 
-	set_header_values(&pdu.header, version, PDU_TYPE_IPV6_PREFIX, 0);
-	pdu.header.length = RTRPDU_IPV6_PREFIX_LEN;
-
-	pdu.flags = flags;
-	pdu.prefix_length = vrp->prefix_length;
-	pdu.max_length = vrp->max_prefix_length;
-	pdu.zero = 0;
-	pdu.ipv6_prefix = vrp->prefix.v6;
-	pdu.asn = vrp->asn;
-
-	len = serialize_ipv6_prefix_pdu(&pdu, data);
-	if (len != RTRPDU_IPV6_PREFIX_LEN)
-		pr_crit("Serialized IPv6 Prefix is %zu bytes.", len);
+	len = serialize_prefix(version, vrp, flags, data);
+	if (len == 0)
+		return -EINVAL;
 	if (log_op_enabled(LOG_DEBUG))
-		pr_debug_prefix6(&pdu);
-
-	return send_response(fd, pdu.header.pdu_type, data, len);
-}
-
-int
-send_prefix_pdu(int fd, uint8_t version, struct vrp const *vrp, uint8_t flags)
-{
-	switch (vrp->addr_fam) {
-	case AF_INET:
-		return send_ipv4_prefix_pdu(fd, version, vrp, flags);
-	case AF_INET6:
-		return send_ipv6_prefix_pdu(fd, version, vrp, flags);
-	}
+		pr_debug_prefix(vrp);
 
-	return -EINVAL;
+	return queue_response(stream, (vrp->addr_fam == AF_INET)
+	    ? PDU_TYPE_IPV4_PREFIX
+	    : PDU_TYPE_IPV6_PREFIX,
+	    data, len);
 }
 
 int
-send_router_key_pdu(int fd, uint8_t version,
+send_router_key_pdu(struct pdu_stream *stream, uint8_t version,
     struct router_key const *router_key, uint8_t flags)
 {
-	struct router_key_pdu pdu;
 	unsigned char data[RTRPDU_ROUTER_KEY_LEN];
 	size_t len;
-	uint16_t reserved;
 
 	/* Sanity check: this can't be sent on RTRv0 */
 	if (version == RTR_V0)
 		return 0;
 
-	reserved = 0;
-	/* Set the flags at the first 8 bits of reserved field */
-	reserved += (flags << 8);
-	set_header_values(&pdu.header, version, PDU_TYPE_ROUTER_KEY, reserved);
-	pdu.header.length = RTRPDU_ROUTER_KEY_LEN;
-
-	memcpy(pdu.ski, router_key->ski, RK_SKI_LEN);
-	pdu.ski_len = RK_SKI_LEN;
-	pdu.asn = router_key->as;
-	memcpy(pdu.spki, router_key->spk, RK_SPKI_LEN);
-	pdu.spki_len = RK_SPKI_LEN;
-
-	len = serialize_router_key_pdu(&pdu, data);
+	len = serialize_router_key(version, router_key, flags, data);
 	if (len != RTRPDU_ROUTER_KEY_LEN)
 		pr_crit("Serialized Router Key PDU is %zu bytes, not the expected %u.",
-		    len, pdu.header.length);
+		    len, RTRPDU_ROUTER_KEY_LEN);
 
-	return send_response(fd, pdu.header.pdu_type, data, len);
+	return queue_response(stream, PDU_TYPE_ROUTER_KEY, data, len);
+}
+
+/*
+ * Queues the Prefix and Router Key PDUs of the whole database, as they were
+ * serialized when the snapshot was built.
+ */
+int
+send_base_snapshot(struct pdu_stream *stream, struct pdu_snapshot *snapshot)
+{
+	pr_op_debug("Queueing the %zu bytes of base snapshot PDUs for client.",
+	    pdu_snapshot_len(snapshot));
+	return pdu_stream_write(stream, pdu_snapshot_data(snapshot),
+	    pdu_snapshot_len(snapshot));
 }
 
 #define GET_END_OF_DATA_LENGTH(version)					\
 	((version == RTR_V1) ?						\
 	    RTRPDU_END_OF_DATA_V1_LEN : RTRPDU_END_OF_DATA_V0_LEN)
 
+/* Also flushes @stream, since this is the last PDU of the response. */
 int
-send_end_of_data_pdu(int fd, uint8_t version, serial_t end_serial)
+send_end_of_data_pdu(struct pdu_stream *stream, uint8_t version,
+    serial_t end_serial)
 {
 	struct end_of_data_pdu pdu;
 	unsigned char data[GET_END_OF_DATA_LENGTH(version)];
 	size_t len;
+	int error;
 
 	set_header_values(&pdu.header, version, PDU_TYPE_END_OF_DATA,
 	    get_current_session_id(version));
@@ -260,7 +225,11 @@ send_end_of_data_pdu(int fd, uint8_t version, serial_t end_serial)
 	if (len != GET_END_OF_DATA_LENGTH(version))
 		pr_crit("Serialized End of Data is %zu bytes.", len);
 
-	return send_response(fd, pdu.header.pdu_type, data, len);
+	error = queue_response(stream, pdu.header.pdu_type, data, len);
+	if (error)
+		return error;
+
+	return pdu_stream_flush(stream);
 }
 
 int
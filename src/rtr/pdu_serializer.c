@@ -139,6 +139,77 @@ serialize_router_key_pdu(struct router_key_pdu *pdu, unsigned char *buf)
 	return ptr - buf;
 }
 
+/*
+ * Builds and serializes the Prefix PDU (IPv4 or IPv6, depending on @vrp's
+ * address family) that corresponds to @vrp.
+ *
+ * @buf needs RTRPDU_IPV6_PREFIX_LEN bytes. Returns the length of the PDU, or 0
+ * if the address family is unknown.
+ */
+size_t
+serialize_prefix(uint8_t version, struct vrp const *vrp, uint8_t flags,
+    unsigned char *buf)
+{
+	struct ipv4_prefix_pdu pdu4;
+	struct ipv6_prefix_pdu pdu6;
+
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		pdu4.header.protocol_version = version;
+		pdu4.header.pdu_type = PDU_TYPE_IPV4_PREFIX;
+		pdu4.header.m.reserved = 0;
+		pdu4.header.length = RTRPDU_IPV4_PREFIX_LEN;
+		pdu4.flags = flags;
+		pdu4.prefix_length = vrp->prefix_length;
+		pdu4.max_length = vrp->max_prefix_length;
+		pdu4.zero = 0;
+		pdu4.ipv4_prefix = vrp->prefix.v4;
+		pdu4.asn = vrp->asn;
+		return serialize_ipv4_prefix_pdu(&pdu4, buf);
+	case AF_INET6:
+		pdu6.header.protocol_version = version;
+		pdu6.header.pdu_type = PDU_TYPE_IPV6_PREFIX;
+		pdu6.header.m.reserved = 0;
+		pdu6.header.length = RTRPDU_IPV6_PREFIX_LEN;
+		pdu6.flags = flags;
+		pdu6.prefix_length = vrp->prefix_length;
+		pdu6.max_length = vrp->max_prefix_length;
+		pdu6.zero = 0;
+		pdu6.ipv6_prefix = vrp->prefix.v6;
+		pdu6.asn = vrp->asn;
+		return serialize_ipv6_prefix_pdu(&pdu6, buf);
+	}
+
+	return 0;
+}
+
+/*
+ * Builds and serializes the Router Key PDU that corresponds to @key.
+ *
+ * @buf needs RTRPDU_ROUTER_KEY_LEN bytes. Returns the length of the PDU, or 0
+ * if @version is RTRv0 (which lacks Router Keys).
+ */
+size_t
+serialize_router_key(uint8_t version, struct router_key const *key,
+    uint8_t flags, unsigned char *buf)
+{
+	struct router_key_pdu pdu;
+
+	pdu.header.protocol_version = version;
+	pdu.header.pdu_type = PDU_TYPE_ROUTER_KEY;
+	/* Set the flags at the first 8 bits of reserved field */
+	pdu.header.m.reserved = flags << 8;
+	pdu.header.length = RTRPDU_ROUTER_KEY_LEN;
+
+	memcpy(pdu.ski, key->ski, RK_SKI_LEN);
+	pdu.ski_len = RK_SKI_LEN;
+	pdu.asn = key->as;
+	memcpy(pdu.spki, key->spk, RK_SPKI_LEN);
+	pdu.spki_len = RK_SPKI_LEN;
+
+	return serialize_router_key_pdu(&pdu, buf);
+}
+
 size_t
 serialize_error_report_pdu(struct error_report_pdu *pdu, unsigned char *buf)
 {
@@ -2,6 +2,7 @@
 #define SRC_RTR_PDU_SERIALIZER_H_
 
 #include "rtr/pdu.h"
+#include "types/vrp.h"
 
 size_t serialize_serial_notify_pdu(struct serial_notify_pdu *,
     unsigned char *);
@@ -14,4 +15,8 @@ size_t serialize_cache_reset_pdu(struct cache_reset_pdu *, unsigned char *);
 size_t serialize_router_key_pdu(struct router_key_pdu *, unsigned char *);
 size_t serialize_error_report_pdu(struct error_report_pdu *, unsigned char *);
 
+size_t serialize_prefix(uint8_t, struct vrp const *, uint8_t, unsigned char *);
+size_t serialize_router_key(uint8_t, struct router_key const *, uint8_t,
+    unsigned char *);
+
 #endif /* SRC_RTR_PDU_SERIALIZER_H_ */
@@ -0,0 +1,122 @@
+#include "rtr/pdu_snapshot.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "types/delta.h"
+#include "rtr/pdu.h"
+#include "rtr/pdu_serializer.h"
+
+struct pdu_snapshot {
+	uint8_t version;
+	unsigned char *data;
+	size_t len;
+	atomic_uint references;
+};
+
+static int
+append_prefix(struct vrp const *vrp, void *arg)
+{
+	struct pdu_snapshot *snapshot = arg;
+	size_t len;
+
+	len = serialize_prefix(snapshot->version, vrp, FLAG_ANNOUNCEMENT,
+	    snapshot->data + snapshot->len);
+	if (len == 0)
+		return -EINVAL;
+
+	snapshot->len += len;
+	return 0;
+}
+
+static int
+append_router_key(struct router_key const *key, void *arg)
+{
+	struct pdu_snapshot *snapshot = arg;
+
+	/* Returns zero on RTRv0, which is what we want */
+	snapshot->len += serialize_router_key(snapshot->version, key,
+	    FLAG_ANNOUNCEMENT, snapshot->data + snapshot->len);
+	return 0;
+}
+
+/**
+ * Serializes all of @base's VRPs and Router Keys as announcements of RTR
+ * version @version.
+ *
+ * @base is not modified, but the caller must prevent concurrent writes.
+ */
+int
+pdu_snapshot_create(struct db_table *base, uint8_t version,
+    struct pdu_snapshot **result)
+{
+	struct pdu_snapshot *snapshot;
+	size_t capacity;
+	int error;
+
+	snapshot = malloc(sizeof(struct pdu_snapshot));
+	if (snapshot == NULL)
+		return pr_enomem();
+
+	/* Upper bound; IPv4 PDUs are shorter. */
+	capacity = db_table_roa_count(base) * RTRPDU_IPV6_PREFIX_LEN;
+	if (version != RTR_V0)
+		capacity += db_table_router_key_count(base)
+		    * RTRPDU_ROUTER_KEY_LEN;
+
+	/* Some mallocs return NULL on zero */
+	snapshot->data = malloc(capacity > 0 ? capacity : 1);
+	if (snapshot->data == NULL) {
+		error = pr_enomem();
+		goto free_snapshot;
+	}
+
+	snapshot->version = version;
+	snapshot->len = 0;
+	atomic_init(&snapshot->references, 1);
+
+	error = db_table_foreach_roa(base, append_prefix, snapshot);
+	if (error)
+		goto free_data;
+	error = db_table_foreach_router_key(base, append_router_key, snapshot);
+	if (error)
+		goto free_data;
+
+	*result = snapshot;
+	return 0;
+
+free_data:
+	free(snapshot->data);
+free_snapshot:
+	free(snapshot);
+	return error;
+}
+
+void
+pdu_snapshot_refget(struct pdu_snapshot *snapshot)
+{
+	atomic_fetch_add(&snapshot->references, 1);
+}
+
+void
+pdu_snapshot_refput(struct pdu_snapshot *snapshot)
+{
+	if (atomic_fetch_sub(&snapshot->references, 1) == 1) {
+		free(snapshot->data);
+		free(snapshot);
+	}
+}
+
+unsigned char const *
+pdu_snapshot_data(struct pdu_snapshot *snapshot)
+{
+	return snapshot->data;
+}
+
+size_t
+pdu_snapshot_len(struct pdu_snapshot *snapshot)
+{
+	return snapshot->len;
+}
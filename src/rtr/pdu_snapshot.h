@@ -0,0 +1,27 @@
+#ifndef SRC_RTR_PDU_SNAPSHOT_H_
+#define SRC_RTR_PDU_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "rtr/db/db_table.h"
+
+/*
+ * The Prefix and Router Key PDUs of an entire database (base), already
+ * serialized for a specific RTR version.
+ *
+ * Every client that requests a Reset Query on the same serial receives the
+ * exact same bytes, so they are only encoded once (when the base is
+ * published), and then simply copied into the sockets.
+ *
+ * Immutable, aside from the reference counter.
+ */
+struct pdu_snapshot;
+
+int pdu_snapshot_create(struct db_table *, uint8_t, struct pdu_snapshot **);
+void pdu_snapshot_refget(struct pdu_snapshot *);
+void pdu_snapshot_refput(struct pdu_snapshot *);
+
+unsigned char const *pdu_snapshot_data(struct pdu_snapshot *);
+size_t pdu_snapshot_len(struct pdu_snapshot *);
+
+#endif /* SRC_RTR_PDU_SNAPSHOT_H_ */
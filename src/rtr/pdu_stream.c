@@ -0,0 +1,129 @@
+#include "rtr/pdu_stream.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+int
+pdu_stream_init(struct pdu_stream *stream, int fd, size_t capacity)
+{
+	stream->buffer = malloc(capacity);
+	if (stream->buffer == NULL)
+		return pr_enomem();
+
+	stream->fd = fd;
+	stream->capacity = capacity;
+	stream->len = 0;
+	return 0;
+}
+
+/* Blocks until @fd can be written. */
+static int
+wait_writable(int fd)
+{
+	struct pollfd pfd;
+	int error;
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+
+	do {
+		pfd.revents = 0;
+		error = poll(&pfd, 1, -1);
+		if (error < 0) {
+			error = errno;
+			if (error == EINTR)
+				continue;
+			return pr_op_err("poll() error: %s", strerror(error));
+		}
+		if (error == 0)
+			return pr_op_err("poll() returned 0, even though there's no timeout.");
+		if (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))
+			return pr_op_err("poll() returned revents %u.", pfd.revents);
+	} while (!(pfd.revents & POLLOUT));
+
+	return 0;
+}
+
+/* Writes all of @data, even if the kernel accepts it in several pieces. */
+static int
+write_all(int fd, unsigned char const *data, size_t len)
+{
+	ssize_t written;
+	int error;
+
+	while (len > 0) {
+		error = wait_writable(fd);
+		if (error)
+			return error;
+
+		written = write(fd, data, len);
+		if (written < 0) {
+			error = errno;
+			if (error == EINTR || error == EAGAIN
+			    || error == EWOULDBLOCK)
+				continue;
+			pr_op_err("Error sending PDUs to client: %s",
+			    strerror(error));
+			return error;
+		}
+
+		data += written;
+		len -= written;
+	}
+
+	return 0;
+}
+
+/**
+ * Queues @data (which is expected to be one or more serialized PDUs) for
+ * sending. The buffer is flushed first if there's no room left.
+ */
+int
+pdu_stream_write(struct pdu_stream *stream, unsigned char const *data,
+    size_t len)
+{
+	int error;
+
+	if (stream->len + len > stream->capacity) {
+		error = pdu_stream_flush(stream);
+		if (error)
+			return error;
+	}
+
+	/* Too big to be buffered; don't bother copying it. */
+	if (len > stream->capacity)
+		return write_all(stream->fd, data, len);
+
+	memcpy(stream->buffer + stream->len, data, len);
+	stream->len += len;
+	return 0;
+}
+
+/* Sends everything that has been queued so far. */
+int
+pdu_stream_flush(struct pdu_stream *stream)
+{
+	int error;
+
+	if (stream->len == 0)
+		return 0;
+
+	pr_op_debug("Sending %zu bytes of PDUs to client.", stream->len);
+
+	error = write_all(stream->fd, stream->buffer, stream->len);
+	/* The data is dropped on error; the client is going to be closed. */
+	stream->len = 0;
+	return error;
+}
+
+/* Does not flush. */
+void
+pdu_stream_cleanup(struct pdu_stream *stream)
+{
+	free(stream->buffer);
+}
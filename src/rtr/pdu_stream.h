@@ -0,0 +1,34 @@
+#ifndef SRC_RTR_PDU_STREAM_H_
+#define SRC_RTR_PDU_STREAM_H_
+
+#include <stddef.h>
+
+/*
+ * Default size of the buffer; PDUs are sent to the client in writes of
+ * (roughly) this size.
+ */
+#define PDU_STREAM_CAPACITY (64 * 1024)
+
+/*
+ * A buffered writer of PDUs.
+ *
+ * Serializing a full table (Reset Query response) one write per PDU costs two
+ * syscalls per VRP (poll() and write()). Instead, the PDUs are accumulated here
+ * and sent in large chunks.
+ *
+ * Instances of this struct are expected to live on the stack.
+ */
+struct pdu_stream {
+	int fd;
+	unsigned char *buffer;
+	size_t capacity;
+	/* Number of bytes currently waiting in @buffer. */
+	size_t len;
+};
+
+int pdu_stream_init(struct pdu_stream *, int, size_t);
+int pdu_stream_write(struct pdu_stream *, unsigned char const *, size_t);
+int pdu_stream_flush(struct pdu_stream *);
+void pdu_stream_cleanup(struct pdu_stream *);
+
+#endif /* SRC_RTR_PDU_STREAM_H_ */
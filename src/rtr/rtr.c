@@ -4,13 +4,18 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <log.h>
-#include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <sys/queue.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
 
 #include "config.h"
 #include "types/address.h"
@@ -21,23 +26,34 @@
 static pthread_t server_thread;
 static volatile bool stop_server_thread;
 
+#define REQUEST_BUFFER_LEN 1024
+
+/* A connected router, along with the state the server keeps for it. */
+struct client {
+	struct rtr_client meta;
+	/*
+	 * Bytes the router sent that haven't been handled yet.
+	 * (Normally, the beginning of a PDU that was split across reads.)
+	 */
+	unsigned char buffer[REQUEST_BUFFER_LEN];
+	size_t nread;
+#ifndef __linux__
+	/* Is the server thread supposed to be polling this client? */
+	bool armed;
+#endif
+	TAILQ_ENTRY(client) hook;
+};
+
 STATIC_ARRAY_LIST(server_arraylist, struct rtr_server)
-STATIC_ARRAY_LIST(client_arraylist, struct rtr_client)
+TAILQ_HEAD(client_list, client);
 
 static struct server_arraylist servers;
-static struct client_arraylist clients;
+/* Protected by @lock. */
+static struct client_list clients;
 static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
 struct thread_pool *request_handlers;
 
-#define REQUEST_BUFFER_LEN 1024
-
-struct client_request {
-	struct rtr_client *client;
-	unsigned char buffer[REQUEST_BUFFER_LEN];
-	size_t nread;
-};
-
 enum poll_verdict {
 	PV_CONTINUE,
 	PV_RETRY, /* Pause for a while, then continue */
@@ -84,8 +100,16 @@ cleanup_client(struct rtr_client *client)
 static void
 destroy_db(void)
 {
+	struct client *client;
+
 	server_arraylist_cleanup(&servers, cleanup_server);
-	client_arraylist_cleanup(&clients, cleanup_client);
+
+	while (!TAILQ_EMPTY(&clients)) {
+		client = TAILQ_FIRST(&clients);
+		TAILQ_REMOVE(&clients, client, hook);
+		cleanup_client(&client->meta);
+		free(client);
+	}
 }
 
 /*
@@ -380,371 +404,652 @@ init_server_fds(void)
 }
 
 static void
-handle_client_request(void *arg)
+close_client(struct client *client)
 {
-	struct client_request *crequest = arg;
-	struct pdu_reader reader;
-	struct rtr_request rrequest;
-	struct pdu_metadata const *meta;
-
-	pdu_reader_init(&reader, crequest->buffer, crequest->nread);
-
-	while (pdu_load(&reader, crequest->client, &rrequest, &meta) == 0) {
-		meta->handle(crequest->client->fd, &rrequest);
-		meta->destructor(rrequest.pdu);
-	}
+	lock_mutex();
+	TAILQ_REMOVE(&clients, client, hook);
+	unlock_mutex();
 
-	free(crequest);
+	cleanup_client(&client->meta);
+	free(client);
 }
 
-static void
-init_pollfd(struct pollfd *pfd, int fd)
+static bool
+is_server(void *owner)
 {
-	pfd->fd = fd;
-	pfd->events = POLLIN;
-	pfd->revents = 0;
-}
+	struct rtr_server *server;
+	unsigned int i;
 
-enum accept_verdict {
-	AV_SUCCESS,
-	AV_CLIENT_ERROR,
-	AV_SERVER_ERROR,
-};
+	ARRAYLIST_FOREACH(&servers, server, i)
+		if (server == owner)
+			return true;
+
+	return false;
+}
 
 /*
- * Converts an error code to a verdict.
- * The error code is assumed to have been spewed by the `accept()` function.
+ * The event backend.
+ *
+ * Servers are level-triggered. Clients are one-shot: Once a client reports
+ * activity, the server thread stops listening to it until the worker that
+ * handles the activity rearms it. This way, each client is read and answered
+ * by one thread at a time, and its requests are handled in order.
+ *
+ * On Linux, this is epoll. Elsewhere, it's a poll() whose pollfd array is only
+ * rebuilt when the set of polled sockets changes.
  */
-static enum accept_verdict
-handle_accept_result(int client_fd, int err)
-{
-	if (client_fd >= 0)
-		return AV_SUCCESS;
 
-	/*
-	 * Note: I can't just use a single nice switch because EAGAIN and
-	 * EWOULDBLOCK are the same value in at least one supported system
-	 * (Linux).
-	 */
+static void handle_event(void *, char const *);
 
-#if __linux__
-	/*
-	 * man 2 accept (on Linux):
-	 * Linux  accept() (...) passes already-pending network errors on the
-	 * new socket as an error code from accept(). This behavior differs from
-	 * other BSD socket implementations. For reliable operation the
-	 * application should detect the network errors defined for the protocol
-	 * after accept() and treat them like EAGAIN by retrying. In the case of
-	 * TCP/IP, these are (...)
-	 */
-	if (err == ENETDOWN || err == EPROTO || err == ENOPROTOOPT
-	    || err == EHOSTDOWN || err == ENONET || err == EHOSTUNREACH
-	    || err == EOPNOTSUPP || err == ENETUNREACH)
-		goto retry;
-#endif
+#ifdef __linux__
 
-	if (err == EAGAIN)
-		goto retry;
-	if (err == EWOULDBLOCK)
-		goto retry;
+#define MAX_EVENTS 64
 
-	pr_op_info("Client connection attempt not accepted: %s. Quitting...",
-	    strerror(err));
-	return AV_SERVER_ERROR;
+static int epoll_fd = -1;
 
-retry:
-	pr_op_info("Client connection attempt not accepted: %s. Retrying...",
-	    strerror(err));
-	return AV_CLIENT_ERROR;
+static int
+events_init(void)
+{
+	int error;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		error = errno;
+		pr_op_err("epoll_create1() failed: %s", strerror(error));
+		return error;
+	}
+
+	return 0;
 }
 
-static enum accept_verdict
-accept_new_client(struct pollfd const *server_fd)
+static void
+events_cleanup(void)
 {
-	struct sockaddr_storage client_addr;
-	socklen_t sizeof_client_addr;
-	struct rtr_client client;
-	enum accept_verdict result;
-
-	sizeof_client_addr = sizeof(client_addr);
+	if (epoll_fd != -1) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+}
 
-	/* Accept the connection */
-	client.fd = accept(server_fd->fd, (struct sockaddr *) &client_addr,
-	    &sizeof_client_addr);
+static int
+__epoll_ctl(int op, int fd, uint32_t events, void *owner)
+{
+	struct epoll_event event;
+	int error;
 
-	result = handle_accept_result(client.fd, errno);
-	if (result != AV_SUCCESS)
-		return result;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = owner;
 
-	if (set_nonblock(client.fd) != 0) {
-		close(client.fd);
-		return AV_CLIENT_ERROR;
+	if (epoll_ctl(epoll_fd, op, fd, &event) != 0) {
+		error = errno;
+		pr_op_err("epoll_ctl() failed: %s", strerror(error));
+		return error;
 	}
 
-	client.rtr_version = -1;
-	sockaddr2str(&client_addr, client.addr);
-	if (client_arraylist_add(&clients, &client) != 0) {
-		close(client.fd);
-		return AV_CLIENT_ERROR;
-	}
+	return 0;
+}
 
-	pr_op_info("Client accepted [FD: %d]: %s", client.fd, client.addr);
-	return AV_SUCCESS;
+static int
+events_add_server(struct rtr_server *server)
+{
+	return __epoll_ctl(EPOLL_CTL_ADD, server->fd, EPOLLIN, server);
+}
+
+static int
+events_add_client(struct client *client)
+{
+	return __epoll_ctl(EPOLL_CTL_ADD, client->meta.fd,
+	    EPOLLIN | EPOLLET | EPOLLONESHOT, client);
 }
 
 /*
- * true: success.
- * false: oh noes; close socket.
+ * Can be called from any thread. If the client sent something since it was
+ * last read, epoll reports it right away.
  */
-static bool
-read_until_block(int fd, struct client_request *request)
+static int
+events_rearm_client(struct client *client)
 {
-	ssize_t read_result;
-	size_t offset;
-	int error;
+	return __epoll_ctl(EPOLL_CTL_MOD, client->meta.fd,
+	    EPOLLIN | EPOLLET | EPOLLONESHOT, client);
+}
 
-	request->nread = 0;
+/* Closing the fd already removes it from the epoll set. */
+static void
+events_refresh(void)
+{
+}
 
-	for (offset = 0; offset < REQUEST_BUFFER_LEN; offset += read_result) {
-		read_result = read(fd, &request->buffer[offset],
-		    REQUEST_BUFFER_LEN - offset);
-		if (read_result == -1) {
-			error = errno;
-			if (error == EAGAIN || error == EWOULDBLOCK)
-				return true; /* Ok, we have the full packet. */
+static char const *
+events_failure(uint32_t events)
+{
+	if (events & EPOLLHUP)
+		return "EPOLLHUP (Peer hung up)";
+	if (events & EPOLLERR)
+		return "EPOLLERR (Generic error)";
+	return NULL;
+}
 
-			pr_op_err("Client socket read interrupted: %s",
-			    strerror(error));
-			return false;
-		}
+static enum poll_verdict
+events_wait(void)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int nevents;
+	int i;
+	int error;
 
-		if (read_result == 0) {
-			if (offset == 0) {
-				pr_op_debug("Client closed the socket.");
-				return false;
-			}
+	nevents = epoll_wait(epoll_fd, events, MAX_EVENTS, 1000);
 
-			return true; /* Ok, we have the last packet. */
-		}
+	if (stop_server_thread)
+		return PV_STOP;
 
-		request->nread += read_result;
+	if (nevents < 0) {
+		error = errno;
+		switch (error) {
+		case EINTR:
+			pr_op_info("epoll_wait() was interrupted by some signal.");
+			return PV_STOP;
+		default:
+			pr_crit("epoll_wait() returned %d.", error);
+		}
 	}
 
-	pr_op_warn("Peer's request is too big (>= %u bytes). Peer does not look like an RTR client; closing connection.",
-	    REQUEST_BUFFER_LEN);
-	return false;
+	for (i = 0; i < nevents; i++)
+		handle_event(events[i].data.ptr,
+		    events_failure(events[i].events));
+
+	return PV_CONTINUE;
 }
 
-static bool
-__handle_client_request(struct rtr_client *client)
+#else /* __linux__ */
+
+/*
+ * pollfds[0] is the read end of @wakeup; workers write to @wakeup when they
+ * rearm a client, so the server thread starts polling it right away.
+ * @owners[i] is the server or client that owns @pollfds[i].
+ */
+static struct pollfd *pollfds;
+static void **owners;
+static unsigned int pollfds_len;
+static unsigned int pollfds_capacity;
+/* Does the array need to be rebuilt? Protected by @lock. */
+static bool dirty;
+static int wakeup[2] = { -1, -1 };
+
+static int
+events_init(void)
 {
-	struct client_request *request;
 	int error;
 
-	request = malloc(sizeof(struct client_request));
-	if (request == NULL) {
-		pr_enomem();
-		return false;
-	}
+	pollfds = NULL;
+	owners = NULL;
+	pollfds_len = 0;
+	pollfds_capacity = 0;
+	dirty = true;
 
-	request->client = client;
-	if (!read_until_block(client->fd, request))
-		goto cancel;
+	if (pipe(wakeup) != 0) {
+		error = errno;
+		pr_op_err("pipe() failed: %s", strerror(error));
+		return error;
+	}
 
-	pr_op_debug("Client sent %zu bytes.", request->nread);
-	error = thread_pool_push(request_handlers, "RTR request",
-	    handle_client_request, request);
+	error = set_nonblock(wakeup[0]);
 	if (error)
-		goto cancel;
+		goto fail;
+	error = set_nonblock(wakeup[1]);
+	if (error)
+		goto fail;
 
-	return true;
+	return 0;
 
-cancel:
-	free(request);
-	return false;
+fail:
+	close(wakeup[0]);
+	close(wakeup[1]);
+	wakeup[0] = wakeup[1] = -1;
+	return error;
 }
 
 static void
-print_poll_failure(struct pollfd *pfd, char const *what, char const *addr)
+events_cleanup(void)
 {
-	if (pfd->revents & POLLHUP)
-		pr_op_err("%s '%s' down: POLLHUP (Peer hung up)", what, addr);
-	if (pfd->revents & POLLERR)
-		pr_op_err("%s '%s' down: POLLERR (Generic error)", what, addr);
-	if (pfd->revents & POLLNVAL)
-		pr_op_err("%s '%s' down: POLLNVAL (fd not open)", what, addr);
+	if (wakeup[0] != -1) {
+		close(wakeup[0]);
+		close(wakeup[1]);
+		wakeup[0] = wakeup[1] = -1;
+	}
+	free(pollfds);
+	free(owners);
 }
 
 static void
-delete_dead_clients(void)
+events_refresh(void)
 {
-	unsigned int src;
-	unsigned int dst;
+	lock_mutex();
+	dirty = true;
+	unlock_mutex();
+}
 
-	for (src = 0, dst = 0; src < clients.len; src++) {
-		if (clients.array[src].fd != -1) {
-			clients.array[dst] = clients.array[src];
-			dst++;
-		}
-	}
+static int
+events_add_server(struct rtr_server *server)
+{
+	events_refresh();
+	return 0;
+}
 
-	clients.len = dst;
+static int
+events_add_client(struct client *client)
+{
+	lock_mutex();
+	client->armed = true;
+	dirty = true;
+	unlock_mutex();
+	return 0;
+}
+
+static int
+events_rearm_client(struct client *client)
+{
+	lock_mutex();
+	client->armed = true;
+	dirty = true;
+	unlock_mutex();
+
+	/* If the pipe is full, the server thread is already due to wake up. */
+	if (write(wakeup[1], "", 1) < 0 && errno != EAGAIN)
+		pr_op_warn("Could not wake up the server thread: %s",
+		    strerror(errno));
+	return 0;
 }
 
 static void
-apply_pollfds(struct pollfd *pollfds, unsigned int nclients)
+init_pollfd(unsigned int index, int fd, void *owner)
+{
+	pollfds[index].fd = fd;
+	pollfds[index].events = POLLIN;
+	pollfds[index].revents = 0;
+	owners[index] = owner;
+}
+
+/* Needs @lock. */
+static int
+rebuild_pollfds(void)
 {
-	struct pollfd *pfd;
 	struct rtr_server *server;
-	struct rtr_client *client;
+	struct client *client;
+	struct pollfd *tmp_pollfds;
+	void **tmp_owners;
+	unsigned int capacity;
 	unsigned int i;
 
-	for (i = 0; i < servers.len; i++) {
-		pfd = &pollfds[i];
-		server = &servers.array[i];
+	capacity = 1 + servers.len;
+	TAILQ_FOREACH(client, &clients, hook)
+		capacity++;
 
-		/* PR_DEBUG_MSG("pfd:%d server:%d", pfd->fd, server->fd); */
+	if (capacity > pollfds_capacity) {
+		tmp_pollfds = realloc(pollfds, capacity * sizeof(*pollfds));
+		if (tmp_pollfds == NULL)
+			return pr_enomem();
+		pollfds = tmp_pollfds;
 
-		if ((pfd->fd == -1) && (server->fd != -1)) {
-			close(server->fd);
-			server->fd = -1;
-			print_poll_failure(pfd, "Server", server->addr);
-		}
+		tmp_owners = realloc(owners, capacity * sizeof(*owners));
+		if (tmp_owners == NULL)
+			return pr_enomem();
+		owners = tmp_owners;
+
+		pollfds_capacity = capacity;
 	}
 
-	for (i = 0; i < nclients; i++) {
-		pfd = &pollfds[servers.len + i];
-		client = &clients.array[i];
+	pollfds_len = 0;
+	init_pollfd(pollfds_len++, wakeup[0], NULL);
+	ARRAYLIST_FOREACH(&servers, server, i)
+		if (server->fd != -1)
+			init_pollfd(pollfds_len++, server->fd, server);
+	TAILQ_FOREACH(client, &clients, hook)
+		if (client->armed)
+			init_pollfd(pollfds_len++, client->meta.fd, client);
 
-		/* PR_DEBUG_MSG("pfd:%d client:%d", pfd->fd, client->fd); */
+	dirty = false;
+	return 0;
+}
 
-		if ((pfd->fd == -1) && (client->fd != -1)) {
-			close(client->fd);
-			client->fd = -1;
-			print_poll_failure(pfd, "Client", client->addr);
-		}
-	}
+static void
+drain_wakeup(void)
+{
+	char buffer[64];
 
-	delete_dead_clients();
+	while (read(wakeup[0], buffer, sizeof(buffer)) > 0)
+		;
 }
 
-static enum poll_verdict
-fddb_poll(void)
+static char const *
+events_failure(short revents)
 {
-	struct pollfd *pollfds; /* array */
-
-	struct rtr_server *server;
-	struct rtr_client *client;
-	struct pollfd *fd;
+	if (revents & POLLHUP)
+		return "POLLHUP (Peer hung up)";
+	if (revents & POLLERR)
+		return "POLLERR (Generic error)";
+	if (revents & POLLNVAL)
+		return "POLLNVAL (fd not open)";
+	return NULL;
+}
 
-	unsigned int nclients;
+static enum poll_verdict
+events_wait(void)
+{
+	struct client *client;
 	unsigned int i;
 	int error;
 
-	pollfds = calloc(servers.len + clients.len, sizeof(struct pollfd));
-	if (pollfds == NULL) {
-		pr_enomem();
+	lock_mutex();
+	error = dirty ? rebuild_pollfds() : 0;
+	unlock_mutex();
+	if (error)
 		return PV_RETRY;
-	}
 
-	ARRAYLIST_FOREACH(&servers, server, i)
-		init_pollfd(&pollfds[i], server->fd);
-	ARRAYLIST_FOREACH(&clients, client, i)
-		init_pollfd(&pollfds[servers.len + i], client->fd);
-
-	error = poll(pollfds, servers.len + clients.len, 1000);
+	error = poll(pollfds, pollfds_len, 1000);
 
 	if (stop_server_thread)
-		goto stop;
+		return PV_STOP;
 
 	if (error == 0)
-		goto success;
+		return PV_CONTINUE;
 
 	if (error < 0) {
 		error = errno;
 		switch (error) {
 		case EINTR:
 			pr_op_info("poll() was interrupted by some signal.");
-			goto stop;
+			return PV_STOP;
 		case ENOMEM:
 			pr_enomem();
 			/* Fall through */
 		case EAGAIN:
-			goto retry;
+			return PV_RETRY;
 		case EFAULT:
 		case EINVAL:
 			pr_crit("poll() returned %d.", error);
 		}
 	}
 
-	/* The servers might change this number, so store a backup. */
-	nclients = clients.len;
+	if (pollfds[0].revents != 0)
+		drain_wakeup();
 
-	/* New connections */
-	for (i = 0; i < servers.len; i++) {
-		/* This fd is a listening socket. */
-		fd = &pollfds[i];
+	for (i = 1; i < pollfds_len; i++) {
+		if (pollfds[i].revents == 0)
+			continue;
 
-		/* PR_DEBUG_MSG("Server %u: fd:%d revents:%x",
-		    i, fd->fd, fd->revents); */
+		if (!is_server(owners[i])) {
+			/* One-shot; the worker will rearm it. */
+			client = owners[i];
+			lock_mutex();
+			client->armed = false;
+			dirty = true;
+			unlock_mutex();
+		}
 
-		if (fd->fd == -1)
-			continue;
+		handle_event(owners[i], events_failure(pollfds[i].revents));
+	}
+
+	return PV_CONTINUE;
+}
 
-		if (fd->revents & (POLLHUP | POLLERR | POLLNVAL)) {
-			fd->fd = -1;
-
-		} else if (fd->revents & POLLIN) {
-			switch (accept_new_client(fd)) {
-			case AV_SUCCESS:
-			case AV_CLIENT_ERROR:
-				break;
-			case AV_SERVER_ERROR:
-				fd->fd = -1;
-			}
+#endif /* __linux__ */
+
+/*
+ * Returns the length of the PDU at the beginning of @bytes, if all of it has
+ * already arrived. Otherwise returns zero.
+ *
+ * PDUs too large for the buffer are considered complete, so pdu_load() can
+ * reject them.
+ */
+static size_t
+complete_pdu_len(unsigned char const *bytes, size_t nread)
+{
+	uint32_t pdu_len;
+
+	if (nread < RTRPDU_HDR_LEN)
+		return 0;
+
+	pdu_len = (((uint32_t)bytes[4]) << 24)
+	        | (((uint32_t)bytes[5]) << 16)
+	        | (((uint32_t)bytes[6]) <<  8)
+	        | (((uint32_t)bytes[7])      );
+
+	if (pdu_len > REQUEST_BUFFER_LEN)
+		return nread;
+	if (pdu_len < RTRPDU_HDR_LEN)
+		return RTRPDU_HDR_LEN; /* pdu_load() will complain */
+	return (nread >= pdu_len) ? pdu_len : 0;
+}
+
+/*
+ * Handles all the complete PDUs in @client's buffer, and leaves the remainder
+ * at the beginning of it.
+ */
+static void
+handle_client_pdus(struct client *client)
+{
+	struct pdu_reader reader;
+	struct rtr_request request;
+	struct pdu_metadata const *meta;
+	size_t offset;
+	size_t pdu_len;
+
+	offset = 0;
+	while ((pdu_len = complete_pdu_len(client->buffer + offset,
+	    client->nread - offset)) != 0) {
+		pdu_reader_init(&reader, client->buffer + offset, pdu_len);
+		if (pdu_load(&reader, &client->meta, &request, &meta) != 0) {
+			/*
+			 * Error PDU already sent, if any. Whatever follows is
+			 * no longer trustworthy.
+			 */
+			client->nread = 0;
+			return;
 		}
+
+		meta->handle(client->meta.fd, &request);
+		meta->destructor(request.pdu);
+		offset += pdu_len;
 	}
 
-	/* Client requests */
-	for (i = 0; i < nclients; i++) {
-		/* This fd is a client handler socket. */
-		fd = &pollfds[servers.len + i];
+	client->nread -= offset;
+	memmove(client->buffer, client->buffer + offset, client->nread);
+}
 
-		/* PR_DEBUG_MSG("Client %u: fd:%d revents:%x", i, fd->fd,
-		    fd->revents); */
+/*
+ * Reads and handles everything the client sent, until the socket runs dry.
+ *
+ * true: success.
+ * false: oh noes; close socket.
+ */
+static bool
+read_until_block(struct client *client)
+{
+	ssize_t read_result;
+	int error;
 
-		if (fd->fd == -1)
-			continue;
+	do {
+		read_result = read(client->meta.fd,
+		    client->buffer + client->nread,
+		    REQUEST_BUFFER_LEN - client->nread);
+		if (read_result == -1) {
+			error = errno;
+			if (error == EAGAIN || error == EWOULDBLOCK)
+				return true; /* Ok, we have everything. */
+			if (error == EINTR)
+				continue;
 
-		if (fd->revents & (POLLHUP | POLLERR | POLLNVAL)) {
-			fd->fd = -1;
-		} else if (fd->revents & POLLIN) {
-			if (!__handle_client_request(&clients.array[i]))
-				fd->fd = -1;
+			pr_op_err("Client socket read interrupted: %s",
+			    strerror(error));
+			return false;
 		}
+
+		if (read_result == 0) {
+			pr_op_debug("Client closed the socket.");
+			return false;
+		}
+
+		pr_op_debug("Client sent %zd bytes.", read_result);
+		client->nread += read_result;
+		handle_client_pdus(client);
+	} while (true);
+}
+
+static void
+handle_client_request(void *arg)
+{
+	struct client *client = arg;
+
+	if (!read_until_block(client) || events_rearm_client(client) != 0)
+		close_client(client);
+}
+
+enum accept_verdict {
+	AV_SUCCESS,
+	AV_CLIENT_ERROR,
+	AV_SERVER_ERROR,
+};
+
+/*
+ * Converts an error code to a verdict.
+ * The error code is assumed to have been spewed by the `accept()` function.
+ */
+static enum accept_verdict
+handle_accept_result(int client_fd, int err)
+{
+	if (client_fd >= 0)
+		return AV_SUCCESS;
+
+	/*
+	 * Note: I can't just use a single nice switch because EAGAIN and
+	 * EWOULDBLOCK are the same value in at least one supported system
+	 * (Linux).
+	 */
+
+#if __linux__
+	/*
+	 * man 2 accept (on Linux):
+	 * Linux  accept() (...) passes already-pending network errors on the
+	 * new socket as an error code from accept(). This behavior differs from
+	 * other BSD socket implementations. For reliable operation the
+	 * application should detect the network errors defined for the protocol
+	 * after accept() and treat them like EAGAIN by retrying. In the case of
+	 * TCP/IP, these are (...)
+	 */
+	if (err == ENETDOWN || err == EPROTO || err == ENOPROTOOPT
+	    || err == EHOSTDOWN || err == ENONET || err == EHOSTUNREACH
+	    || err == EOPNOTSUPP || err == ENETUNREACH)
+		goto retry;
+#endif
+
+	if (err == EAGAIN)
+		goto retry;
+	if (err == EWOULDBLOCK)
+		goto retry;
+
+	pr_op_info("Client connection attempt not accepted: %s. Quitting...",
+	    strerror(err));
+	return AV_SERVER_ERROR;
+
+retry:
+	pr_op_info("Client connection attempt not accepted: %s. Retrying...",
+	    strerror(err));
+	return AV_CLIENT_ERROR;
+}
+
+static enum accept_verdict
+accept_new_client(struct rtr_server *server)
+{
+	struct sockaddr_storage client_addr;
+	socklen_t sizeof_client_addr;
+	struct client *client;
+	enum accept_verdict result;
+	int fd;
+
+	sizeof_client_addr = sizeof(client_addr);
+
+	/* Accept the connection */
+	fd = accept(server->fd, (struct sockaddr *) &client_addr,
+	    &sizeof_client_addr);
+
+	result = handle_accept_result(fd, errno);
+	if (result != AV_SUCCESS)
+		return result;
+
+	if (set_nonblock(fd) != 0) {
+		close(fd);
+		return AV_CLIENT_ERROR;
+	}
+
+	client = malloc(sizeof(struct client));
+	if (client == NULL) {
+		pr_enomem();
+		close(fd);
+		return AV_CLIENT_ERROR;
 	}
 
+	client->meta.fd = fd;
+	client->meta.rtr_version = -1;
+	sockaddr2str(&client_addr, client->meta.addr);
+	client->nread = 0;
+
 	lock_mutex();
-	apply_pollfds(pollfds, nclients);
+	TAILQ_INSERT_TAIL(&clients, client, hook);
 	unlock_mutex();
-	/* Fall through */
 
-success:
-	free(pollfds);
-	return PV_CONTINUE;
-retry:
-	free(pollfds);
-	return PV_RETRY;
-stop:
-	free(pollfds);
-	return PV_STOP;
+	if (events_add_client(client) != 0) {
+		close_client(client);
+		return AV_CLIENT_ERROR;
+	}
+
+	pr_op_info("Client accepted [FD: %d]: %s", fd, client->meta.addr);
+	return AV_SUCCESS;
+}
+
+static void
+handle_server_event(struct rtr_server *server, char const *failure)
+{
+	if (failure == NULL) {
+		switch (accept_new_client(server)) {
+		case AV_SUCCESS:
+		case AV_CLIENT_ERROR:
+			return;
+		case AV_SERVER_ERROR:
+			break;
+		}
+	} else {
+		pr_op_err("Server '%s' down: %s", server->addr, failure);
+	}
+
+	close(server->fd);
+	server->fd = -1;
+	events_refresh();
+}
+
+/*
+ * @owner is the server or client whose socket reported activity. @failure is
+ * NULL, or the reason why the socket is no longer usable.
+ */
+static void
+handle_event(void *owner, char const *failure)
+{
+	if (is_server(owner)) {
+		handle_server_event(owner, failure);
+		return;
+	}
+
+	/* Also on failure; the worker will notice the socket is dead. */
+	if (thread_pool_push(request_handlers, "RTR request",
+	    handle_client_request, owner) != 0)
+		close_client(owner);
 }
 
 static void *
 server_cb(void *arg)
 {
 	do {
-		switch (fddb_poll()) {
+		switch (events_wait()) {
 		case PV_CONTINUE:
 			break;
 		case PV_RETRY:
@@ -756,32 +1061,60 @@ server_cb(void *arg)
 	} while (true);
 }
 
+static int
+init_events(void)
+{
+	struct rtr_server *server;
+	unsigned int i;
+	int error;
+
+	error = events_init();
+	if (error)
+		return error;
+
+	ARRAYLIST_FOREACH(&servers, server, i) {
+		error = events_add_server(server);
+		if (error) {
+			events_cleanup();
+			return error;
+		}
+	}
+
+	return 0;
+}
+
 int
 rtr_start(void)
 {
 	int error;
 
 	server_arraylist_init(&servers);
-	client_arraylist_init(&clients);
+	TAILQ_INIT(&clients);
 
 	error = init_server_fds();
 	if (error)
 		goto revert_fds;
 
+	error = init_events();
+	if (error)
+		goto revert_fds;
+
 	error = thread_pool_create("Server",
 	    config_get_thread_pool_server_max(),
 	    &request_handlers);
 	if (error)
-		goto revert_fds;
+		goto revert_events;
 
 	error = pthread_create(&server_thread, NULL, server_cb, NULL);
 	if (error) {
 		thread_pool_destroy(request_handlers);
-		goto revert_fds;
+		goto revert_events;
 	}
 
 	return 0;
 
+revert_events:
+	events_cleanup();
 revert_fds:
 	destroy_db();
 	return error;
@@ -801,23 +1134,21 @@ void rtr_stop(void)
 	thread_pool_destroy(request_handlers);
 
 	destroy_db();
+	events_cleanup();
 }
 
 int
 rtr_foreach_client(rtr_foreach_client_cb cb, void *arg)
 {
-	struct rtr_client *client;
-	unsigned int i;
+	struct client *client;
 	int error = 0;
 
 	lock_mutex();
 
-	ARRAYLIST_FOREACH(&clients, client, i) {
-		if (client->fd != -1) {
-			error = cb(client, arg);
-			if (error)
-				break;
-		}
+	TAILQ_FOREACH(client, &clients, hook) {
+		error = cb(&client->meta, arg);
+		if (error)
+			break;
 	}
 
 	unlock_mutex();
@@ -3,10 +3,14 @@
 #include <string.h>
 #include <time.h>
 #include <arpa/inet.h>
+#include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
+#include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 
 #include "common.h"
 #include "crypto/base64.h"
 #include "data_structure/array_list.h"
+#include "data_structure/uthash_nonfatal.h"
+#include "slurm/prefix_trie.h"
 #include "types/router_key.h"
 
 struct slurm_prefix_wrap {
@@ -31,8 +35,38 @@ struct slurm_lists {
 	struct al_assertion_bgpsec assertion_bgps_al;
 };
 
+/* Filters that can be told apart by ASN and/or SKI alone. */
+struct filter_key {
+	uint32_t asn;
+	unsigned char ski[RK_SKI_LEN];
+};
+
+struct filter_node {
+	struct filter_key key; /* Unused fields are zero */
+	UT_hash_handle hh;
+};
+
+/*
+ * @lists.filter_pfx_al and @lists.filter_bgps_al again, arranged so the VRPs
+ * and Router Keys don't have to be compared to every filter.
+ */
+struct filter_index {
+	/* Prefix filters that only have an ASN */
+	struct filter_node *pfx_asns;
+	/* Prefix filters that have a prefix (and maybe an ASN) */
+	struct prefix_trie pfx_v4;
+	struct prefix_trie pfx_v6;
+	/* BGPsec filters that only have an ASN */
+	struct filter_node *bgpsec_asns;
+	/* BGPsec filters that only have a SKI */
+	struct filter_node *bgpsec_skis;
+	/* BGPsec filters that have both */
+	struct filter_node *bgpsec_pairs;
+};
+
 struct db_slurm {
 	struct slurm_lists lists;
+	struct filter_index filters;
 	struct slurm_lists *cache;
 	time_t loaded_date;
 	struct slurm_csum_list csum_list;
@@ -116,6 +150,12 @@ db_slurm_create(struct slurm_csum_list *csums, struct db_slurm **result)
 	al_assertion_prefix_init(&db->lists.assertion_pfx_al);
 	al_filter_bgpsec_init(&db->lists.filter_bgps_al);
 	al_assertion_bgpsec_init(&db->lists.assertion_bgps_al);
+	db->filters.pfx_asns = NULL;
+	prefix_trie_init(&db->filters.pfx_v4);
+	prefix_trie_init(&db->filters.pfx_v6);
+	db->filters.bgpsec_asns = NULL;
+	db->filters.bgpsec_skis = NULL;
+	db->filters.bgpsec_pairs = NULL;
 	db->cache = NULL;
 	db->csum_list = *csums;
 
@@ -130,125 +170,130 @@ db_slurm_create(struct slurm_csum_list *csums, struct db_slurm **result)
 	return 0;
 }
 
-/*
- * @filter_wrap is the prefix loaded from SLURM, @prefix is the VRP "masked" as
- * a slurm_prefix
- */
-static bool
-prefix_filtered_by(struct slurm_prefix_wrap *filter_wrap,
-    struct slurm_prefix *prefix)
+static int
+filter_index_add(struct filter_node **table, uint32_t asn,
+    unsigned char const *ski)
 {
-	struct slurm_prefix *filter;
-	struct vrp *filter_vrp, *prefix_vrp;
-	bool equal;
+	struct filter_node *node;
+	struct filter_node *old;
 
-	filter = &filter_wrap->element;
-	filter_vrp = &filter->vrp;
-	prefix_vrp = &prefix->vrp;
+	node = malloc(sizeof(struct filter_node));
+	if (node == NULL)
+		return pr_enomem();
 
-	/*
-	 * Ignore the comments, remember: FILTERS don't have the same data (no
-	 * max_length is declared), while ASSERTIONS do.
-	 */
-	if ((filter->data_flag & ~SLURM_COM_FLAG_COMMENT) !=
-	    (prefix->data_flag & ~SLURM_COM_FLAG_COMMENT)) {
-		/* The filter has ASN and prefix */
-		if ((filter->data_flag & ~SLURM_COM_FLAG_COMMENT) ==
-		    (SLURM_COM_FLAG_ASN | SLURM_PFX_FLAG_PREFIX))
-			return (filter_vrp->asn == prefix_vrp->asn) &&
-			    vrp_prefix_cov(filter_vrp, prefix_vrp);
-
-		/* Both have ASN */
-		if ((filter->data_flag & SLURM_COM_FLAG_ASN) > 0 &&
-		    (prefix->data_flag & SLURM_COM_FLAG_ASN) > 0)
-			return filter_vrp->asn == prefix_vrp->asn;
-
-		/* Both have a prefix of the same type */
-		if ((filter->data_flag & SLURM_PFX_FLAG_PREFIX) > 0 &&
-		    (prefix->data_flag & SLURM_PFX_FLAG_PREFIX) > 0)
-			return vrp_prefix_cov(filter_vrp, prefix_vrp);
-
-		return false;
-	}
+	/* Needed by uthash */
+	memset(node, 0, sizeof(struct filter_node));
+	node->key.asn = asn;
+	if (ski != NULL)
+		memcpy(node->key.ski, ski, RK_SKI_LEN);
 
-	/* It has the same data, compare it */
-	equal = true;
-	if (equal && (filter->data_flag & SLURM_COM_FLAG_ASN) > 0)
-		equal = filter_vrp->asn == prefix_vrp->asn;
+	HASH_FIND(hh, *table, &node->key, sizeof(node->key), old);
+	if (old != NULL) {
+		free(node);
+		return 0;
+	}
 
-	if (equal && (filter->data_flag & SLURM_PFX_FLAG_PREFIX) > 0)
-		equal = vrp_prefix_cov(filter_vrp, prefix_vrp);
+	errno = 0;
+	HASH_ADD(hh, *table, key, sizeof(node->key), node);
+	if (errno) {
+		free(node);
+		return pr_enomem();
+	}
 
-	return equal;
+	return 0;
 }
 
 static bool
-prefix_filtered(struct db_slurm *db, struct slurm_prefix *prefix)
+filter_index_contains(struct filter_node *table, uint32_t asn,
+    unsigned char const *ski)
 {
-	struct slurm_prefix_wrap *cursor;
-	array_index i;
+	struct filter_key key;
+	struct filter_node *node;
 
-	ARRAYLIST_FOREACH(&db->lists.filter_pfx_al, cursor, i)
-		if (prefix_filtered_by(cursor, prefix))
-			return true;
+	memset(&key, 0, sizeof(key));
+	key.asn = asn;
+	if (ski != NULL)
+		memcpy(key.ski, ski, RK_SKI_LEN);
 
-	return false;
+	HASH_FIND(hh, table, &key, sizeof(key), node);
+	return node != NULL;
 }
 
-static bool
-bgpsec_filtered_by(struct slurm_bgpsec_wrap *filter_wrap,
-    struct slurm_bgpsec *bgpsec)
-{
-	struct slurm_bgpsec *filter;
-	bool equal;
-
-	filter = &filter_wrap->element;
-
-	/* Ignore the comments */
-	if ((filter->data_flag & ~SLURM_COM_FLAG_COMMENT) !=
-	    (bgpsec->data_flag & ~SLURM_COM_FLAG_COMMENT)) {
-		/* The filter has ASN and SKI */
-		if ((filter->data_flag & ~SLURM_COM_FLAG_COMMENT) ==
-		    (SLURM_COM_FLAG_ASN | SLURM_BGPS_FLAG_SKI))
-			return bgpsec->asn == filter->asn &&
-			    memcmp(bgpsec->ski, filter->ski, RK_SKI_LEN) == 0;
-
-		/* Both have ASN */
-		if ((bgpsec->data_flag & SLURM_COM_FLAG_ASN) > 0 &&
-		    (filter->data_flag & SLURM_COM_FLAG_ASN) > 0)
-			return bgpsec->asn == filter->asn;
-
-		/* Both have a SKI */
-		if ((bgpsec->data_flag & SLURM_BGPS_FLAG_SKI) > 0 &&
-		    (filter->data_flag & SLURM_BGPS_FLAG_SKI) > 0)
-			return memcmp(bgpsec->ski, filter->ski, RK_SKI_LEN)
-			    == 0;
-
-		return false;
+static void
+filter_table_destroy(struct filter_node **table)
+{
+	struct filter_node *node;
+	struct filter_node *tmp;
+
+	HASH_ITER(hh, *table, node, tmp) {
+		HASH_DEL(*table, node);
+		free(node);
 	}
+}
+
+static void
+filter_index_cleanup(struct filter_index *index)
+{
+	filter_table_destroy(&index->pfx_asns);
+	prefix_trie_cleanup(&index->pfx_v4);
+	prefix_trie_cleanup(&index->pfx_v6);
+	filter_table_destroy(&index->bgpsec_asns);
+	filter_table_destroy(&index->bgpsec_skis);
+	filter_table_destroy(&index->bgpsec_pairs);
+}
 
-	/* It has the same data, compare it */
-	equal = true;
-	if (equal && (filter->data_flag & SLURM_COM_FLAG_ASN) > 0)
-		equal = filter->asn == bgpsec->asn;
+/*
+ * Remember: FILTERS don't have the same data as ASSERTIONS (no max_length is
+ * declared), and the parser already made sure they have an ASN and/or prefix.
+ */
+static int
+filter_index_add_prefix(struct filter_index *index,
+    struct slurm_prefix *filter)
+{
+	struct vrp *vrp;
+	uint32_t const *asn;
+
+	vrp = &filter->vrp;
 
-	if (equal && (filter->data_flag & SLURM_BGPS_FLAG_SKI) > 0)
-		equal = memcmp(filter->ski, bgpsec->ski, RK_SKI_LEN) == 0;
+	if (!(filter->data_flag & SLURM_PFX_FLAG_PREFIX))
+		return (filter->data_flag & SLURM_COM_FLAG_ASN)
+		    ? filter_index_add(&index->pfx_asns, vrp->asn, NULL)
+		    : 0;
 
-	return equal;
+	asn = (filter->data_flag & SLURM_COM_FLAG_ASN) ? &vrp->asn : NULL;
+
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		return prefix_trie_add(&index->pfx_v4,
+		    (uint8_t const *) &vrp->prefix.v4, vrp->prefix_length, asn);
+	case AF_INET6:
+		return prefix_trie_add(&index->pfx_v6,
+		    (uint8_t const *) &vrp->prefix.v6, vrp->prefix_length, asn);
+	}
+
+	pr_crit("Unknown address family: %u", vrp->addr_fam);
 }
 
-static bool
-bgpsec_filtered(struct db_slurm *db, struct slurm_bgpsec *bgpsec)
+/* Same as above: The parser made sure there's an ASN and/or SKI. */
+static int
+filter_index_add_bgpsec(struct filter_index *index,
+    struct slurm_bgpsec *filter)
 {
-	struct slurm_bgpsec_wrap *cursor;
-	array_index i;
+	bool has_asn;
+	bool has_ski;
 
-	ARRAYLIST_FOREACH(&db->lists.filter_bgps_al, cursor, i)
-		if (bgpsec_filtered_by(cursor, bgpsec))
-			return true;
+	has_asn = (filter->data_flag & SLURM_COM_FLAG_ASN) > 0;
+	has_ski = (filter->data_flag & SLURM_BGPS_FLAG_SKI) > 0;
 
-	return false;
+	if (has_asn && has_ski)
+		return filter_index_add(&index->bgpsec_pairs, filter->asn,
+		    filter->ski);
+	if (has_asn)
+		return filter_index_add(&index->bgpsec_asns, filter->asn, NULL);
+	if (has_ski)
+		return filter_index_add(&index->bgpsec_skis, 0, filter->ski);
+
+	return 0;
 }
 
 static bool
@@ -381,32 +426,41 @@ db_slurm_add_bgpsec_assertion(struct db_slurm *db, struct slurm_bgpsec *elem)
 	return al_assertion_bgpsec_add(&db->cache->assertion_bgps_al, &new);
 }
 
+/*
+ * A filter drops @vrp if its ASN (if any) equals @vrp's, and its prefix (if
+ * any) covers @vrp's.
+ */
 bool
 db_slurm_vrp_is_filtered(struct db_slurm *db, struct vrp const *vrp)
 {
-	struct slurm_prefix slurm_prefix;
-
-	slurm_prefix.data_flag = SLURM_COM_FLAG_ASN | SLURM_PFX_FLAG_PREFIX
-	    | SLURM_PFX_FLAG_MAX_LENGTH;
-	slurm_prefix.vrp = *vrp;
+	if (filter_index_contains(db->filters.pfx_asns, vrp->asn, NULL))
+		return true;
+
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		return prefix_trie_covers(&db->filters.pfx_v4,
+		    (uint8_t const *) &vrp->prefix.v4, vrp->prefix_length,
+		    vrp->asn);
+	case AF_INET6:
+		return prefix_trie_covers(&db->filters.pfx_v6,
+		    (uint8_t const *) &vrp->prefix.v6, vrp->prefix_length,
+		    vrp->asn);
+	}
 
-	return prefix_filtered(db, &slurm_prefix);
+	return false;
 }
 
+/*
+ * A filter drops @key if its ASN (if any) and SKI (if any) equal @key's.
+ * (Router public key isn't used at filters.)
+ */
 bool
 db_slurm_bgpsec_is_filtered(struct db_slurm *db, struct router_key const *key)
 {
-	unsigned char ski[RK_SKI_LEN];
-	struct slurm_bgpsec slurm_bgpsec;
-
-	slurm_bgpsec.data_flag = SLURM_COM_FLAG_ASN | SLURM_BGPS_FLAG_SKI;
-	slurm_bgpsec.asn = key->as;
-	memcpy(ski, key->ski, RK_SKI_LEN);
-	slurm_bgpsec.ski = ski;
-	/* Router public key isn't used at filters */
-	slurm_bgpsec.router_public_key = NULL;
-
-	return bgpsec_filtered(db, &slurm_bgpsec);
+	return filter_index_contains(db->filters.bgpsec_asns, key->as, NULL)
+	    || filter_index_contains(db->filters.bgpsec_skis, 0, key->ski)
+	    || filter_index_contains(db->filters.bgpsec_pairs, key->as,
+	           key->ski);
 }
 
 #define ITERATE_LIST_FUNC(type, object, db_list)			\
@@ -561,6 +615,9 @@ persist_filter_prefix(struct db_slurm *db)
 		error = al_filter_prefix_add(&db->lists.filter_pfx_al, cursor);
 		if (error)
 			return error;
+		error = filter_index_add_prefix(&db->filters, &cursor->element);
+		if (error)
+			return error;
 	}
 
 	return 0;
@@ -578,6 +635,9 @@ persist_filter_bgpsec(struct db_slurm *db)
 		if (error)
 			return error;
 		slurm_bgpsec_wrap_refget(cursor);
+		error = filter_index_add_bgpsec(&db->filters, &cursor->element);
+		if (error)
+			return error;
 	}
 
 	return 0;
@@ -661,6 +721,7 @@ db_slurm_destroy(struct db_slurm *db)
 	struct slurm_file_csum *tmp;
 
 	slurm_lists_cleanup(&db->lists);
+	filter_index_cleanup(&db->filters);
 	if (db->cache)
 		slurm_lists_destroy(db->cache);
 
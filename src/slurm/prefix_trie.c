@@ -0,0 +1,218 @@
+#include "slurm/prefix_trie.h"
+
+#include <string.h>
+
+#include "log.h"
+#include "data_structure/array_list.h"
+
+/* Enough for IPv6 */
+#define ADDR_LEN 16
+
+STATIC_ARRAY_LIST(asn_list, uint32_t)
+
+struct trie_node {
+	/* Only the first @len bits are meaningful; the rest are zero. */
+	uint8_t addr[ADDR_LEN];
+	uint8_t len;
+
+	/* Was a filter without ASN declared on this prefix? */
+	bool any_asn;
+	/* ASNs of the filters declared on this prefix. */
+	struct asn_list asns;
+
+	/*
+	 * Longer prefixes, indexed by their bit @len.
+	 * Nodes created to join two branches have no filters.
+	 */
+	struct trie_node *children[2];
+};
+
+static unsigned int
+get_bit(uint8_t const *addr, unsigned int bit)
+{
+	return (addr[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/* Returns the number of leading bits @a and @b share, up to @max. */
+static unsigned int
+common_len(uint8_t const *a, uint8_t const *b, unsigned int max)
+{
+	unsigned int i;
+	uint8_t diff;
+
+	for (i = 0; i < max; i += 8) {
+		diff = a[i >> 3] ^ b[i >> 3];
+		if (diff != 0) {
+			while (!(diff & 0x80)) {
+				diff <<= 1;
+				i++;
+			}
+			return (i < max) ? i : max;
+		}
+	}
+
+	return max;
+}
+
+static struct trie_node *
+create_node(uint8_t const *addr, uint8_t len)
+{
+	struct trie_node *node;
+	unsigned int bytes;
+
+	node = malloc(sizeof(struct trie_node));
+	if (node == NULL)
+		return NULL;
+
+	memset(node->addr, 0, ADDR_LEN);
+	bytes = len >> 3;
+	memcpy(node->addr, addr, bytes);
+	if (len & 7)
+		node->addr[bytes] = addr[bytes] & (0xFF << (8 - (len & 7)));
+	node->len = len;
+	node->any_asn = false;
+	asn_list_init(&node->asns);
+	node->children[0] = NULL;
+	node->children[1] = NULL;
+
+	return node;
+}
+
+static void
+destroy_node(struct trie_node *node)
+{
+	if (node == NULL)
+		return;
+
+	destroy_node(node->children[0]);
+	destroy_node(node->children[1]);
+	asn_list_cleanup(&node->asns, NULL);
+	free(node);
+}
+
+void
+prefix_trie_init(struct prefix_trie *trie)
+{
+	trie->root = NULL;
+}
+
+void
+prefix_trie_cleanup(struct prefix_trie *trie)
+{
+	destroy_node(trie->root);
+	trie->root = NULL;
+}
+
+/* Returns the node that represents @addr/@len, creating it if necessary. */
+static struct trie_node *
+find_or_create(struct prefix_trie *trie, uint8_t const *addr, uint8_t len)
+{
+	struct trie_node **slot;
+	struct trie_node *node;
+	struct trie_node *parent;
+	struct trie_node *leaf;
+	unsigned int common;
+
+	slot = &trie->root;
+
+	while (*slot != NULL) {
+		node = *slot;
+		common = common_len(node->addr, addr,
+		    (node->len < len) ? node->len : len);
+
+		if (common == node->len) {
+			if (node->len == len)
+				return node;
+			slot = &node->children[get_bit(addr, node->len)];
+			continue;
+		}
+
+		/* @addr/@len branches off above @node. */
+		parent = create_node(addr, common);
+		if (parent == NULL)
+			return NULL;
+		parent->children[get_bit(node->addr, common)] = node;
+		*slot = parent;
+
+		if (common == len)
+			return parent;
+
+		leaf = create_node(addr, len);
+		if (leaf == NULL)
+			return NULL; /* @parent is harmless; leave it be */
+		parent->children[get_bit(addr, common)] = leaf;
+		return leaf;
+	}
+
+	*slot = create_node(addr, len);
+	return *slot;
+}
+
+/*
+ * Registers a filter on prefix @addr/@len. @asn is the filter's ASN, or NULL if
+ * the filter matches any ASN.
+ */
+int
+prefix_trie_add(struct prefix_trie *trie, uint8_t const *addr, uint8_t len,
+    uint32_t const *asn)
+{
+	struct trie_node *node;
+	uint32_t tmp;
+
+	if (len > 8 * ADDR_LEN)
+		pr_crit("Prefix length %u is too long for the trie.", len);
+
+	node = find_or_create(trie, addr, len);
+	if (node == NULL)
+		return pr_enomem();
+
+	if (asn == NULL) {
+		node->any_asn = true;
+		return 0;
+	}
+
+	tmp = *asn;
+	return asn_list_add(&node->asns, &tmp);
+}
+
+static bool
+node_matches(struct trie_node *node, uint32_t asn)
+{
+	uint32_t *cursor;
+	array_index i;
+
+	if (node->any_asn)
+		return true;
+
+	ARRAYLIST_FOREACH(&node->asns, cursor, i)
+		if (*cursor == asn)
+			return true;
+
+	return false;
+}
+
+/*
+ * Is prefix @addr/@len covered by (ie. equal to, or more specific than) the
+ * prefix of a filter that has ASN @asn, or no ASN?
+ *
+ * O(@len), give or take the ASNs declared on each traversed prefix.
+ */
+bool
+prefix_trie_covers(struct prefix_trie *trie, uint8_t const *addr, uint8_t len,
+    uint32_t asn)
+{
+	struct trie_node *node;
+
+	node = trie->root;
+	while (node != NULL && node->len <= len) {
+		if (common_len(node->addr, addr, node->len) != node->len)
+			return false;
+		if (node_matches(node, asn))
+			return true;
+		if (node->len == len)
+			return false;
+		node = node->children[get_bit(addr, node->len)];
+	}
+
+	return false;
+}
@@ -0,0 +1,27 @@
+#ifndef SRC_SLURM_PREFIX_TRIE_H_
+#define SRC_SLURM_PREFIX_TRIE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Path-compressed binary trie of IP prefixes, used to index the SLURM prefix
+ * filters. Each prefix remembers the ASNs of the filters that were declared on
+ * it, and whether one of them had no ASN (ie. matches any ASN).
+ *
+ * Addresses are in network byte order (as in struct in_addr and in6_addr).
+ * IPv4 and IPv6 prefixes must not be mixed in the same trie.
+ */
+struct prefix_trie {
+	struct trie_node *root;
+};
+
+void prefix_trie_init(struct prefix_trie *);
+void prefix_trie_cleanup(struct prefix_trie *);
+
+int prefix_trie_add(struct prefix_trie *, uint8_t const *, uint8_t,
+    uint32_t const *);
+bool prefix_trie_covers(struct prefix_trie *, uint8_t const *, uint8_t,
+    uint32_t);
+
+#endif /* SRC_SLURM_PREFIX_TRIE_H_ */
@@ -1,6 +1,7 @@
 #include "sorted_array.h"
 
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include "log.h"
@@ -16,7 +17,8 @@ struct sorted_array {
 	/* Comparison function for element insertion */
 	sarray_cmp cmp;
 
-	unsigned int refcount;
+	/* Children inherit their parents' arrays, possibly in other threads. */
+	atomic_uint refcount;
 };
 
 struct sorted_array *
@@ -37,7 +39,7 @@ sarray_create(size_t elem_size, sarray_cmp cmp)
 	result->len = 8;
 	result->size = elem_size;
 	result->cmp = cmp;
-	result->refcount = 1;
+	atomic_init(&result->refcount, 1);
 
 	return result;
 }
@@ -45,14 +47,13 @@ sarray_create(size_t elem_size, sarray_cmp cmp)
 void
 sarray_get(struct sorted_array *sarray)
 {
-	sarray->refcount++;
+	atomic_fetch_add(&sarray->refcount, 1);
 }
 
 void
 sarray_put(struct sorted_array *sarray)
 {
-	sarray->refcount--;
-	if (sarray->refcount == 0) {
+	if (atomic_fetch_sub(&sarray->refcount, 1) == 1) {
 		free(sarray->array);
 		free(sarray);
 	}
@@ -1,28 +1,28 @@
 #include "state.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
 #include "rrdp/db/db_rrdp.h"
+#include "common.h"
+#include "fetch_scheduler.h"
 #include "log.h"
 #include "thread_var.h"
+#include "crypto/sigcache.h"
+#include "data_structure/arena.h"
 
 /**
- * The current state of the validation cycle.
- *
- * It is one of the core objects in this project. Every time a trust anchor
- * triggers a validation cycle, the validator creates one of these objects and
- * uses it to traverse the tree and keep track of validated data.
+ * The part of the validation state that is shared by all the threads that are
+ * traversing the same trust anchor's tree.
  */
-struct validation {
-	struct tal *tal;
-
+struct validation_shared {
 	struct x509_data {
 		/** https://www.openssl.org/docs/man1.1.1/man3/X509_STORE_load_locations.html */
 		X509_STORE *store;
 		X509_VERIFY_PARAM *params;
 	} x509_data;
 
-	struct cert_stack *certstack;
-
 	struct uri_list *rsync_visited_uris;
 
 	/* Local RRDP workspace path */
@@ -31,6 +31,66 @@ struct validation {
 	/* Shallow copy of RRDP URIs and its corresponding visited uris */
 	struct db_rrdp_uri *rrdp_uris;
 
+	/*
+	 * Protects @rsync_visited_uris. (@rrdp_uris has its own lock.)
+	 *
+	 * The repositories themselves are synchronized at the same time by
+	 * several threads; @fetches prevents them from downloading the same
+	 * repository at once.
+	 */
+	pthread_mutex_t sync_lock;
+
+	/* Repositories that are currently being downloaded */
+	struct fetch_table *fetches;
+
+	struct validation_handler validation_handler;
+
+	atomic_uint references;
+};
+
+/**
+ * The current state of the validation cycle.
+ *
+ * It is one of the core objects in this project. Every time a trust anchor
+ * triggers a validation cycle, the validator creates one of these objects and
+ * uses it to traverse the tree and keep track of validated data.
+ *
+ * Subtrees of the tree can be traversed by other threads; each of them gets
+ * its own copy of this object. (See validation_fork().)
+ */
+struct validation {
+	/* NULL if the state was forked. (Subtrees do not need the TAL.) */
+	struct tal *tal;
+
+	struct validation_shared *shared;
+
+	/*
+	 * Memory for the short-lived objects of this traversal. Released when
+	 * the state dies. (See arena.h.)
+	 */
+	struct arena *arena;
+
+	struct cert_stack *certstack;
+
+	/*
+	 * Context of the certificate chain validations. It's recycled by all
+	 * of them instead of being allocated every time. (Created lazily; see
+	 * validation_store_ctx().)
+	 */
+	X509_STORE_CTX *store_ctx;
+
+	/*
+	 * RRDP workspace of the repository the traversal is currently working
+	 * on, or NULL if it's not working on an RRDP repository.
+	 */
+	char const *rrdp_current_workspace;
+
+	/*
+	 * Memo the ROAs of the current RPP are being recorded in, or NULL if
+	 * they aren't being recorded. (See rpp_memo.h.)
+	 */
+	struct rpp_memo *rpp_memo;
+
 	/* Did the TAL's public key match the root certificate's public key? */
 	enum pubkey_state pubkey_state;
 
@@ -43,8 +103,6 @@ struct validation {
 	 */
 	char addr_buffer1[INET6_ADDRSTRLEN];
 	char addr_buffer2[INET6_ADDRSTRLEN];
-
-	struct validation_handler validation_handler;
 };
 
 /*
@@ -82,28 +140,18 @@ cb(int ok, X509_STORE_CTX *ctx)
 	return (error == X509_V_ERR_UNHANDLED_CRITICAL_EXTENSION) ? 1 : ok;
 }
 
-/**
- * Creates a struct validation, puts it in thread local, and (incidentally)
- * returns it.
- */
-int
-validation_prepare(struct validation **out, struct tal *tal,
-    struct validation_handler *validation_handler)
+static int
+shared_create(struct tal *tal, struct validation_handler *validation_handler,
+    struct validation_shared **out)
 {
-	struct validation *result;
+	struct validation_shared *result;
 	X509_VERIFY_PARAM *params;
 	int error;
 
-	result = malloc(sizeof(struct validation));
+	result = malloc(sizeof(struct validation_shared));
 	if (!result)
 		return pr_enomem();
 
-	error = state_store(result);
-	if (error)
-		goto abort1;
-
-	result->tal = tal;
-
 	result->x509_data.store = X509_STORE_new();
 	if (!result->x509_data.store) {
 		error = val_crypto_err("X509_STORE_new() returned NULL");
@@ -119,26 +167,39 @@ validation_prepare(struct validation **out, struct tal *tal,
 	X509_VERIFY_PARAM_set_flags(params, X509_V_FLAG_CRL_CHECK);
 	X509_STORE_set1_param(result->x509_data.store, params);
 	X509_STORE_set_verify_cb(result->x509_data.store, cb);
+	if (sigcache_enabled())
+		X509_STORE_set_verify(result->x509_data.store,
+		    sigcache_verify_chain);
 
-	error = certstack_create(&result->certstack);
+	error = rsync_create(&result->rsync_visited_uris);
 	if (error)
 		goto abort3;
 
-	error = rsync_create(&result->rsync_visited_uris);
-	if (error)
+	error = pthread_mutex_init(&result->sync_lock, NULL);
+	if (error) {
+		pr_op_err("pthread_mutex_init() returned error %d: %s", error,
+		    strerror(error));
+		error = -error;
 		goto abort4;
+	}
+
+	error = fetch_table_create(&result->fetches);
+	if (error)
+		goto abort5;
 
 	result->rrdp_uris = db_rrdp_get_uris(tal_get_file_name(tal));
 	result->rrdp_workspace = db_rrdp_get_workspace(tal_get_file_name(tal));
 
-	result->pubkey_state = PKS_UNTESTED;
 	result->validation_handler = *validation_handler;
 	result->x509_data.params = params; /* Ownership transfered */
+	atomic_init(&result->references, 1);
 
 	*out = result;
 	return 0;
+abort5:
+	pthread_mutex_destroy(&result->sync_lock);
 abort4:
-	certstack_destroy(result->certstack);
+	rsync_destroy(result->rsync_visited_uris);
 abort3:
 	X509_VERIFY_PARAM_free(params);
 abort2:
@@ -148,13 +209,119 @@ abort1:
 	return error;
 }
 
+static void
+shared_refput(struct validation_shared *shared)
+{
+	if (atomic_fetch_sub(&shared->references, 1) == 1) {
+		X509_VERIFY_PARAM_free(shared->x509_data.params);
+		X509_STORE_free(shared->x509_data.store);
+		rsync_destroy(shared->rsync_visited_uris);
+		pthread_mutex_destroy(&shared->sync_lock);
+		fetch_table_destroy(shared->fetches);
+		free(shared);
+	}
+}
+
+/**
+ * Creates a struct validation, puts it in thread local, and (incidentally)
+ * returns it.
+ */
+int
+validation_prepare(struct validation **out, struct tal *tal,
+    struct validation_handler *validation_handler)
+{
+	struct validation *result;
+	int error;
+
+	result = malloc(sizeof(struct validation));
+	if (!result)
+		return pr_enomem();
+
+	error = state_store(result);
+	if (error)
+		goto abort1;
+
+	result->tal = tal;
+
+	error = shared_create(tal, validation_handler, &result->shared);
+	if (error)
+		goto abort1;
+
+	error = arena_create(&result->arena);
+	if (error)
+		goto abort2;
+
+	error = certstack_create(result->arena, &result->certstack);
+	if (error)
+		goto abort3;
+
+	result->store_ctx = NULL;
+	result->rrdp_current_workspace = NULL;
+	result->rpp_memo = NULL;
+	result->pubkey_state = PKS_UNTESTED;
+
+	*out = result;
+	return 0;
+abort3:
+	arena_destroy(result->arena);
+abort2:
+	shared_refput(result->shared);
+abort1:
+	free(result);
+	return error;
+}
+
+/**
+ * Creates a struct validation meant to traverse the children of @parent's
+ * current certificate, presumably in another thread.
+ *
+ * Unlike validation_prepare(), the result is not put in thread local. The
+ * thread that will use it has to state_store() it.
+ */
+int
+validation_fork(struct validation *parent, struct validation **out)
+{
+	struct validation *result;
+	int error;
+
+	result = malloc(sizeof(struct validation));
+	if (!result)
+		return pr_enomem();
+
+	error = arena_create(&result->arena);
+	if (error) {
+		free(result);
+		return error;
+	}
+
+	error = certstack_snapshot(parent->certstack, result->arena,
+	    &result->certstack);
+	if (error) {
+		arena_destroy(result->arena);
+		free(result);
+		return error;
+	}
+
+	result->tal = NULL;
+	result->shared = parent->shared;
+	atomic_fetch_add(&result->shared->references, 1);
+	result->store_ctx = NULL;
+	result->rrdp_current_workspace = parent->rrdp_current_workspace;
+	result->rpp_memo = NULL;
+	result->pubkey_state = parent->pubkey_state;
+
+	*out = result;
+	return 0;
+}
+
 void
 validation_destroy(struct validation *state)
 {
-	X509_VERIFY_PARAM_free(state->x509_data.params);
-	X509_STORE_free(state->x509_data.store);
+	if (state->store_ctx != NULL)
+		X509_STORE_CTX_free(state->store_ctx);
 	certstack_destroy(state->certstack);
-	rsync_destroy(state->rsync_visited_uris);
+	arena_destroy(state->arena);
+	shared_refput(state->shared);
 	free(state);
 }
 
@@ -167,7 +334,23 @@ validation_tal(struct validation *state)
 X509_STORE *
 validation_store(struct validation *state)
 {
-	return state->x509_data.store;
+	return state->shared->x509_data.store;
+}
+
+/*
+ * Returns the state's X509_STORE_CTX. Initialize it with X509_STORE_CTX_init()
+ * and release it with X509_STORE_CTX_cleanup() (not X509_STORE_CTX_free()).
+ */
+X509_STORE_CTX *
+validation_store_ctx(struct validation *state)
+{
+	if (state->store_ctx == NULL) {
+		state->store_ctx = X509_STORE_CTX_new();
+		if (state->store_ctx == NULL)
+			val_crypto_err("X509_STORE_CTX_new() returned NULL");
+	}
+
+	return state->store_ctx;
 }
 
 struct cert_stack *
@@ -176,10 +359,36 @@ validation_certstack(struct validation *state)
 	return state->certstack;
 }
 
+/* Only use this while holding the sync lock. */
 struct uri_list *
 validation_rsync_visited_uris(struct validation *state)
 {
-	return state->rsync_visited_uris;
+	return state->shared->rsync_visited_uris;
+}
+
+/**
+ * Protects the rsync visited URIs, since the same tree might be traversed (and
+ * its repositories synchronized) by several threads at the same time.
+ *
+ * Don't hold it while downloading; see validation_fetches() instead.
+ */
+void
+validation_sync_lock(struct validation *state)
+{
+	mutex_lock(&state->shared->sync_lock);
+}
+
+void
+validation_sync_unlock(struct validation *state)
+{
+	mutex_unlock(&state->shared->sync_lock);
+}
+
+/* Repository downloads currently in progress. See fetch_begin(). */
+struct fetch_table *
+validation_fetches(struct validation *state)
+{
+	return state->shared->fetches;
 }
 
 void
@@ -215,17 +424,43 @@ validation_get_ip_buffer2(struct validation *state)
 struct validation_handler const *
 validation_get_validation_handler(struct validation *state)
 {
-	return &state->validation_handler;
+	return &state->shared->validation_handler;
 }
 
+/* The table has its own lock. */
 struct db_rrdp_uri *
 validation_get_rrdp_uris(struct validation *state)
 {
-	return state->rrdp_uris;
+	return state->shared->rrdp_uris;
 }
 
 char const *
 validation_get_rrdp_workspace(struct validation *state)
 {
-	return state->rrdp_workspace;
+	return state->shared->rrdp_workspace;
+}
+
+char const *
+validation_get_rrdp_current_workspace(struct validation *state)
+{
+	return state->rrdp_current_workspace;
+}
+
+void
+validation_set_rrdp_current_workspace(struct validation *state,
+    char const *workspace)
+{
+	state->rrdp_current_workspace = workspace;
+}
+
+struct rpp_memo *
+validation_get_rpp_memo(struct validation *state)
+{
+	return state->rpp_memo;
+}
+
+void
+validation_set_rpp_memo(struct validation *state, struct rpp_memo *memo)
+{
+	state->rpp_memo = memo;
 }
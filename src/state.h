@@ -3,6 +3,7 @@
 
 #include <openssl/x509.h>
 #include "cert_stack.h"
+#include "rpp_memo.h"
 #include "validation_handler.h"
 #include "object/tal.h"
 #include "rsync/rsync.h"
@@ -12,13 +13,19 @@ struct validation;
 
 int validation_prepare(struct validation **, struct tal *,
     struct validation_handler *);
+int validation_fork(struct validation *, struct validation **);
 void validation_destroy(struct validation *);
 
 struct tal *validation_tal(struct validation *);
 X509_STORE *validation_store(struct validation *);
+X509_STORE_CTX *validation_store_ctx(struct validation *);
 struct cert_stack *validation_certstack(struct validation *);
 struct uri_list *validation_rsync_visited_uris(struct validation *);
 
+void validation_sync_lock(struct validation *);
+void validation_sync_unlock(struct validation *);
+struct fetch_table *validation_fetches(struct validation *);
+
 enum pubkey_state {
 	PKS_VALID,
 	PKS_INVALID,
@@ -37,5 +44,10 @@ validation_get_validation_handler(struct validation *);
 
 struct db_rrdp_uri *validation_get_rrdp_uris(struct validation *);
 char const *validation_get_rrdp_workspace(struct validation *);
+char const *validation_get_rrdp_current_workspace(struct validation *);
+void validation_set_rrdp_current_workspace(struct validation *, char const *);
+
+struct rpp_memo *validation_get_rpp_memo(struct validation *);
+void validation_set_rpp_memo(struct validation *, struct rpp_memo *);
 
 #endif /* SRC_STATE_H_ */
@@ -19,6 +19,9 @@
  * - Parent Thread: The thread that owns the pool, and wants to defer work to
  *   the worker threads.
  * - Task: Work that will be handled by a Worker Thread.
+ * - Deque: Tasks pushed by a Worker Thread (from inside some other task).
+ *   Each Worker Thread has its own. Its owner claims the newest tasks first,
+ *   and idle Worker Threads "steal" the oldest ones.
  */
 
 /* Task to be done by each Worker Thread. */
@@ -33,9 +36,20 @@ struct thread_pool_task {
 	TAILQ_ENTRY(thread_pool_task) next;
 };
 
-/* A collection of Tasks, used as FIFO. */
+/* A collection of Tasks, used as FIFO (queue) or LIFO (deque). */
 TAILQ_HEAD(task_queue, thread_pool_task);
 
+struct thread_pool_worker {
+	struct thread_pool *pool;
+	/* Debugging purposes only. */
+	unsigned int id;
+	/*
+	 * Tasks pushed by this Worker Thread.
+	 * The head is the newest task, the tail is the oldest.
+	 */
+	struct task_queue deque;
+};
+
 struct thread_pool {
 	/*
 	 * Debugging purposes only. Uniqueness is not a requirement.
@@ -74,11 +88,24 @@ struct thread_pool {
 	 * Worker Thread to claim them.
 	 */
 	struct task_queue queue;
+	/*
+	 * Number of tasks currently waiting to be claimed, counting the ones
+	 * in @queue and the ones in every worker's deque.
+	 */
+	unsigned int task_count;
 
 	pthread_t *thread_ids; /* Array. */
+	/* Array, indexes match @thread_ids'. */
+	struct thread_pool_worker *workers;
 	unsigned int thread_ids_len;
 };
 
+/*
+ * The worker the current thread is, or NULL if the current thread does not
+ * belong to any pool.
+ */
+static _Thread_local struct thread_pool_worker *current_worker;
+
 static void
 panic_on_fail(int error, char const *function_name)
 {
@@ -88,13 +115,13 @@ panic_on_fail(int error, char const *function_name)
 }
 
 static void
-mutex_lock(struct thread_pool *pool)
+pool_lock(struct thread_pool *pool)
 {
 	panic_on_fail(pthread_mutex_lock(&pool->lock), "pthread_mutex_lock");
 }
 
 static void
-mutex_unlock(struct thread_pool *pool)
+pool_unlock(struct thread_pool *pool)
 {
 	panic_on_fail(pthread_mutex_unlock(&pool->lock), "pthread_mutex_unlock");
 }
@@ -153,36 +180,92 @@ task_destroy(struct thread_pool_task *task)
 	free(task);
 }
 
+static void
+task_queue_cleanup(struct task_queue *queue)
+{
+	struct thread_pool_task *tmp;
+
+	while (!TAILQ_EMPTY(queue)) {
+		tmp = TAILQ_FIRST(queue);
+		TAILQ_REMOVE(queue, tmp, next);
+		task_destroy(tmp);
+	}
+}
+
 /**
- * Pops the tail of @queue. pthread_cond_signal() is technically allowed to wake
- * more than one thread, so please keep in mind that the result might be NULL.
+ * Claims the next task @worker should work on. pthread_cond_signal() is
+ * technically allowed to wake more than one thread, so please keep in mind that
+ * the result might be NULL.
+ *
+ * The order is
+ *
+ * 1. The head of the worker's own deque. (Newest first, so subtasks are
+ *    handled depth-first, and the deques stay short.)
+ * 2. The tail of the Parent Thread's queue. (Oldest first.)
+ * 3. The tail of some other worker's deque. (Oldest first; old tasks tend to
+ *    be the largest chunks of work.)
  *
  * Freeing the task is the caller's responsibility.
  */
 static struct thread_pool_task *
-task_queue_pull(struct thread_pool *pool, unsigned int thread_id)
+task_claim(struct thread_pool_worker *worker)
 {
+	struct thread_pool *pool = worker->pool;
+	struct thread_pool_worker *victim;
 	struct thread_pool_task *task;
+	unsigned int i;
+
+	task = TAILQ_FIRST(&worker->deque);
+	if (task != NULL) {
+		TAILQ_REMOVE(&worker->deque, task, next);
+		goto claimed;
+	}
 
 	task = TAILQ_LAST(&pool->queue, task_queue);
 	if (task != NULL) {
 		TAILQ_REMOVE(&pool->queue, task, next);
-		pr_op_debug("Thread %s.%u: Claimed task '%s'", pool->name,
-		    thread_id, task->name);
-	} else {
-		pr_op_debug("Thread %s.%u: Claimed nothing", pool->name,
-		    thread_id);
+		goto claimed;
 	}
 
+	for (i = 1; i < pool->thread_ids_len; i++) {
+		victim = &pool->workers[(worker->id - 1 + i) % pool->thread_ids_len];
+		task = TAILQ_LAST(&victim->deque, task_queue);
+		if (task != NULL) {
+			TAILQ_REMOVE(&victim->deque, task, next);
+			pr_op_debug("Thread %s.%u: Stole task '%s' from thread %u",
+			    pool->name, worker->id, task->name, victim->id);
+			goto claimed;
+		}
+	}
+
+	pr_op_debug("Thread %s.%u: Claimed nothing", pool->name, worker->id);
+	return NULL;
+
+claimed:
+	pool->task_count--;
+	pr_op_debug("Thread %s.%u: Claimed task '%s'", pool->name, worker->id,
+	    task->name);
 	return task;
 }
 
-/* Insert the task at the HEAD */
+/*
+ * Insert the task at the HEAD of the queue, or of the current worker's deque if
+ * the task is being pushed by one of @pool's Working Threads.
+ */
 static void
 task_queue_push(struct thread_pool *pool, struct thread_pool_task *task)
 {
-	TAILQ_INSERT_HEAD(&pool->queue, task, next);
-	pr_op_debug("Pool '%s': Pushed task '%s'", pool->name, task->name);
+	if (current_worker != NULL && current_worker->pool == pool) {
+		TAILQ_INSERT_HEAD(&current_worker->deque, task, next);
+		pr_op_debug("Thread %s.%u: Pushed task '%s'", pool->name,
+		    current_worker->id, task->name);
+	} else {
+		TAILQ_INSERT_HEAD(&pool->queue, task, next);
+		pr_op_debug("Pool '%s': Pushed task '%s'", pool->name,
+		    task->name);
+	}
+
+	pool->task_count++;
 }
 
 /*
@@ -199,46 +282,48 @@ task_queue_push(struct thread_pool *pool, struct thread_pool_task *task)
 static void *
 tasks_poll(void *arg)
 {
-	struct thread_pool *pool = arg;
+	struct thread_pool_worker *worker = arg;
+	struct thread_pool *pool = worker->pool;
 	struct thread_pool_task *task;
-	unsigned int thread_id;
 
-	mutex_lock(pool);
+	current_worker = worker;
+
+	pool_lock(pool);
 
 	pool->thread_count++;
-	thread_id = pool->thread_count;
 
 	while (true) {
-		while (TAILQ_EMPTY(&pool->queue) && !pool->stop)
-			wait_for_parent_signal(pool, thread_id);
+		while (pool->task_count == 0 && !pool->stop)
+			wait_for_parent_signal(pool, worker->id);
 
 		if (pool->stop)
 			break;
 
 		/* Claim the work. */
-		task = task_queue_pull(pool, thread_id);
+		task = task_claim(worker);
 		pool->working_count++;
-		mutex_unlock(pool);
+		pool_unlock(pool);
 
 		if (task != NULL) {
 			task->cb(task->arg);
 			pr_op_debug("Thread %s.%u: Task '%s' ended", pool->name,
-			    thread_id, task->name);
+			    worker->id, task->name);
 			task_destroy(task);
 		}
 
-		mutex_lock(pool);
+		pool_lock(pool);
 		pool->working_count--;
 
 		if (pool->stop)
 			break;
 		/* If there's no more work left, wake up parent. */
-		if (pool->working_count == 0 && TAILQ_EMPTY(&pool->queue))
+		if (pool->working_count == 0 && pool->task_count == 0)
 			signal_to_parent(pool);
 	}
 
-	mutex_unlock(pool);
-	pr_op_debug("Thread %s.%u: Returning.", pool->name, thread_id);
+	pool_unlock(pool);
+	pr_op_debug("Thread %s.%u: Returning.", pool->name, worker->id);
+	current_worker = NULL;
 	return NULL;
 }
 
@@ -294,8 +379,12 @@ spawn_threads(struct thread_pool *pool)
 		return error;
 
 	for (i = 0; i < pool->thread_ids_len; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i + 1;
+		TAILQ_INIT(&pool->workers[i].deque);
+
 		error = pthread_create(&pool->thread_ids[i], &attr, tasks_poll,
-		    pool);
+		    &pool->workers[i]);
 		if (error) {
 			pr_op_err("pthread_create() returned error %d: %s",
 			    error, strerror(error));
@@ -346,6 +435,7 @@ thread_pool_create(char const *name, unsigned int threads,
 	}
 
 	TAILQ_INIT(&result->queue);
+	result->task_count = 0;
 	result->name = name;
 	result->stop = false;
 	result->working_count = 0;
@@ -355,15 +445,22 @@ thread_pool_create(char const *name, unsigned int threads,
 		error = pr_enomem();
 		goto free_waiting_cond;
 	}
+	result->workers = calloc(threads, sizeof(struct thread_pool_worker));
+	if (result->workers == NULL) {
+		error = pr_enomem();
+		goto free_thread_ids;
+	}
 	result->thread_ids_len = threads;
 
 	error = spawn_threads(result);
 	if (error)
-		goto free_thread_ids;
+		goto free_workers;
 
 	*pool = result;
 	return 0;
 
+free_workers:
+	free(result->workers);
 free_thread_ids:
 	free(result->thread_ids);
 free_waiting_cond:
@@ -380,26 +477,23 @@ free_tmp:
 void
 thread_pool_destroy(struct thread_pool *pool)
 {
-	struct task_queue *queue;
-	struct thread_pool_task *tmp;
 	unsigned int t;
 
 	pr_op_debug("Destroying thread pool '%s'.", pool->name);
 
 	/* Remove all pending work and send the signal to stop it */
-	mutex_lock(pool);
-	queue = &(pool->queue);
-	while (!TAILQ_EMPTY(queue)) {
-		tmp = TAILQ_FIRST(queue);
-		TAILQ_REMOVE(queue, tmp, next);
-		task_destroy(tmp);
-	}
+	pool_lock(pool);
+	task_queue_cleanup(&pool->queue);
+	for (t = 0; t < pool->thread_ids_len; t++)
+		task_queue_cleanup(&pool->workers[t].deque);
+	pool->task_count = 0;
 	pool->stop = true;
 	pthread_cond_broadcast(&pool->parent2worker);
-	mutex_unlock(pool);
+	pool_unlock(pool);
 
 	for (t = 0; t < pool->thread_ids_len; t++)
 		pthread_join(pool->thread_ids[t], NULL);
+	free(pool->workers);
 	free(pool->thread_ids);
 
 	pthread_cond_destroy(&pool->worker2parent);
@@ -413,6 +507,10 @@ thread_pool_destroy(struct thread_pool *pool)
 /*
  * Push a new task to @pool, the task to be executed is @cb with the argument
  * @arg.
+ *
+ * Can also be called from inside one of @pool's tasks, in which case the new
+ * task is queued in the current worker's deque. Other idle workers will steal
+ * it if the current one stays busy.
  */
 int
 thread_pool_push(struct thread_pool *pool, char const *task_name,
@@ -425,9 +523,9 @@ thread_pool_push(struct thread_pool *pool, char const *task_name,
 	if (error)
 		return error;
 
-	mutex_lock(pool);
+	pool_lock(pool);
 	task_queue_push(pool, task);
-	mutex_unlock(pool);
+	pool_unlock(pool);
 
 	/*
 	 * Note: This assumes the threads have already spawned.
@@ -443,9 +541,9 @@ thread_pool_avail_threads(struct thread_pool *pool)
 {
 	bool result;
 
-	mutex_lock(pool);
+	pool_lock(pool);
 	result = (pool->working_count < pool->thread_ids_len);
-	mutex_unlock(pool);
+	pool_unlock(pool);
 
 	return result;
 }
@@ -454,15 +552,14 @@ thread_pool_avail_threads(struct thread_pool *pool)
 void
 thread_pool_wait(struct thread_pool *pool)
 {
-	mutex_lock(pool);
+	pool_lock(pool);
 
 	/* If the pool has to stop, the wait will happen during the joins. */
 	while (!pool->stop) {
 		pr_op_debug("- Active workers: %u", pool->working_count);
-		pr_op_debug("- Task queue: %s",
-		    TAILQ_EMPTY(&pool->queue) ? "Empty" : "Not Empty");
+		pr_op_debug("- Pending tasks: %u", pool->task_count);
 
-		if (pool->working_count == 0 && TAILQ_EMPTY(&pool->queue)) {
+		if (pool->working_count == 0 && pool->task_count == 0) {
 			pr_op_debug("Pool '%s': All work has been completed.",
 			    pool->name);
 			break;
@@ -473,5 +570,5 @@ thread_pool_wait(struct thread_pool *pool)
 		wait_for_worker_signal(pool);
 	}
 
-	mutex_unlock(pool);
+	pool_unlock(pool);
 }
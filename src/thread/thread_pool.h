@@ -5,6 +5,8 @@
 
 /*
  * THREAD POOL THREADS ARE NOT ALLOWED TO SLEEP FOR LONG PERIODS OF TIME.
+ * (Except for the fetch pool's, which exist precisely to wait on the network.
+ * See fetch_scheduler.h.)
  */
 
 /* Thread pool base struct */
@@ -14,6 +16,7 @@ int thread_pool_create(char const *, unsigned int, struct thread_pool **);
 void thread_pool_destroy(struct thread_pool *);
 
 typedef void (*thread_pool_task_cb)(void *);
+/* Tasks are allowed to push more tasks. */
 int thread_pool_push(struct thread_pool *, char const *, thread_pool_task_cb,
     void *);
 
@@ -5,14 +5,10 @@
 #include "thread_var.h"
 
 static struct validation_handler const *
-get_current_threads_handler(void)
+get_handler(struct validation *state)
 {
-	struct validation *state;
 	struct validation_handler const *handler;
 
-	state = state_retrieve();
-	if (state == NULL)
-		return NULL;
 	handler = validation_get_validation_handler(state);
 	if (handler == NULL)
 		pr_crit("This thread lacks a validation handler.");
@@ -20,34 +16,66 @@ get_current_threads_handler(void)
 	return handler;
 }
 
+static struct validation_handler const *
+get_current_threads_handler(void)
+{
+	struct validation *state;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return NULL;
+
+	return get_handler(state);
+}
+
 int
 vhandler_handle_roa_v4(uint32_t as, struct ipv4_prefix const *prefix,
     uint8_t max_length)
 {
+	struct validation *state;
 	struct validation_handler const *handler;
+	struct rpp_memo *memo;
+	int error;
 
-	handler = get_current_threads_handler();
-	if (handler == NULL)
+	state = state_retrieve();
+	if (state == NULL)
 		return -EINVAL;
+	handler = get_handler(state);
 
-	return (handler->handle_roa_v4 != NULL)
+	error = (handler->handle_roa_v4 != NULL)
 	    ? handler->handle_roa_v4(as, prefix, max_length, handler->arg)
 	    : 0;
+
+	memo = validation_get_rpp_memo(state);
+	if (!error && memo != NULL)
+		rpp_memo_add_roa_v4(memo, as, prefix, max_length);
+
+	return error;
 }
 
 int
 vhandler_handle_roa_v6(uint32_t as, struct ipv6_prefix const *prefix,
     uint8_t max_length)
 {
+	struct validation *state;
 	struct validation_handler const *handler;
+	struct rpp_memo *memo;
+	int error;
 
-	handler = get_current_threads_handler();
-	if (handler == NULL)
+	state = state_retrieve();
+	if (state == NULL)
 		return -EINVAL;
+	handler = get_handler(state);
 
-	return (handler->handle_roa_v6 != NULL)
+	error = (handler->handle_roa_v6 != NULL)
 	    ? handler->handle_roa_v6(as, prefix, max_length, handler->arg)
 	    : 0;
+
+	memo = validation_get_rpp_memo(state);
+	if (!error && memo != NULL)
+		rpp_memo_add_roa_v6(memo, as, prefix, max_length);
+
+	return error;
 }
 
 int
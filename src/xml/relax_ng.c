@@ -78,22 +78,14 @@ cleanup_parser:
 	return error;
 }
 
-/*
- * Validate file at @path against globally loaded schema. The file must be
- * parsed using @cb (will receive @arg as argument).
- */
-int
-relax_ng_parse(const char *path, xml_read_cb cb, void *arg)
+/* Consumes @reader, which is released afterwards. */
+static int
+__relax_ng_parse(xmlTextReaderPtr reader, xml_read_cb cb, void *arg)
 {
-	xmlTextReaderPtr reader;
 	xmlRelaxNGValidCtxtPtr rngvalidctx;
 	int read;
 	int error;
 
-	reader = xmlNewTextReaderFilename(path);
-	if (reader == NULL)
-		return pr_val_err("Couldn't get XML '%s' file.", path);
-
 	error = xmlTextReaderRelaxNGSetSchema(reader, schema);
 	if (error) {
 		error = pr_val_err("Couldn't set Relax NG schema.");
@@ -149,6 +141,40 @@ free_reader:
 	return error;
 }
 
+/*
+ * Validate file at @path against globally loaded schema. The file must be
+ * parsed using @cb (will receive @arg as argument).
+ */
+int
+relax_ng_parse(const char *path, xml_read_cb cb, void *arg)
+{
+	xmlTextReaderPtr reader;
+
+	reader = xmlNewTextReaderFilename(path);
+	if (reader == NULL)
+		return pr_val_err("Couldn't get XML '%s' file.", path);
+
+	return __relax_ng_parse(reader, cb, arg);
+}
+
+/*
+ * Same as relax_ng_parse(), except the document is pulled from @read (which
+ * will receive @read_arg as argument) as it's parsed, instead of being read
+ * from a file. @name is only used for logging.
+ */
+int
+relax_ng_parse_io(char const *name, xmlInputReadCallback read, void *read_arg,
+    xml_read_cb cb, void *arg)
+{
+	xmlTextReaderPtr reader;
+
+	reader = xmlReaderForIO(read, NULL, read_arg, name, NULL, 0);
+	if (reader == NULL)
+		return pr_val_err("Couldn't read XML '%s'.", name);
+
+	return __relax_ng_parse(reader, cb, arg);
+}
+
 void
 relax_ng_cleanup(void)
 {
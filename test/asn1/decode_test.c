@@ -0,0 +1,224 @@
+#include <check.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.c"
+#include "impersonator.c"
+#include "data_structure/arena.c"
+#include "asn1/pool.c"
+#include "asn1/der.c"
+#include "asn1/decode.c"
+#include "asn1/asn1c/Manifest.h"
+#include "asn1/asn1c/RouteOriginAttestation.h"
+
+/*
+ * The second file's hash has nonzero unused bits, so the pool has to copy it.
+ * The first one is borrowed.
+ */
+static unsigned char const MFT[] = {
+	0x30, 0x4E,
+	0x02, 0x01, 0x05,
+	0x18, 0x0F, '2', '0', '2', '4', '0', '1', '0', '1',
+	'0', '0', '0', '0', '0', '0', 'Z',
+	0x18, 0x0F, '2', '0', '2', '4', '0', '1', '0', '2',
+	'0', '0', '0', '0', '0', '0', 'Z',
+	0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01,
+	0x30, 0x1C,
+	0x30, 0x0C, 0x16, 0x05, 'a', '.', 'r', 'o', 'a',
+	0x03, 0x03, 0x00, 0xAB, 0xCD,
+	0x30, 0x0C, 0x16, 0x05, 'b', '.', 'r', 'o', 'a',
+	0x03, 0x03, 0x04, 0xAB, 0xCD,
+};
+
+/* 192.0.2.0/24-24 and 192.0.2.0/23 (with a stray unused bit) */
+static unsigned char const ROA[] = {
+	0x30, 0x22,
+	0x02, 0x03, 0x00, 0xFD, 0xE8,
+	0x30, 0x1B,
+	0x30, 0x19,
+	0x04, 0x02, 0x00, 0x01,
+	0x30, 0x13,
+	0x30, 0x09, 0x03, 0x04, 0x00, 0xC0, 0x00, 0x02, 0x02, 0x01, 0x18,
+	0x30, 0x06, 0x03, 0x04, 0x01, 0xC0, 0x00, 0x03,
+};
+
+static bool
+borrowed(void const *ptr, unsigned char const *buf, size_t size)
+{
+	return buf <= (unsigned char const *) ptr
+	    && (unsigned char const *) ptr < buf + size;
+}
+
+static char *
+print(asn_TYPE_descriptor_t const *td, void const *sptr)
+{
+	char *result;
+	size_t size;
+	FILE *stream;
+
+	stream = open_memstream(&result, &size);
+	ck_assert_ptr_ne(NULL, stream);
+	ck_assert_int_eq(0, xer_fprint(stream, td, sptr));
+	ck_assert_int_eq(0, fclose(stream));
+
+	return result;
+}
+
+/* Decodes @buf both ways, and compares the results. */
+static void *
+decode_both(asn_TYPE_descriptor_t const *td, unsigned char const *buf,
+    size_t size, struct arena **pool)
+{
+	unsigned char original[256];
+	OCTET_STRING_t string;
+	void *regular;
+	void *pooled;
+	char *regular_str;
+	char *pooled_str;
+
+	ck_assert(size <= sizeof(original));
+	memcpy(original, buf, size);
+	string.buf = (uint8_t *) buf;
+	string.size = size;
+
+	ck_assert_int_eq(0, asn1_decode_octet_string(&string, td, &regular,
+	    true, false));
+	ck_assert_int_eq(0, asn1_decode_octet_string_pooled(&string, td,
+	    &pooled, pool, true, false));
+	ck_assert(!asn1_pool_active());
+
+	regular_str = print(td, regular);
+	pooled_str = print(td, pooled);
+	ck_assert_str_eq(regular_str, pooled_str);
+	free(regular_str);
+	free(pooled_str);
+
+	/* The pooled decoding must not have touched the input. */
+	ck_assert_int_eq(0, memcmp(original, buf, size));
+
+	ASN_STRUCT_FREE(*td, regular);
+	return pooled;
+}
+
+START_TEST(test_manifest)
+{
+	Manifest_t *mft;
+	struct FileAndHash *file;
+	struct arena *pool;
+
+	mft = decode_both(&asn_DEF_Manifest, MFT, sizeof(MFT), &pool);
+	ck_assert_int_eq(2, mft->fileList.list.count);
+
+	file = mft->fileList.list.array[0];
+	ck_assert(borrowed(file->file.buf, MFT, sizeof(MFT)));
+	ck_assert(borrowed(file->hash.buf, MFT, sizeof(MFT)));
+	ck_assert_int_eq(0, file->hash.bits_unused);
+
+	/* Copied, and its unused bits cleared */
+	file = mft->fileList.list.array[1];
+	ck_assert(borrowed(file->file.buf, MFT, sizeof(MFT)));
+	ck_assert(!borrowed(file->hash.buf, MFT, sizeof(MFT)));
+	ck_assert_int_eq(4, file->hash.bits_unused);
+	ck_assert_int_eq(2, file->hash.size);
+	ck_assert_uint_eq(0xC0, file->hash.buf[1]);
+
+	arena_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_roa)
+{
+	RouteOriginAttestation_t *roa;
+	struct ROAIPAddressFamily *family;
+	struct ROAIPAddress *addr;
+	struct arena *pool;
+
+	roa = decode_both(&asn_DEF_RouteOriginAttestation, ROA, sizeof(ROA),
+	    &pool);
+	ck_assert_int_eq(1, roa->ipAddrBlocks.list.count);
+
+	family = roa->ipAddrBlocks.list.array[0];
+	ck_assert(borrowed(family->addressFamily.buf, ROA, sizeof(ROA)));
+	ck_assert_int_eq(2, family->addresses.list.count);
+
+	addr = family->addresses.list.array[0];
+	ck_assert(borrowed(addr->address.buf, ROA, sizeof(ROA)));
+	ck_assert_ptr_ne(NULL, addr->maxLength);
+	ck_assert(borrowed(addr->maxLength->buf, ROA, sizeof(ROA)));
+
+	addr = family->addresses.list.array[1];
+	ck_assert(!borrowed(addr->address.buf, ROA, sizeof(ROA)));
+	ck_assert_uint_eq(0x02, addr->address.buf[2]);
+	ck_assert_ptr_eq(NULL, addr->maxLength);
+
+	arena_destroy(pool);
+}
+END_TEST
+
+/*
+ * If the decoder gives up halfway through, the partial result lives in the
+ * pool, so it must be released along with the pool. (ASN_STRUCT_FREE() would
+ * hand pool chunks to free().)
+ */
+START_TEST(test_failure)
+{
+	unsigned char buf[sizeof(ROA)];
+	OCTET_STRING_t string;
+	void *result;
+	struct arena *pool;
+
+	string.buf = buf;
+
+	/* Truncated */
+	memcpy(buf, ROA, sizeof(ROA));
+	string.size = sizeof(ROA) - 1;
+	ck_assert_int_ne(0, asn1_decode_octet_string_pooled(&string,
+	    &asn_DEF_RouteOriginAttestation, &result, &pool, false, false));
+	ck_assert(!asn1_pool_active());
+
+	/* The second address is an OCTET STRING instead of a BIT STRING */
+	buf[sizeof(ROA) - 6] = 0x04;
+	string.size = sizeof(ROA);
+	ck_assert_int_ne(0, asn1_decode_octet_string_pooled(&string,
+	    &asn_DEF_RouteOriginAttestation, &result, &pool, false, false));
+	ck_assert(!asn1_pool_active());
+
+	/* Decodes, but isn't DER (so it fails after the decoder) */
+	memcpy(buf, ROA, sizeof(ROA));
+	ck_assert_int_eq(-EINVAL, asn1_decode_octet_string_pooled(&string,
+	    &asn_DEF_RouteOriginAttestation, &result, &pool, false, true));
+	ck_assert(!asn1_pool_active());
+}
+END_TEST
+
+Suite *decode_suite(void)
+{
+	Suite *suite;
+	TCase *pooled;
+
+	pooled = tcase_create("Pooled");
+	tcase_add_test(pooled, test_manifest);
+	tcase_add_test(pooled, test_roa);
+	tcase_add_test(pooled, test_failure);
+
+	suite = suite_create("Decode");
+	suite_add_tcase(suite, pooled);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = decode_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,329 @@
+#include <check.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "log.c"
+#include "impersonator.c"
+#include "data_structure/arena.c"
+#include "asn1/pool.c"
+#include "asn1/der.c"
+#include "asn1/decode.c"
+#include "asn1/asn1c/Manifest.h"
+#include "asn1/asn1c/SignedAttributes.h"
+
+/* Manifest fields that don't change between tests */
+#define NUMBER		0x02, 0x01, 0x05
+#define THIS_UPDATE	0x18, 0x0F, '2', '0', '2', '4', '0', '1', '0', '1', \
+			'0', '0', '0', '0', '0', '0', 'Z'
+#define NEXT_UPDATE	0x18, 0x0F, '2', '0', '2', '4', '0', '1', '0', '2', \
+			'0', '0', '0', '0', '0', '0', 'Z'
+#define SHA256		0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, \
+			0x02, 0x01
+/* @... is the content of the BIT STRING; three octets. */
+#define FILE_LIST(...)	0x30, 0x0E, 0x30, 0x0C, \
+			0x16, 0x05, 'a', '.', 'r', 'o', 'a', \
+			0x03, 0x03, __VA_ARGS__
+#define FILES		FILE_LIST(0x00, 0xAB, 0xCD)
+/* Length of NUMBER, THIS_UPDATE, NEXT_UPDATE, SHA256 and FILES */
+#define BODY_LEN	64
+
+/* Two CMSAttributes; @a sorts before @b. */
+#define ATTR_A		0x30, 0x0A, 0x06, 0x03, 0x2A, 0x03, 0x04, \
+			0x31, 0x03, 0x02, 0x01, 0x01
+#define ATTR_B		0x30, 0x0A, 0x06, 0x03, 0x2A, 0x03, 0x05, \
+			0x31, 0x03, 0x02, 0x01, 0x01
+
+#define test_der(td, expected, ...) do {				\
+		unsigned char const buf[] = { __VA_ARGS__ };		\
+		check_der(&td, buf, sizeof(buf), expected);		\
+	} while (0)
+
+static void
+check_der(asn_TYPE_descriptor_t const *td, unsigned char const *buf,
+    size_t size, int expected)
+{
+	void *result = NULL;
+	char const *failed = NULL;
+	asn_dec_rval_t rval;
+
+	/* It has to be valid BER, otherwise there's nothing to validate. */
+	rval = ber_decode(NULL, td, &result, buf, size);
+	ck_assert_int_eq(RC_OK, rval.code);
+	ck_assert_uint_eq(size, rval.consumed);
+
+	ck_assert_int_eq(expected, der_validate(td, result, buf, size,
+	    &failed));
+	if (expected == -EINVAL)
+		ck_assert_ptr_ne(NULL, failed);
+
+	ASN_STRUCT_FREE(*td, result);
+}
+
+START_TEST(test_valid)
+{
+	test_der(asn_DEF_Manifest, 0,
+	    0x30, BODY_LEN, NUMBER, THIS_UPDATE, NEXT_UPDATE, SHA256, FILES);
+	/* Non-default version */
+	test_der(asn_DEF_Manifest, 0,
+	    0x30, BODY_LEN + 5, 0xA0, 0x03, 0x02, 0x01, 0x01,
+	    NUMBER, THIS_UPDATE, NEXT_UPDATE, SHA256, FILES);
+	/* Fraction of second */
+	test_der(asn_DEF_Manifest, 0,
+	    0x30, BODY_LEN + 2, NUMBER,
+	    0x18, 0x11, '2', '0', '2', '4', '0', '1', '0', '1',
+	    '0', '0', '0', '0', '0', '0', '.', '5', 'Z',
+	    NEXT_UPDATE, SHA256, FILES);
+	/* Unused bits, all zero */
+	test_der(asn_DEF_Manifest, 0,
+	    0x30, BODY_LEN, NUMBER, THIS_UPDATE, NEXT_UPDATE, SHA256,
+	    FILE_LIST(0x04, 0xAB, 0xC0));
+	/* Negative INTEGER that needs its leading 0xFF */
+	test_der(asn_DEF_Manifest, 0,
+	    0x30, BODY_LEN + 1, 0x02, 0x02, 0xFF, 0x05,
+	    THIS_UPDATE, NEXT_UPDATE, SHA256, FILES);
+
+	/* Sorted SET OFs */
+	test_der(asn_DEF_SignedAttributes, 0, 0x31, 0x18, ATTR_A, ATTR_B);
+	test_der(asn_DEF_SignedAttributes, 0,
+	    0x31, 0x0F, 0x30, 0x0D, 0x06, 0x03, 0x2A, 0x03, 0x04,
+	    0x31, 0x06, 0x02, 0x01, 0x01, 0x02, 0x01, 0x02);
+}
+END_TEST
+
+START_TEST(test_long_length)
+{
+	unsigned char const rest[] = {
+		THIS_UPDATE, NEXT_UPDATE, SHA256, FILES
+	};
+	unsigned char buf[6 + 129 + sizeof(rest)];
+
+	/* Both lengths need the long form. (The INTEGER is 2^1024.) */
+	buf[0] = 0x30;
+	buf[1] = 0x81;
+	buf[2] = sizeof(buf) - 3;
+	buf[3] = 0x02;
+	buf[4] = 0x81;
+	buf[5] = 129;
+	buf[6] = 0x01;
+	memset(buf + 7, 0, 128);
+	memcpy(buf + 6 + 129, rest, sizeof(rest));
+	check_der(&asn_DEF_Manifest, buf, sizeof(buf), 0);
+}
+END_TEST
+
+START_TEST(test_length)
+{
+	/* Long form, for a length that fits in the short form */
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, 0x81, BODY_LEN, NUMBER, THIS_UPDATE, NEXT_UPDATE, SHA256,
+	    FILES);
+	/* Leading zero length octets */
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, 0x82, 0x00, BODY_LEN, NUMBER, THIS_UPDATE, NEXT_UPDATE,
+	    SHA256, FILES);
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, BODY_LEN + 1, 0x02, 0x81, 0x01, 0x05,
+	    THIS_UPDATE, NEXT_UPDATE, SHA256, FILES);
+	/* Indefinite length */
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, 0x80, NUMBER, THIS_UPDATE, NEXT_UPDATE, SHA256, FILES,
+	    0x00, 0x00);
+}
+END_TEST
+
+START_TEST(test_tag)
+{
+	/* High tag number form, for a number that fits in the low one */
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, BODY_LEN + 1, 0x1F, 0x02, 0x01, 0x05,
+	    THIS_UPDATE, NEXT_UPDATE, SHA256, FILES);
+}
+END_TEST
+
+START_TEST(test_constructed)
+{
+	unsigned char buf[] = {
+		0x30, BODY_LEN, NUMBER, THIS_UPDATE, NEXT_UPDATE, SHA256, FILES
+	};
+	void *result = NULL;
+	char const *failed;
+
+	/* Primitive type in constructed form */
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, BODY_LEN + 2, NUMBER, THIS_UPDATE, NEXT_UPDATE, SHA256,
+	    0x30, 0x10, 0x30, 0x0E,
+	    0x36, 0x07, 0x16, 0x05, 'a', '.', 'r', 'o', 'a',
+	    0x03, 0x03, 0x00, 0xAB, 0xCD);
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, BODY_LEN + 2, NUMBER, THIS_UPDATE, NEXT_UPDATE, SHA256,
+	    0x30, 0x10, 0x30, 0x0E,
+	    0x16, 0x05, 'a', '.', 'r', 'o', 'a',
+	    0x23, 0x05, 0x03, 0x03, 0x00, 0xAB, 0xCD);
+
+	/*
+	 * Constructed type in primitive form. The decoder already refuses this
+	 * one, so tamper with the encoding after decoding it.
+	 */
+	ck_assert_int_eq(RC_OK, ber_decode(NULL, &asn_DEF_Manifest, &result,
+	    buf, sizeof(buf)).code);
+	ck_assert_int_eq(0, der_validate(&asn_DEF_Manifest, result, buf,
+	    sizeof(buf), &failed));
+	buf[2 + BODY_LEN - 16] &= ~0x20; /* fileList */
+	ck_assert_int_eq(-EINVAL, der_validate(&asn_DEF_Manifest, result, buf,
+	    sizeof(buf), &failed));
+	ASN_STRUCT_FREE(asn_DEF_Manifest, result);
+}
+END_TEST
+
+START_TEST(test_integer)
+{
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, BODY_LEN + 1, 0x02, 0x02, 0x00, 0x05,
+	    THIS_UPDATE, NEXT_UPDATE, SHA256, FILES);
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, BODY_LEN + 1, 0x02, 0x02, 0xFF, 0x85,
+	    THIS_UPDATE, NEXT_UPDATE, SHA256, FILES);
+}
+END_TEST
+
+START_TEST(test_bit_string)
+{
+	/* Nonzero unused bits */
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, BODY_LEN, NUMBER, THIS_UPDATE, NEXT_UPDATE, SHA256,
+	    FILE_LIST(0x04, 0xAB, 0xCD));
+}
+END_TEST
+
+START_TEST(test_generalized_time)
+{
+	/* Trailing zero in the fraction */
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, BODY_LEN + 3, NUMBER,
+	    0x18, 0x12, '2', '0', '2', '4', '0', '1', '0', '1',
+	    '0', '0', '0', '0', '0', '0', '.', '5', '0', 'Z',
+	    NEXT_UPDATE, SHA256, FILES);
+	/* Decimal point without a fraction */
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, BODY_LEN + 1, NUMBER,
+	    0x18, 0x10, '2', '0', '2', '4', '0', '1', '0', '1',
+	    '0', '0', '0', '0', '0', '0', '.', 'Z',
+	    NEXT_UPDATE, SHA256, FILES);
+	/* Not UTC */
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, BODY_LEN - 1, NUMBER,
+	    0x18, 0x0E, '2', '0', '2', '4', '0', '1', '0', '1',
+	    '0', '0', '0', '0', '0', '0',
+	    NEXT_UPDATE, SHA256, FILES);
+}
+END_TEST
+
+START_TEST(test_default)
+{
+	/* version is DEFAULT 0, so it can't be encoded as 0. */
+	test_der(asn_DEF_Manifest, -EINVAL,
+	    0x30, BODY_LEN + 5, 0xA0, 0x03, 0x02, 0x01, 0x00,
+	    NUMBER, THIS_UPDATE, NEXT_UPDATE, SHA256, FILES);
+}
+END_TEST
+
+START_TEST(test_set_of)
+{
+	test_der(asn_DEF_SignedAttributes, -EINVAL,
+	    0x31, 0x18, ATTR_B, ATTR_A);
+	/* The nested one */
+	test_der(asn_DEF_SignedAttributes, -EINVAL,
+	    0x31, 0x0F, 0x30, 0x0D, 0x06, 0x03, 0x2A, 0x03, 0x04,
+	    0x31, 0x06, 0x02, 0x01, 0x02, 0x02, 0x01, 0x01);
+}
+END_TEST
+
+/*
+ * der_validate() doesn't know this type, so asn1_decode() needs to fall back to
+ * reencode_der().
+ */
+static asn_TYPE_operation_t unknown_op;
+static asn_TYPE_descriptor_t unknown_td;
+
+static void
+init_unknown(void)
+{
+	unknown_op = asn_OP_INTEGER;
+	unknown_td = asn_DEF_INTEGER;
+	unknown_td.op = &unknown_op;
+}
+
+START_TEST(test_fallback)
+{
+	unsigned char const valid[] = { 0x02, 0x01, 0x05 };
+	unsigned char const invalid[] = { 0x02, 0x02, 0x00, 0x05 };
+	char const *failed;
+	void *result;
+
+	init_unknown();
+
+	ck_assert_int_eq(0, asn1_decode(valid, sizeof(valid), &unknown_td,
+	    &result, false, false));
+	ck_assert_int_eq(-ENOTSUP, der_validate(&unknown_td, result, valid,
+	    sizeof(valid), &failed));
+	ASN_STRUCT_FREE(unknown_td, result);
+
+	ck_assert_int_eq(0, asn1_decode(invalid, sizeof(invalid), &unknown_td,
+	    &result, false, false));
+	ck_assert_int_eq(-ENOTSUP, der_validate(&unknown_td, result, invalid,
+	    sizeof(invalid), &failed));
+	ASN_STRUCT_FREE(unknown_td, result);
+
+	/* Now with DER validation */
+	ck_assert_int_eq(0, asn1_decode(valid, sizeof(valid), &unknown_td,
+	    &result, false, true));
+	ASN_STRUCT_FREE(unknown_td, result);
+	ck_assert_int_eq(-EINVAL, asn1_decode(invalid, sizeof(invalid),
+	    &unknown_td, &result, false, true));
+}
+END_TEST
+
+Suite *der_suite(void)
+{
+	Suite *suite;
+	TCase *valid, *invalid, *fallback;
+
+	valid = tcase_create("Valid");
+	tcase_add_test(valid, test_valid);
+	tcase_add_test(valid, test_long_length);
+
+	invalid = tcase_create("Invalid");
+	tcase_add_test(invalid, test_length);
+	tcase_add_test(invalid, test_tag);
+	tcase_add_test(invalid, test_constructed);
+	tcase_add_test(invalid, test_integer);
+	tcase_add_test(invalid, test_bit_string);
+	tcase_add_test(invalid, test_generalized_time);
+	tcase_add_test(invalid, test_default);
+	tcase_add_test(invalid, test_set_of);
+
+	fallback = tcase_create("Fallback");
+	tcase_add_test(fallback, test_fallback);
+
+	suite = suite_create("DER");
+	suite_add_tcase(suite, valid);
+	suite_add_tcase(suite, invalid);
+	suite_add_tcase(suite, fallback);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = der_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,75 @@
+#include <check.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "log.c"
+#include "impersonator.c"
+#include "data_structure/arena.c"
+
+static bool
+is_aligned(void *ptr)
+{
+	return (((uintptr_t) ptr) % alignof(max_align_t)) == 0;
+}
+
+START_TEST(test_alloc)
+{
+	struct arena *arena = NULL;
+	unsigned char *small[1000];
+	unsigned char *large;
+	unsigned int i;
+
+	ck_assert_int_eq(0, arena_create(&arena));
+
+	/* Enough to need several blocks */
+	for (i = 0; i < 1000; i++) {
+		small[i] = arena_alloc(arena, 100 + i);
+		ck_assert_ptr_ne(NULL, small[i]);
+		ck_assert(is_aligned(small[i]));
+		memset(small[i], i & 0xFF, 100 + i);
+	}
+
+	large = arena_alloc(arena, 2 * MAX_BLOCK_SIZE);
+	ck_assert_ptr_ne(NULL, large);
+	ck_assert(is_aligned(large));
+	memset(large, 0xFF, 2 * MAX_BLOCK_SIZE);
+
+	/* Nobody stepped on anybody else */
+	for (i = 0; i < 1000; i++) {
+		ck_assert_uint_eq(i & 0xFF, small[i][0]);
+		ck_assert_uint_eq(i & 0xFF, small[i][100 + i - 1]);
+	}
+
+	arena_destroy(arena);
+}
+END_TEST
+
+Suite *arena_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, test_alloc);
+
+	suite = suite_create("Arena");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = arena_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -109,6 +109,30 @@ config_get_mode(void)
 	return STANDALONE;
 }
 
+char const *
+config_get_state_file(void)
+{
+	return NULL;
+}
+
+unsigned int
+config_get_interval_expire(void)
+{
+	return 7200;
+}
+
+unsigned int
+config_get_signature_cache_size(void)
+{
+	return 1024;
+}
+
+unsigned int
+config_get_asn1_decode_max_stack(void)
+{
+	return 4096;
+}
+
 char const *
 config_get_output_roa(void)
 {
@@ -0,0 +1,184 @@
+#include <check.h>
+#include <stdlib.h>
+
+#include "common.c"
+#include "log.c"
+#include "impersonator.c"
+#include "rpp_memo.c"
+
+static unsigned int v4_count;
+static unsigned int v6_count;
+
+int
+vhandler_handle_roa_v4(uint32_t as, struct ipv4_prefix const *prefix,
+    uint8_t max_length)
+{
+	ck_assert_uint_eq(10, as);
+	ck_assert_uint_eq(htonl(0xC0000200), prefix->addr.s_addr);
+	ck_assert_uint_eq(24, prefix->len);
+	ck_assert_uint_eq(32, max_length);
+	v4_count++;
+	return 0;
+}
+
+int
+vhandler_handle_roa_v6(uint32_t as, struct ipv6_prefix const *prefix,
+    uint8_t max_length)
+{
+	ck_assert_uint_eq(11, as);
+	ck_assert_uint_eq(120, prefix->len);
+	ck_assert_uint_eq(128, max_length);
+	v6_count++;
+	return 0;
+}
+
+static X509_CRL *
+create_crl(void)
+{
+	X509_CRL *crl;
+	ASN1_TIME *next_update;
+
+	crl = X509_CRL_new();
+	ck_assert_ptr_ne(NULL, crl);
+	next_update = ASN1_TIME_adj(NULL, time(NULL), 1, 0);
+	ck_assert_ptr_ne(NULL, next_update);
+	ck_assert_int_eq(1, X509_CRL_set1_nextUpdate(crl, next_update));
+	ASN1_TIME_free(next_update);
+
+	return crl;
+}
+
+static struct rpp_memo *
+create_memo(struct rpp_memo_key *key, X509_CRL *crl, unsigned char id)
+{
+	struct rpp_memo *memo;
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+
+	memset(key, id, sizeof(*key));
+	memo = rpp_memo_create(key, crl);
+	ck_assert_ptr_ne(NULL, memo);
+
+	prefix4.addr.s_addr = htonl(0xC0000200);
+	prefix4.len = 24;
+	rpp_memo_add_roa_v4(memo, 10, &prefix4, 32);
+	memset(&prefix6.addr, 0, sizeof(prefix6.addr));
+	prefix6.len = 120;
+	rpp_memo_add_roa_v6(memo, 11, &prefix6, 128);
+
+	return memo;
+}
+
+static int
+replay(struct rpp_memo_key *key)
+{
+	v4_count = 0;
+	v6_count = 0;
+	return rpp_memo_replay(key);
+}
+
+START_TEST(test_replay)
+{
+	struct rpp_memo_key key;
+	X509_CRL *crl;
+
+	ck_assert_int_eq(0, rpp_memo_init());
+	crl = create_crl();
+
+	memset(&key, 1, sizeof(key));
+	ck_assert_int_eq(-ENOENT, replay(&key));
+
+	rpp_memo_finish(create_memo(&key, crl, 1), 0);
+	ck_assert_int_eq(0, replay(&key));
+	ck_assert_uint_eq(1, v4_count);
+	ck_assert_uint_eq(1, v6_count);
+
+	/* Different key */
+	key.chain[0] = 2;
+	ck_assert_int_eq(-ENOENT, replay(&key));
+
+	/* Same manifest, but one of its ROAs went missing */
+	memset(&key, 1, sizeof(key));
+	key.roas[0] = 2;
+	ck_assert_int_eq(-ENOENT, replay(&key));
+	key.chain[0] = 2;
+
+	/* Invalid ROAs are not memoized */
+	rpp_memo_finish(create_memo(&key, crl, 3), -EINVAL);
+	ck_assert_int_eq(-ENOENT, replay(&key));
+
+	/* Used during the cycle, so it survives */
+	rpp_memo_cycle_end();
+	memset(&key, 1, sizeof(key));
+	ck_assert_int_eq(0, replay(&key));
+
+	/* Not used during this cycle, so it's dropped */
+	rpp_memo_cycle_end();
+	rpp_memo_cycle_end();
+	ck_assert_int_eq(-ENOENT, replay(&key));
+
+	X509_CRL_free(crl);
+	rpp_memo_cleanup();
+}
+END_TEST
+
+START_TEST(test_expiration)
+{
+	struct rpp_memo_key key;
+	struct rpp_memo *memo;
+	ASN1_TIME *not_after;
+	X509_CRL *crl;
+
+	ck_assert_int_eq(0, rpp_memo_init());
+	crl = create_crl();
+
+	/* An EE certificate that expires later doesn't matter */
+	memo = create_memo(&key, crl, 1);
+	not_after = ASN1_TIME_adj(NULL, time(NULL), 30, 0);
+	rpp_memo_expire_at(memo, not_after);
+	ASN1_TIME_free(not_after);
+	rpp_memo_finish(memo, 0);
+	ck_assert_int_eq(0, replay(&key));
+
+	/* An EE certificate that already expired does */
+	memo = create_memo(&key, crl, 2);
+	not_after = ASN1_TIME_adj(NULL, time(NULL), 0, -60);
+	rpp_memo_expire_at(memo, not_after);
+	ASN1_TIME_free(not_after);
+	rpp_memo_finish(memo, 0);
+	ck_assert_int_eq(-ENOENT, replay(&key));
+
+	X509_CRL_free(crl);
+	rpp_memo_cleanup();
+}
+END_TEST
+
+Suite *rpp_memo_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, test_replay);
+	tcase_add_test(core, test_expiration);
+
+	suite = suite_create("RPP memo");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = rpp_memo_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
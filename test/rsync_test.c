@@ -96,6 +96,16 @@ START_TEST(rsync_test_list)
 	    false);
 	assert_downloaded("rsync://example.potato/rpki/abc/", visited_uris,
 	    true);
+	assert_downloaded("rsync://example.foo/repositoryX/", visited_uris,
+	    false);
+	assert_downloaded("rsync://example.foo/", visited_uris, false);
+	assert_downloaded("rsync://example.foo", visited_uris, false);
+
+	/* Deep URIs must not cover their ancestors */
+	__mark_as_downloaded("rsync://example.bar/a/b/c/d", visited_uris);
+	assert_downloaded("rsync://example.bar/a/b/c/d/e", visited_uris, true);
+	assert_downloaded("rsync://example.bar/a/b/c", visited_uris, false);
+	assert_downloaded("rsync://example.bar/a/b/c/dd", visited_uris, false);
 
 	rsync_destroy(visited_uris);
 }
@@ -153,6 +153,8 @@ START_TEST(test_basic)
 	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table, 10, &prefix6, 127));
 
 	/* Check table contents */
+	db_table_seal(table);
+	ck_assert_uint_eq(TOTAL_ROAS, db_table_roa_count(table));
 	memset(roas_found, 0, sizeof(roas_found));
 	total_found = 0;
 	ck_assert_int_eq(0, db_table_foreach_roa(table, foreach_cb, NULL));
@@ -164,6 +166,139 @@ START_TEST(test_basic)
 }
 END_TEST
 
+START_TEST(test_merge)
+{
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+	struct db_table *table1, *table2;
+	array_index i;
+
+	table1 = db_table_create();
+	ck_assert_ptr_ne(NULL, table1);
+	table2 = db_table_create();
+	ck_assert_ptr_ne(NULL, table2);
+
+	prefix4.addr.s_addr = ADDR1;
+	prefix4.len = 24;
+	in6_addr_init(&prefix6.addr, 0x20010DB8u, 0, 0, 1);
+	prefix6.len = 120;
+
+	/* Some only in the first table, some only in the second, some both */
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table1, 10, &prefix4, 32));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table2, 10, &prefix4, 32));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table2, 11, &prefix4, 32));
+	prefix4.addr.s_addr = ADDR2;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table1, 10, &prefix4, 32));
+	prefix4.addr.s_addr = ADDR1;
+	prefix4.len = 25;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table2, 10, &prefix4, 32));
+	prefix4.len = 24;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table1, 10, &prefix4, 30));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table2, 10, &prefix4, 30));
+
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table1, 10, &prefix6, 128));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table2, 11, &prefix6, 128));
+	in6_addr_init(&prefix6.addr, 0x20010DB8u, 0, 0, 2);
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table2, 10, &prefix6, 128));
+	in6_addr_init(&prefix6.addr, 0x20010DB8u, 0, 0, 1);
+	prefix6.len = 121;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table1, 10, &prefix6, 128));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table2, 10, &prefix6, 128));
+	prefix6.len = 120;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table1, 10, &prefix6, 127));
+
+	ck_assert_int_eq(0, db_table_merge(table1, table2));
+	ck_assert_uint_eq(0, db_table_roa_count(table2));
+	ck_assert_uint_eq(TOTAL_ROAS, db_table_roa_count(table1));
+
+	memset(roas_found, 0, sizeof(roas_found));
+	total_found = 0;
+	ck_assert_int_eq(0, db_table_foreach_roa(table1, foreach_cb, NULL));
+	ck_assert_int_eq(TOTAL_ROAS, total_found);
+	for (i = 0; i < TOTAL_ROAS; i++)
+		ck_assert_int_eq(true, roas_found[i]);
+
+	db_table_destroy(table1);
+	db_table_destroy(table2);
+}
+END_TEST
+
+static unsigned int announcements;
+static unsigned int withdrawals;
+
+static int
+delta_cb(struct delta_vrp const *delta, void *arg)
+{
+	switch (delta->flags) {
+	case FLAG_ANNOUNCEMENT:
+		ck_assert(vrp_equals_v6(&delta->vrp, 10, 2, 120, 128));
+		announcements++;
+		break;
+	case FLAG_WITHDRAWAL:
+		ck_assert(vrp_equals_v4(&delta->vrp, 11, ADDR1, 24, 32)
+		    || vrp_equals_v4(&delta->vrp, 10, ADDR2, 24, 32));
+		withdrawals++;
+		break;
+	default:
+		ck_abort_msg("Unknown delta flags: %u", delta->flags);
+	}
+
+	return 0;
+}
+
+START_TEST(test_deltas)
+{
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+	struct vrp vrp;
+	struct db_table *old, *new;
+	struct deltas *deltas;
+
+	old = db_table_create();
+	ck_assert_ptr_ne(NULL, old);
+	new = db_table_create();
+	ck_assert_ptr_ne(NULL, new);
+
+	prefix4.addr.s_addr = ADDR1;
+	prefix4.len = 24;
+	in6_addr_init(&prefix6.addr, 0x20010DB8u, 0, 0, 1);
+	prefix6.len = 120;
+
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(old, 10, &prefix4, 32));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(old, 11, &prefix4, 32));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(old, 10, &prefix6, 128));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(new, 10, &prefix4, 32));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(new, 11, &prefix4, 32));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(new, 10, &prefix6, 128));
+	prefix4.addr.s_addr = ADDR2;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(old, 10, &prefix4, 32));
+	in6_addr_init(&prefix6.addr, 0x20010DB8u, 0, 0, 2);
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(new, 10, &prefix6, 128));
+	db_table_seal(old);
+	db_table_seal(new);
+
+	/* Removed records should count as withdrawn */
+	memset(&vrp, 0, sizeof(vrp));
+	vrp.asn = 11;
+	vrp.prefix.v4.s_addr = ADDR1;
+	vrp.prefix_length = 24;
+	vrp.max_prefix_length = 32;
+	vrp.addr_fam = AF_INET;
+	db_table_remove_roa(new, &vrp);
+	ck_assert_uint_eq(3, db_table_roa_count(new));
+
+	announcements = withdrawals = 0;
+	ck_assert_int_eq(0, compute_deltas(old, new, &deltas));
+	ck_assert_int_eq(0, deltas_foreach(deltas, delta_cb, NULL, NULL));
+	ck_assert_uint_eq(1, announcements);
+	ck_assert_uint_eq(2, withdrawals);
+
+	deltas_refput(deltas);
+	db_table_destroy(old);
+	db_table_destroy(new);
+}
+END_TEST
+
 Suite *pdu_suite(void)
 {
 	Suite *suite;
@@ -171,6 +306,8 @@ Suite *pdu_suite(void)
 
 	core = tcase_create("Core");
 	tcase_add_test(core, test_basic);
+	tcase_add_test(core, test_merge);
+	tcase_add_test(core, test_deltas);
 
 	suite = suite_create("DB Table");
 	suite_add_tcase(suite, core);
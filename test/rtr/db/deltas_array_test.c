@@ -80,6 +80,34 @@ START_TEST(add_only)
 }
 END_TEST
 
+START_TEST(copy)
+{
+	struct deltas_array *darray;
+	struct deltas_array *copy;
+	unsigned int i;
+
+	darray = darray_create();
+	ck_assert_ptr_ne(NULL, darray);
+
+	for (i = 0; i < 7; i++) {
+		ck_assert_int_eq(0, deltas_create(&created[i]));
+		darray_add(darray, created[i]);
+	}
+
+	copy = darray_copy(darray);
+	ck_assert_ptr_ne(NULL, copy);
+	test_foreach(copy, 5, 2);
+
+	/* The copy should not see the original's changes */
+	darray_clear(darray);
+	test_foreach(darray, 0, 0);
+	test_foreach(copy, 5, 2);
+
+	darray_destroy(darray);
+	darray_destroy(copy);
+}
+END_TEST
+
 Suite *address_load_suite(void)
 {
 	Suite *suite;
@@ -87,6 +115,7 @@ Suite *address_load_suite(void)
 
 	core = tcase_create("Core");
 	tcase_add_test(core, add_only);
+	tcase_add_test(core, copy);
 
 	suite = suite_create("Deltas Array");
 	suite_add_tcase(suite, core);
@@ -0,0 +1,220 @@
+#include <check.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common.c"
+#include "file.c"
+#include "log.c"
+#include "impersonator.c"
+#include "types/address.c"
+#include "types/delta.c"
+#include "types/router_key.c"
+#include "types/vrp.c"
+#include "rtr/db/delta.c"
+#include "rtr/db/deltas_array.c"
+#include "rtr/db/db_table.c"
+#include "rtr/db/vrps_file.c"
+
+#define ADDR1 htonl(0xC0000201) /* 192.0.2.1 */
+#define ADDR2 htonl(0xC0000202) /* 192.0.2.2 */
+
+static unsigned char ski[RK_SKI_LEN];
+static unsigned char spk[RK_SPKI_LEN];
+
+unsigned int
+config_get_deltas_lifetime(void)
+{
+	return 4;
+}
+
+static void
+add_roa_v4(struct db_table *table, uint32_t as, uint32_t addr)
+{
+	struct ipv4_prefix prefix4;
+
+	prefix4.addr.s_addr = addr;
+	prefix4.len = 24;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, as, &prefix4, 32));
+}
+
+static struct db_table *
+create_base(void)
+{
+	struct ipv6_prefix prefix6;
+	struct db_table *table;
+
+	table = db_table_create();
+	ck_assert_ptr_ne(NULL, table);
+
+	add_roa_v4(table, 10, ADDR1);
+	add_roa_v4(table, 11, ADDR2);
+	in6_addr_init(&prefix6.addr, 0x20010DB8u, 0, 0, 1);
+	prefix6.len = 120;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table, 10, &prefix6, 128));
+	memset(ski, 1, sizeof(ski));
+	memset(spk, 2, sizeof(spk));
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(table, ski, 12, spk));
+
+	db_table_seal(table);
+	return table;
+}
+
+static struct deltas *
+create_deltas(uint32_t as)
+{
+	struct deltas *deltas;
+	struct vrp vrp;
+
+	ck_assert_int_eq(0, deltas_create(&deltas));
+
+	memset(&vrp, 0, sizeof(vrp));
+	vrp.asn = as;
+	vrp.prefix.v4.s_addr = ADDR1;
+	vrp.prefix_length = 24;
+	vrp.max_prefix_length = 32;
+	vrp.addr_fam = AF_INET;
+	ck_assert_int_eq(0, deltas_add_roa(deltas, &vrp, FLAG_ANNOUNCEMENT));
+	vrp.prefix.v4.s_addr = ADDR2;
+	ck_assert_int_eq(0, deltas_add_roa(deltas, &vrp, FLAG_WITHDRAWAL));
+
+	return deltas;
+}
+
+static int
+count_vrp(struct vrp const *vrp, void *arg)
+{
+	(*((unsigned int *) arg))++;
+	return 0;
+}
+
+static int
+count_rk(struct router_key const *key, void *arg)
+{
+	ck_assert_uint_eq(12, key->as);
+	ck_assert_int_eq(0, memcmp(ski, key->ski, RK_SKI_LEN));
+	ck_assert_int_eq(0, memcmp(spk, key->spk, RK_SPKI_LEN));
+	(*((unsigned int *) arg))++;
+	return 0;
+}
+
+static int
+check_delta_vrp(struct delta_vrp const *delta, void *arg)
+{
+	uint32_t *as = arg;
+
+	ck_assert_uint_eq(*as, delta->vrp.asn);
+	ck_assert_uint_eq(24, delta->vrp.prefix_length);
+	ck_assert_uint_eq((delta->flags == FLAG_ANNOUNCEMENT) ? ADDR1 : ADDR2,
+	    delta->vrp.prefix.v4.s_addr);
+	return 0;
+}
+
+static int
+check_delta_rk(struct delta_router_key const *delta, void *arg)
+{
+	ck_abort_msg("Unexpected Router Key delta");
+	return -EINVAL;
+}
+
+static int
+check_deltas(struct deltas *deltas, void *arg)
+{
+	uint32_t *as = arg;
+
+	ck_assert_int_eq(0, deltas_foreach(deltas, check_delta_vrp,
+	    check_delta_rk, as));
+	(*as)++;
+	return 0;
+}
+
+START_TEST(test_roundtrip)
+{
+	char path[] = "/tmp/fort-vrps-file-XXXXXX";
+	struct vrps_file stored;
+	struct vrps_file loaded;
+	struct vrps_file invalid;
+	unsigned int count;
+	uint32_t as;
+	int fd;
+
+	fd = mkstemp(path);
+	ck_assert_int_ne(-1, fd);
+	close(fd);
+
+	stored.base = create_base();
+	stored.deltas = darray_create();
+	ck_assert_ptr_ne(NULL, stored.deltas);
+	darray_add(stored.deltas, create_deltas(100));
+	darray_add(stored.deltas, create_deltas(101));
+	stored.serial = 1234;
+	stored.v0_session_id = 5;
+	stored.v1_session_id = 4;
+
+	ck_assert_int_eq(0, vrps_file_store(path, &stored));
+	ck_assert_int_eq(0, vrps_file_load(path, &loaded));
+
+	ck_assert_uint_eq(1234, loaded.serial);
+	ck_assert_uint_eq(5, loaded.v0_session_id);
+	ck_assert_uint_eq(4, loaded.v1_session_id);
+	ck_assert(loaded.timestamp > 0);
+
+	ck_assert_uint_eq(3, db_table_roa_count(loaded.base));
+	ck_assert_uint_eq(1, db_table_router_key_count(loaded.base));
+	count = 0;
+	ck_assert_int_eq(0, db_table_foreach_roa(loaded.base, count_vrp,
+	    &count));
+	ck_assert_uint_eq(3, count);
+	count = 0;
+	ck_assert_int_eq(0, db_table_foreach_router_key(loaded.base, count_rk,
+	    &count));
+	ck_assert_uint_eq(1, count);
+
+	/* Oldest first */
+	ck_assert_uint_eq(2, darray_len(loaded.deltas));
+	as = 100;
+	ck_assert_int_eq(0, darray_foreach_since(loaded.deltas, 2,
+	    check_deltas, &as));
+	ck_assert_uint_eq(102, as);
+
+	/* Truncated files are rejected */
+	ck_assert_int_eq(0, truncate(path, 40));
+	ck_assert_int_eq(-EINVAL, vrps_file_load(path, &invalid));
+
+	ck_assert_int_eq(0, unlink(path));
+	ck_assert_int_eq(-ENOENT, vrps_file_load(path, &invalid));
+
+	db_table_destroy(stored.base);
+	darray_destroy(stored.deltas);
+	db_table_destroy(loaded.base);
+	darray_destroy(loaded.deltas);
+}
+END_TEST
+
+Suite *vrps_file_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, test_roundtrip);
+
+	suite = suite_create("VRP state file");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = vrps_file_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -19,7 +19,12 @@
 #include "rtr/db/db_table.c"
 #include "rtr/db/rtr_db_impersonator.c"
 #include "rtr/db/vrps.c"
+#include "rtr/db/vrps_file.c"
+#include "rtr/pdu_serializer.c"
+#include "rtr/pdu_snapshot.c"
+#include "rtr/primitive_writer.c"
 #include "slurm/db_slurm.c"
+#include "slurm/prefix_trie.c"
 #include "slurm/slurm_loader.c"
 #include "slurm/slurm_parser.c"
 #include "thread/thread_pool.c"
@@ -253,11 +258,26 @@ check_serial(serial_t expected_serial)
 	ck_assert_uint_eq(expected_serial, actual_serial);
 }
 
+static void
+check_snapshot(uint8_t version, serial_t expected_serial, size_t expected_len)
+{
+	struct pdu_snapshot *snapshot;
+	serial_t actual_serial;
+
+	ck_assert_int_eq(0, vrps_get_base_snapshot(version, &actual_serial,
+	    &snapshot));
+	ck_assert_uint_eq(expected_serial, actual_serial);
+	ck_assert_uint_eq(expected_len, pdu_snapshot_len(snapshot));
+	pdu_snapshot_refput(snapshot);
+}
+
 static void
 check_base(serial_t expected_serial, bool const *expected_base)
 {
 	serial_t actual_serial;
 	bool actual_base[6];
+	size_t prefix_len;
+	size_t rk_len;
 	array_index i;
 
 	memset(actual_base, 0, sizeof(actual_base));
@@ -267,6 +287,14 @@ check_base(serial_t expected_serial, bool const *expected_base)
 	ck_assert_uint_eq(expected_serial, actual_serial);
 	for (i = 0; i < ARRAY_LEN(actual_base); i++)
 		ck_assert_uint_eq(expected_base[i], actual_base[i]);
+
+	prefix_len = expected_base[0] * RTRPDU_IPV4_PREFIX_LEN
+	    + expected_base[1] * RTRPDU_IPV4_PREFIX_LEN
+	    + expected_base[2] * RTRPDU_IPV6_PREFIX_LEN
+	    + expected_base[3] * RTRPDU_IPV6_PREFIX_LEN;
+	rk_len = (expected_base[4] + expected_base[5]) * RTRPDU_ROUTER_KEY_LEN;
+	check_snapshot(RTR_V0, expected_serial, prefix_len);
+	check_snapshot(RTR_V1, expected_serial, prefix_len + rk_len);
 }
 
 static int
@@ -360,6 +388,10 @@ START_TEST(test_basic)
 	check_deltas(2, 3, deltas_2to3);
 	check_deltas(3, 3, deltas_3to3);
 
+	/* Again; these should come from the coalesced deltas cache */
+	check_deltas(1, 3, deltas_1to3);
+	check_deltas(2, 3, deltas_2to3);
+
 	vrps_destroy();
 }
 END_TEST
@@ -416,6 +448,49 @@ START_TEST(test_delta_ovrd)
 }
 END_TEST
 
+static bool updated;
+
+/* Publishes a new version while the old base is being iterated. */
+static int
+vrp_update_check(struct vrp const *vrp, void *arg)
+{
+	bool changed;
+
+	if (!updated) {
+		ck_assert_int_eq(0, vrps_update(&changed));
+		ck_assert(changed);
+		check_serial(3);
+		updated = true;
+	}
+
+	return vrp_check(vrp, arg);
+}
+
+START_TEST(test_pinned_base)
+{
+	bool actual_base[6];
+	array_index i;
+
+	deltas_lifetime = 5;
+
+	create_deltas_1to2();
+
+	/* The reader should keep seeing the base it started with */
+	updated = false;
+	memset(actual_base, 0, sizeof(actual_base));
+	ck_assert_int_eq(0, vrps_foreach_base(vrp_update_check, rk_check,
+	    actual_base));
+	ck_assert(updated);
+	for (i = 0; i < ARRAY_LEN(actual_base); i++)
+		ck_assert_uint_eq(iteration2_base[i], actual_base[i]);
+
+	check_base(3, iteration3_base);
+	check_deltas(2, 3, deltas_2to3);
+
+	vrps_destroy();
+}
+END_TEST
+
 Suite *pdu_suite(void)
 {
 	Suite *suite;
@@ -425,6 +500,7 @@ Suite *pdu_suite(void)
 	tcase_add_test(core, test_basic);
 	tcase_add_test(core, test_delta_forget);
 	tcase_add_test(core, test_delta_ovrd);
+	tcase_add_test(core, test_pinned_base);
 
 	suite = suite_create("VRP Database");
 	suite_add_tcase(suite, core);
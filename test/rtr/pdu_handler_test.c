@@ -17,6 +17,9 @@
 #include "types/vrp.c"
 #include "rtr/pdu.c"
 #include "rtr/pdu_handler.c"
+#include "rtr/pdu_serializer.c"
+#include "rtr/pdu_snapshot.c"
+#include "rtr/pdu_stream.c"
 #include "rtr/primitive_reader.c"
 #include "rtr/primitive_writer.c"
 #include "rtr/err_pdu.c"
@@ -25,7 +28,9 @@
 #include "rtr/db/db_table.c"
 #include "rtr/db/rtr_db_impersonator.c"
 #include "rtr/db/vrps.c"
+#include "rtr/db/vrps_file.c"
 #include "slurm/db_slurm.c"
+#include "slurm/prefix_trie.c"
 #include "slurm/slurm_loader.c"
 #include "slurm/slurm_parser.c"
 #include "thread/thread_pool.c"
@@ -144,7 +149,7 @@ send_cache_reset_pdu(int fd, uint8_t version)
 }
 
 int
-send_cache_response_pdu(int fd, uint8_t version)
+send_cache_response_pdu(struct pdu_stream *stream, uint8_t version)
 {
 	pr_op_info("    Server sent Cache Response.");
 	ck_assert_int_eq(pop_expected_pdu(), PDU_TYPE_CACHE_RESPONSE);
@@ -164,7 +169,8 @@ flags2str(uint8_t flags)
 }
 
 int
-send_prefix_pdu(int fd, uint8_t version, struct vrp const *vrp, uint8_t flags)
+send_prefix_pdu(struct pdu_stream *stream, uint8_t version,
+    struct vrp const *vrp, uint8_t flags)
 {
 	/*
 	 * We don't care about order.
@@ -193,7 +199,7 @@ send_prefix_pdu(int fd, uint8_t version, struct vrp const *vrp, uint8_t flags)
 }
 
 int
-send_router_key_pdu(int fd, uint8_t version,
+send_router_key_pdu(struct pdu_stream *stream, uint8_t version,
     struct router_key const *router_key, uint8_t flags)
 {
 	/*
@@ -210,7 +216,46 @@ send_router_key_pdu(int fd, uint8_t version,
 }
 
 int
-send_end_of_data_pdu(int fd, uint8_t version, serial_t end_serial)
+send_base_snapshot(struct pdu_stream *stream, struct pdu_snapshot *snapshot)
+{
+	unsigned char const *data;
+	size_t len;
+	size_t offset;
+	uint32_t pdu_len;
+	uint8_t pdu_type;
+
+	data = pdu_snapshot_data(snapshot);
+	len = pdu_snapshot_len(snapshot);
+
+	for (offset = 0; offset < len; offset += pdu_len) {
+		ck_assert_int_ge(len - offset, RTRPDU_HDR_LEN);
+		pdu_len = (data[offset + 4] << 24) | (data[offset + 5] << 16)
+		    | (data[offset + 6] << 8) | data[offset + 7];
+		ck_assert_int_ge(pdu_len, RTRPDU_HDR_LEN);
+		ck_assert_int_le(pdu_len, len - offset);
+
+		pdu_type = pop_expected_pdu();
+		pr_op_info("    Server sent snapshot PDU %u.", data[offset + 1]);
+		switch (data[offset + 1]) {
+		case PDU_TYPE_IPV4_PREFIX:
+		case PDU_TYPE_IPV6_PREFIX:
+			/* Same as send_prefix_pdu(); order doesn't matter. */
+			ck_assert_msg(pdu_type == PDU_TYPE_IPV4_PREFIX
+			    || pdu_type == PDU_TYPE_IPV6_PREFIX,
+			    "Server sent a prefix. Expected PDU type was %d.",
+			    pdu_type);
+			break;
+		default:
+			ck_assert_int_eq(pdu_type, data[offset + 1]);
+		}
+	}
+
+	return 0;
+}
+
+int
+send_end_of_data_pdu(struct pdu_stream *stream, uint8_t version,
+    serial_t end_serial)
 {
 	pr_op_info("    Server sent End of Data.");
 	ck_assert_int_eq(pop_expected_pdu(), PDU_TYPE_END_OF_DATA);
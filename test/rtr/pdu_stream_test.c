@@ -0,0 +1,142 @@
+#include <check.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "impersonator.c"
+#include "log.c"
+#include "rtr/pdu_stream.c"
+
+#define PDU_LEN 20
+#define PDU_COUNT 10000
+#define BIG_LEN 5000
+
+struct writer_args {
+	int fd;
+	size_t capacity;
+	int result;
+};
+
+static unsigned char
+expected_byte(size_t offset)
+{
+	return (offset * 7 + offset / 256) & 0xFF;
+}
+
+/* Queues PDU_COUNT "PDUs", then one chunk larger than the buffer. */
+static void *
+writer(void *arg)
+{
+	struct writer_args *args = arg;
+	struct pdu_stream stream;
+	unsigned char pdu[BIG_LEN];
+	size_t offset;
+	unsigned int i, j;
+
+	args->result = pdu_stream_init(&stream, args->fd, args->capacity);
+	if (args->result)
+		return NULL;
+
+	offset = 0;
+	for (i = 0; i < PDU_COUNT; i++) {
+		for (j = 0; j < PDU_LEN; j++)
+			pdu[j] = expected_byte(offset++);
+		args->result = pdu_stream_write(&stream, pdu, PDU_LEN);
+		if (args->result)
+			goto end;
+	}
+
+	for (j = 0; j < BIG_LEN; j++)
+		pdu[j] = expected_byte(offset++);
+	args->result = pdu_stream_write(&stream, pdu, BIG_LEN);
+	if (args->result)
+		goto end;
+
+	args->result = pdu_stream_flush(&stream);
+end:
+	pdu_stream_cleanup(&stream);
+	close(args->fd);
+	return NULL;
+}
+
+static void
+test_stream(size_t capacity, bool nonblocking)
+{
+	struct writer_args args;
+	pthread_t thread;
+	unsigned char buffer[4096];
+	size_t offset;
+	ssize_t consumed;
+	ssize_t i;
+	int fds[2];
+
+	ck_assert_int_eq(0, pipe(fds));
+	if (nonblocking)
+		ck_assert_int_ne(-1, fcntl(fds[1], F_SETFL, O_NONBLOCK));
+
+	args.fd = fds[1];
+	args.capacity = capacity;
+	args.result = -1;
+	ck_assert_int_eq(0, pthread_create(&thread, NULL, writer, &args));
+
+	offset = 0;
+	do {
+		/* Slow reader, to force the writer to wait */
+		consumed = read(fds[0], buffer, sizeof(buffer));
+		ck_assert_int_ge(consumed, 0);
+		for (i = 0; i < consumed; i++)
+			ck_assert_uint_eq(expected_byte(offset + i), buffer[i]);
+		offset += consumed;
+	} while (consumed > 0);
+
+	ck_assert_int_eq(0, pthread_join(thread, NULL));
+	ck_assert_int_eq(0, args.result);
+	ck_assert_uint_eq(PDU_COUNT * PDU_LEN + BIG_LEN, offset);
+
+	close(fds[0]);
+}
+
+START_TEST(test_small_buffer)
+{
+	test_stream(1024, false);
+	test_stream(1024, true);
+}
+END_TEST
+
+START_TEST(test_default_buffer)
+{
+	test_stream(PDU_STREAM_CAPACITY, false);
+	test_stream(PDU_STREAM_CAPACITY, true);
+}
+END_TEST
+
+Suite *pdu_stream_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, test_small_buffer);
+	tcase_add_test(core, test_default_buffer);
+
+	suite = suite_create("PDU stream");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = pdu_stream_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
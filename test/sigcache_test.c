@@ -0,0 +1,188 @@
+#include <check.h>
+#include <stdlib.h>
+#include <openssl/ec.h>
+#include <openssl/x509v3.h>
+
+#include "common.c"
+#include "log.c"
+#include "impersonator.c"
+#include "crypto/sigcache.c"
+
+static EVP_PKEY *
+create_key(void)
+{
+	EVP_PKEY_CTX *ctx;
+	EVP_PKEY *key;
+
+	ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	ck_assert_ptr_ne(NULL, ctx);
+	ck_assert_int_eq(1, EVP_PKEY_keygen_init(ctx));
+	ck_assert_int_eq(1, EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx,
+	    NID_X9_62_prime256v1));
+	key = NULL;
+	ck_assert_int_eq(1, EVP_PKEY_keygen(ctx, &key));
+	EVP_PKEY_CTX_free(ctx);
+
+	return key;
+}
+
+/* @issuer NULL means self-signed. */
+static X509 *
+create_cert(char const *name, EVP_PKEY *key, X509 *issuer,
+    EVP_PKEY *signer, long lifetime)
+{
+	static long serial = 1;
+	X509 *cert;
+	X509_NAME *subject;
+	X509_EXTENSION *ext;
+
+	cert = X509_new();
+	ck_assert_ptr_ne(NULL, cert);
+	ck_assert_int_eq(1, X509_set_version(cert, 2));
+	ck_assert_int_eq(1, ASN1_INTEGER_set(X509_get_serialNumber(cert),
+	    serial++));
+	ck_assert_ptr_ne(NULL, X509_gmtime_adj(X509_getm_notBefore(cert),
+	    -7200));
+	ck_assert_ptr_ne(NULL, X509_gmtime_adj(X509_getm_notAfter(cert),
+	    lifetime));
+
+	subject = X509_get_subject_name(cert);
+	ck_assert_int_eq(1, X509_NAME_add_entry_by_txt(subject, "CN",
+	    MBSTRING_ASC, (unsigned char const *) name, -1, -1, 0));
+	ck_assert_int_eq(1, X509_set_issuer_name(cert, (issuer != NULL)
+	    ? X509_get_subject_name(issuer)
+	    : subject));
+	ck_assert_int_eq(1, X509_set_pubkey(cert, key));
+
+	ext = X509V3_EXT_conf_nid(NULL, NULL, NID_basic_constraints,
+	    "critical,CA:TRUE");
+	ck_assert_ptr_ne(NULL, ext);
+	ck_assert_int_eq(1, X509_add_ext(cert, ext, -1));
+	X509_EXTENSION_free(ext);
+
+	ck_assert_int_ne(0, X509_sign(cert, signer, EVP_sha256()));
+	return cert;
+}
+
+static int
+verify(X509 *cert, STACK_OF(X509) *trusted)
+{
+	X509_STORE *store;
+	X509_STORE_CTX *ctx;
+	int error;
+
+	store = X509_STORE_new();
+	ck_assert_ptr_ne(NULL, store);
+	X509_STORE_set_verify(store, sigcache_verify_chain);
+	ctx = X509_STORE_CTX_new();
+	ck_assert_ptr_ne(NULL, ctx);
+	ck_assert_int_eq(1, X509_STORE_CTX_init(ctx, store, cert, NULL));
+	X509_STORE_CTX_trusted_stack(ctx, trusted);
+
+	error = (X509_verify_cert(ctx) > 0)
+	    ? X509_V_OK
+	    : X509_STORE_CTX_get_error(ctx);
+
+	X509_STORE_CTX_free(ctx);
+	X509_STORE_free(store);
+	return error;
+}
+
+static bool
+is_cached(X509 *cert, X509 *issuer)
+{
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_len;
+	struct sigcache_key key;
+	EVP_MD_CTX *ctx;
+
+	ck_assert_int_eq(1, X509_digest(cert, EVP_sha256(), digest,
+	    &digest_len));
+	ck_assert_int_eq(0, sigcache_key_start(issuer, &ctx));
+	ck_assert_int_eq(0, sigcache_key_update(ctx, digest, digest_len));
+	ck_assert_int_eq(0, sigcache_key_finish(ctx, &key));
+
+	return sigcache_contains(&key);
+}
+
+START_TEST(test_chain)
+{
+	EVP_PKEY *ta_key, *ca_key, *ee_key;
+	X509 *ta, *ca, *ee, *forged, *expired;
+	STACK_OF(X509) *trusted;
+
+	ck_assert_int_eq(0, sigcache_init());
+	ck_assert(sigcache_enabled());
+
+	ta_key = create_key();
+	ca_key = create_key();
+	ee_key = create_key();
+	ta = create_cert("TA", ta_key, NULL, ta_key, 3600);
+	ca = create_cert("CA", ca_key, ta, ta_key, 3600);
+	ee = create_cert("EE", ee_key, ca, ca_key, 3600);
+	/* Claims to be issued by the CA, but the TA signed it */
+	forged = create_cert("EE", ee_key, ca, ta_key, 3600);
+	expired = create_cert("EE", ee_key, ca, ca_key, -60);
+
+	trusted = sk_X509_new_null();
+	ck_assert_ptr_ne(NULL, trusted);
+	ck_assert_int_ne(0, sk_X509_push(trusted, ta));
+	ck_assert_int_ne(0, sk_X509_push(trusted, ca));
+
+	ck_assert(!is_cached(ee, ca));
+	ck_assert_int_eq(X509_V_OK, verify(ee, trusted));
+	ck_assert(is_cached(ee, ca));
+	ck_assert(is_cached(ca, ta));
+	/* Now from the cache */
+	ck_assert_int_eq(X509_V_OK, verify(ee, trusted));
+
+	ck_assert_int_eq(X509_V_ERR_CERT_SIGNATURE_FAILURE,
+	    verify(forged, trusted));
+	ck_assert(!is_cached(forged, ca));
+
+	/* The signature is cached, but the validity period isn't. */
+	ck_assert_int_eq(X509_V_ERR_CERT_HAS_EXPIRED, verify(expired, trusted));
+	ck_assert(is_cached(expired, ca));
+	ck_assert_int_eq(X509_V_ERR_CERT_HAS_EXPIRED, verify(expired, trusted));
+
+	sk_X509_free(trusted);
+	X509_free(expired);
+	X509_free(forged);
+	X509_free(ee);
+	X509_free(ca);
+	X509_free(ta);
+	EVP_PKEY_free(ee_key);
+	EVP_PKEY_free(ca_key);
+	EVP_PKEY_free(ta_key);
+	sigcache_cleanup();
+}
+END_TEST
+
+Suite *sigcache_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, test_chain);
+
+	suite = suite_create("Signature cache");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = sigcache_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,213 @@
+#include <check.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include "impersonator.c"
+#include "log.c"
+#include "slurm/prefix_trie.c"
+
+#define FILTER_COUNT 1000
+#define QUERY_COUNT 20000
+
+static void
+add4(struct prefix_trie *trie, char const *addr, uint8_t len,
+    uint32_t const *asn)
+{
+	struct in_addr tmp;
+	ck_assert_int_eq(1, inet_pton(AF_INET, addr, &tmp));
+	ck_assert_int_eq(0, prefix_trie_add(trie, (uint8_t *) &tmp, len, asn));
+}
+
+static bool
+covers4(struct prefix_trie *trie, char const *addr, uint8_t len, uint32_t asn)
+{
+	struct in_addr tmp;
+	ck_assert_int_eq(1, inet_pton(AF_INET, addr, &tmp));
+	return prefix_trie_covers(trie, (uint8_t *) &tmp, len, asn);
+}
+
+static bool
+covers6(struct prefix_trie *trie, char const *addr, uint8_t len, uint32_t asn)
+{
+	struct in6_addr tmp;
+	ck_assert_int_eq(1, inet_pton(AF_INET6, addr, &tmp));
+	return prefix_trie_covers(trie, (uint8_t *) &tmp, len, asn);
+}
+
+START_TEST(test_ipv4)
+{
+	struct prefix_trie trie;
+	uint32_t asn1 = 1;
+	uint32_t asn2 = 2;
+	uint32_t asn3 = 3;
+
+	prefix_trie_init(&trie);
+
+	ck_assert_int_eq(false, covers4(&trie, "10.0.0.0", 8, 1));
+
+	add4(&trie, "10.0.0.0", 8, &asn1);
+	add4(&trie, "10.1.0.0", 16, NULL);
+	add4(&trie, "192.168.0.0", 24, &asn2);
+	add4(&trie, "192.168.0.0", 24, &asn3);
+	/* Forces a node that joins two branches */
+	add4(&trie, "192.168.1.0", 24, &asn2);
+
+	ck_assert_int_eq(true, covers4(&trie, "10.0.0.0", 8, 1));
+	ck_assert_int_eq(true, covers4(&trie, "10.2.0.0", 16, 1));
+	ck_assert_int_eq(true, covers4(&trie, "10.2.3.4", 32, 1));
+	ck_assert_int_eq(false, covers4(&trie, "10.2.0.0", 16, 2));
+	ck_assert_int_eq(false, covers4(&trie, "10.0.0.0", 7, 1));
+	ck_assert_int_eq(false, covers4(&trie, "11.0.0.0", 8, 1));
+
+	ck_assert_int_eq(true, covers4(&trie, "10.1.0.0", 16, 2));
+	ck_assert_int_eq(true, covers4(&trie, "10.1.128.0", 17, 1234));
+	ck_assert_int_eq(false, covers4(&trie, "10.0.0.0", 15, 1234));
+
+	ck_assert_int_eq(true, covers4(&trie, "192.168.0.0", 24, 2));
+	ck_assert_int_eq(true, covers4(&trie, "192.168.0.0", 24, 3));
+	ck_assert_int_eq(true, covers4(&trie, "192.168.0.128", 25, 3));
+	ck_assert_int_eq(false, covers4(&trie, "192.168.0.0", 24, 4));
+	ck_assert_int_eq(true, covers4(&trie, "192.168.1.0", 24, 2));
+	ck_assert_int_eq(false, covers4(&trie, "192.168.1.0", 24, 3));
+	/* The joining node (192.168.0.0/23) has no filters */
+	ck_assert_int_eq(false, covers4(&trie, "192.168.0.0", 23, 2));
+	ck_assert_int_eq(false, covers4(&trie, "192.168.2.0", 24, 2));
+
+	/* Default route covers everything */
+	add4(&trie, "0.0.0.0", 0, &asn3);
+	ck_assert_int_eq(true, covers4(&trie, "203.0.113.0", 24, 3));
+	ck_assert_int_eq(false, covers4(&trie, "203.0.113.0", 24, 4));
+
+	prefix_trie_cleanup(&trie);
+}
+END_TEST
+
+START_TEST(test_ipv6)
+{
+	struct prefix_trie trie;
+	struct in6_addr addr;
+	uint32_t asn = 64496;
+
+	prefix_trie_init(&trie);
+
+	ck_assert_int_eq(1, inet_pton(AF_INET6, "2001:db8::", &addr));
+	ck_assert_int_eq(0, prefix_trie_add(&trie, (uint8_t *) &addr, 32,
+	    &asn));
+	ck_assert_int_eq(1, inet_pton(AF_INET6, "2001:db8:ffff::1", &addr));
+	ck_assert_int_eq(0, prefix_trie_add(&trie, (uint8_t *) &addr, 128,
+	    NULL));
+
+	ck_assert_int_eq(true, covers6(&trie, "2001:db8:1::", 48, 64496));
+	ck_assert_int_eq(false, covers6(&trie, "2001:db8:1::", 48, 64497));
+	ck_assert_int_eq(true, covers6(&trie, "2001:db8:ffff::1", 128, 64497));
+	ck_assert_int_eq(false, covers6(&trie, "2001:db8:ffff::", 127, 64497));
+	ck_assert_int_eq(false, covers6(&trie, "2001:db9::", 32, 64496));
+
+	prefix_trie_cleanup(&trie);
+}
+END_TEST
+
+struct filter {
+	uint8_t addr[4];
+	uint8_t len;
+	bool has_asn;
+	uint32_t asn;
+};
+
+static bool
+naive_covers(struct filter *filters, uint8_t const *addr, uint8_t len,
+    uint32_t asn)
+{
+	struct filter *filter;
+	unsigned int f;
+	unsigned int b;
+
+	for (f = 0; f < FILTER_COUNT; f++) {
+		filter = &filters[f];
+		if (filter->len > len)
+			continue;
+		if (filter->has_asn && filter->asn != asn)
+			continue;
+		for (b = 0; b < filter->len; b++)
+			if (get_bit(filter->addr, b) != get_bit(addr, b))
+				break;
+		if (b == filter->len)
+			return true;
+	}
+
+	return false;
+}
+
+static void
+random_prefix(uint8_t *addr, uint8_t *len)
+{
+	/* Few distinct addresses, so prefixes overlap a lot. */
+	addr[0] = 10;
+	addr[1] = rand() & 0x0F;
+	addr[2] = rand() & 0xF0;
+	addr[3] = rand() & 0xFF;
+	*len = 4 + rand() % 29;
+}
+
+START_TEST(test_random)
+{
+	static struct filter filters[FILTER_COUNT];
+	struct prefix_trie trie;
+	uint8_t addr[4];
+	uint8_t len;
+	uint32_t asn;
+	unsigned int i;
+
+	srand(1234);
+	prefix_trie_init(&trie);
+
+	for (i = 0; i < FILTER_COUNT; i++) {
+		random_prefix(filters[i].addr, &filters[i].len);
+		filters[i].has_asn = (rand() % 4) != 0;
+		filters[i].asn = rand() % 8;
+		ck_assert_int_eq(0, prefix_trie_add(&trie, filters[i].addr,
+		    filters[i].len,
+		    filters[i].has_asn ? &filters[i].asn : NULL));
+	}
+
+	for (i = 0; i < QUERY_COUNT; i++) {
+		random_prefix(addr, &len);
+		asn = rand() % 8;
+		ck_assert_int_eq(naive_covers(filters, addr, len, asn),
+		    prefix_trie_covers(&trie, addr, len, asn));
+	}
+
+	prefix_trie_cleanup(&trie);
+}
+END_TEST
+
+Suite *prefix_trie_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, test_ipv4);
+	tcase_add_test(core, test_ipv6);
+	tcase_add_test(core, test_random);
+
+	suite = suite_create("Prefix trie");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = prefix_trie_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
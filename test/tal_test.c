@@ -110,6 +110,18 @@ db_rrdp_rem_nonvisited_tals(void)
 	/* Empty */
 }
 
+void
+fetch_scheduler_wait(void)
+{
+	/* Empty */
+}
+
+void
+rpp_memo_cycle_end(void)
+{
+	/* Empty */
+}
+
 START_TEST(tal_load_normal)
 {
 	struct tal *tal;
@@ -1,4 +1,5 @@
 #include <check.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -48,6 +49,44 @@ test_threads_work(unsigned int total_threads)
 	thread_pool_destroy(pool);
 }
 
+static struct thread_pool *nested_pool;
+static atomic_uint nested_count;
+
+/* Each task spawns two children, until @depth reaches zero. */
+static void
+nested_work(void *arg)
+{
+	uintptr_t depth = (uintptr_t) arg;
+
+	atomic_fetch_add(&nested_count, 1);
+	if (depth == 0)
+		return;
+
+	ck_assert_int_eq(0, thread_pool_push(nested_pool, "nested task",
+	    nested_work, (void *) (depth - 1)));
+	ck_assert_int_eq(0, thread_pool_push(nested_pool, "nested task",
+	    nested_work, (void *) (depth - 1)));
+}
+
+static void
+test_nested_work(unsigned int total_threads)
+{
+	int error;
+
+	error = thread_pool_create("test pool", total_threads, &nested_pool);
+	ck_assert_int_eq(error, 0);
+
+	atomic_init(&nested_count, 0);
+	thread_pool_push(nested_pool, "nested task", nested_work,
+	    (void *) 9);
+
+	/* Has to wait for the tasks pushed by other tasks as well */
+	thread_pool_wait(nested_pool);
+	ck_assert_uint_eq(atomic_load(&nested_count), 1023);
+
+	thread_pool_destroy(nested_pool);
+}
+
 START_TEST(tpool_single_work)
 {
 	test_threads_work(1);
@@ -60,20 +99,31 @@ START_TEST(tpool_multiple_work)
 }
 END_TEST
 
+START_TEST(tpool_nested_work)
+{
+	test_nested_work(1);
+	test_nested_work(10);
+}
+END_TEST
+
 Suite *thread_pool_suite(void)
 {
 	Suite *suite;
-	TCase *single, *multiple;
+	TCase *single, *multiple, *nested;
 
 	single = tcase_create("single_work");
-	tcase_add_test(multiple, tpool_single_work);
+	tcase_add_test(single, tpool_single_work);
 
 	multiple = tcase_create("multiple_work");
 	tcase_add_test(multiple, tpool_multiple_work);
 
+	nested = tcase_create("nested_work");
+	tcase_add_test(nested, tpool_nested_work);
+
 	suite = suite_create("thread_pool_test()");
 	suite_add_tcase(suite, single);
 	suite_add_tcase(suite, multiple);
+	suite_add_tcase(suite, nested);
 
 	return suite;
 }